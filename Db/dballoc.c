@@ -111,6 +111,7 @@ gint wg_init_db_memsegment(void* db, gint key, gint size) {
   dbh->initialadr=(gint)dbh; /* XXX: this assumes pointer size. Currently harmless
                              * because initialadr isn't used much. */
   dbh->key=key;  /* might be 0 if local memory used */
+  dbh->write_epoch=0;
 
 #ifdef CHECK
   if(((gint) dbh)%SUBAREA_ALIGNMENT_BYTES)
@@ -388,7 +389,12 @@ static gint init_db_index_area_header(void* db) {
   dbh->index_control_area_header.number_of_indexes=0;
   memset(dbh->index_control_area_header.index_table, 0,
     (MAX_INDEXED_FIELDNR+1)*sizeof(gint));
+  memset(dbh->index_control_area_header.index_include_table, 0,
+    (MAX_INDEXED_FIELDNR+1)*sizeof(gint));
   dbh->index_control_area_header.index_list=0;
+  dbh->index_control_area_header.index_build_list=0;
+  dbh->index_control_area_header.index_path_list=0;
+  dbh->index_control_area_header.index_epoch=0;
 #ifdef USE_INDEX_TEMPLATE
   dbh->index_control_area_header.index_template_list=0;
   memset(dbh->index_control_area_header.index_template_table, 0,
@@ -256,6 +256,8 @@ gcell;
 /* index related stuff */
 #define MAX_INDEX_FIELDS 10       /** maximum number of fields in one index */
 #define MAX_INDEXED_FIELDNR 127   /** limits the size of field/index table */
+#define WG_INDEX_HIST_BUCKETS 16  /** buckets in index value histogram */
+#define WG_INDEX_HLL_BITS 8       /** log2 of distinct count sketch size */
 
 #ifndef TTREE_CHAINED_NODES
 #define WG_TNODE_ARRAY_SIZE 10
@@ -373,6 +375,32 @@ struct __wg_hashidx_header {
   db_hash_area_header hasharea;
 };
 
+/**
+ * Bitmap-specific index header fields
+ */
+struct __wg_bitmapidx_header {
+  gint value_dir;           /** offset to the value directory */
+};
+
+/**
+ * R-tree-specific index header fields
+ */
+struct __wg_rtreeidx_header {
+  gint offset_root_node;
+};
+
+/**
+ * Index statistics, used for query planning
+ */
+struct __wg_index_stats {
+  gint rows;                /** rows in the index */
+  gint nulls;               /** rows with NULL in the first column */
+  gint buckets;             /** histogram buckets in use, 0 if none */
+  double bound[WG_INDEX_HIST_BUCKETS+1]; /** bucket boundaries */
+  gint bucket_rows[WG_INDEX_HIST_BUCKETS]; /** rows in each bucket */
+  unsigned char hll[1<<WG_INDEX_HLL_BITS]; /** HyperLogLog registers */
+};
+
 
 /** control data for one index
 *
@@ -384,8 +412,15 @@ typedef struct {
   union {
     struct __wg_ttree_header t;
     struct __wg_hashidx_header h;
+    struct __wg_bitmapidx_header b;
+    struct __wg_rtreeidx_header r;
   } ctl;                    /** shared fields for different index types */
   gint template_offset;     /** matchrec template, 0 if full index */
+  gint include_count;       /** number of included (covered) fields */
+  gint rec_include_index[MAX_INDEX_FIELDS]; /** included field numbers */
+  volatile gint version;    /** update counter, odd while being modified */
+  gint build_cursor;        /** next row to scan by online build, 0 if none */
+  struct __wg_index_stats stats; /** row count and value distribution */
 } wg_index_header;
 
 
@@ -407,7 +442,13 @@ typedef struct {
 typedef struct {
   gint number_of_indexes;       /** unused, reserved */
   gint index_list;              /** master index list */
+  gint index_build_list;        /** indexes being built online */
+  gint index_path_list;         /** JSON path indexes */
+  gint index_epoch;             /** incremented when indexes are added
+                                  * or dropped */
   gint index_table[MAX_INDEXED_FIELDNR+1];    /** index lookup by column */
+  gint index_include_table[MAX_INDEXED_FIELDNR+1]; /** covering indexes
+                                                     * by included column */
 #ifdef USE_INDEX_TEMPLATE
   gint index_template_list;     /** sorted list of index masks */
   gint index_template_table[MAX_INDEXED_FIELDNR+1]; /** masks indexed by column */
@@ -475,6 +516,8 @@ typedef struct _db_memsegment_header {
   gint free;       /** pointer to first free area in segment (aligned) */
   gint initialadr; /** initial segment address, only valid for creator */
   gint key;        /** global shared mem key */
+  gint write_epoch; /** incremented when rows are created, deleted or
+                     * modified (see wg_make_query()) */
   // areas
   db_area_header datarec_area_header;
   db_area_header longstr_area_header;
@@ -511,6 +554,8 @@ typedef struct _db_memsegment_header {
 typedef struct {
   db_memsegment_header *db; /** shared memory header */
   void *logdata;            /** log data structure in local memory */
+  void *indexdata;          /** deferred index updates in local memory */
+  void *querycache;         /** cached query results in local memory */
 } db_handle;
 #endif
 
@@ -73,6 +73,10 @@ extern "C" {
 #define WG_COND_GREATER     0x0008      /** > */
 #define WG_COND_LTEQUAL     0x0010      /** <= */
 #define WG_COND_GTEQUAL     0x0020      /** >= */
+#define WG_COND_CONTAINS    0x0040      /** substring (strings only) */
+#define WG_COND_IN          0x0080      /** in a list of values */
+#define WG_COND_OR          0x0100      /** flag: or the previous argument */
+#define WG_COND_PREFIX      0x0200      /** begins with (strings and URIs) */
 
 /* Query types. Python extension module uses the API and needs these. */
 #define WG_QTYPE_TTREE      0x01
@@ -80,6 +84,29 @@ extern "C" {
 #define WG_QTYPE_SCAN       0x04
 #define WG_QTYPE_PREFETCH   0x80
 
+#define WG_QPLAN_SCAN       0   /** check all rows */
+#define WG_QPLAN_TTREE      1   /** T-tree range */
+#define WG_QPLAN_HASH       2   /** hash index lookup */
+#define WG_QPLAN_INTERSECT  3   /** intersection of index ranges/lookups */
+#define WG_QPLAN_BITMAP     4   /** bitmap and trigram indexes */
+#define WG_QPLAN_RTREE      5   /** R-tree box search */
+#define WG_QPLAN_PROBE      6   /** T-tree lookup of each value in a list */
+
+#define WG_QPLAN_MAX_INDEXES 4
+
+#define WG_ORDER_ASC        0   /** ascending order */
+#define WG_ORDER_DESC       1   /** descending order */
+
+#define WG_JOIN_REFERENCE   1   /** follow record references */
+#define WG_JOIN_INDEX       2   /** index lookup for each left row */
+#define WG_JOIN_HASH        3   /** hash table of the right rows */
+
+#define WG_AGGR_COUNT       1   /** number of rows or values */
+#define WG_AGGR_SUM         2   /** sum of numeric values */
+#define WG_AGGR_MIN         3   /** smallest value */
+#define WG_AGGR_MAX         4   /** largest value */
+#define WG_AGGR_AVG         5   /** average of numeric values */
+
 /* Direct access to field */
 #define RECORD_HEADER_GINTS 3
 #define wg_field_addr(db,record,fieldnr) (((wg_int*)(record))+RECORD_HEADER_GINTS+(fieldnr))
@@ -96,6 +123,54 @@ typedef struct {
   wg_int value;       /** encoded value */
 } wg_query_arg;
 
+/** Query plan */
+typedef struct {
+  wg_int type;              /** plan type (WG_QPLAN_*) */
+  wg_int count;             /** number of indexes used */
+  wg_int index_id[WG_QPLAN_MAX_INDEXES]; /** indexes, in the order of use */
+  wg_int epoch;             /** index epoch when the plan was made */
+  double rows;              /** estimated number of rows */
+  double cost;              /** estimated cost (rows checked) */
+} wg_query_plan;
+
+/** Query plan with details (see wg_explain_query()) */
+typedef struct {
+  wg_query_plan plan;       /** plan the query would be run with */
+  wg_int index_type[WG_QPLAN_MAX_INDEXES]; /** types of the indexes */
+  wg_int column;            /** leading column of the T-tree index */
+  wg_int start_bound;       /** encoded lower bound, WG_ILLEGAL if none */
+  wg_int end_bound;         /** encoded upper bound, WG_ILLEGAL if none */
+  wg_int start_inclusive;   /** lower bound is in the range */
+  wg_int end_inclusive;     /** upper bound is in the range */
+} wg_query_explain;
+
+/** Execution counters of a query (see wg_query) */
+typedef struct {
+  wg_int examined;          /** rows checked against the conditions */
+  wg_int matched;           /** rows that satisfied the conditions */
+  wg_int returned;          /** rows returned by the fetch functions */
+  wg_int tnodes;            /** T-tree nodes read */
+  double time;              /** seconds spent creating the query */
+} wg_query_stats;
+
+/** Aggregate function and its result (see wg_query_aggregate()) */
+typedef struct {
+  wg_int type;      /** aggregate function (WG_AGGR_*) */
+  wg_int column;    /** column, -1 to count rows */
+  wg_int count;     /** result: number of rows or values aggregated */
+  wg_int value;     /** result: encoded minimum or maximum value */
+  double result;    /** result: sum or average */
+} wg_query_aggr;
+
+/** Groups and their aggregates (see wg_query_group()) */
+typedef struct {
+  wg_int groups;            /** number of groups */
+  wg_int key_count;         /** key values of each group */
+  wg_int aggr_count;        /** aggregates of each group */
+  wg_int *keys;             /** encoded key values, key_count per group */
+  wg_query_aggr *aggr;      /** aggregates, aggr_count per group */
+} wg_query_groups;
+
 /** Query object */
 typedef struct {
   wg_int qtype;         /** Query type (T-tree, hash, full scan, prefetch) */
@@ -117,8 +192,53 @@ typedef struct {
   void *curr_page;          /** current page of results */
   wg_int curr_pidx;         /** current index on page */
   wg_uint res_count;        /** number of rows in results */
+  /* Fields for covering index */
+  wg_int cover_index;       /** covering index used, 0 if none */
+  wg_int cover_args;        /** arglist can be checked on index entries */
+  wg_int curr_entry;        /** index entry of the last fetched row */
+  wg_query_plan plan;       /** plan the query was built with */
+  void *cache_entry;        /** shared cached result, NULL if none */
+  wg_query_stats stats;     /** counters of running the query */
 } wg_query;
 
+/** Join object (see wg_make_join()) */
+typedef struct {
+  wg_int type;              /** join method (WG_JOIN_*) */
+  wg_query *left;           /** query of the left rows */
+  wg_int left_column;       /** join column of the left rows */
+  wg_int right_column;      /** join column of the right rows, -1 if none */
+  wg_query_arg *arglist;    /** conditions of the right rows */
+  wg_int argc;              /** number of elements in arglist */
+  wg_query_plan plan;       /** plan of the index lookups */
+  void *prepared;           /** prepared index lookup (wg_prepared_query) */
+  wg_query *inner;          /** right rows of the current left row */
+  void *curr_left;          /** current left row */
+  wg_int curr_key;          /** join value of the current left row */
+  wg_uint curr_hash;        /** hash of the join value */
+  wg_int curr_entry;        /** next hash table entry to check */
+  void *table;              /** hash table of the right rows */
+} wg_join;
+
+/** Prepared query (see wg_prepare_query()) */
+typedef struct {
+  wg_query query;           /** query object reset by each execution */
+  wg_query_arg *args;       /** arguments with the bound values */
+  wg_int argc;              /** number of elements in args */
+  wg_query_arg *full_arglist; /** combined arguments of the execution */
+  wg_query_arg *arglist;    /** buffer of the reduced argument list */
+  wg_int *listbuf;          /** lists of values of combined disjunctions */
+  wg_int listsize;          /** size of listbuf in gints */
+  wg_query_plan plan;       /** plan reused while the indexes are the same */
+} wg_prepared_query;
+
+/** Query cache statistics (see wg_get_query_cache_stats()) */
+typedef struct {
+  wg_int size;              /** maximum number of cached results */
+  wg_int entries;           /** number of cached results */
+  wg_int hits;              /** queries answered from the cache */
+  wg_int misses;            /** queries that were run */
+} wg_query_cache_stats;
+
 /* prototypes of wg database api functions
 
 */
@@ -335,8 +455,43 @@ wg_query *wg_make_query(void *db, void *matchrec, wg_int reclen,
 #define wg_make_prefetch_query wg_make_query
 wg_query *wg_make_query_rc(void *db, void *matchrec, wg_int reclen,
   wg_query_arg *arglist, wg_int argc, wg_uint rowlimit);
+wg_query *wg_make_ordered_query(void *db, void *matchrec, wg_int reclen,
+  wg_query_arg *arglist, wg_int argc, wg_int column, wg_int order,
+  wg_uint limit);
+wg_int wg_explain_query(void *db, void *matchrec, wg_int reclen,
+  wg_query_arg *arglist, wg_int argc, wg_query_explain *explain);
 void *wg_fetch(void *db, wg_query *query);
+wg_int wg_fetch_many(void *db, wg_query *query, void **out, wg_int n);
+wg_int wg_query_skip(void *db, wg_query *query, wg_int n);
+void *wg_fetch_values(void *db, wg_query *query, wg_int *columns,
+  wg_int count, wg_int *values);
 void wg_free_query(void *db, wg_query *query);
+wg_int wg_query_aggregate(void *db, void *matchrec, wg_int reclen,
+  wg_query_arg *arglist, wg_int argc, wg_query_aggr *specs, wg_int count);
+wg_int wg_query_count(void *db, void *matchrec, wg_int reclen,
+  wg_query_arg *arglist, wg_int argc);
+wg_int wg_query_exists(void *db, void *matchrec, wg_int reclen,
+  wg_query_arg *arglist, wg_int argc);
+wg_query_groups *wg_query_group(void *db, wg_query *query,
+  wg_int *columns, wg_int col_count, wg_query_aggr *specs, wg_int count);
+wg_query_groups *wg_query_group_part(void *db, wg_query *query,
+  wg_int part, wg_int parts, wg_int *columns, wg_int col_count,
+  wg_query_aggr *specs, wg_int count);
+wg_int wg_merge_query_groups(void *db, wg_query_groups *dest,
+  wg_query_groups *src);
+void wg_free_query_groups(void *db, wg_query_groups *groups);
+wg_join *wg_make_join(void *db, wg_query *left, wg_int left_column,
+  wg_query_arg *arglist, wg_int argc, wg_int right_column);
+void *wg_fetch_join(void *db, wg_join *join, void **right);
+void wg_free_join(void *db, wg_join *join);
+wg_prepared_query *wg_prepare_query(void *db, void *matchrec, wg_int reclen,
+  wg_query_arg *arglist, wg_int argc);
+wg_int wg_bind_query(void *db, wg_prepared_query *pq, wg_int argnum,
+  wg_int value);
+wg_query *wg_exec_query(void *db, wg_prepared_query *pq);
+void wg_free_prepared_query(void *db, wg_prepared_query *pq);
+wg_int wg_enable_query_cache(void *db, wg_int size);
+wg_int wg_get_query_cache_stats(void *db, wg_query_cache_stats *stats);
 
 wg_int wg_encode_query_param_null(void *db, const char *data);
 wg_int wg_encode_query_param_record(void *db, void *data);
@@ -350,6 +505,7 @@ wg_int wg_encode_query_param_double(void *db, double data);
 wg_int wg_encode_query_param_str(void *db, const char *data, const char *lang);
 wg_int wg_encode_query_param_xmlliteral(void *db, const char *data, const char *xsdtype);
 wg_int wg_encode_query_param_uri(void *db, const char *data, const char *prefix);
+wg_int wg_encode_query_param_list(void *db, wg_int *values, wg_int count);
 wg_int wg_free_query_param(void* db, wg_int data);
 
 void *wg_find_record(void *db, wg_int fieldnr, wg_int cond, wg_int data,
@@ -73,10 +73,32 @@ static struct tm * localtime_r (const time_t *timer, struct tm *result);
 #define snprintf sprintf_s
 #endif
 
+#ifdef USE_BACKLINKING
+#define BACKLINK_SET_REFS_POS     1
+#define BACKLINK_SET_PARENTS_POS  2
+#define BACKLINK_SET_USED_POS     3
+#define BACKLINK_SET_CAP_POS      4
+#define BACKLINK_SET_HEADER_SIZE  5
+#define BACKLINK_SET_DELETED      1   /* never a valid record offset */
+
+#define BACKLINK_SET_SLOT(s, i) ((s) + BACKLINK_SET_HEADER_SIZE + 2*(i))
+#define BACKLINK_SET_HASH(o, m) \
+  ((gint) (((((wg_uint) (o)) >> 3) * 2654435761U) & (m)))
+#endif
+
 
 /* ======= Private protos ================ */
 
 #ifdef USE_BACKLINKING
+static gint backlink_set_find(gint *set, gint parent);
+static void backlink_set_insert(gint *set, gint parent, gint refs);
+static gint backlink_new_set(void *db, gint capacity);
+static gint backlink_set_rehash(void *db, gint offset, gint capacity);
+static gint backlink_list_to_set(void *db, gint *rec, gint parent);
+static void backlink_set_to_list(void *db, gint *rec);
+static gint add_backlink(void *db, gint *rec, gint parent);
+static gint remove_backlink(void *db, gint *rec, gint parent);
+static gint find_backlink(void *db, gint *rec, gint parent, gint *iter);
 static gint remove_backlink_index_entries(void *db, gint *record,
   gint value, gint depth);
 static gint restore_backlink_index_entries(void *db, gint *record,
@@ -174,6 +196,8 @@ void* wg_create_raw_record(void* db, wg_int length) {
     return 0;
   }
 
+  dbmemsegh(db)->write_epoch++;
+
   /* Init header */
   dbstore(db, offset+RECORD_META_POS*sizeof(gint), 0);
   dbstore(db, offset+RECORD_BACKLINKS_POS*sizeof(gint), 0);
@@ -227,8 +251,14 @@ gint wg_delete_record(void* db, void *rec) {
   }
 #endif
 
+  dbmemsegh(db)->write_epoch++;
+
   /* Remove data from index */
   if(!is_special_record(rec)) {
+    if(dbmemsegh(db)->index_control_area_header.index_path_list) {
+      if(wg_path_index_del_rec(db, rec) < -1)
+        return -3;
+    }
     if(wg_index_del_rec(db, rec) < -1)
       return -3; /* index error */
   }
@@ -256,23 +286,11 @@ gint wg_delete_record(void* db, void *rec) {
     if(wg_get_encoded_type(db, data) == WG_RECORDTYPE) {
 #endif
       gint *child = (gint *) wg_decode_record(db, data);
-      gint *next_offset = child + RECORD_BACKLINKS_POS;
-      gcell *old = NULL;
-
-      while(*next_offset) {
-        old = (gcell *) offsettoptr(db, *next_offset);
-        if(old->car == offset) {
-          gint old_offset = *next_offset;
-          *next_offset = old->cdr; /* remove from list chain */
-          wg_free_listcell(db, old_offset); /* free storage */
-          goto recdel_backlink_removed;
-        }
-        next_offset = &(old->cdr);
+      if(remove_backlink(db, child, offset)) {
+        show_data_error(db, "Corrupt backlink chain");
+        return -3; /* backlink error */
       }
-      show_data_error(db, "Corrupt backlink chain");
-      return -3; /* backlink error */
     }
-recdel_backlink_removed:
 #endif
 
     if(isptr(data)) free_field_encoffset(db,data);
@@ -416,18 +434,16 @@ void* wg_get_next_raw_record(void* db, void* record) {
  */
 void *wg_get_first_parent(void* db, void *record) {
 #ifdef USE_BACKLINKING
-  gint backlink_list;
+  gint parent, iter;
 #ifdef CHECK
   if (!dbcheck(db)) {
     show_data_error(db,"invalid database pointer given to wg_get_first_parent");
     return NULL;
   }
 #endif
-  backlink_list = *((gint *) record + RECORD_BACKLINKS_POS);
-  if(backlink_list) {
-    gcell *cell = (gcell *) offsettoptr(db, backlink_list);
-    return (void *) offsettoptr(db, cell->car);
-  }
+  parent = wg_first_backlink(db, (gint *) record, &iter);
+  if(parent)
+    return (void *) offsettoptr(db, parent);
 #endif /* USE_BACKLINKING */
   return NULL; /* no parents or backlinking not enabled */
 }
@@ -437,29 +453,348 @@ void *wg_get_first_parent(void* db, void *record) {
  */
 void *wg_get_next_parent(void* db, void* record, void *parent) {
 #ifdef USE_BACKLINKING
-  gint backlink_list;
+  gint next, iter;
 #ifdef CHECK
   if (!dbcheck(db)) {
     show_data_error(db,"invalid database pointer given to wg_get_next_parent");
     return NULL;
   }
 #endif
-  backlink_list = *((gint *) record + RECORD_BACKLINKS_POS);
-  if(backlink_list) {
-    gcell *next = (gcell *) offsettoptr(db, backlink_list);
-    while(next->cdr) {
-      void *pp = (void *) offsettoptr(db, next->car);
-      next = (gcell *) offsettoptr(db, next->cdr);
-      if(pp == parent && next->car) {
-        return (void *) offsettoptr(db, next->car);
-      }
-    }
+  if(!find_backlink(db, (gint *) record, ptrtooffset(db, parent), &iter)) {
+    next = wg_next_backlink(db, (gint *) record, &iter);
+    if(next)
+      return (void *) offsettoptr(db, next);
   }
 #endif /* USE_BACKLINKING */
   return NULL; /* no more parents or backlinking not enabled */
 }
 
 
+/* ------------ backlink storage ------------------- */
+
+#ifdef USE_BACKLINKING
+
+/*
+ * Backlinks of a record are normally kept as a list of cells, one
+ * cell per reference. Once the list would grow to BACKLINK_SET_MIN
+ * cells, it is replaced with an open addressing hash set that maps
+ * each parent to its number of references, so that adding or removing
+ * a reference no longer walks the list. The set is allocated from
+ * the index hash area and its offset is stored in the record header
+ * tagged with BACKLINK_SET_TAG. When the number of references drops
+ * below BACKLINK_SET_MIN/4, the set is turned back into a list.
+ *
+ *  set: | hdr | refs | parents | used | capacity | (parent, refs) ... |
+ *
+ * Removed parents leave a BACKLINK_SET_DELETED marker in their slot.
+ * The capacity is a power of two and at most 3/4 of the slots are used.
+ */
+
+/** Find the slot of a parent in a backlink set
+ *  returns the slot number, -1 if the parent is not in the set.
+ */
+static gint backlink_set_find(gint *set, gint parent) {
+  gint mask = set[BACKLINK_SET_CAP_POS] - 1;
+  gint i = BACKLINK_SET_HASH(parent, mask);
+
+  for(;;) { /* there is always an empty slot */
+    gint *slot = BACKLINK_SET_SLOT(set, i);
+    if(!slot[0])
+      return -1;
+    if(slot[0] == parent)
+      return i;
+    i = (i + 1) & mask;
+  }
+}
+
+/** Add references of a parent to a backlink set
+ *  The set must have room for a new parent.
+ */
+static void backlink_set_insert(gint *set, gint parent, gint refs) {
+  gint mask = set[BACKLINK_SET_CAP_POS] - 1;
+  gint i = BACKLINK_SET_HASH(parent, mask), free_slot = -1;
+  gint *slot;
+
+  for(;;) {
+    slot = BACKLINK_SET_SLOT(set, i);
+    if(!slot[0])
+      break;
+    if(slot[0] == parent) {
+      slot[1] += refs;
+      set[BACKLINK_SET_REFS_POS] += refs;
+      return;
+    }
+    if(slot[0] == BACKLINK_SET_DELETED && free_slot < 0)
+      free_slot = i;
+    i = (i + 1) & mask;
+  }
+
+  if(free_slot >= 0)
+    slot = BACKLINK_SET_SLOT(set, free_slot);
+  else
+    set[BACKLINK_SET_USED_POS]++;
+  slot[0] = parent;
+  slot[1] = refs;
+  set[BACKLINK_SET_PARENTS_POS]++;
+  set[BACKLINK_SET_REFS_POS] += refs;
+}
+
+/** Allocate an empty backlink set
+ *  returns the offset of the set, 0 on error.
+ */
+static gint backlink_new_set(void *db, gint capacity) {
+  gint offset = wg_alloc_gints(db, &(dbmemsegh(db)->indexhash_area_header),
+    BACKLINK_SET_HEADER_SIZE + 2*capacity);
+  gint *set;
+
+  if(!offset) {
+    show_data_error(db, "Failed to allocate backlink set");
+    return 0;
+  }
+  set = (gint *) offsettoptr(db, offset);
+  set[BACKLINK_SET_REFS_POS] = 0;
+  set[BACKLINK_SET_PARENTS_POS] = 0;
+  set[BACKLINK_SET_USED_POS] = 0;
+  set[BACKLINK_SET_CAP_POS] = capacity;
+  memset(BACKLINK_SET_SLOT(set, 0), 0, 2*capacity*sizeof(gint));
+  return offset;
+}
+
+/** Copy a backlink set into a new one, dropping the deleted slots
+ *  The old set is freed.
+ *  returns the offset of the new set, 0 on error.
+ */
+static gint backlink_set_rehash(void *db, gint offset, gint capacity) {
+  gint newoffset = backlink_new_set(db, capacity);
+  gint *set, *newset, i;
+
+  if(!newoffset)
+    return 0;
+  set = (gint *) offsettoptr(db, offset);
+  newset = (gint *) offsettoptr(db, newoffset);
+  for(i=0; i<set[BACKLINK_SET_CAP_POS]; i++) {
+    gint *slot = BACKLINK_SET_SLOT(set, i);
+    if(slot[0] > BACKLINK_SET_DELETED)
+      backlink_set_insert(newset, slot[0], slot[1]);
+  }
+  wg_free_object(db, &(dbmemsegh(db)->indexhash_area_header), offset);
+  return newoffset;
+}
+
+/** Convert the backlink list of a record to a set
+ *  The new parent is added as well.
+ *  returns 0 on success, -1 on error.
+ */
+static gint backlink_list_to_set(void *db, gint *rec, gint parent) {
+  gint offset = backlink_new_set(db, 2*BACKLINK_SET_MIN);
+  gint *set, cell;
+
+  if(!offset)
+    return -1;
+  set = (gint *) offsettoptr(db, offset);
+  cell = rec[RECORD_BACKLINKS_POS];
+  while(cell) {
+    gcell *old = (gcell *) offsettoptr(db, cell);
+    gint next = old->cdr;
+    backlink_set_insert(set, old->car, 1);
+    wg_free_listcell(db, cell);
+    cell = next;
+  }
+  backlink_set_insert(set, parent, 1);
+  rec[RECORD_BACKLINKS_POS] = offset | BACKLINK_SET_TAG;
+  return 0;
+}
+
+/** Convert the backlink set of a record to a list
+ *  If the list cannot be allocated, the set is kept.
+ */
+static void backlink_set_to_list(void *db, gint *rec) {
+  gint offset = rec[RECORD_BACKLINKS_POS] & ~((gint) BACKLINK_SET_TAG);
+  gint *set = (gint *) offsettoptr(db, offset);
+  gint list = 0, i, j;
+
+  for(i=0; i<set[BACKLINK_SET_CAP_POS]; i++) {
+    gint *slot = BACKLINK_SET_SLOT(set, i);
+    if(slot[0] <= BACKLINK_SET_DELETED)
+      continue;
+    for(j=0; j<slot[1]; j++) {
+      gint cell = wg_alloc_fixlen_object(db,
+        &(dbmemsegh(db)->listcell_area_header));
+      if(!cell) {
+        while(list) {
+          gint next = ((gcell *) offsettoptr(db, list))->cdr;
+          wg_free_listcell(db, list);
+          list = next;
+        }
+        return;
+      }
+      ((gcell *) offsettoptr(db, cell))->car = slot[0];
+      ((gcell *) offsettoptr(db, cell))->cdr = list;
+      list = cell;
+    }
+  }
+  wg_free_object(db, &(dbmemsegh(db)->indexhash_area_header), offset);
+  rec[RECORD_BACKLINKS_POS] = list;
+}
+
+/** Add a backlink to a record
+ *  returns 0 on success, -1 on error.
+ */
+static gint add_backlink(void *db, gint *rec, gint parent) {
+  gint *next_offset = rec + RECORD_BACKLINKS_POS;
+  gint new_offset, length = 0;
+  gcell *new_cell;
+
+  if(is_backlink_set(*next_offset)) {
+    gint offset = *next_offset & ~((gint) BACKLINK_SET_TAG);
+    gint *set = (gint *) offsettoptr(db, offset);
+
+    if(backlink_set_find(set, parent) < 0 &&\
+      4*(set[BACKLINK_SET_USED_POS] + 1) > 3*set[BACKLINK_SET_CAP_POS]) {
+      /* No room for a new parent. Grow the set, unless most of the
+       * used slots are deleted. */
+      gint capacity = set[BACKLINK_SET_CAP_POS];
+      if(4*(set[BACKLINK_SET_PARENTS_POS] + 1) > capacity)
+        capacity *= 2;
+      offset = backlink_set_rehash(db, offset, capacity);
+      if(!offset)
+        return -1;
+      *next_offset = offset | BACKLINK_SET_TAG;
+      set = (gint *) offsettoptr(db, offset);
+    }
+    backlink_set_insert(set, parent, 1);
+    return 0;
+  }
+
+  while(*next_offset) {
+    next_offset = &(((gcell *) offsettoptr(db, *next_offset))->cdr);
+    length++;
+  }
+  if(length + 1 >= BACKLINK_SET_MIN)
+    return backlink_list_to_set(db, rec, parent);
+
+  new_offset = wg_alloc_fixlen_object(db,
+    &(dbmemsegh(db)->listcell_area_header));
+  if(!new_offset) {
+    show_data_error(db, "Failed to allocate backlink");
+    return -1;
+  }
+  new_cell = (gcell *) offsettoptr(db, new_offset);
+  new_cell->car = parent;
+  new_cell->cdr = 0;
+  *next_offset = new_offset;
+  return 0;
+}
+
+/** Remove a backlink from a record
+ *  returns 0 on success, -1 if the backlink was not found.
+ */
+static gint remove_backlink(void *db, gint *rec, gint parent) {
+  gint *next_offset = rec + RECORD_BACKLINKS_POS;
+
+  if(is_backlink_set(*next_offset)) {
+    gint *set = (gint *) offsettoptr(db,
+      *next_offset & ~((gint) BACKLINK_SET_TAG));
+    gint i = backlink_set_find(set, parent);
+    gint *slot;
+
+    if(i < 0)
+      return -1;
+    slot = BACKLINK_SET_SLOT(set, i);
+    set[BACKLINK_SET_REFS_POS]--;
+    if(!(--slot[1])) {
+      slot[0] = BACKLINK_SET_DELETED;
+      set[BACKLINK_SET_PARENTS_POS]--;
+    }
+    if(set[BACKLINK_SET_REFS_POS] < BACKLINK_SET_MIN/4)
+      backlink_set_to_list(db, rec);
+    return 0;
+  }
+
+  while(*next_offset) {
+    gcell *old = (gcell *) offsettoptr(db, *next_offset);
+    if(old->car == parent) {
+      gint old_offset = *next_offset;
+      *next_offset = old->cdr; /* remove from list chain */
+      wg_free_listcell(db, old_offset); /* free storage */
+      return 0;
+    }
+    next_offset = &(old->cdr);
+  }
+  return -1;
+}
+
+/** Get the first parent from the backlinks of a record
+ *  *iter is set to the position in the backlinks, to be passed to
+ *  wg_next_backlink(). If a parent refers to the record several times,
+ *  it may be returned once (if the backlinks are kept in a set) or once
+ *  per reference.
+ *  returns the offset of the parent, 0 if there are no parents.
+ */
+gint wg_first_backlink(void *db, gint *rec, gint *iter) {
+  gint backlinks = rec[RECORD_BACKLINKS_POS];
+
+  if(is_backlink_set(backlinks)) {
+    *iter = -1;
+    return wg_next_backlink(db, rec, iter);
+  }
+  *iter = backlinks;
+  if(!backlinks)
+    return 0;
+  return ((gcell *) offsettoptr(db, backlinks))->car;
+}
+
+/** Get the next parent from the backlinks of a record
+ *  returns the offset of the parent, 0 if there are no more parents.
+ */
+gint wg_next_backlink(void *db, gint *rec, gint *iter) {
+  gint backlinks = rec[RECORD_BACKLINKS_POS];
+
+  if(is_backlink_set(backlinks)) {
+    gint *set = (gint *) offsettoptr(db,
+      backlinks & ~((gint) BACKLINK_SET_TAG));
+    gint i;
+    for(i=*iter+1; i<set[BACKLINK_SET_CAP_POS]; i++) {
+      gint *slot = BACKLINK_SET_SLOT(set, i);
+      if(slot[0] > BACKLINK_SET_DELETED) {
+        *iter = i;
+        return slot[0];
+      }
+    }
+    *iter = i;
+    return 0;
+  }
+  else if(*iter) {
+    gcell *cell = (gcell *) offsettoptr(db, *iter);
+    *iter = cell->cdr;
+    if(cell->cdr)
+      return ((gcell *) offsettoptr(db, cell->cdr))->car;
+  }
+  return 0;
+}
+
+/** Find the position of a parent in the backlinks of a record
+ *  The position can be passed to wg_next_backlink().
+ *  returns 0 if the parent was found, -1 otherwise.
+ */
+static gint find_backlink(void *db, gint *rec, gint parent, gint *iter) {
+  gint backlinks = rec[RECORD_BACKLINKS_POS];
+
+  if(is_backlink_set(backlinks)) {
+    *iter = backlink_set_find((gint *) offsettoptr(db,
+      backlinks & ~((gint) BACKLINK_SET_TAG)), parent);
+    return (*iter < 0 ? -1 : 0);
+  }
+  for(*iter = backlinks; *iter;
+    *iter = ((gcell *) offsettoptr(db, *iter))->cdr) {
+    if(((gcell *) offsettoptr(db, *iter))->car == parent)
+      return 0;
+  }
+  return -1;
+}
+
+#endif
+
 /* ------------ backlink chain recursive functions ------------------- */
 
 #ifdef USE_BACKLINKING
@@ -491,7 +826,8 @@ static gint remove_backlink_index_entries(void *db, gint *record,
          * we don't need to deal with index templates here
          * (record links are not allowed in templates).
          */
-        if(dbh->index_control_area_header.index_table[col]) {
+        if(dbh->index_control_area_header.index_table[col] ||\
+          dbh->index_control_area_header.index_build_list) {
           if(wg_index_del_field(db, record, col) < -1)
             return -1;
         }
@@ -503,19 +839,14 @@ static gint remove_backlink_index_entries(void *db, gint *record,
    * of this record.
    */
   if(depth > 0) {
-    gint backlink_list = *(record + RECORD_BACKLINKS_POS);
-    if(backlink_list) {
-      gcell *next = (gcell *) offsettoptr(db, backlink_list);
-      for(;;) {
-        err = remove_backlink_index_entries(db,
-          (gint *) offsettoptr(db, next->car),
-          wg_encode_record(db, record), depth-1);
-        if(err)
-          return err;
-        if(!next->cdr)
-          break;
-        next = (gcell *) offsettoptr(db, next->cdr);
-      }
+    gint iter, parent = wg_first_backlink(db, record, &iter);
+    while(parent) {
+      err = remove_backlink_index_entries(db,
+        (gint *) offsettoptr(db, parent),
+        wg_encode_record(db, record), depth-1);
+      if(err)
+        return err;
+      parent = wg_next_backlink(db, record, &iter);
     }
   }
 
@@ -545,7 +876,8 @@ static gint restore_backlink_index_entries(void *db, gint *record,
 
     for(col=0; col<length; col++) {
       if(*(record + RECORD_HEADER_GINTS + col) == value) {
-        if(dbh->index_control_area_header.index_table[col]) {
+        if(dbh->index_control_area_header.index_table[col] ||\
+          dbh->index_control_area_header.index_build_list) {
           if(wg_index_add_field(db, record, col) < -1)
             return -1;
         }
@@ -555,19 +887,14 @@ static gint restore_backlink_index_entries(void *db, gint *record,
 
   /* Continue to the parents until depth==0 */
   if(depth > 0) {
-    gint backlink_list = *(record + RECORD_BACKLINKS_POS);
-    if(backlink_list) {
-      gcell *next = (gcell *) offsettoptr(db, backlink_list);
-      for(;;) {
-        err = restore_backlink_index_entries(db,
-          (gint *) offsettoptr(db, next->car),
-          wg_encode_record(db, record), depth-1);
-        if(err)
-          return err;
-        if(!next->cdr)
-          break;
-        next = (gcell *) offsettoptr(db, next->cdr);
-      }
+    gint iter, parent = wg_first_backlink(db, record, &iter);
+    while(parent) {
+      err = restore_backlink_index_entries(db,
+        (gint *) offsettoptr(db, parent),
+        wg_encode_record(db, record), depth-1);
+      if(err)
+        return err;
+      parent = wg_next_backlink(db, record, &iter);
     }
   }
 
@@ -643,19 +970,27 @@ wg_int wg_set_field(void* db, void* record, wg_int fieldnr, wg_int data) {
   if(fielddata == data) {
     return 0;
   }
+  dbh->write_epoch++;
 
   /* Update index(es) while the old value is still in the db */
 #ifdef USE_INDEX_TEMPLATE
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
     (dbh->index_control_area_header.index_table[fieldnr] ||\
-     dbh->index_control_area_header.index_template_table[fieldnr])) {
+     dbh->index_control_area_header.index_template_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #else
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
-    dbh->index_control_area_header.index_table[fieldnr]) {
+    (dbh->index_control_area_header.index_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #endif
     if(wg_index_del_field(db, record, fieldnr) < -1)
       return -3; /* index error */
   }
+  if(dbh->index_control_area_header.index_path_list &&\
+    !is_special_record(record)) {
+    if(wg_path_index_del_field(db, record, fieldnr) < -1)
+      return -3;
+  }
 
   /* If there are backlinks, go up the chain and remove the reference
    * to this record from all indexes (updating a field in the record
@@ -666,19 +1001,16 @@ wg_int wg_set_field(void* db, void* record, wg_int fieldnr, wg_int data) {
 #if defined(USE_BACKLINKING) && (WG_COMPARE_REC_DEPTH > 0)
   backlink_list = *((gint *) record + RECORD_BACKLINKS_POS);
   if(backlink_list) {
-    gint err;
-    gcell *next = (gcell *) offsettoptr(db, backlink_list);
+    gint err, iter, parent = wg_first_backlink(db, (gint *) record, &iter);
     rec_enc = wg_encode_record(db, record);
-    for(;;) {
+    while(parent) {
       err = remove_backlink_index_entries(db,
-        (gint *) offsettoptr(db, next->car),
+        (gint *) offsettoptr(db, parent),
         rec_enc, WG_COMPARE_REC_DEPTH-1);
       if(err) {
         return -4; /* override the error code, for now. */
       }
-      if(!next->cdr)
-        break;
-      next = (gcell *) offsettoptr(db, next->cdr);
+      parent = wg_next_backlink(db, (gint *) record, &iter);
     }
   }
 #endif
@@ -707,24 +1039,11 @@ wg_int wg_set_field(void* db, void* record, wg_int fieldnr, wg_int data) {
   if(wg_get_encoded_type(db, fielddata) == WG_RECORDTYPE) {
 #endif
     gint *rec = (gint *) wg_decode_record(db, fielddata);
-    gint *next_offset = rec + RECORD_BACKLINKS_POS;
-    gint parent_offset = ptrtooffset(db, record);
-    gcell *old = NULL;
-
-    while(*next_offset) {
-      old = (gcell *) offsettoptr(db, *next_offset);
-      if(old->car == parent_offset) {
-        gint old_offset = *next_offset;
-        *next_offset = old->cdr; /* remove from list chain */
-        wg_free_listcell(db, old_offset); /* free storage */
-        goto setfld_backlink_removed;
-      }
-      next_offset = &(old->cdr);
+    if(remove_backlink(db, rec, ptrtooffset(db, record))) {
+      show_data_error(db, "Corrupt backlink chain");
+      return -4; /* backlink error */
     }
-    show_data_error(db, "Corrupt backlink chain");
-    return -4; /* backlink error */
   }
-setfld_backlink_removed:
 #endif
 
 #ifdef USE_CHILD_DB
@@ -747,14 +1066,23 @@ setfld_backlink_removed:
 #ifdef USE_INDEX_TEMPLATE
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
     (dbh->index_control_area_header.index_table[fieldnr] ||\
-     dbh->index_control_area_header.index_template_table[fieldnr])) {
+     dbh->index_control_area_header.index_template_table[fieldnr] ||\
+     dbh->index_control_area_header.index_include_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #else
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
-    dbh->index_control_area_header.index_table[fieldnr]) {
+    (dbh->index_control_area_header.index_table[fieldnr] ||\
+     dbh->index_control_area_header.index_include_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #endif
     if(wg_index_add_field(db, record, fieldnr) < -1)
       return -3;
   }
+  if(dbh->index_control_area_header.index_path_list &&\
+    !is_special_record(record)) {
+    if(wg_path_index_add_field(db, record, fieldnr) < -1)
+      return -3;
+  }
 
 #ifdef USE_BACKLINKING
   /* Is the new field value a record pointer? If so, add a backlink */
@@ -765,34 +1093,23 @@ setfld_backlink_removed:
   if(wg_get_encoded_type(db, data) == WG_RECORDTYPE) {
 #endif
     gint *rec = (gint *) wg_decode_record(db, data);
-    gint *next_offset = rec + RECORD_BACKLINKS_POS;
-    gint new_offset = wg_alloc_fixlen_object(db,
-      &(dbmemsegh(db)->listcell_area_header));
-    gcell *new_cell = (gcell *) offsettoptr(db, new_offset);
-
-    while(*next_offset)
-      next_offset = &(((gcell *) offsettoptr(db, *next_offset))->cdr);
-    new_cell->car = ptrtooffset(db, record);
-    new_cell->cdr = 0;
-    *next_offset = new_offset;
+    if(add_backlink(db, rec, ptrtooffset(db, record)))
+      return -4; /* backlink error */
   }
 #endif
 
 #if defined(USE_BACKLINKING) && (WG_COMPARE_REC_DEPTH > 0)
   /* Create new entries in indexes in all referring records */
   if(backlink_list) {
-    gint err;
-    gcell *next = (gcell *) offsettoptr(db, backlink_list);
-    for(;;) {
+    gint err, iter, parent = wg_first_backlink(db, (gint *) record, &iter);
+    while(parent) {
       err = restore_backlink_index_entries(db,
-        (gint *) offsettoptr(db, next->car),
+        (gint *) offsettoptr(db, parent),
         rec_enc, WG_COMPARE_REC_DEPTH-1);
       if(err) {
         return -4;
       }
-      if(!next->cdr)
-        break;
-      next = (gcell *) offsettoptr(db, next->cdr);
+      parent = wg_next_backlink(db, (gint *) record, &iter);
     }
   }
 #endif
@@ -862,6 +1179,7 @@ wg_int wg_set_new_field(void* db, void* record, wg_int fieldnr, wg_int data) {
   }
 #endif
   (*fieldadr)=data;
+  dbh->write_epoch++;
 
 #ifdef USE_CHILD_DB
   if (islongstr(data) && offset_owner == dbmemseg(db)) {
@@ -877,14 +1195,23 @@ wg_int wg_set_new_field(void* db, void* record, wg_int fieldnr, wg_int data) {
 #ifdef USE_INDEX_TEMPLATE
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
     (dbh->index_control_area_header.index_table[fieldnr] ||\
-     dbh->index_control_area_header.index_template_table[fieldnr])) {
+     dbh->index_control_area_header.index_template_table[fieldnr] ||\
+     dbh->index_control_area_header.index_include_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #else
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
-    dbh->index_control_area_header.index_table[fieldnr]) {
+    (dbh->index_control_area_header.index_table[fieldnr] ||\
+     dbh->index_control_area_header.index_include_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #endif
     if(wg_index_add_field(db, record, fieldnr) < -1)
       return -3;
   }
+  if(dbh->index_control_area_header.index_path_list &&\
+    !is_special_record(record)) {
+    if(wg_path_index_add_field(db, record, fieldnr) < -1)
+      return -3;
+  }
 
 #ifdef USE_BACKLINKING
   /* Is the new field value a record pointer? If so, add a backlink */
@@ -895,16 +1222,8 @@ wg_int wg_set_new_field(void* db, void* record, wg_int fieldnr, wg_int data) {
   if(wg_get_encoded_type(db, data) == WG_RECORDTYPE) {
 #endif
     gint *rec = (gint *) wg_decode_record(db, data);
-    gint *next_offset = rec + RECORD_BACKLINKS_POS;
-    gint new_offset = wg_alloc_fixlen_object(db,
-      &(dbmemsegh(db)->listcell_area_header));
-    gcell *new_cell = (gcell *) offsettoptr(db, new_offset);
-
-    while(*next_offset)
-      next_offset = &(((gcell *) offsettoptr(db, *next_offset))->cdr);
-    new_cell->car = ptrtooffset(db, record);
-    new_cell->cdr = 0;
-    *next_offset = new_offset;
+    if(add_backlink(db, rec, ptrtooffset(db, record)))
+      return -4; /* backlink error */
   }
 #endif
 
@@ -915,19 +1234,16 @@ wg_int wg_set_new_field(void* db, void* record, wg_int fieldnr, wg_int data) {
    */
   backlink_list = *((gint *) record + RECORD_BACKLINKS_POS);
   if(backlink_list) {
-    gint err;
-    gcell *next = (gcell *) offsettoptr(db, backlink_list);
+    gint err, iter, parent = wg_first_backlink(db, (gint *) record, &iter);
     gint rec_enc = wg_encode_record(db, record);
-    for(;;) {
+    while(parent) {
       err = restore_backlink_index_entries(db,
-        (gint *) offsettoptr(db, next->car),
+        (gint *) offsettoptr(db, parent),
         rec_enc, WG_COMPARE_REC_DEPTH-1);
       if(err) {
         return -4;
       }
-      if(!next->cdr)
-        break;
-      next = (gcell *) offsettoptr(db, next->cdr);
+      parent = wg_next_backlink(db, (gint *) record, &iter);
     }
   }
 #endif
@@ -1021,13 +1337,27 @@ wg_int wg_update_atomic_field(void* db, void* record, wg_int fieldnr, wg_int dat
 #ifdef USE_INDEX_TEMPLATE
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
     (dbh->index_control_area_header.index_table[fieldnr] ||\
-     dbh->index_control_area_header.index_template_table[fieldnr])) {
+     dbh->index_control_area_header.index_template_table[fieldnr] ||\
+     dbh->index_control_area_header.index_include_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #else
   if(!is_special_record(record) && fieldnr<=MAX_INDEXED_FIELDNR &&\
-    dbh->index_control_area_header.index_table[fieldnr]) {
+    (dbh->index_control_area_header.index_table[fieldnr] ||\
+     dbh->index_control_area_header.index_include_table[fieldnr] ||\
+     dbh->index_control_area_header.index_build_list)) {
 #endif
     return -13;
   }
+  if(dbh->index_control_area_header.index_path_list &&\
+    !is_special_record(record)) {
+#ifdef USE_BACKLINKING
+    if(is_schema_document(record) ||\
+      *((gint *) record + RECORD_BACKLINKS_POS))
+#else
+    if(is_schema_document(record))
+#endif
+      return -13; /* part of an indexed JSON document */
+  }
   // check that no logging is used
 #ifdef USE_DBLOG
   if(dbh->logging.active) {
@@ -1037,7 +1367,10 @@ wg_int wg_update_atomic_field(void* db, void* record, wg_int fieldnr, wg_int dat
   // checks passed, do atomic field setting
   fieldadr=((gint*)record)+RECORD_HEADER_GINTS+fieldnr;
   tmp=wg_compare_and_swap(fieldadr, old_data, data);
-  if (tmp) return 0;
+  if (tmp) {
+    dbh->write_epoch++;
+    return 0;
+  }
   else return -15;
 }
 
@@ -257,12 +257,19 @@ wg_int wg_decode_var(void* db, wg_int data);
 #define RECORD_META_POS 1           /** metainfo, reserved for future use */
 #define RECORD_BACKLINKS_POS 2      /** backlinks structure offset */
 
+/* Backlinks are a list of cells, or a hash set for records with many
+ * parents. The offset of a set is tagged in the lowest bit. */
+#define BACKLINK_SET_TAG 0x1
+#define BACKLINK_SET_MIN 64         /** list length that is turned to a set */
+#define is_backlink_set(b) ((b) & BACKLINK_SET_TAG)
+
 #define LITTLEENDIAN 1  ///< (intel is little-endian) difference in encoding tinystr
 //#define USETINYSTR 1    ///< undef to prohibit usage of tinystr
 
 /* Record meta bits. */
 #define RECORD_META_NOTDATA 0x1 /** Record is a "special" record (not data) */
 #define RECORD_META_MATCH 0x2   /** "match" record (needs NOTDATA as well) */
+#define RECORD_META_LOCAL 0x4   /** query parameter in local memory */
 #define RECORD_META_DOC 0x10    /** schema bits: top-level document */
 #define RECORD_META_OBJECT 0x20 /** schema bits: object */
 #define RECORD_META_ARRAY 0x40  /** schema bits: array */
@@ -666,5 +673,9 @@ void *wg_get_rec_owner(void *db, void *rec);
 #ifdef USE_RECPTR_BITMAP
 gint wg_recptr_check(void *db,void *ptr);
 #endif
+#ifdef USE_BACKLINKING
+gint wg_first_backlink(void *db, gint *rec, gint *iter);
+gint wg_next_backlink(void *db, gint *rec, gint *iter);
+#endif
 
 #endif /* DEFINED_DBDATA_H */
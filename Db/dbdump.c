@@ -280,7 +280,7 @@ gint wg_import_dump(void * db,char fileName[]) {
   db_memsegment_header* dumph;
   FILE *f;
   db_memsegment_header* dbh = dbmemsegh(db);
-  gint dbsize = -1, newsize;
+  gint dbsize = -1, newsize, epoch;
   gint err = -1;
 #ifdef USE_DBLOG
   gint active = dbh->logging.active;
@@ -325,6 +325,7 @@ gint wg_import_dump(void * db,char fileName[]) {
   } else if(dbsize > 0) {
     /* We have a compatible dump file. */
     newsize = dbh->size;
+    epoch = dbh->write_epoch;
     fseek(f, 0, SEEK_SET);
     if(fread(dbmemseg(db), dbsize, 1, f) != 1) {
       show_dump_error(db, "Error reading dump file");
@@ -333,6 +334,7 @@ gint wg_import_dump(void * db,char fileName[]) {
       err = 0;
       dbh->size = newsize;
       dbh->checksum = 0;
+      dbh->write_epoch = epoch + 1; /* all the rows were replaced */
     }
   }
 
@@ -45,7 +45,9 @@ extern "C" {
 #include "dbindex.h"
 #include "dbcompare.h"
 #include "dbhash.h"
+#include "dbschema.h"
 #include "dbutil.h"
+#include "dblock.h"
 
 
 /* ====== Private defs =========== */
@@ -63,18 +65,89 @@ extern "C" {
 #define HASHIDX_OP_REMOVE 2
 #define HASHIDX_OP_FIND 3
 
+/* Optimistic T-tree searches repeated before falling back to a
+ * search that assumes the database lock (see wg_search_ttree_index()) */
+#define TTREE_READ_RETRIES 100
+
+/* Bitmap index storage layout (see create_bitmap_index()) */
+#define BITMAP_DIR_COUNT_POS      1
+#define BITMAP_DIR_CAP_POS        2
+#define BITMAP_DIR_HEADER_SIZE    3
+#define BITMAP_SET_COUNT_POS      1
+#define BITMAP_SET_CAP_POS        2
+#define BITMAP_SET_CARD_POS       3
+#define BITMAP_SET_HEADER_SIZE    4
+#define BITMAP_CHUNK_KEY_POS      0
+#define BITMAP_CHUNK_CARD_POS     1
+#define BITMAP_CHUNK_DATA_POS     2
+#define BITMAP_CHUNK_SIZE_GINTS   3
+#define BITMAP_ARRAY_CAP_POS      1
+#define BITMAP_ARRAY_HEADER_SIZE  2
+#define BITMAP_BITS_HEADER_SIZE   1
+
+#define BITMAP_MIN_CAPACITY 4
+#define BITMAP_ARRAY_MAX 4096     /* larger chunks use bitmap containers */
+
+#define BITMAP_DIR_SIZE(c) (BITMAP_DIR_HEADER_SIZE + 2*(c))
+#define BITMAP_SET_SIZE(c) (BITMAP_SET_HEADER_SIZE + \
+                            BITMAP_CHUNK_SIZE_GINTS*(c))
+#define BITMAP_ARRAY_SIZE(c) (BITMAP_ARRAY_HEADER_SIZE + \
+          ((c)*sizeof(unsigned short) + sizeof(gint) - 1)/sizeof(gint))
+#define BITMAP_BITS_SIZE (BITMAP_BITS_HEADER_SIZE + \
+          BITMAP_CHUNK_WORDS*sizeof(wg_uint)/sizeof(gint))
+
+#define BITMAP_TEST_BIT(w, n) \
+  ((w)[(n) / BITMAP_WORD_BITS] & (((wg_uint) 1) << ((n) % BITMAP_WORD_BITS)))
+#define BITMAP_SET_BIT(w, n) \
+  ((w)[(n) / BITMAP_WORD_BITS] |= (((wg_uint) 1) << ((n) % BITMAP_WORD_BITS)))
+#define BITMAP_CLEAR_BIT(w, n) \
+  ((w)[(n) / BITMAP_WORD_BITS] &= ~(((wg_uint) 1) << ((n) % BITMAP_WORD_BITS)))
+
+#define RTREE_NODE_COUNT_POS      1
+#define RTREE_NODE_LEVEL_POS      2
+#define RTREE_NODE_HEADER_SIZE    3
+#define RTREE_MAX_ENTRIES         16
+
+#define RTREE_DOUBLE_GINTS \
+          ((gint) ((sizeof(double) + sizeof(gint) - 1)/sizeof(gint)))
+#define RTREE_ENTRY_SIZE(d) (1 + 2*(d)*RTREE_DOUBLE_GINTS)
+#define RTREE_NODE_SIZE(d) (RTREE_NODE_HEADER_SIZE + \
+                            RTREE_MAX_ENTRIES*RTREE_ENTRY_SIZE(d))
+#define RTREE_ENTRY(n, i, d) ((n) + RTREE_NODE_HEADER_SIZE + \
+                              (i)*RTREE_ENTRY_SIZE(d))
+
+/* Field of a composite T-tree key (record or search key) */
+#define COMPOSITE_KEY_FIELD(d, k, c) \
+  dbfetch(d, (k) + (RECORD_HEADER_GINTS + (c))*sizeof(gint))
+
 /* ======= Private protos ================ */
 
 #ifndef TTREE_SINGLE_COMPARE
-static gint db_find_bounding_tnode(void *db, gint rootoffset, gint key,
-  gint *result, struct wg_tnode *rb_node);
+static gint db_find_bounding_tnode(void *db, gint index_id, gint rootoffset,
+  gint key, gint *result, struct wg_tnode *rb_node);
 #endif
 static int db_which_branch_causes_overweight(void *db, struct wg_tnode *root);
+static gint ttree_subtree_count(void *db, gint nodeoffset);
+static void ttree_count_node(void *db, struct wg_tnode *node);
+static void ttree_update_counts(void *db, gint nodeoffset);
 static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root,
   int overw);
 static gint ttree_add_row(void *db, gint index_id, void *rec);
+static gint ttree_find_row(void *db, gint index_id, void *rec,
+  struct wg_tnode **rnode);
 static gint ttree_remove_row(void *db, gint index_id, void * rec);
-
+static void index_write_begin(void *db, wg_index_header *hdr);
+static void index_write_end(void *db, wg_index_header *hdr);
+static gint ttree_versioned_add_row(void *db, gint index_id, void *rec);
+static gint ttree_versioned_remove_row(void *db, gint index_id, void *rec);
+static gint ttree_read_node(void *db, wg_index_header *hdr, gint nodeoffset,
+  gint version, struct wg_tnode *node);
+static gint ttree_read_entry(void *db, wg_index_header *hdr, gint rowoffset,
+  gint version, gint *key, gint *rec);
+static gint ttree_lookup(void *db, wg_index_header *hdr, gint key,
+  gint version);
+
+static gint ttree_init_root(void *db, wg_index_header *hdr);
 static gint create_ttree_index(void *db, gint index_id);
 static gint drop_ttree_index(void *db, gint column);
 
@@ -97,7 +170,123 @@ static gint hash_extend_prefix(void *db, wg_index_header *hdr, char *prefix,
 static gint create_hash_index(void *db, gint index_id);
 static gint drop_hash_index(void *db, gint index_id);
 
+static gint path_index_value(void *db, wg_index_header *hdr, gint enc,
+  gint *path, gint depth, gint nesting, gint levels, void *doc, gint op);
+static gint path_index_field(void *db, wg_index_header *hdr, void *rec,
+  gint column, gint *path, gint depth, gint nesting, gint levels,
+  void *doc, gint op);
+static gint path_index_doc(void *db, gint index_id, void *doc, gint column,
+  gint op);
+#ifdef USE_BACKLINKING
+static void *path_index_parent(void *db, void *rec);
+static gint path_index_locate(void *db, void **rec, gint *column, void **doc,
+  gint *path, gint *depth, gint *nesting, gint *levels);
+#endif
+static gint path_index_update(void *db, void *rec, gint column, gint op);
+static gint create_path_index(void *db, gint *columns, gint col_count,
+  gint include_count, gint *matchrec, gint online);
+
+static gint bitmap_resize(void *db, gint offset, gint oldsize,
+  gint newsize);
+static gint bitmap_find_value(void *db, gint *dir, gint value);
+static gint bitmap_find_chunk(gint *set, gint key);
+static gint bitmap_find_array(unsigned short *arr, gint count, gint low);
+static gint bitmap_chunk_add(void *db, gint *chunk, gint low);
+static gint bitmap_chunk_remove(void *db, gint *chunk, gint low);
+static gint bitmap_new_set(void *db);
+static gint bitmap_set_add(void *db, gint *setp, gint recnr);
+static gint bitmap_set_remove(void *db, gint *set, gint recnr);
+static gint bitmap_set_first(void *db, gint *set);
+static void bitmap_free_set(void *db, gint offset);
+static gint bitmap_add_value(void *db, wg_index_header *hdr, gint value,
+  gint offset);
+static gint bitmap_remove_value(void *db, wg_index_header *hdr, gint value,
+  gint offset);
+static gint bitmap_init_dir(void *db, wg_index_header *hdr);
+static gint bitmap_add_row(void *db, gint index_id, void *rec);
+static gint bitmap_remove_row(void *db, gint index_id, void *rec);
+
+static gint create_bitmap_index(void *db, gint index_id);
+static gint drop_bitmap_index(void *db, gint index_id);
+
+static int compare_trigrams(const void *a, const void *b);
+static gint trigram_add_row(void *db, gint index_id, void *rec);
+static gint trigram_remove_row(void *db, gint index_id, void *rec);
+static gint create_trigram_index(void *db, gint index_id);
+
+static void rtree_get_box(gint *entry, gint dims, double *box);
+static void rtree_set_box(gint *entry, gint dims, double *box);
+static void rtree_extend_box(double *box, double *other, gint dims);
+static gint rtree_overlaps(double *box, double *other, gint dims);
+static void rtree_node_box(gint *node, gint dims, double *box);
+static gint rtree_new_node(void *db, gint dims, gint level);
+static gint rtree_row_point(void *db, wg_index_header *hdr, void *rec,
+  double *box);
+static gint rtree_split_node(void *db, gint dims, gint nodeoffset,
+  gint child, double *box, gint *split);
+static gint rtree_add_entry(void *db, gint dims, gint nodeoffset,
+  gint child, double *box, gint *split);
+static gint rtree_insert(void *db, gint dims, gint nodeoffset,
+  gint offset, double *box, gint *split);
+static gint rtree_remove(void *db, gint dims, gint nodeoffset,
+  gint offset, double *box);
+static gint rtree_search(void *db, gint dims, gint nodeoffset,
+  double *box, gint **offsets, gint *count, gint *size);
+static void rtree_free_nodes(void *db, gint dims, gint nodeoffset);
+static gint rtree_add_row(void *db, gint index_id, void *rec);
+static gint rtree_remove_row(void *db, gint index_id, void *rec);
+static int compare_rtree_items(const void *a, const void *b);
+static void rtree_str_sort(void *items, gint count, gint size,
+  gint dim, gint dims);
+static gint rtree_pack(void *db, gint dims, void *items, gint count,
+  gint size, gint level);
+static gint create_rtree_index(void *db, gint index_id);
+static gint drop_rtree_index(void *db, gint index_id);
+
+static unsigned int stats_hash_bytes(unsigned int h, const void *data,
+  gint len);
+static unsigned int stats_key_hash(void *db, wg_index_header *hdr, void *rec);
+static gint stats_row_counted(void *db, wg_index_header *hdr, void *rec);
+static gint stats_find_bucket(struct __wg_index_stats *st, double value);
+static void stats_count_row(void *db, wg_index_header *hdr, void *rec);
+static void stats_add_row(void *db, wg_index_header *hdr, void *rec);
+static void stats_remove_row(void *db, wg_index_header *hdr, void *rec);
+static int compare_doubles(const void *a, const void *b);
+static double stats_log(double x);
+static gint stats_distinct(struct __wg_index_stats *st);
+static gint refresh_index_stats(void *db, gint index_id);
+static wg_index_header *find_index_header(void *db, gint index_id);
+
+static gint create_index_entry(void *db, wg_index_header *hdr, void *rec);
+static gint find_index_entry(void *db, gint index_id, void *rec);
+static void update_index_entry(void *db, gint index_id, void *rec,
+  gint column);
+
+static db_handle_indexdata *deferred_indexdata(void *db);
+static gint find_pending_slot(db_handle_indexdata *idata, gint index_id,
+  gint rec);
+static gint resize_pending(void *db, db_handle_indexdata *idata,
+  gint size);
+static gint index_row_pending(void *db, gint index_id, void *rec);
+static gint queue_index_row(void *db, gint index_id, void *rec);
+static gint unqueue_index_row(void *db, gint index_id, void *rec);
+static int compare_pending(const void *a, const void *b);
+static gint flush_index_row(void *db, gint index_id, void *rec);
+
+static gint create_index(void *db, gint *columns, gint col_count,
+  gint *include, gint include_count, gint type, gint *matchrec, gint reclen,
+  gint online);
+static gint find_index_lists(void *db, wg_index_header *hdr, gint **ilist);
+static gint link_index(void *db, gint index_id, gint **ilist);
+static gint init_index(void *db, gint index_id);
+static gint *find_building_index(void *db, gint index_id);
+static gint update_building_indexes(void *db, void *rec, gint column,
+  gint add);
+static gint index_uses_column(void *db, wg_index_header *hdr, gint column);
+
 static gint sort_columns(gint *sorted_cols, gint *columns, gint col_count);
+static gint max_index_column(wg_index_header *hdr);
+static gint max_covered_column(wg_index_header *hdr);
 
 static gint show_index_error(void* db, char* errmsg);
 static gint show_index_error_nr(void* db, char* errmsg, gint nr);
@@ -116,8 +305,35 @@ static gint show_index_error_nr(void* db, char* errmsg, gint nr);
  *   on by defining TTREE_CHAINED_NODES. Other alterations described in
  *   the original T* tree paper were not implemented.
  *
+ * - composite T-tree keys: a T-tree index on several columns orders
+ *   the records lexicographically by the columns, in the order they
+ *   were given when creating the index (see TTREE_KEY and TTREE_COMPARE).
+ *
  * - hash index (allows multi-column indexes) (not done yet)
  *
+ * - bitmap index for columns with few distinct values. Records are
+ *   numbered by offset and each value has a compressed bitmap of
+ *   the records (see bitmap_add_row()).
+ *
+ * - trigram index for substring (WG_COND_CONTAINS) queries. Uses the
+ *   bitmap index storage, keyed by the 3-byte substrings of the
+ *   string values (see trigram_add_row()).
+ *
+ * - covering indexes: T-tree and hash indexes may carry copies of
+ *   additional (included) columns. Entries of such an index are special
+ *   records instead of data record offsets (see create_index_entry()),
+ *   so that queries can read the covered fields without touching
+ *   the data records.
+ *
+ * - optimistic T-tree lookups: each index header has a version counter
+ *   that is incremented before and after the tree is modified (like a
+ *   sequence lock). wg_search_ttree_index() (and wg_find_record() for
+ *   the first equal row) reads copies of the nodes without the database
+ *   lock and repeats the search if the version changed. Only immediate
+ *   keys are compared that way. Range searches (find_ttree_bounds() in
+ *   dbquery.c) keep node positions for reading the rows later, so they
+ *   still need the read lock.
+ *
  * Index metainfo:
  * data about indexes in system is stored in dbh->index_control_area_header
  *
@@ -138,6 +354,9 @@ static gint show_index_error_nr(void* db, char* errmsg, gint nr);
  *  In the above example, A is a (hash) index on columns 2 and 5, while B
  *  is an index on column 5.
  *
+ *  index_include_table is arranged the same way, but lists the covering
+ *  indexes by their included columns.
+ *
  * Note: offset to index header struct is also used as an index id.
  */
 
@@ -148,31 +367,32 @@ static gint show_index_error_nr(void* db, char* errmsg, gint nr);
 /**
 *  returns bounding node offset or if no really bounding node exists, then the closest node
 */
-static gint db_find_bounding_tnode(void *db, gint rootoffset, gint key,
-  gint *result, struct wg_tnode *rb_node) {
+static gint db_find_bounding_tnode(void *db, gint index_id, gint rootoffset,
+  gint key, gint *result, struct wg_tnode *rb_node) {
 
   struct wg_tnode * node = (struct wg_tnode *)offsettoptr(db,rootoffset);
+  wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
   /* Original tree search algorithm: compares both bounds of
    * the node to determine immediately if the value falls between them.
    */
 
-  if(WG_COMPARE(db, key, node->current_min) == WG_LESSTHAN) {
+  if(TTREE_COMPARE(db, hdr, key, node->current_min) == WG_LESSTHAN) {
     /* if(key < node->current_max) */
     if(node->left_child_offset != 0)
-      return db_find_bounding_tnode(db, node->left_child_offset,
+      return db_find_bounding_tnode(db, index_id, node->left_child_offset,
         key, result, NULL);
     else {
       *result = DEAD_END_LEFT_NOT_BOUNDING;
       return rootoffset;
     }
-  } else if(WG_COMPARE(db, key, node->current_max) != WG_GREATER) {
+  } else if(TTREE_COMPARE(db, hdr, key, node->current_max) != WG_GREATER) {
     *result = REALLY_BOUNDING_NODE;
     return rootoffset;
   }
   else { /* if(key > node->current_max) */
     if(node->right_child_offset != 0)
-      return db_find_bounding_tnode(db, node->right_child_offset,
+      return db_find_bounding_tnode(db, index_id, node->right_child_offset,
         key, result, NULL);
     else{
       *result = DEAD_END_RIGHT_NOT_BOUNDING;
@@ -206,13 +426,46 @@ static int db_which_branch_causes_overweight(void *db, struct wg_tnode *root){
   }
 }
 
+/** Number of elements in a T-tree subtree
+*  returns 0 for an empty subtree (offset 0).
+*/
+static gint ttree_subtree_count(void *db, gint nodeoffset) {
+  if(!nodeoffset)
+    return 0;
+  return ((struct wg_tnode *) offsettoptr(db, nodeoffset))->subtree_count;
+}
+
+/** Recompute the element count of a node from its children
+*/
+static void ttree_count_node(void *db, struct wg_tnode *node) {
+  node->subtree_count = node->number_of_elements +
+    ttree_subtree_count(db, node->left_child_offset) +
+    ttree_subtree_count(db, node->right_child_offset);
+}
+
+/** Update the element counts from a node up to the root
+*  Called after the elements of the node (or the children of it)
+*  have changed. The counts of the other children on the path
+*  must be valid.
+*/
+static void ttree_update_counts(void *db, gint nodeoffset) {
+  while(nodeoffset) {
+    struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, nodeoffset);
+    ttree_count_node(db, node);
+    nodeoffset = node->parent_offset;
+  }
+}
+
+/** Rotate a T-tree subtree
+*  The element counts of the rotated nodes are recomputed, the count
+*  of the subtree as a whole does not change.
+*/
 static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int overw){
   gint grandparent = root->parent_offset;
   gint initialrootoffset = ptrtooffset(db,root);
   struct wg_tnode *r = NULL;
   struct wg_tnode *g = (struct wg_tnode *)offsettoptr(db,grandparent);
   wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
-  gint column = hdr->rec_field_index[0]; /* always one column for T-tree */
 
   if(overw == LL_CASE){
 
@@ -240,6 +493,8 @@ static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int o
     root->parent_offset = offset_left_child;
     //for later grandparent fix
     r = (struct wg_tnode *)offsettoptr(db,offset_left_child);
+    ttree_count_node(db, root);
+    ttree_count_node(db, r);
 
   }else if(overw == RR_CASE){
 
@@ -265,6 +520,8 @@ static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int o
     root->parent_offset = offset_right_child;
     //for later grandparent fix
     r = (struct wg_tnode *)offsettoptr(db,offset_right_child);
+    ttree_count_node(db, root);
+    ttree_count_node(db, r);
 
   }else if(overw == LR_CASE){
 /*               A                    E
@@ -311,8 +568,8 @@ static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int o
       ee->number_of_elements = bb->number_of_elements;
 
       /* Examine the new leftmost element to find current_min */
-      ee->current_min = wg_get_field(db, (void *)offsettoptr(db,
-        ee->array_of_values[0]), column);
+      ee->current_min = TTREE_KEY(db, hdr, (void *)offsettoptr(db,
+        ee->array_of_values[0]));
 
       bb -> number_of_elements = 1;
       bb -> current_max = bb -> current_min;
@@ -328,6 +585,9 @@ static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int o
     root -> parent_offset = offset_right_grandchild;
     //for later grandparent fix
     r = ee;
+    ttree_count_node(db, bb);
+    ttree_count_node(db, root);
+    ttree_count_node(db, ee);
 
   }else if(overw == RL_CASE){
 
@@ -370,8 +630,8 @@ static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int o
       ee->number_of_elements = bb->number_of_elements;
 
       /* Examine the new rightmost element to find current_max */
-      ee->current_max = wg_get_field(db, (void *)offsettoptr(db,
-        ee->array_of_values[ee->number_of_elements - 1]), column);
+      ee->current_max = TTREE_KEY(db, hdr, (void *)offsettoptr(db,
+        ee->array_of_values[ee->number_of_elements - 1]));
 
       /* Remaining B node array element should sit in slot 0 */
       bb->array_of_values[0] = \
@@ -390,6 +650,9 @@ static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int o
     root -> parent_offset = offset_left_grandchild;
     //for later grandparent fix
     r = ee;
+    ttree_count_node(db, bb);
+    ttree_count_node(db, root);
+    ttree_count_node(db, ee);
 
   } else {
     /* catch an error case (can't really happen) */
@@ -426,7 +689,7 @@ static int db_rotate_ttree(void *db, gint index_id, struct wg_tnode *root, int o
 *  -1 - if error
 */
 static gint ttree_add_row(void *db, gint index_id, void *rec) {
-  gint rootoffset, column;
+  gint rootoffset;
   gint newvalue, boundtype, bnodeoffset, newoffset;
   struct wg_tnode *node;
   wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
@@ -442,13 +705,21 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
     return -1;
   }
 #endif
-  column = hdr->rec_field_index[0]; /* always one column for T-tree */
+  if(hdr->include_count) {
+    /* Covering index stores the entry in place of the row. The keys
+     * of the entry are the same as those of the row. */
+    gint entry = create_index_entry(db, hdr, rec);
+    if(!entry)
+      return -1;
+    rec = offsettoptr(db, entry);
+  }
 
   //extract real value from the row (rec)
-  newvalue = wg_get_field(db, rec, column);
+  newvalue = TTREE_KEY(db, hdr, rec);
 
   //find bounding node for the value
-  bnodeoffset = db_find_bounding_tnode(db, rootoffset, newvalue, &boundtype, NULL);
+  bnodeoffset = db_find_bounding_tnode(db, index_id, rootoffset, newvalue,
+    &boundtype, NULL);
   node = (struct wg_tnode *)offsettoptr(db,bnodeoffset);
   newoffset = 0;//save here the offset of newly created tnode - 0 if no node added into the tree
   //if bounding node exists - follow one algorithm, else the other
@@ -469,8 +740,8 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
          * since here the compare is more expensive than the slot
          * copying.
          */
-        cr = WG_COMPARE(db, wg_get_field(db,
-          (void *)offsettoptr(db,node->array_of_values[i]), column),
+        cr = TTREE_COMPARE(db, hdr, TTREE_KEY(db, hdr,
+          (void *)offsettoptr(db,node->array_of_values[i])),
           newvalue);
 
         if(cr != WG_LESSTHAN) { /* value >= newvalue */
@@ -509,8 +780,8 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
        * do this scan (and sort) in reverse order, compared to the case
        * where array had some space left. */
       for(i=WG_TNODE_ARRAY_SIZE-1; i>0; i--) {
-        cr = WG_COMPARE(db, wg_get_field(db,
-          (void *)offsettoptr(db,node->array_of_values[i]), column),
+        cr = TTREE_COMPARE(db, hdr, TTREE_KEY(db, hdr,
+          (void *)offsettoptr(db,node->array_of_values[i])),
           newvalue);
         if(cr != WG_GREATER) { /* value <= newvalue */
           /* Push remaining values to the left */
@@ -527,8 +798,8 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
       if(i==0) {
         node->current_min = newvalue;
       } else {
-        node->current_min = wg_get_field(db,
-          (void *)offsettoptr(db,node->array_of_values[0]), column);
+        node->current_min = TTREE_KEY(db, hdr,
+          (void *)offsettoptr(db,node->array_of_values[0]));
         /* The scan for the free slot starts from the right and
          * tries to exit as fast as possible. So it's possible that
          * the rightmost slot was changed.
@@ -567,6 +838,7 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
         leaf->current_max = minvalue;
         leaf->current_min = minvalue;
         leaf->number_of_elements = 1;
+        leaf->subtree_count = 1;
         leaf->left_child_offset = 0;
         leaf->right_child_offset = 0;
         leaf->array_of_values[0] = minvaluerowoffset;
@@ -663,6 +935,7 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
       leaf->current_max = newvalue;
       leaf->current_min = newvalue;
       leaf->number_of_elements = 1;
+      leaf->subtree_count = 1;
       leaf->left_child_offset = 0;
       leaf->right_child_offset = 0;
       leaf->array_of_values[0] = ptrtooffset(db,rec);
@@ -708,6 +981,12 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
     }
   }//no bounding node found - algorithm 2
 
+  /* One element was added. The lowest node that changed is either
+   * the new leaf or the node variable (if the minimum was moved out of
+   * the bounding node, the GLB node is below it).
+   */
+  ttree_update_counts(db, newoffset ? newoffset : ptrtooffset(db, node));
+
   //if new node was added to tree - must update child height data in nodes from leaf to root
   //or until find a node with imbalance
   //then determine the bad balance case: LL, LR, RR or RL and execute proper rotation
@@ -751,20 +1030,20 @@ static gint ttree_add_row(void *db, gint index_id, void *rec) {
   return 0;
 }
 
-/**  removes pointer to data row from index tree structure
+/**  finds the slot of a data row in index tree structure
 *
 *  returns:
-*  0 - on success
+*  slot number in the node stored in rnode - on success
 *  -1 - if error, index doesnt exist
 *  -2 - if error, no bounding node for key
 *  -3 - if error, boundig node exists, value not
-*  -4 - if error, tree not in balance
 */
-static gint ttree_remove_row(void *db, gint index_id, void * rec) {
-  int i, found;
-  gint key, rootoffset, column, boundtype, bnodeoffset;
+static gint ttree_find_row(void *db, gint index_id, void *rec,
+  struct wg_tnode **rnode) {
+  int i;
+  gint key, rootoffset, boundtype, bnodeoffset;
   gint rowoffset;
-  struct wg_tnode *node, *parent;
+  struct wg_tnode *node;
   wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
   rootoffset = TTREE_ROOT_NODE(hdr);
@@ -777,8 +1056,7 @@ static gint ttree_remove_row(void *db, gint index_id, void * rec) {
     return -1;
   }
 #endif
-  column = hdr->rec_field_index[0]; /* always one column for T-tree */
-  key = wg_get_field(db, rec, column);
+  key = TTREE_KEY(db, hdr, rec);
   rowoffset = ptrtooffset(db, rec);
 
   /* find bounding node for the value. Since non-unique values
@@ -786,7 +1064,7 @@ static gint ttree_remove_row(void *db, gint index_id, void * rec) {
    * right from there (we *need* the exact row offset).
    */
 
-  bnodeoffset = wg_search_ttree_leftmost(db,
+  bnodeoffset = wg_search_ttree_leftmost(db, index_id,
           rootoffset, key, &boundtype, NULL);
   node = (struct wg_tnode *)offsettoptr(db,bnodeoffset);
 
@@ -797,24 +1075,46 @@ static gint ttree_remove_row(void *db, gint index_id, void * rec) {
    * are many repeated values, so unnecessary deleting should be avoided
    * on higher level.
    */
-  found = -1;
   for(;;) {
     for(i=0;i<node->number_of_elements;i++){
-      if(node->array_of_values[i] == rowoffset) {
-        found = i;
-        goto found_row;
+      if(INDEX_ENTRY_RECORD(db, hdr, node->array_of_values[i]) == rowoffset) {
+        *rnode = node;
+        return i;
       }
     }
     bnodeoffset = TNODE_SUCCESSOR(db, node);
     if(!bnodeoffset)
       break; /* no more successors */
     node = (struct wg_tnode *)offsettoptr(db,bnodeoffset);
-    if(WG_COMPARE(db, node->current_min, key) == WG_GREATER)
+    if(TTREE_COMPARE(db, hdr, node->current_min, key) == WG_GREATER)
       break; /* successor is not a bounding node */
   }
+  return -3;
+}
+
+/**  removes pointer to data row from index tree structure
+*
+*  returns:
+*  0 - on success
+*  -1 - if error, index doesnt exist
+*  -2 - if error, no bounding node for key
+*  -3 - if error, boundig node exists, value not
+*  -4 - if error, tree not in balance
+*/
+static gint ttree_remove_row(void *db, gint index_id, void * rec) {
+  int i;
+  gint found, countoffset;
+  struct wg_tnode *node, *parent;
+  wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
-found_row:
-  if(found == -1) return -3;
+  found = ttree_find_row(db, index_id, rec, &node);
+  if(found < 0) return found;
+
+  if(hdr->include_count) {
+    /* The entry of a covering index is not needed any more */
+    wg_free_object(db, &(dbmemsegh(db)->datarec_area_header),
+      node->array_of_values[found]);
+  }
 
   //delete the key and rearrange other elements
   node->number_of_elements--;
@@ -829,12 +1129,12 @@ found_row:
   if(found==node->number_of_elements && node->number_of_elements != 0) {
     /* Rightmost element was removed, so new max should be updated to
      * the new rightmost value */
-    node->current_max = wg_get_field(db, (void *)offsettoptr(db,
-      node->array_of_values[node->number_of_elements - 1]), column);
+    node->current_max = TTREE_KEY(db, hdr, (void *)offsettoptr(db,
+      node->array_of_values[node->number_of_elements - 1]));
   } else if(found==0 && node->number_of_elements != 0) {
     /* current_min removed, update to new leftmost value */
-    node->current_min = wg_get_field(db, (void *)offsettoptr(db,
-      node->array_of_values[0]), column);
+    node->current_min = TTREE_KEY(db, hdr, (void *)offsettoptr(db,
+      node->array_of_values[0]));
   }
 
   //check underflow and take some actions if needed
@@ -864,8 +1164,8 @@ found_row:
 
       //reset new max for glbnode
       if(glbnode->number_of_elements != 0) {
-        glbnode->current_max = wg_get_field(db, (void *)offsettoptr(db,
-          glbnode->array_of_values[glbnode->number_of_elements - 1]), column);
+        glbnode->current_max = TTREE_KEY(db, hdr, (void *)offsettoptr(db,
+          glbnode->array_of_values[glbnode->number_of_elements - 1]));
       }
 
       node = glbnode;
@@ -876,6 +1176,7 @@ found_row:
   //this is definitely leaf or half-leaf
   //if the node is empty - free it and rebalanc the tree
   parent = NULL;
+  countoffset = ptrtooffset(db, node); /* lowest node with changed count */
   //delete the empty leaf
   if(node->left_child_offset == 0 && node->right_child_offset == 0 && node->number_of_elements == 0){
     if(node->parent_offset != 0){
@@ -908,6 +1209,7 @@ found_row:
 #endif
     /* Free the node, unless it's the root node */
     if(node != offsettoptr(db, TTREE_ROOT_NODE(hdr))) {
+      countoffset = node->parent_offset;
       wg_free_tnode(db, ptrtooffset(db,node));
     } else {
       /* Set empty state of root node */
@@ -996,6 +1298,10 @@ found_row:
     }
   }
 
+  /* Element counts are updated before rotating, the rotations
+   * rely on the counts of the subtrees they move. */
+  ttree_update_counts(db, countoffset);
+
   //check balance and update subtree height data
   //stop when find a node where subtree heights dont change
   if(parent != NULL){
@@ -1029,6 +1335,195 @@ found_row:
   return 0;
 }
 
+/** Mark the start of a modification of an index
+ *  Makes the version of the index odd. Called with the database
+ *  write lock held, so there is only one writer at a time.
+ */
+static void index_write_begin(void *db, wg_index_header *hdr) {
+  hdr->version++;
+  wg_memory_barrier();
+}
+
+/** Mark the end of a modification of an index
+ */
+static void index_write_end(void *db, wg_index_header *hdr) {
+  wg_memory_barrier();
+  hdr->version++;
+}
+
+/** Insert a row into T-tree, updating the index version
+ */
+static gint ttree_versioned_add_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint res;
+
+  index_write_begin(db, hdr);
+  res = ttree_add_row(db, index_id, rec);
+  index_write_end(db, hdr);
+  return res;
+}
+
+/** Remove a row from T-tree, updating the index version
+ */
+static gint ttree_versioned_remove_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint res;
+
+  index_write_begin(db, hdr);
+  res = ttree_remove_row(db, index_id, rec);
+  index_write_end(db, hdr);
+  return res;
+}
+
+/** Copy a T-node for a search
+ *  If the index is read optimistically (version is not -1), the copy
+ *  is only used when the index was not modified while it was made,
+ *  so the search never acts on a node that a writer is changing.
+ *
+ *  returns 0 on success, -1 if the index was modified, -2 if the
+ *  node is not valid although the index was not modified (the
+ *  search must be done under the database lock).
+ */
+static gint ttree_read_node(void *db, wg_index_header *hdr, gint nodeoffset,
+  gint version, struct wg_tnode *node) {
+  if(version == -1) {
+    memcpy(node, offsettoptr(db, nodeoffset), sizeof(struct wg_tnode));
+    return 0;
+  }
+  if(nodeoffset > 0 &&\
+    nodeoffset <= dbmemsegh(db)->size - (gint) sizeof(struct wg_tnode)) {
+    memcpy(node, offsettoptr(db, nodeoffset), sizeof(struct wg_tnode));
+    wg_memory_barrier();
+    if(hdr->version != version)
+      return -1;
+    if(node->number_of_elements >= 0 &&\
+      node->number_of_elements <= WG_TNODE_ARRAY_SIZE)
+      return 0;
+  }
+  wg_memory_barrier();
+  return (hdr->version != version ? -1 : -2);
+}
+
+/** Read the key and the data row of a T-tree element for a search
+ *  Like ttree_read_node(), the values are checked against the version
+ *  of the index before they are used. Only the part of the row up to
+ *  the indexed field is read.
+ *
+ *  returns 0 on success, -1 if the index was modified, -2 if the
+ *  element is not valid although the index was not modified.
+ */
+static gint ttree_read_entry(void *db, wg_index_header *hdr, gint rowoffset,
+  gint version, gint *key, gint *rec) {
+  gint keypos;
+
+  if(version == -1) {
+    *key = TTREE_KEY(db, hdr, offsettoptr(db, rowoffset));
+    *rec = INDEX_ENTRY_RECORD(db, hdr, rowoffset);
+    return 0;
+  }
+  keypos = (RECORD_HEADER_GINTS + hdr->rec_field_index[0]) * sizeof(gint);
+  if(rowoffset <= 0 ||\
+    rowoffset > dbmemsegh(db)->size - keypos - (gint) sizeof(gint)) {
+    wg_memory_barrier();
+    return (hdr->version != version ? -1 : -2);
+  }
+  *key = dbfetch(db, rowoffset + keypos);
+  *rec = INDEX_ENTRY_RECORD(db, hdr, rowoffset);
+  wg_memory_barrier();
+  return (hdr->version != version ? -1 : 0);
+}
+
+/** Search T-tree for the first row with a key
+ *  Same search as wg_search_ttree_leftmost() followed by a scan of
+ *  the bounding node, but iterative and working on copies of the
+ *  nodes (see ttree_read_node()).
+ *
+ *  If version is -1, the index can not change during the search
+ *  (the database lock is held). Otherwise the index is read
+ *  optimistically: every node and key is checked against the version
+ *  before it is used, and only immediate values are compared, because
+ *  the data of other values may be freed by a writer at any time.
+ *
+ *  returns offset to data row, 0 if not found, -1 if the index
+ *  was modified (the result of the search is not valid), -2 if the
+ *  index can not be searched without the database lock.
+ */
+static gint ttree_lookup(void *db, wg_index_header *hdr, gint key,
+  gint version) {
+  gint nodeoffset = TTREE_ROOT_NODE(hdr), lb_offset = 0, entry, rec, err;
+  struct wg_tnode node, lb_node;
+  int i;
+
+  if(version != -1 && hdr->fields != 1)
+    return -2; /* the keys are records */
+  if(!nodeoffset)
+    return 0; /* the index is being dropped */
+
+  /* Find the leftmost bounding node */
+  for(;;) {
+    if((err = ttree_read_node(db, hdr, nodeoffset, version, &node)))
+      return err;
+    if(version != -1 && (!isimmediatedata(node.current_min) ||\
+      !isimmediatedata(node.current_max)))
+      return -2;
+    if(TTREE_COMPARE(db, hdr, key, node.current_max) == WG_GREATER) {
+      if(node.right_child_offset) {
+        nodeoffset = node.right_child_offset;
+        continue;
+      }
+      if(lb_offset && TTREE_COMPARE(db, hdr, key,
+        lb_node.current_min) != WG_LESSTHAN) {
+        node = lb_node;
+        nodeoffset = lb_offset;
+        break;
+      }
+      return 0;
+    }
+    else {
+      if(node.left_child_offset) {
+        lb_node = node;
+        lb_offset = nodeoffset;
+        nodeoffset = node.left_child_offset;
+        continue;
+      }
+      if(TTREE_COMPARE(db, hdr, key, node.current_min) != WG_LESSTHAN)
+        break;
+      return 0;
+    }
+  }
+
+  /* find the record inside the node or its successors */
+  for(;;) {
+    for(i=0;i<node.number_of_elements;i++){
+      if((err = ttree_read_entry(db, hdr, node.array_of_values[i],
+        version, &entry, &rec)))
+        return err;
+      if(version != -1 && !isimmediatedata(entry))
+        return -2;
+      if(TTREE_COMPARE(db, hdr, entry, key) == WG_EQUAL)
+        return rec;
+    }
+#ifdef TTREE_CHAINED_NODES
+    nodeoffset = node.succ_offset;
+#else
+    /* The successor is found by walking the tree */
+    if(version != -1)
+      return -2;
+    nodeoffset = TNODE_SUCCESSOR(db,
+      ((struct wg_tnode *) offsettoptr(db, nodeoffset)));
+#endif
+    if(!nodeoffset)
+      break;
+    if((err = ttree_read_node(db, hdr, nodeoffset, version, &node)))
+      return err;
+    if(version != -1 && !isimmediatedata(node.current_min))
+      return -2;
+    if(TTREE_COMPARE(db, hdr, node.current_min, key) == WG_GREATER)
+      break;
+  }
+  return 0;
+}
+
 
 /* ------------------- T-tree public functions ---------------- */
 
@@ -1037,20 +1532,24 @@ found_row:
 *  -1 - error, index does not exist
 *  0 - if key NOT found
 *  other integer - if key found (= offset to data row)
-*  XXX: with duplicate values, which one is returned is somewhat
-*  undetermined, so this function is mainly for early development/testing
+*  With duplicate values, the first row in the index order is returned.
+*
+*  The search does not need the database lock if the index is on one
+*  column that holds immediate values (NULL, small integers, chars,
+*  fixpoints, dates and times): if a writer modifies the index during
+*  the search, the search is repeated. After TTREE_READ_RETRIES
+*  attempts, or if the index holds other values, the search is done
+*  as under the lock, so a caller that can not rule out concurrent
+*  writers must hold the read lock, as with the other searches.
 */
 gint wg_search_ttree_index(void *db, gint index_id, gint key){
-  int i;
-  gint rootoffset, bnodetype, bnodeoffset;
-  gint rowoffset, column;
-  struct wg_tnode * node;
+  gint version, rowoffset;
+  int retries;
   wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
-  rootoffset = TTREE_ROOT_NODE(hdr);
 #ifdef CHECK
   /* XXX: This is a rather weak check but might catch some errors */
-  if(rootoffset == 0){
+  if(TTREE_ROOT_NODE(hdr) == 0){
 #ifdef WG_NO_ERRPRINT
 #else
     LOG_ERROR(-1, "index at offset %d does not exist\n", (int) index_id);
@@ -1059,36 +1558,104 @@ gint wg_search_ttree_index(void *db, gint index_id, gint key){
   }
 #endif
 
-  /* Find the leftmost bounding node */
-  bnodeoffset = wg_search_ttree_leftmost(db,
-          rootoffset, key, &bnodetype, NULL);
-  node = (struct wg_tnode *)offsettoptr(db,bnodeoffset);
+  for(retries=0;;) {
+    version = wg_index_read_begin(db, index_id);
+    rowoffset = ttree_lookup(db, hdr, key, version);
+    if(rowoffset != -1 && !wg_index_read_retry(db, index_id, version))
+      break;
+    if(++retries >= TTREE_READ_RETRIES) {
+      rowoffset = -2;
+      break;
+    }
+  }
+  if(rowoffset == -2)
+    rowoffset = ttree_lookup(db, hdr, key, -1);
+  return rowoffset;
+}
 
-  if(bnodetype != REALLY_BOUNDING_NODE) return 0;
+/** Start an optimistic read of an index
+ *  Waits until no writer is modifying the index.
+ *  returns the version of the index, to be passed to wg_index_read_retry().
+ */
+gint wg_index_read_begin(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint version;
 
-  column = hdr->rec_field_index[0]; /* always one column for T-tree */
-  /* find the record inside the node. */
-  for(;;) {
-    for(i=0;i<node->number_of_elements;i++){
-      rowoffset = node->array_of_values[i];
-      if(WG_COMPARE(db,
-        wg_get_field(db, (void *)offsettoptr(db,rowoffset), column),
-        key) == WG_EQUAL) {
-        return rowoffset;
-      }
-    }
-    /* Normally we cannot end up here. We'll keep the code in case
-     * implementation of wg_compare() changes in the future.
+  do {
+    version = hdr->version;
+  } while(version & 1);
+  wg_memory_barrier();
+  return version;
+}
+
+/** Check if an optimistic read of an index needs to be repeated
+ *  Anything read from the index since wg_index_read_begin() is only
+ *  valid if this returns 0. The values must also not be used before
+ *  they are checked (see ttree_read_node()), so the searches that
+ *  follow pointers, such as wg_search_ttree_leftmost() and
+ *  wg_search_ttree_rightmost(), still need the database read lock.
+ *  returns 1 if the index was modified, 0 otherwise.
+ */
+gint wg_index_read_retry(void *db, gint index_id, gint version) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+
+  wg_memory_barrier();
+  return (hdr->version != version);
+}
+
+/** Compare two keys of a composite T-tree index
+ *  Keys are offsets to records or search keys with the record layout
+ *  (see wg_init_ttree_key()). Columns are compared in index key order.
+ *  A WG_ILLEGAL column in either key ends the comparison, so a search
+ *  key with only the leading columns set is equal to all the records
+ *  that share that prefix.
+ *
+ *  returns WG_LESSTHAN, WG_EQUAL or WG_GREATER
+ */
+gint wg_compare_ttree_keys(void *db, wg_index_header *hdr, gint a, gint b) {
+  gint i, cr;
+
+  if(a == b)
+    return WG_EQUAL;
+  if(a == WG_ILLEGAL || b == WG_ILLEGAL) {
+    /* Empty root node has WG_ILLEGAL in place of min/max. Compare
+     * the leading column the same way a single column index would.
      */
-    bnodeoffset = TNODE_SUCCESSOR(db, node);
-    if(!bnodeoffset)
-      break; /* no more successors */
-    node = (struct wg_tnode *)offsettoptr(db,bnodeoffset);
-    if(WG_COMPARE(db, node->current_min, key) == WG_GREATER)
-      break; /* successor is not a bounding node */
+    gint col = hdr->rec_field_index[0];
+    return WG_COMPARE(db,
+      (a == WG_ILLEGAL ? WG_ILLEGAL : COMPOSITE_KEY_FIELD(db, a, col)),
+      (b == WG_ILLEGAL ? WG_ILLEGAL : COMPOSITE_KEY_FIELD(db, b, col)));
   }
 
-  return 0;
+  for(i=0; i<hdr->fields; i++) {
+    gint col = hdr->rec_field_index[i];
+    gint va = COMPOSITE_KEY_FIELD(db, a, col);
+    gint vb = COMPOSITE_KEY_FIELD(db, b, col);
+    if(va == WG_ILLEGAL || vb == WG_ILLEGAL)
+      break; /* prefix match */
+    cr = WG_COMPARE(db, va, vb);
+    if(cr != WG_EQUAL)
+      return cr;
+  }
+  return WG_EQUAL;
+}
+
+/** Initialize a search key for a composite T-tree index
+ *  keybuf should have room for TTREE_KEYBUF_SIZE gints. All the
+ *  columns are initially unset; the caller fills in the indexed
+ *  columns (keybuf[RECORD_HEADER_GINTS + column]).
+ *
+ *  returns the key (usable with TTREE_COMPARE() and the T-tree
+ *  search functions).
+ */
+gint wg_init_ttree_key(void *db, gint *keybuf) {
+  int i;
+  keybuf[0] = TTREE_KEYBUF_SIZE * sizeof(gint); /* object size */
+  keybuf[1] = 0;
+  keybuf[2] = 0;
+  for(i=RECORD_HEADER_GINTS; i<TTREE_KEYBUF_SIZE; i++)
+    keybuf[i] = WG_ILLEGAL;
+  return ptrtooffset(db, keybuf);
 }
 
 /*
@@ -1178,10 +1745,11 @@ gint wg_ttree_find_leaf_successor(void *db, gint nodeoffset) {
 /** Find rightmost node containing given value
  *  returns NULL if node was not found
  */
-gint wg_search_ttree_rightmost(void *db, gint rootoffset,
+gint wg_search_ttree_rightmost(void *db, gint index_id, gint rootoffset,
   gint key, gint *result, struct wg_tnode *rb_node) {
 
   struct wg_tnode * node;
+  wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
 #ifdef TTREE_SINGLE_COMPARE
   node = (struct wg_tnode *)offsettoptr(db,rootoffset);
@@ -1191,14 +1759,14 @@ gint wg_search_ttree_rightmost(void *db, gint rootoffset,
    * is selected immediately. If the search ends in a dead end, the node where
    * the right branch was taken is examined again.
    */
-  if(WG_COMPARE(db, key, node->current_min) == WG_LESSTHAN) {
+  if(TTREE_COMPARE(db, hdr, key, node->current_min) == WG_LESSTHAN) {
     /* key < node->current_min */
     if(node->left_child_offset != 0) {
-      return wg_search_ttree_rightmost(db, node->left_child_offset, key,
+      return wg_search_ttree_rightmost(db, index_id, node->left_child_offset, key,
         result, rb_node);
     } else if (rb_node) {
       /* Dead end, but we still have an unexamined node left */
-      if(WG_COMPARE(db, key, rb_node->current_max) != WG_GREATER) {
+      if(TTREE_COMPARE(db, hdr, key, rb_node->current_max) != WG_GREATER) {
         /* key<=rb_node->current_max */
         *result = REALLY_BOUNDING_NODE;
         return ptrtooffset(db, rb_node);
@@ -1214,9 +1782,9 @@ gint wg_search_ttree_rightmost(void *db, gint rootoffset,
        * current_max of the node (therefore avoiding one expensive
        * compare operation).
        */
-      return wg_search_ttree_rightmost(db, node->right_child_offset, key,
+      return wg_search_ttree_rightmost(db, index_id, node->right_child_offset, key,
         result, node);
-    } else if(WG_COMPARE(db, key, node->current_max) != WG_GREATER) {
+    } else if(TTREE_COMPARE(db, hdr, key, node->current_max) != WG_GREATER) {
       /* key<=node->current_max */
       *result = REALLY_BOUNDING_NODE;
       return rootoffset;
@@ -1229,18 +1797,19 @@ gint wg_search_ttree_rightmost(void *db, gint rootoffset,
 #else
   gint bnodeoffset;
 
-  bnodeoffset = db_find_bounding_tnode(db, rootoffset, key, result, NULL);
+  bnodeoffset = db_find_bounding_tnode(db, index_id, rootoffset, key,
+    result, NULL);
   if(*result != REALLY_BOUNDING_NODE)
     return bnodeoffset;
 
   /* There is at least one node with the key we're interested in,
    * now make sure we have the rightmost */
   node = offsettoptr(db, bnodeoffset);
-  while(WG_COMPARE(db, node->current_max, key) == WG_EQUAL) {
+  while(TTREE_COMPARE(db, hdr, node->current_max, key) == WG_EQUAL) {
     gint nextoffset = TNODE_SUCCESSOR(db, node);
     if(nextoffset) {
       struct wg_tnode *next = offsettoptr(db, nextoffset);
-        if(WG_COMPARE(db, next->current_min, key) == WG_GREATER)
+        if(TTREE_COMPARE(db, hdr, next->current_min, key) == WG_GREATER)
           /* next->current_min > key */
           break; /* overshot */
       node = next;
@@ -1255,23 +1824,24 @@ gint wg_search_ttree_rightmost(void *db, gint rootoffset,
 /** Find leftmost node containing given value
  *  returns NULL if node was not found
  */
-gint wg_search_ttree_leftmost(void *db, gint rootoffset,
+gint wg_search_ttree_leftmost(void *db, gint index_id, gint rootoffset,
   gint key, gint *result, struct wg_tnode *lb_node) {
 
   struct wg_tnode * node;
+  wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
 #ifdef TTREE_SINGLE_COMPARE
   node = (struct wg_tnode *)offsettoptr(db,rootoffset);
 
   /* Rightmost bound search mirrored */
-  if(WG_COMPARE(db, key, node->current_max) == WG_GREATER) {
+  if(TTREE_COMPARE(db, hdr, key, node->current_max) == WG_GREATER) {
     /* key > node->current_max */
     if(node->right_child_offset != 0) {
-      return wg_search_ttree_leftmost(db, node->right_child_offset, key,
+      return wg_search_ttree_leftmost(db, index_id, node->right_child_offset, key,
         result, lb_node);
     } else if (lb_node) {
       /* Dead end, but we still have an unexamined node left */
-      if(WG_COMPARE(db, key, lb_node->current_min) != WG_LESSTHAN) {
+      if(TTREE_COMPARE(db, hdr, key, lb_node->current_min) != WG_LESSTHAN) {
         /* key>=lb_node->current_min */
         *result = REALLY_BOUNDING_NODE;
         return ptrtooffset(db, lb_node);
@@ -1282,9 +1852,9 @@ gint wg_search_ttree_leftmost(void *db, gint rootoffset,
   }
   else {
     if(node->left_child_offset != 0) {
-      return wg_search_ttree_leftmost(db, node->left_child_offset, key,
+      return wg_search_ttree_leftmost(db, index_id, node->left_child_offset, key,
         result, node);
-    } else if(WG_COMPARE(db, key, node->current_min) != WG_LESSTHAN) {
+    } else if(TTREE_COMPARE(db, hdr, key, node->current_min) != WG_LESSTHAN) {
       /* key>=node->current_min */
       *result = REALLY_BOUNDING_NODE;
       return rootoffset;
@@ -1295,18 +1865,19 @@ gint wg_search_ttree_leftmost(void *db, gint rootoffset,
 #else
   gint bnodeoffset;
 
-  bnodeoffset = db_find_bounding_tnode(db, rootoffset, key, result, NULL);
+  bnodeoffset = db_find_bounding_tnode(db, index_id, rootoffset, key,
+    result, NULL);
   if(*result != REALLY_BOUNDING_NODE)
     return bnodeoffset;
 
   /* One (we don't know which) bounding node found, traverse the
    * tree to the leftmost. */
   node = offsettoptr(db, bnodeoffset);
-  while(WG_COMPARE(db, node->current_min, key) == WG_EQUAL) {
+  while(TTREE_COMPARE(db, hdr, node->current_min, key) == WG_EQUAL) {
     gint prevoffset = TNODE_PREDECESSOR(db, node);
     if(prevoffset) {
       struct wg_tnode *prev = offsettoptr(db, prevoffset);
-      if(WG_COMPARE(db, prev->current_max, key) == WG_LESSTHAN)
+      if(TTREE_COMPARE(db, hdr, prev->current_max, key) == WG_LESSTHAN)
         /* prev->current_max < key */
         break; /* overshot */
       node = prev;
@@ -1324,16 +1895,17 @@ gint wg_search_ttree_leftmost(void *db, gint rootoffset,
  *  exceeds it is returned.
  */
 gint wg_search_tnode_first(void *db, gint nodeoffset, gint key,
-  gint column) {
+  gint index_id) {
 
   gint i, encoded;
   struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, nodeoffset);
+  wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
   for(i=0; i<node->number_of_elements; i++) {
     /* Naive scan is ok for small values of WG_TNODE_ARRAY_SIZE. */
-    encoded = wg_get_field(db,
-      (void *)offsettoptr(db,node->array_of_values[i]), column);
-    if(WG_COMPARE(db, encoded, key) != WG_LESSTHAN)
+    encoded = TTREE_KEY(db, hdr,
+      (void *)offsettoptr(db,node->array_of_values[i]));
+    if(TTREE_COMPARE(db, hdr, encoded, key) != WG_LESSTHAN)
       /* encoded >= key */
       return i;
   }
@@ -1347,15 +1919,16 @@ gint wg_search_tnode_first(void *db, gint nodeoffset, gint key,
  *  is smaller (when scanning from right to left) is returned.
  */
 gint wg_search_tnode_last(void *db, gint nodeoffset, gint key,
-  gint column) {
+  gint index_id) {
 
   gint i, encoded;
   struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, nodeoffset);
+  wg_index_header *hdr = (wg_index_header *)offsettoptr(db,index_id);
 
   for(i=node->number_of_elements -1; i>=0; i--) {
-    encoded = wg_get_field(db,
-      (void *)offsettoptr(db,node->array_of_values[i]), column);
-    if(WG_COMPARE(db, encoded, key) != WG_GREATER)
+    encoded = TTREE_KEY(db, hdr,
+      (void *)offsettoptr(db,node->array_of_values[i]));
+    if(TTREE_COMPARE(db, hdr, encoded, key) != WG_GREATER)
       /* encoded <= key */
       return i;
   }
@@ -1363,23 +1936,70 @@ gint wg_search_tnode_last(void *db, gint nodeoffset, gint key,
   return -1;
 }
 
-/** Create T-tree index on a column
-*  returns:
-*  0 - on success
-*  -1 - error (failed to create the index)
+/** Find the position of a T-tree element
+ *  The position is counted from the smallest element of the tree,
+ *  using the element counts of the subtrees on the path to the root.
+ *  returns the number of elements that precede the slot of the node.
+ */
+gint wg_ttree_rank(void *db, gint nodeoffset, gint slot) {
+  struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, nodeoffset);
+  gint rank = slot + ttree_subtree_count(db, node->left_child_offset);
+
+  while(node->parent_offset) {
+    struct wg_tnode *parent = \
+      (struct wg_tnode *) offsettoptr(db, node->parent_offset);
+    if(parent->right_child_offset == nodeoffset) {
+      /* The parent and its left subtree precede this subtree */
+      rank += parent->subtree_count - node->subtree_count;
+    }
+    nodeoffset = node->parent_offset;
+    node = parent;
+  }
+  return rank;
+}
+
+/** Find a T-tree element by its position
+ *  This is the reverse of wg_ttree_rank(). The search starts from
+ *  the root node of the tree, the slot of the element is stored
+ *  in *slot.
+ *  returns the offset of the node, 0 if the position is out of range.
+ */
+gint wg_ttree_select(void *db, gint rootoffset, gint pos, gint *slot) {
+  gint nodeoffset = rootoffset;
+
+  if(pos < 0 || pos >= ttree_subtree_count(db, nodeoffset))
+    return 0;
+  while(nodeoffset) {
+    struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, nodeoffset);
+    gint left = ttree_subtree_count(db, node->left_child_offset);
+    if(pos < left) {
+      nodeoffset = node->left_child_offset;
+    } else if(pos < left + node->number_of_elements) {
+      *slot = pos - left;
+      return nodeoffset;
+    } else {
+      pos -= left + node->number_of_elements;
+      nodeoffset = node->right_child_offset;
+    }
+  }
+  return 0; /* counts do not match the tree */
+}
+
+/** Allocate the root node of an empty T-tree index
+*  returns 0 on success, -1 on error.
 */
-static gint create_ttree_index(void *db, gint index_id){
+static gint ttree_init_root(void *db, wg_index_header *hdr){
   gint node;
-  unsigned int rowsprocessed;
   struct wg_tnode *nodest;
-  void *rec;
   db_memsegment_header* dbh = dbmemsegh(db);
-  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
-  gint column = hdr->rec_field_index[0];
 
   /* allocate (+ init) root node for new index tree and save
    * the offset into index_array */
   node = wg_alloc_fixlen_object(db, &dbh->tnode_area_header);
+  if(!node) {
+    show_index_error(db, "Failed to allocate T-tree root node");
+    return -1;
+  }
   nodest =(struct wg_tnode *)offsettoptr(db,node);
   nodest->parent_offset = 0;
   nodest->left_subtree_height = 0;
@@ -1387,6 +2007,7 @@ static gint create_ttree_index(void *db, gint index_id){
   nodest->current_max = WG_ILLEGAL;
   nodest->current_min = WG_ILLEGAL;
   nodest->number_of_elements = 0;
+  nodest->subtree_count = 0;
   nodest->left_child_offset = 0;
   nodest->right_child_offset = 0;
 #ifdef TTREE_CHAINED_NODES
@@ -1399,6 +2020,22 @@ static gint create_ttree_index(void *db, gint index_id){
   TTREE_MIN_NODE(hdr) = node;
   TTREE_MAX_NODE(hdr) = node;
 #endif
+  return 0;
+}
+
+/** Create T-tree index on a column
+*  returns:
+*  0 - on success
+*  -1 - error (failed to create the index)
+*/
+static gint create_ttree_index(void *db, gint index_id){
+  unsigned int rowsprocessed;
+  void *rec;
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint column = max_index_column(hdr);
+
+  if(ttree_init_root(db, hdr))
+    return -1;
 
   //scan all the data - make entry for every suitable row
   rec = wg_get_first_record(db);
@@ -1418,7 +2055,7 @@ static gint create_ttree_index(void *db, gint index_id){
 #ifdef WG_NO_ERRPRINT
 #else
   LOG_ERROR(0, "new index created on rec field %d into slot %d and %d data rows inserted\n",
-    (int) column, (int) index_id, rowsprocessed);
+    (int) hdr->rec_field_index[0], (int) index_id, rowsprocessed);
 #endif
 
   return 0;
@@ -1436,6 +2073,11 @@ static gint drop_ttree_index(void *db, gint index_id){
 
   hdr = (wg_index_header *) offsettoptr(db, index_id);
 
+  /* Optimistic readers must not follow the freed nodes. The tree is
+   * emptied inside the version update, so a search that is repeated
+   * finds nothing. */
+  index_write_begin(db, hdr);
+
   /* Free the T-node memory. This is trivial for chained nodes, since
    * once we've found a successor for a node it can be deleted and
    * forgotten about. For plain T-tree this does not work since tree
@@ -1450,6 +2092,12 @@ static gint drop_ttree_index(void *db, gint index_id){
     node = (struct wg_tnode *) offsettoptr(db, TTREE_ROOT_NODE(hdr));
   while(node) {
     gint deleteme = ptrtooffset(db, node);
+    if(hdr->include_count) {
+      int i;
+      for(i=0; i<node->number_of_elements; i++)
+        wg_free_object(db, &(dbmemsegh(db)->datarec_area_header),
+          node->array_of_values[i]);
+    }
     if(node->succ_offset)
       node = (struct wg_tnode *) offsettoptr(db, node->succ_offset);
     else
@@ -1460,6 +2108,12 @@ static gint drop_ttree_index(void *db, gint index_id){
   /* XXX: not implemented */
   show_index_error(db, "Warning: T-node memory cannot be deallocated");
 #endif
+  TTREE_ROOT_NODE(hdr) = 0;
+#ifdef TTREE_CHAINED_NODES
+  TTREE_MIN_NODE(hdr) = 0;
+  TTREE_MAX_NODE(hdr) = 0;
+#endif
+  index_write_end(db, hdr);
 
   return 0;
 }
@@ -1479,6 +2133,13 @@ static gint hash_add_row(void *db, gint index_id, void *rec) {
   for(i=0; i<hdr->fields; i++) {
     values[i] = wg_get_field(db, rec, hdr->rec_field_index[i]);
   }
+  if(hdr->include_count) {
+    /* Covering index stores the entry in place of the row */
+    gint entry = create_index_entry(db, hdr, rec);
+    if(!entry)
+      return -1;
+    rec = offsettoptr(db, entry);
+  }
   return hash_recurse(db, hdr, NULL, 0, values, hdr->fields, rec,
     HASHIDX_OP_STORE, (hdr->type == WG_INDEX_TYPE_HASH_JSON));
 }
@@ -1496,6 +2157,16 @@ static gint hash_remove_row(void *db, gint index_id, void *rec) {
   for(i=0; i<hdr->fields; i++) {
     values[i] = wg_get_field(db, rec, hdr->rec_field_index[i]);
   }
+  if(hdr->include_count) {
+    gint entry = find_index_entry(db, index_id, rec);
+    gint retv;
+    if(entry < 1)
+      return -1;
+    retv = hash_recurse(db, hdr, NULL, 0, values, hdr->fields,
+      offsettoptr(db, entry), HASHIDX_OP_REMOVE, 0);
+    wg_free_object(db, &(dbmemsegh(db)->datarec_area_header), entry);
+    return retv;
+  }
   return hash_recurse(db, hdr, NULL, 0, values, hdr->fields, rec,
     HASHIDX_OP_REMOVE, (hdr->type == WG_INDEX_TYPE_HASH_JSON));
 }
@@ -1684,11 +2355,14 @@ static gint drop_hash_index(void *db, gint index_id){
 
 /**
  *  Search the hash index for given values.
+ *  For a JSON path index, the values are the keys of the path
+ *  followed by the value (see path_index_value()).
  *
  *  returns offset to data row:
  *  -1 - error
  *  0 - if key NOT found
  *  >0 - offset to the linked list that contains the row offsets
+ *  (entry offsets in case of a covering index, see INDEX_ENTRY_RECORD)
  */
 gint wg_search_hash(void *db, gint index_id, gint *values, gint count) {
   wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
@@ -1696,9 +2370,15 @@ gint wg_search_hash(void *db, gint index_id, gint *values, gint count) {
   gint type = wg_get_index_type(db, index_id); /* also validates the id */
   if(type < 0)
     return type;
-  if(type != WG_INDEX_TYPE_HASH && type != WG_INDEX_TYPE_HASH_JSON)
+  if(type != WG_INDEX_TYPE_HASH && type != WG_INDEX_TYPE_HASH_JSON &&\
+    type != WG_INDEX_TYPE_HASH_PATH)
     return show_index_error(db, "wg_search_hash: Not a hash index");
-  if(hdr->fields != count) {
+  if(type == WG_INDEX_TYPE_HASH_PATH) {
+    if(count < 2 || count > PATH_INDEX_MAX_KEYS + 1) {
+      show_index_error(db, "Invalid path length");
+      return -1;
+    }
+  } else if(hdr->fields != count) {
     show_index_error(db, "Number of indexed fields does not match");
     return -1;
   }
@@ -1708,37 +2388,1813 @@ gint wg_search_hash(void *db, gint index_id, gint *values, gint count) {
 }
 
 
-/* ----------------- Index template functions -------------- */
+/* -------------- JSON path index private functions ------------- */
 
-/** Insert into list
+/*
+ * JSON path index maps the values in JSON documents to the documents
+ * that contain them. The key of an entry is the path of object keys
+ * leading to a value, followed by the value, hashed like the fields of
+ * a multi-column hash index. The entries refer to the top-level records
+ * of the documents, so the documents are found without following the
+ * backlinks. A value is entered under every suffix of its path, so
+ * that a key can be looked up without knowing its depth in the
+ * document: {"a":{"b":1}} has the entries (b, 1) and (a, b, 1).
  *
- * helper function to insert list elements. Takes address of
- * a variable containing an offset to the first element (that
- * offset may be 0 for empty lists or when appending).
+ * Arrays do not add to the path. The values of an array are entered
+ * under the key of the array, like in the JSON hash index, but the
+ * values of the arrays nested in it are not. Objects are followed at
+ * any depth that wg_find_document() can reach back from.
+ *
+ * The index is not in the column lists, as the documents do not have
+ * fixed columns. When a path index exists, wg_set_field() and
+ * wg_delete_record() call the wg_path_index_*() functions for all
+ * records instead. A change updates the entries below the changed
+ * field. For a nested record, the keys leading to it are collected by
+ * following the backlinks up to the document. If a record on the way
+ * has several parents, the path is ambiguous and the whole document is
+ * removed and re-entered instead.
  */
-static gint insert_into_list(void *db, gint *head, gint value) {
-  db_memsegment_header* dbh = dbmemsegh(db);
-  gint old = *head;
 
-  *head = wg_alloc_fixlen_object(db, &dbh->listcell_area_header);
-  if(*head) {
-    gcell *listelem = (gcell *) offsettoptr(db, *head);
-    listelem->car = value;
-    listelem->cdr = old;
+/** Add or remove the index entries of a value
+ *  path holds the depth keys leading to the value and has room for
+ *  the value. nesting is the number of arrays between the last key
+ *  and the value. levels is the number of record levels that may still
+ *  be visited.
+ *  returns 0 on success, -1 on error.
+ */
+static gint path_index_value(void *db, wg_index_header *hdr, gint enc,
+  gint *path, gint depth, gint nesting, gint levels, void *doc, gint op)
+{
+  gint i, reclen;
+  void *rec;
+
+  if(wg_get_encoded_type(db, enc) != WG_RECORDTYPE) {
+    if(!depth || nesting > 1)
+      return 0;
+    path[depth] = enc;
+    for(i=0; i<depth; i++) {
+      if(hash_recurse(db, hdr, NULL, 0, &path[i], depth - i + 1,
+        doc, op, 0))
+        return -1;
+    }
+    return 0;
   }
-  return *head;
+
+  if(levels < 1)
+    return 0;
+  rec = wg_decode_record(db, enc);
+  if(!is_schema_array(rec) && !is_schema_object(rec))
+    return 0; /* a link to a plain record is not a part of the document */
+  reclen = wg_get_record_len(db, rec);
+  for(i=0; i<reclen; i++) {
+    if(path_index_field(db, hdr, rec, i, path, depth, nesting,
+      levels - 1, doc, op))
+      return -1;
+  }
+  return 0;
 }
 
-/** Delete from list
- *
- * helper function to delete list elements. Deletes the current
- * element.
+/** Add or remove the index entries of a field of an array or object
+ *  returns 0 on success, -1 on error.
  */
-static void delete_from_list(void *db, gint *head) {
-  db_memsegment_header* dbh = dbmemsegh(db);
-  gcell *listelem = (gcell *) offsettoptr(db, *head);
+static gint path_index_field(void *db, wg_index_header *hdr, void *rec,
+  gint column, gint *path, gint depth, gint nesting, gint levels,
+  void *doc, gint op)
+{
+  gint enc = wg_get_field(db, rec, column);
 
-  *head = listelem->cdr;
+  if(is_schema_object(rec)) {
+    /* Object fields are links to key-value pairs */
+    void *kv;
+    if(levels < 1 || depth >= PATH_INDEX_MAX_KEYS ||\
+      wg_get_encoded_type(db, enc) != WG_RECORDTYPE)
+      return 0;
+    kv = wg_decode_record(db, enc);
+    if(wg_get_record_len(db, kv) <= WG_SCHEMA_VALUE_OFFSET)
+      return 0;
+    path[depth] = wg_get_field(db, kv, WG_SCHEMA_KEY_OFFSET);
+    return path_index_value(db, hdr,
+      wg_get_field(db, kv, WG_SCHEMA_VALUE_OFFSET),
+      path, depth + 1, 0, levels - 1, doc, op);
+  }
+  return path_index_value(db, hdr, enc, path, depth, nesting + 1,
+    levels, doc, op);
+}
+
+/** Add or remove the index entries of one field of a document
+ *  If column is -1, all the fields are processed.
+ *  returns 0 on success, -1 on error.
+ */
+static gint path_index_doc(void *db, gint index_id, void *doc, gint column,
+  gint op)
+{
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint path[PATH_INDEX_MAX_KEYS + 1];
+  gint i, reclen;
+
+  if(column >= 0) {
+    return path_index_field(db, hdr, doc, column, path, 0, 0,
+      WG_COMPARE_REC_DEPTH - 1, doc, op);
+  }
+  reclen = wg_get_record_len(db, doc);
+  for(i=0; i<reclen; i++) {
+    if(path_index_field(db, hdr, doc, i, path, 0, 0,
+      WG_COMPARE_REC_DEPTH - 1, doc, op))
+      return -1;
+  }
+  return 0;
+}
+
+#ifdef USE_BACKLINKING
+/** Get the parent of a record inside a document
+ *  returns NULL if the record does not have exactly one parent.
+ */
+static void *path_index_parent(void *db, void *rec) {
+  gint iter, parent = wg_first_backlink(db, (gint *) rec, &iter);
+  if(!parent || wg_next_backlink(db, (gint *) rec, &iter))
+    return NULL;
+  return offsettoptr(db, parent);
+}
+
+/** Find the position of a nested record in its document
+ *  Sets *doc and the path, depth, nesting and levels that
+ *  path_index_field() gets for the fields of *rec when the whole
+ *  document is indexed. A key-value pair is replaced by its object
+ *  and *column by the position of the pair in the object.
+ *  returns 1 if the field is indexed, 0 if it is not and -1 if the
+ *  record is not reached through single parents.
+ */
+static gint path_index_locate(void *db, void **rec, gint *column, void **doc,
+  gint *path, gint *depth, gint *nesting, gint *levels)
+{
+  void *chain[WG_COMPARE_REC_DEPTH];
+  void *parent;
+  gint i, n, reclen, enc;
+
+  if(!is_schema_array(*rec) && !is_schema_object(*rec)) {
+    parent = path_index_parent(db, *rec);
+    if(!parent)
+      return -1;
+    if(!is_schema_object(parent))
+      return 0; /* a link to a plain record is not a part of the document */
+    enc = wg_encode_record(db, *rec);
+    reclen = wg_get_record_len(db, parent);
+    for(i=0; i<reclen && wg_get_field(db, parent, i) != enc; i++);
+    if(i == reclen)
+      return -1;
+    *rec = parent;
+    *column = i;
+  }
+
+  /* Collect the records up to the document, which is found within the
+   * same depth as in wg_find_document() */
+  chain[0] = *rec;
+  n = 1;
+  while(!is_schema_document(chain[n-1])) {
+    if(n >= WG_COMPARE_REC_DEPTH)
+      return 0;
+    parent = path_index_parent(db, chain[n-1]);
+    if(!parent)
+      return -1;
+    chain[n++] = parent;
+  }
+  *doc = chain[n-1];
+  if(is_special_record(*doc))
+    return 0;
+
+  /* Descend like path_index_field() and path_index_value() */
+  *depth = 0;
+  *nesting = 0;
+  *levels = WG_COMPARE_REC_DEPTH - 1;
+  for(i=n-1; i>0; i--) {
+    if(is_schema_object(chain[i])) {
+      /* The child is a key-value pair, followed by its value */
+      void *kv = chain[i-1];
+      if(i < 2 || wg_get_record_len(db, kv) <= WG_SCHEMA_VALUE_OFFSET ||\
+        wg_get_field(db, kv, WG_SCHEMA_VALUE_OFFSET) !=\
+        wg_encode_record(db, chain[i-2]))
+        return -1;
+      if(*levels < 2 || *depth >= PATH_INDEX_MAX_KEYS ||\
+        (!is_schema_array(chain[i-2]) && !is_schema_object(chain[i-2])))
+        return 0;
+      path[(*depth)++] = wg_get_field(db, kv, WG_SCHEMA_KEY_OFFSET);
+      *nesting = 0;
+      *levels -= 2;
+      i--;
+    } else {
+      if(*levels < 1 || !is_schema_array(chain[i]) ||\
+        (!is_schema_array(chain[i-1]) && !is_schema_object(chain[i-1])))
+        return 0;
+      (*nesting)++;
+      (*levels)--;
+    }
+  }
+  return 1;
+}
+#endif
+
+/** Update the JSON path indexes for a field of a record
+ *  If column is -1, all the fields of the document are processed.
+ *  returns 0 on success, -2 on error.
+ */
+static gint path_index_update(void *db, void *rec, gint column, gint op) {
+  gint *ilist = &dbmemsegh(db)->index_control_area_header.index_path_list;
+  gint path[PATH_INDEX_MAX_KEYS + 1];
+  gint depth = 0, nesting = 0, levels = WG_COMPARE_REC_DEPTH - 1;
+  void *doc = rec;
+
+  if(!is_schema_document(rec)) {
+#ifdef USE_BACKLINKING
+    gint found;
+    if(!*((gint *) rec + RECORD_BACKLINKS_POS))
+      return 0; /* not (yet) a part of a document */
+    found = path_index_locate(db, &rec, &column, &doc, path, &depth,
+      &nesting, &levels);
+    if(!found)
+      return 0;
+    if(found < 0) {
+      doc = wg_find_document(db, rec);
+      if(!doc || is_special_record(doc))
+        return 0;
+      rec = doc;
+      column = -1; /* the paths below the document are not known */
+    }
+#else
+    return 0;
+#endif
+  }
+
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(column < 0) {
+      if(path_index_doc(db, ilistelem->car, doc, -1, op))
+        return -2;
+    } else if(path_index_field(db,
+      (wg_index_header *) offsettoptr(db, ilistelem->car), rec, column,
+      path, depth, nesting, levels, doc, op)) {
+      return -2;
+    }
+    ilist = &ilistelem->cdr;
+  }
+  return 0;
+}
+
+/** Create a JSON path index
+ *  The index is kept in the master list and the path index list, but
+ *  not in the column lists.
+ *  returns the index id on success, -1 on error.
+ */
+static gint create_path_index(void *db, gint *columns, gint col_count,
+  gint include_count, gint *matchrec, gint online)
+{
+#ifndef USE_BACKLINKING
+  show_index_error(db, "JSON path index requires backlinks");
+  return -1;
+#else
+  gint index_id;
+  unsigned int docsprocessed;
+  void *rec;
+  wg_index_header *hdr;
+  db_memsegment_header* dbh = dbmemsegh(db);
+
+  if(col_count != 1 || columns[0] != 0) {
+    show_index_error(db, "JSON path index must be created on column 0");
+    return -1;
+  }
+  if(include_count || matchrec || online) {
+    show_index_error(db, "JSON path index does not support templates, "\
+      "included columns or online build");
+    return -1;
+  }
+  if(dbh->index_control_area_header.index_path_list) {
+    show_index_error(db, "JSON path index already exists");
+    return -1;
+  }
+
+  index_id = wg_alloc_fixlen_object(db, &dbh->indexhdr_area_header);
+  if(!index_id) {
+    show_index_error(db, "Failed to allocate index header");
+    return -1;
+  }
+  hdr = (wg_index_header *) offsettoptr(db, index_id);
+  hdr->type = WG_INDEX_TYPE_HASH_PATH;
+  hdr->fields = 1;
+  hdr->rec_field_index[0] = 0;
+  hdr->include_count = 0;
+  hdr->template_offset = 0;
+  hdr->version = 0;
+  hdr->build_cursor = 0;
+  memset(&hdr->stats, 0, sizeof(struct __wg_index_stats));
+
+  if(wg_create_hash(db, HASHIDX_ARRAYP(hdr), 0))
+    return -1;
+
+  /* Add existing documents */
+  rec = wg_get_first_record(db);
+  docsprocessed = 0;
+  while(rec != NULL) {
+    if(is_schema_document(rec) && !is_special_record(rec)) {
+      if(path_index_doc(db, index_id, rec, -1, HASHIDX_OP_STORE))
+        return -1;
+      docsprocessed++;
+    }
+    rec = wg_get_next_record(db, rec);
+  }
+
+  if(!insert_into_list(db,
+    &dbh->index_control_area_header.index_list, index_id))
+    return -1;
+  if(!insert_into_list(db,
+    &dbh->index_control_area_header.index_path_list, index_id))
+    return -1;
+  dbh->index_control_area_header.number_of_indexes++;
+  dbh->index_control_area_header.index_epoch++;
+
+#ifdef WG_NO_ERRPRINT
+#else
+  fprintf(stderr, "new JSON path index created into slot %d"\
+    " and %d documents inserted\n", (int) index_id, docsprocessed);
+#endif
+  return index_id;
+#endif
+}
+
+/* -------------- JSON path index public functions -------------- */
+
+/** Add the entries of a field to the JSON path indexes
+ *  Called by wg_set_field() after the field is written, if there are
+ *  path indexes.
+ *  returns 0 on success, -2 on error.
+ */
+gint wg_path_index_add_field(void *db, void *rec, gint column) {
+  return path_index_update(db, rec, column, HASHIDX_OP_STORE);
+}
+
+/** Remove the entries of a field from the JSON path indexes
+ *  Called by wg_set_field() before the field is written.
+ *  returns 0 on success, -2 on error.
+ */
+gint wg_path_index_del_field(void *db, void *rec, gint column) {
+  return path_index_update(db, rec, column, HASHIDX_OP_REMOVE);
+}
+
+/** Remove the entries of a deleted document from the JSON path indexes
+ *  The records inside documents have backlinks, so they cannot
+ *  be deleted and need no handling here.
+ *  returns 0 on success, -2 on error.
+ */
+gint wg_path_index_del_rec(void *db, void *rec) {
+  if(!is_schema_document(rec))
+    return 0;
+  return path_index_update(db, rec, -1, HASHIDX_OP_REMOVE);
+}
+
+
+/* -------------- Bitmap index private functions ------------- */
+
+/*
+ * Bitmap index stores a directory of the distinct values of the
+ * column, sorted by WG_COMPARE(). Each value refers to the set of
+ * records having that value, stored as a compressed bitmap: the
+ * record numbers are split into chunks (see BITMAP_RECORD_NR()) and
+ * each chunk is either a sorted array of 16-bit positions (up to
+ * BITMAP_ARRAY_MAX records) or a plain bitmap. This is the
+ * container scheme of Roaring bitmaps (Chambi et al '16).
+ *
+ * All objects are allocated from the index hash area. The first gint
+ * of an object is the allocator header.
+ *
+ *  value directory: | hdr | count | capacity | (value, set) ... |
+ *  record set:      | hdr | count | capacity | records |
+ *                     (key, records, container) ... |
+ *  array container: | hdr | capacity | unsigned short ... |
+ *  bitmap container:| hdr | wg_uint ... |
+ */
+
+/** Resize a bitmap index object
+ *  Contents are copied and the old object is freed.
+ *  returns the offset of the new object, 0 on error.
+ */
+static gint bitmap_resize(void *db, gint offset, gint oldsize,
+  gint newsize) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint newoffset = wg_alloc_gints(db, &(dbh->indexhash_area_header),
+    newsize);
+
+  if(!newoffset) {
+    show_index_error(db, "Failed to allocate bitmap index storage");
+    return 0;
+  }
+  memcpy((gint *) offsettoptr(db, newoffset) + 1,
+    (gint *) offsettoptr(db, offset) + 1,
+    ((oldsize < newsize ? oldsize : newsize) - 1) * sizeof(gint));
+  wg_free_object(db, &(dbh->indexhash_area_header), offset);
+  return newoffset;
+}
+
+/** Find a value in the value directory.
+ *  returns the position of the value. If the value is not present,
+ *  returns -(insert position)-1.
+ */
+static gint bitmap_find_value(void *db, gint *dir, gint value) {
+  gint *pairs = dir + BITMAP_DIR_HEADER_SIZE;
+  gint lo = 0, hi = dir[BITMAP_DIR_COUNT_POS] - 1;
+
+  while(lo <= hi) {
+    gint mid = (lo + hi) / 2;
+    gint cr = WG_COMPARE(db, pairs[2*mid], value);
+    if(cr == WG_EQUAL)
+      return mid;
+    else if(cr == WG_LESSTHAN)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -lo - 1;
+}
+
+/** Find a chunk in a record set.
+ *  returns the position of the chunk or -(insert position)-1.
+ */
+static gint bitmap_find_chunk(gint *set, gint key) {
+  gint *chunks = set + BITMAP_SET_HEADER_SIZE;
+  gint lo = 0, hi = set[BITMAP_SET_COUNT_POS] - 1;
+
+  while(lo <= hi) {
+    gint mid = (lo + hi) / 2;
+    gint k = chunks[BITMAP_CHUNK_SIZE_GINTS*mid + BITMAP_CHUNK_KEY_POS];
+    if(k == key)
+      return mid;
+    else if(k < key)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -lo - 1;
+}
+
+/** Find a position in an array container.
+ *  returns the index in the array or -(insert position)-1.
+ */
+static gint bitmap_find_array(unsigned short *arr, gint count, gint low) {
+  gint lo = 0, hi = count - 1;
+
+  while(lo <= hi) {
+    gint mid = (lo + hi) / 2;
+    if(arr[mid] == low)
+      return mid;
+    else if(arr[mid] < low)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -lo - 1;
+}
+
+/** Add a position to a chunk.
+ *  chunk points to the (key, records, container) triple of the set.
+ *  returns 1 if the position was added, 0 if it was already present,
+ *  -1 on error.
+ */
+static gint bitmap_chunk_add(void *db, gint *chunk, gint low) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint card = chunk[BITMAP_CHUNK_CARD_POS];
+  gint *cont = (gint *) offsettoptr(db, chunk[BITMAP_CHUNK_DATA_POS]);
+
+  if(card > BITMAP_ARRAY_MAX) {
+    wg_uint *words = (wg_uint *) (cont + BITMAP_BITS_HEADER_SIZE);
+    if(BITMAP_TEST_BIT(words, low))
+      return 0;
+    BITMAP_SET_BIT(words, low);
+  } else {
+    unsigned short *arr = (unsigned short *) \
+      (cont + BITMAP_ARRAY_HEADER_SIZE);
+    gint pos = bitmap_find_array(arr, card, low);
+
+    if(pos >= 0)
+      return 0;
+    pos = -pos - 1;
+
+    if(card == BITMAP_ARRAY_MAX) {
+      /* Array is full, convert it to a bitmap container */
+      gint i, newcont;
+      wg_uint *words;
+
+      newcont = wg_alloc_gints(db, &(dbh->indexhash_area_header),
+        BITMAP_BITS_SIZE);
+      if(!newcont)
+        return show_index_error(db, "Failed to allocate bitmap container");
+      words = (wg_uint *) ((gint *) offsettoptr(db, newcont) +\
+        BITMAP_BITS_HEADER_SIZE);
+      memset(words, 0, BITMAP_CHUNK_WORDS * sizeof(wg_uint));
+      for(i=0; i<card; i++)
+        BITMAP_SET_BIT(words, arr[i]);
+      BITMAP_SET_BIT(words, low);
+      wg_free_object(db, &(dbh->indexhash_area_header),
+        chunk[BITMAP_CHUNK_DATA_POS]);
+      chunk[BITMAP_CHUNK_DATA_POS] = newcont;
+    } else {
+      if(card == cont[BITMAP_ARRAY_CAP_POS]) {
+        gint newcap = 2 * card, newcont;
+        if(newcap > BITMAP_ARRAY_MAX)
+          newcap = BITMAP_ARRAY_MAX;
+        newcont = bitmap_resize(db, chunk[BITMAP_CHUNK_DATA_POS],
+          BITMAP_ARRAY_SIZE(card), BITMAP_ARRAY_SIZE(newcap));
+        if(!newcont)
+          return -1;
+        chunk[BITMAP_CHUNK_DATA_POS] = newcont;
+        cont = (gint *) offsettoptr(db, newcont);
+        cont[BITMAP_ARRAY_CAP_POS] = newcap;
+        arr = (unsigned short *) (cont + BITMAP_ARRAY_HEADER_SIZE);
+      }
+      memmove(arr + pos + 1, arr + pos,
+        (card - pos) * sizeof(unsigned short));
+      arr[pos] = (unsigned short) low;
+    }
+  }
+
+  chunk[BITMAP_CHUNK_CARD_POS]++;
+  return 1;
+}
+
+/** Remove a position from a chunk.
+ *  If the chunk becomes empty, the container is freed.
+ *  returns 1 if the position was removed, 0 if it was not present,
+ *  -1 on error.
+ */
+static gint bitmap_chunk_remove(void *db, gint *chunk, gint low) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint card = chunk[BITMAP_CHUNK_CARD_POS];
+  gint *cont = (gint *) offsettoptr(db, chunk[BITMAP_CHUNK_DATA_POS]);
+
+  if(card > BITMAP_ARRAY_MAX) {
+    wg_uint *words = (wg_uint *) (cont + BITMAP_BITS_HEADER_SIZE);
+    if(!BITMAP_TEST_BIT(words, low))
+      return 0;
+
+    if(card - 1 == BITMAP_ARRAY_MAX) {
+      /* Sparse enough again, convert to an array container */
+      gint i, j = 0, newcont;
+      gint *newp;
+      unsigned short *arr;
+
+      newcont = wg_alloc_gints(db, &(dbh->indexhash_area_header),
+        BITMAP_ARRAY_SIZE(BITMAP_ARRAY_MAX));
+      if(!newcont)
+        return show_index_error(db, "Failed to allocate array container");
+      newp = (gint *) offsettoptr(db, newcont);
+      newp[BITMAP_ARRAY_CAP_POS] = BITMAP_ARRAY_MAX;
+      arr = (unsigned short *) (newp + BITMAP_ARRAY_HEADER_SIZE);
+      BITMAP_CLEAR_BIT(words, low);
+      for(i=0; i<(gint) BITMAP_CHUNK_WORDS; i++) {
+        wg_uint w = words[i];
+        gint b = i * BITMAP_WORD_BITS;
+        for(; w; w >>= 1, b++) {
+          if(w & 1)
+            arr[j++] = (unsigned short) b;
+        }
+      }
+      wg_free_object(db, &(dbh->indexhash_area_header),
+        chunk[BITMAP_CHUNK_DATA_POS]);
+      chunk[BITMAP_CHUNK_DATA_POS] = newcont;
+    } else {
+      BITMAP_CLEAR_BIT(words, low);
+    }
+  } else {
+    unsigned short *arr = (unsigned short *) \
+      (cont + BITMAP_ARRAY_HEADER_SIZE);
+    gint pos = bitmap_find_array(arr, card, low);
+
+    if(pos < 0)
+      return 0;
+    memmove(arr + pos, arr + pos + 1,
+      (card - pos - 1) * sizeof(unsigned short));
+  }
+
+  if(!(--chunk[BITMAP_CHUNK_CARD_POS])) {
+    wg_free_object(db, &(dbh->indexhash_area_header),
+      chunk[BITMAP_CHUNK_DATA_POS]);
+    chunk[BITMAP_CHUNK_DATA_POS] = 0;
+  }
+  return 1;
+}
+
+/** Create an empty record set.
+ *  returns offset to the set, 0 on error.
+ */
+static gint bitmap_new_set(void *db) {
+  gint *set, offset;
+
+  offset = wg_alloc_gints(db, &(dbmemsegh(db)->indexhash_area_header),
+    BITMAP_SET_SIZE(BITMAP_MIN_CAPACITY));
+  if(!offset) {
+    show_index_error(db, "Failed to allocate bitmap index record set");
+    return 0;
+  }
+  set = (gint *) offsettoptr(db, offset);
+  set[BITMAP_SET_COUNT_POS] = 0;
+  set[BITMAP_SET_CAP_POS] = BITMAP_MIN_CAPACITY;
+  set[BITMAP_SET_CARD_POS] = 0;
+  return offset;
+}
+
+/** Add a record to a record set.
+ *  setp points to the offset of the set, it is updated if the
+ *  set is moved.
+ *  returns 0 on success, -1 on error.
+ */
+static gint bitmap_set_add(void *db, gint *setp, gint recnr) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint key = recnr >> BITMAP_CHUNK_BITS;
+  gint low = recnr & (BITMAP_CHUNK_SIZE - 1);
+  gint *set = (gint *) offsettoptr(db, *setp);
+  gint pos = bitmap_find_chunk(set, key);
+  gint *chunk, res;
+
+  if(pos < 0) {
+    gint count = set[BITMAP_SET_COUNT_POS], cont;
+    gint *chunks;
+
+    /* New chunk starts with a small array container */
+    pos = -pos - 1;
+    cont = wg_alloc_gints(db, &(dbh->indexhash_area_header),
+      BITMAP_ARRAY_SIZE(BITMAP_MIN_CAPACITY));
+    if(!cont)
+      return show_index_error(db, "Failed to allocate array container");
+    ((gint *) offsettoptr(db, cont))[BITMAP_ARRAY_CAP_POS] = \
+      BITMAP_MIN_CAPACITY;
+
+    if(count == set[BITMAP_SET_CAP_POS]) {
+      gint newset = bitmap_resize(db, *setp, BITMAP_SET_SIZE(count),
+        BITMAP_SET_SIZE(2*count));
+      if(!newset) {
+        wg_free_object(db, &(dbh->indexhash_area_header), cont);
+        return -1;
+      }
+      *setp = newset;
+      set = (gint *) offsettoptr(db, newset);
+      set[BITMAP_SET_CAP_POS] = 2*count;
+    }
+
+    chunks = set + BITMAP_SET_HEADER_SIZE;
+    memmove(chunks + BITMAP_CHUNK_SIZE_GINTS*(pos+1),
+      chunks + BITMAP_CHUNK_SIZE_GINTS*pos,
+      BITMAP_CHUNK_SIZE_GINTS*(count-pos)*sizeof(gint));
+    chunk = chunks + BITMAP_CHUNK_SIZE_GINTS*pos;
+    chunk[BITMAP_CHUNK_KEY_POS] = key;
+    chunk[BITMAP_CHUNK_CARD_POS] = 0;
+    chunk[BITMAP_CHUNK_DATA_POS] = cont;
+    set[BITMAP_SET_COUNT_POS]++;
+  }
+  else {
+    chunk = set + BITMAP_SET_HEADER_SIZE + BITMAP_CHUNK_SIZE_GINTS*pos;
+  }
+
+  res = bitmap_chunk_add(db, chunk, low);
+  if(res < 0)
+    return -1;
+  set[BITMAP_SET_CARD_POS] += res;
+  return 0;
+}
+
+/** Remove a record from a record set.
+ *  returns 0 on success, -1 if the record was not found.
+ */
+static gint bitmap_set_remove(void *db, gint *set, gint recnr) {
+  gint key = recnr >> BITMAP_CHUNK_BITS;
+  gint low = recnr & (BITMAP_CHUNK_SIZE - 1);
+  gint pos = bitmap_find_chunk(set, key);
+  gint *chunk;
+
+  if(pos < 0)
+    return -1;
+  chunk = set + BITMAP_SET_HEADER_SIZE + BITMAP_CHUNK_SIZE_GINTS*pos;
+  if(bitmap_chunk_remove(db, chunk, low) < 1)
+    return -1;
+  set[BITMAP_SET_CARD_POS]--;
+
+  if(!chunk[BITMAP_CHUNK_CARD_POS]) {
+    /* Container was freed, remove the chunk from the set */
+    memmove(chunk, chunk + BITMAP_CHUNK_SIZE_GINTS,
+      BITMAP_CHUNK_SIZE_GINTS*(set[BITMAP_SET_COUNT_POS]-pos-1)*\
+      sizeof(gint));
+    set[BITMAP_SET_COUNT_POS]--;
+  }
+  return 0;
+}
+
+/** Return the offset of the first record in a (non-empty) set.
+ */
+static gint bitmap_set_first(void *db, gint *set) {
+  gint *chunk = set + BITMAP_SET_HEADER_SIZE;
+  gint *cont = (gint *) offsettoptr(db, chunk[BITMAP_CHUNK_DATA_POS]);
+  gint low = 0;
+
+  if(chunk[BITMAP_CHUNK_CARD_POS] > BITMAP_ARRAY_MAX) {
+    wg_uint *words = (wg_uint *) (cont + BITMAP_BITS_HEADER_SIZE);
+    while(!BITMAP_TEST_BIT(words, low))
+      low++;
+  } else {
+    low = ((unsigned short *) (cont + BITMAP_ARRAY_HEADER_SIZE))[0];
+  }
+  return BITMAP_RECORD_OFFSET(chunk[BITMAP_CHUNK_KEY_POS], low);
+}
+
+/** Free a record set and its containers.
+ */
+static void bitmap_free_set(void *db, gint offset) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint *set = (gint *) offsettoptr(db, offset);
+  gint *chunks = set + BITMAP_SET_HEADER_SIZE;
+  gint i;
+
+  for(i=0; i<set[BITMAP_SET_COUNT_POS]; i++) {
+    wg_free_object(db, &(dbh->indexhash_area_header),
+      chunks[BITMAP_CHUNK_SIZE_GINTS*i + BITMAP_CHUNK_DATA_POS]);
+  }
+  wg_free_object(db, &(dbh->indexhash_area_header), offset);
+}
+
+/** Add a record to the set of a value.
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint bitmap_add_value(void *db, wg_index_header *hdr, gint value,
+  gint offset) {
+  gint *dir, *pairs, pos;
+
+#ifdef CHECK
+  if(offset & 7)
+    return show_index_error(db, "Record offset not aligned for bitmap index");
+#endif
+
+  dir = (gint *) offsettoptr(db, BITMAP_VALUE_DIR(hdr));
+  pos = bitmap_find_value(db, dir, value);
+  if(pos < 0) {
+    gint count = dir[BITMAP_DIR_COUNT_POS], set;
+
+    /* New distinct value */
+    pos = -pos - 1;
+    set = bitmap_new_set(db);
+    if(!set)
+      return -1;
+    if(count == dir[BITMAP_DIR_CAP_POS]) {
+      gint newdir = bitmap_resize(db, BITMAP_VALUE_DIR(hdr),
+        BITMAP_DIR_SIZE(count), BITMAP_DIR_SIZE(2*count));
+      if(!newdir) {
+        wg_free_object(db, &(dbmemsegh(db)->indexhash_area_header), set);
+        return -1;
+      }
+      BITMAP_VALUE_DIR(hdr) = newdir;
+      dir = (gint *) offsettoptr(db, newdir);
+      dir[BITMAP_DIR_CAP_POS] = 2*count;
+    }
+    pairs = dir + BITMAP_DIR_HEADER_SIZE;
+    memmove(pairs + 2*(pos+1), pairs + 2*pos,
+      2*(count-pos)*sizeof(gint));
+    pairs[2*pos] = value;
+    pairs[2*pos+1] = set;
+    dir[BITMAP_DIR_COUNT_POS]++;
+  }
+  else {
+    pairs = dir + BITMAP_DIR_HEADER_SIZE;
+  }
+
+  return bitmap_set_add(db, &pairs[2*pos+1], BITMAP_RECORD_NR(offset));
+}
+
+/** Remove a record from the set of a value.
+ *  The value is removed when the set becomes empty.
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint bitmap_remove_value(void *db, wg_index_header *hdr, gint value,
+  gint offset) {
+  gint *dir = (gint *) offsettoptr(db, BITMAP_VALUE_DIR(hdr));
+  gint *pair, *set, pos;
+
+  pos = bitmap_find_value(db, dir, value);
+  if(pos < 0)
+    return show_index_error(db, "bitmap_remove_value: value not found");
+  pair = dir + BITMAP_DIR_HEADER_SIZE + 2*pos;
+  set = (gint *) offsettoptr(db, pair[1]);
+
+  if(bitmap_set_remove(db, set, BITMAP_RECORD_NR(offset)))
+    return show_index_error(db, "bitmap_remove_value: record not found");
+
+  if(!set[BITMAP_SET_CARD_POS]) {
+    /* Last record with this value, remove the value */
+    bitmap_free_set(db, pair[1]);
+    memmove(pair, pair + 2,
+      2*(dir[BITMAP_DIR_COUNT_POS]-pos-1)*sizeof(gint));
+    dir[BITMAP_DIR_COUNT_POS]--;
+  }
+  return 0;
+}
+
+/** Create an empty value directory for a bitmap or trigram index.
+ *  returns 0 on success, -1 on error.
+ */
+static gint bitmap_init_dir(void *db, wg_index_header *hdr) {
+  gint dir = wg_alloc_gints(db, &(dbmemsegh(db)->indexhash_area_header),
+    BITMAP_DIR_SIZE(BITMAP_MIN_CAPACITY));
+
+  if(!dir) {
+    show_index_error(db, "Failed to allocate bitmap index directory");
+    return -1;
+  }
+  ((gint *) offsettoptr(db, dir))[BITMAP_DIR_COUNT_POS] = 0;
+  ((gint *) offsettoptr(db, dir))[BITMAP_DIR_CAP_POS] = BITMAP_MIN_CAPACITY;
+  BITMAP_VALUE_DIR(hdr) = dir;
+  return 0;
+}
+
+/** Add a data row to the bitmap index
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint bitmap_add_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  return bitmap_add_value(db, hdr,
+    wg_get_field(db, rec, hdr->rec_field_index[0]), ptrtooffset(db, rec));
+}
+
+/** Remove a data row from the bitmap index
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint bitmap_remove_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint column = hdr->rec_field_index[0];
+  gint value = wg_get_field(db, rec, column);
+  gint *dir, pos;
+
+  if(bitmap_remove_value(db, hdr, value, ptrtooffset(db, rec)))
+    return -1;
+
+  dir = (gint *) offsettoptr(db, BITMAP_VALUE_DIR(hdr));
+  pos = bitmap_find_value(db, dir, value);
+  if(pos >= 0) {
+    gint *pair = dir + BITMAP_DIR_HEADER_SIZE + 2*pos;
+    if(pair[0] == value) {
+      /* The directory may refer to the data of the removed field,
+       * which is about to be freed. Use the field of another
+       * record in the set instead. */
+      pair[0] = wg_get_field(db, offsettoptr(db,
+        bitmap_set_first(db, (gint *) offsettoptr(db, pair[1]))), column);
+    }
+  }
+  return 0;
+}
+
+/*
+ * Create bitmap index.
+ * Returns 0 on success
+ * Returns -1 on failure.
+ */
+static gint create_bitmap_index(void *db, gint index_id) {
+  unsigned int rowsprocessed;
+  void *rec;
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint column = hdr->rec_field_index[0];
+
+  if(bitmap_init_dir(db, hdr))
+    return -1;
+
+  /* Add existing records */
+  rec = wg_get_first_record(db);
+  rowsprocessed = 0;
+
+  while(rec != NULL) {
+    if(column < wg_get_record_len(db, rec) && MATCH_TEMPLATE(db, hdr, rec)) {
+      if(bitmap_add_row(db, index_id, rec))
+        return -1;
+      rowsprocessed++;
+    }
+    rec = wg_get_next_record(db, rec);
+  }
+#ifdef WG_NO_ERRPRINT
+#else
+  fprintf(stderr,"new bitmap index created on column %d into slot %d"\
+    " and %d data rows inserted\n",
+    (int) column, (int) index_id, rowsprocessed);
+#endif
+  return 0;
+}
+
+/** Drop a bitmap index by id
+ *  returns:
+ *  0 - on success
+ *  -1 - error
+ */
+static gint drop_bitmap_index(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint *dir = (gint *) offsettoptr(db, BITMAP_VALUE_DIR(hdr));
+  gint i;
+
+  for(i=0; i<dir[BITMAP_DIR_COUNT_POS]; i++) {
+    bitmap_free_set(db, dir[BITMAP_DIR_HEADER_SIZE + 2*i + 1]);
+  }
+  wg_free_object(db, &(dbmemsegh(db)->indexhash_area_header),
+    BITMAP_VALUE_DIR(hdr));
+  BITMAP_VALUE_DIR(hdr) = 0;
+  return 0;
+}
+
+/* -------------- Bitmap index public functions -------------- */
+
+/** Return the number of distinct values in a bitmap index.
+ */
+gint wg_bitmap_value_count(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  return ((gint *) offsettoptr(db, BITMAP_VALUE_DIR(hdr)))\
+    [BITMAP_DIR_COUNT_POS];
+}
+
+/** Return the i-th distinct value of a bitmap index.
+ *  The values are in the order of WG_COMPARE(). *set is set to the
+ *  offset of the set of records having this value.
+ */
+gint wg_bitmap_value(void *db, gint index_id, gint i, gint *set) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint *pairs = (gint *) offsettoptr(db, BITMAP_VALUE_DIR(hdr)) +\
+    BITMAP_DIR_HEADER_SIZE;
+  *set = pairs[2*i+1];
+  return pairs[2*i];
+}
+
+/** Return the number of records in a record set.
+ */
+gint wg_bitmap_set_card(void *db, gint set) {
+  return ((gint *) offsettoptr(db, set))[BITMAP_SET_CARD_POS];
+}
+
+/** Return the number of (non-empty) chunks in a record set.
+ */
+gint wg_bitmap_chunk_count(void *db, gint set) {
+  return ((gint *) offsettoptr(db, set))[BITMAP_SET_COUNT_POS];
+}
+
+/** Return the key of the i-th chunk in a record set.
+ *  Keys are in ascending order.
+ */
+gint wg_bitmap_chunk_key(void *db, gint set, gint i) {
+  return ((gint *) offsettoptr(db, set))[BITMAP_SET_HEADER_SIZE +\
+    BITMAP_CHUNK_SIZE_GINTS*i + BITMAP_CHUNK_KEY_POS];
+}
+
+/** OR the chunk of a record set into a bitmap.
+ *  words is an array of BITMAP_CHUNK_WORDS, bit n of the array
+ *  marks the record BITMAP_RECORD_OFFSET(key, n).
+ *  returns 1 if the set had records in that chunk, 0 otherwise.
+ */
+gint wg_bitmap_or_chunk(void *db, gint set, gint key, wg_uint *words) {
+  gint *setp = (gint *) offsettoptr(db, set);
+  gint pos = bitmap_find_chunk(setp, key);
+  gint *chunk, *cont, card, i;
+
+  if(pos < 0)
+    return 0;
+  chunk = setp + BITMAP_SET_HEADER_SIZE + BITMAP_CHUNK_SIZE_GINTS*pos;
+  cont = (gint *) offsettoptr(db, chunk[BITMAP_CHUNK_DATA_POS]);
+  card = chunk[BITMAP_CHUNK_CARD_POS];
+
+  if(card > BITMAP_ARRAY_MAX) {
+    wg_uint *src = (wg_uint *) (cont + BITMAP_BITS_HEADER_SIZE);
+    for(i=0; i<(gint) BITMAP_CHUNK_WORDS; i++)
+      words[i] |= src[i];
+  } else {
+    unsigned short *arr = (unsigned short *) \
+      (cont + BITMAP_ARRAY_HEADER_SIZE);
+    for(i=0; i<card; i++)
+      BITMAP_SET_BIT(words, arr[i]);
+  }
+  return 1;
+}
+
+/** Find the record set of a value in a bitmap or trigram index.
+ *  returns the offset of the set, 0 if the value is not present.
+ */
+gint wg_bitmap_find_set(void *db, gint index_id, gint value) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint *dir = (gint *) offsettoptr(db, BITMAP_VALUE_DIR(hdr));
+  gint pos = bitmap_find_value(db, dir, value);
+
+  if(pos < 0)
+    return 0;
+  return dir[BITMAP_DIR_HEADER_SIZE + 2*pos + 1];
+}
+
+/* -------------- Trigram index private functions ------------- */
+
+/*
+ * Trigram index maps the 3-byte substrings of string values to the
+ * records that contain them. It uses the storage of the bitmap index,
+ * with the trigrams (encoded as integers) in place of the field values,
+ * so that the record sets of several trigrams can be intersected.
+ * Strings shorter than 3 bytes have no trigrams and are not indexed.
+ */
+
+static int compare_trigrams(const void *a, const void *b) {
+  gint x = *((gint *) a), y = *((gint *) b);
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/** Add a data row to the trigram index
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint trigram_add_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint *keys, count, i, retv = 0;
+
+  count = wg_trigram_keys(db,
+    wg_get_field(db, rec, hdr->rec_field_index[0]), &keys);
+  if(count < 0)
+    return -1;
+  for(i=0; i<count; i++) {
+    if(bitmap_add_value(db, hdr, keys[i], ptrtooffset(db, rec))) {
+      retv = -1;
+      break;
+    }
+  }
+  if(count)
+    free(keys);
+  return retv;
+}
+
+/** Remove a data row from the trigram index
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint trigram_remove_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint *keys, count, i, retv = 0;
+
+  count = wg_trigram_keys(db,
+    wg_get_field(db, rec, hdr->rec_field_index[0]), &keys);
+  if(count < 0)
+    return -1;
+  for(i=0; i<count; i++) {
+    if(bitmap_remove_value(db, hdr, keys[i], ptrtooffset(db, rec)))
+      retv = -1;
+  }
+  if(count)
+    free(keys);
+  return retv;
+}
+
+/*
+ * Create trigram index.
+ * Returns 0 on success
+ * Returns -1 on failure.
+ */
+static gint create_trigram_index(void *db, gint index_id) {
+  unsigned int rowsprocessed;
+  void *rec;
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint column = hdr->rec_field_index[0];
+
+  if(bitmap_init_dir(db, hdr))
+    return -1;
+
+  /* Add existing records */
+  rec = wg_get_first_record(db);
+  rowsprocessed = 0;
+
+  while(rec != NULL) {
+    if(column < wg_get_record_len(db, rec) && MATCH_TEMPLATE(db, hdr, rec)) {
+      if(trigram_add_row(db, index_id, rec))
+        return -1;
+      rowsprocessed++;
+    }
+    rec = wg_get_next_record(db, rec);
+  }
+#ifdef WG_NO_ERRPRINT
+#else
+  fprintf(stderr,"new trigram index created on column %d into slot %d"\
+    " and %d data rows inserted\n",
+    (int) column, (int) index_id, rowsprocessed);
+#endif
+  return 0;
+}
+
+/* -------------- Trigram index public functions -------------- */
+
+/** Get the trigrams of a string value.
+ *  *keys is set to a newly allocated array of the distinct trigrams,
+ *  in ascending order, encoded as integers. The trigram index
+ *  uses these as the keys.
+ *  returns the number of trigrams (0 if the value is not a string
+ *  or is shorter than 3 bytes; *keys is not allocated in that case)
+ *  returns -1 on error.
+ */
+gint wg_trigram_keys(void *db, gint enc, gint **keys) {
+  unsigned char *str;
+  gint len, count, i, j;
+
+  if(wg_get_encoded_type(db, enc) != WG_STRTYPE)
+    return 0;
+  str = (unsigned char *) wg_decode_str(db, enc);
+  if(!str)
+    return 0;
+  len = strlen((char *) str);
+  if(len < 3)
+    return 0;
+
+  count = len - 2;
+  *keys = (gint *) malloc(count * sizeof(gint));
+  if(!(*keys)) {
+    show_index_error(db, "Failed to allocate memory");
+    return -1;
+  }
+  for(i=0; i<count; i++) {
+    (*keys)[i] = (str[i] << 16) | (str[i+1] << 8) | str[i+2];
+  }
+  qsort(*keys, count, sizeof(gint), compare_trigrams);
+
+  /* Drop the duplicates and encode */
+  for(i=0, j=0; i<count; i++) {
+    if(!j || (*keys)[i] != (*keys)[j-1])
+      (*keys)[j++] = (*keys)[i];
+  }
+  for(i=0; i<j; i++) {
+    (*keys)[i] = wg_encode_int(db, (*keys)[i]);
+  }
+  return j;
+}
+
+/* -------------- R-tree index private functions ------------- */
+
+/*
+ * R-tree index (Guttman '84) over one or more numeric columns. Each
+ * row is a point with one coordinate per indexed column, taken from
+ * an integer, double or fixpoint field (see wg_rtree_coord()). Rows
+ * that have other values in any of the indexed columns are not
+ * in the index.
+ *
+ * Nodes are allocated from the index hash area. An entry holds the
+ * offset of a child node (the record offset in leaf nodes) and the
+ * bounding box of the child as doubles, lower corner first.
+ *
+ *  node:  | hdr | count | level | (child, box) ... |
+ *
+ * Leaves are on level 0. The existing rows are bulk loaded with the
+ * Sort-Tile-Recursive method (Leutenegger et al '97) when the index
+ * is created. Later rows are inserted one by one and a full node is
+ * split in half along the axis where its entries are spread the most.
+ * Empty nodes are removed, but the tree is not rebalanced on deletes.
+ */
+
+/** Get the bounding box of an entry */
+static void rtree_get_box(gint *entry, gint dims, double *box) {
+  memcpy(box, entry + 1, 2*dims*sizeof(double));
+}
+
+/** Set the bounding box of an entry */
+static void rtree_set_box(gint *entry, gint dims, double *box) {
+  memcpy(entry + 1, box, 2*dims*sizeof(double));
+}
+
+/** Extend a bounding box to include another one */
+static void rtree_extend_box(double *box, double *other, gint dims) {
+  gint i;
+  for(i=0; i<dims; i++) {
+    if(other[i] < box[i])
+      box[i] = other[i];
+    if(other[dims+i] > box[dims+i])
+      box[dims+i] = other[dims+i];
+  }
+}
+
+/** Check if two bounding boxes intersect
+ *  returns 1 if they do, 0 otherwise.
+ */
+static gint rtree_overlaps(double *box, double *other, gint dims) {
+  gint i;
+  for(i=0; i<dims; i++) {
+    if(other[dims+i] < box[i] || other[i] > box[dims+i])
+      return 0;
+  }
+  return 1;
+}
+
+/** Compute the bounding box of all the entries in a node
+ *  The node should not be empty.
+ */
+static void rtree_node_box(gint *node, gint dims, double *box) {
+  double ebox[2*MAX_INDEX_FIELDS];
+  gint i;
+
+  rtree_get_box(RTREE_ENTRY(node, 0, dims), dims, box);
+  for(i=1; i<node[RTREE_NODE_COUNT_POS]; i++) {
+    rtree_get_box(RTREE_ENTRY(node, i, dims), dims, ebox);
+    rtree_extend_box(box, ebox, dims);
+  }
+}
+
+/** Allocate an empty R-tree node
+ *  returns the offset of the node, 0 on error.
+ */
+static gint rtree_new_node(void *db, gint dims, gint level) {
+  gint offset = wg_alloc_gints(db, &(dbmemsegh(db)->indexhash_area_header),
+    RTREE_NODE_SIZE(dims));
+  gint *node;
+
+  if(!offset) {
+    show_index_error(db, "Failed to allocate R-tree node");
+    return 0;
+  }
+  node = (gint *) offsettoptr(db, offset);
+  node[RTREE_NODE_COUNT_POS] = 0;
+  node[RTREE_NODE_LEVEL_POS] = level;
+  return offset;
+}
+
+/** Get the point of a row
+ *  returns 0 if the row has numeric values in all the columns
+ *  returns -1 if the row does not belong to the index
+ */
+static gint rtree_row_point(void *db, wg_index_header *hdr, void *rec,
+  double *box) {
+  gint i;
+  for(i=0; i<hdr->fields; i++) {
+    if(wg_rtree_coord(db, wg_get_field(db, rec, hdr->rec_field_index[i]),
+      &box[i]))
+      return -1;
+    box[hdr->fields + i] = box[i];
+  }
+  return 0;
+}
+
+/** Split a full node
+ *  The entries of the node and the new entry are sorted by the
+ *  centers of their boxes along the axis where the centers are spread
+ *  the most. The upper half is moved to a new node.
+ *  returns 0 on success, -1 on error. *split is set to the new node.
+ */
+static gint rtree_split_node(void *db, gint dims, gint nodeoffset,
+  gint child, double *box, gint *split) {
+  gint buf[(RTREE_MAX_ENTRIES+1)*RTREE_ENTRY_SIZE(MAX_INDEX_FIELDS)];
+  gint order[RTREE_MAX_ENTRIES+1];
+  double center[RTREE_MAX_ENTRIES+1];
+  double ebox[2*MAX_INDEX_FIELDS];
+  gint *node = (gint *) offsettoptr(db, nodeoffset);
+  gint *sibling;
+  gint esize = RTREE_ENTRY_SIZE(dims);
+  gint i, j, axis = 0, keep;
+  double spread = -1.0;
+
+  *split = rtree_new_node(db, dims, node[RTREE_NODE_LEVEL_POS]);
+  if(!(*split))
+    return -1;
+  sibling = (gint *) offsettoptr(db, *split);
+
+  memcpy(buf, RTREE_ENTRY(node, 0, dims),
+    RTREE_MAX_ENTRIES*esize*sizeof(gint));
+  buf[RTREE_MAX_ENTRIES*esize] = child;
+  rtree_set_box(buf + RTREE_MAX_ENTRIES*esize, dims, box);
+
+  for(i=0; i<dims; i++) {
+    double lo = 0, hi = 0;
+    for(j=0; j<=RTREE_MAX_ENTRIES; j++) {
+      double c;
+      rtree_get_box(buf + j*esize, dims, ebox);
+      c = (ebox[i] + ebox[dims+i]) / 2;
+      if(!j || c < lo)
+        lo = c;
+      if(!j || c > hi)
+        hi = c;
+    }
+    if(hi - lo > spread) {
+      spread = hi - lo;
+      axis = i;
+    }
+  }
+
+  /* Insertion sort is good enough for a single node */
+  for(i=0; i<=RTREE_MAX_ENTRIES; i++) {
+    double c;
+    rtree_get_box(buf + i*esize, dims, ebox);
+    c = (ebox[axis] + ebox[dims+axis]) / 2;
+    for(j=i; j>0 && center[j-1] > c; j--) {
+      center[j] = center[j-1];
+      order[j] = order[j-1];
+    }
+    center[j] = c;
+    order[j] = i;
+  }
+
+  keep = (RTREE_MAX_ENTRIES+1)/2;
+  for(i=0; i<keep; i++) {
+    memcpy(RTREE_ENTRY(node, i, dims), buf + order[i]*esize,
+      esize*sizeof(gint));
+  }
+  for(; i<=RTREE_MAX_ENTRIES; i++) {
+    memcpy(RTREE_ENTRY(sibling, i-keep, dims), buf + order[i]*esize,
+      esize*sizeof(gint));
+  }
+  node[RTREE_NODE_COUNT_POS] = keep;
+  sibling[RTREE_NODE_COUNT_POS] = RTREE_MAX_ENTRIES+1-keep;
+  return 0;
+}
+
+/** Add an entry to a node
+ *  returns 0 on success, -1 on error. If the node was split,
+ *  *split is set to the new node, otherwise it is 0.
+ */
+static gint rtree_add_entry(void *db, gint dims, gint nodeoffset,
+  gint child, double *box, gint *split) {
+  gint *node = (gint *) offsettoptr(db, nodeoffset);
+  gint *entry;
+
+  *split = 0;
+  if(node[RTREE_NODE_COUNT_POS] == RTREE_MAX_ENTRIES)
+    return rtree_split_node(db, dims, nodeoffset, child, box, split);
+
+  entry = RTREE_ENTRY(node, node[RTREE_NODE_COUNT_POS], dims);
+  entry[0] = child;
+  rtree_set_box(entry, dims, box);
+  node[RTREE_NODE_COUNT_POS]++;
+  return 0;
+}
+
+/** Insert a record into a subtree
+ *  The child whose box needs the least enlargement is followed
+ *  (ties are resolved by the smaller margin of the enlarged box).
+ *  returns 0 on success, -1 on error. If the node was split,
+ *  *split is set to the new node, otherwise it is 0.
+ */
+static gint rtree_insert(void *db, gint dims, gint nodeoffset,
+  gint offset, double *box, gint *split) {
+  double ebox[2*MAX_INDEX_FIELDS];
+  gint *node = (gint *) offsettoptr(db, nodeoffset);
+  gint *entry;
+  gint i, k, best = 0, newnode;
+  double best_area = 0, best_margin = 0;
+
+  if(!node[RTREE_NODE_LEVEL_POS])
+    return rtree_add_entry(db, dims, nodeoffset, offset, box, split);
+
+  for(i=0; i<node[RTREE_NODE_COUNT_POS]; i++) {
+    double area = 1, oldarea = 1, margin = 0;
+    rtree_get_box(RTREE_ENTRY(node, i, dims), dims, ebox);
+    for(k=0; k<dims; k++)
+      oldarea *= ebox[dims+k] - ebox[k];
+    rtree_extend_box(ebox, box, dims);
+    for(k=0; k<dims; k++) {
+      area *= ebox[dims+k] - ebox[k];
+      margin += ebox[dims+k] - ebox[k];
+    }
+    area -= oldarea;
+    if(!i || area < best_area ||\
+      (area == best_area && margin < best_margin)) {
+      best = i;
+      best_area = area;
+      best_margin = margin;
+    }
+  }
+
+  entry = RTREE_ENTRY(node, best, dims);
+  if(rtree_insert(db, dims, entry[0], offset, box, &newnode))
+    return -1;
+
+  if(newnode) {
+    /* Child was split, both halves need new boxes */
+    rtree_node_box((gint *) offsettoptr(db, entry[0]), dims, ebox);
+    rtree_set_box(entry, dims, ebox);
+    rtree_node_box((gint *) offsettoptr(db, newnode), dims, ebox);
+    return rtree_add_entry(db, dims, nodeoffset, newnode, ebox, split);
+  }
+
+  rtree_get_box(entry, dims, ebox);
+  rtree_extend_box(ebox, box, dims);
+  rtree_set_box(entry, dims, ebox);
+  *split = 0;
+  return 0;
+}
+
+/** Remove a record from a subtree
+ *  Only the children whose boxes contain the point of the record
+ *  are searched. Children that become empty are freed.
+ *  returns 1 if the record was removed, 0 if it was not found.
+ */
+static gint rtree_remove(void *db, gint dims, gint nodeoffset,
+  gint offset, double *box) {
+  double ebox[2*MAX_INDEX_FIELDS];
+  gint *node = (gint *) offsettoptr(db, nodeoffset);
+  gint i;
+
+  for(i=0; i<node[RTREE_NODE_COUNT_POS]; i++) {
+    gint *entry = RTREE_ENTRY(node, i, dims);
+    gint removed = 0;
+
+    if(!node[RTREE_NODE_LEVEL_POS]) {
+      removed = (entry[0] == offset);
+    }
+    else {
+      rtree_get_box(entry, dims, ebox);
+      if(!rtree_overlaps(ebox, box, dims) ||\
+        !rtree_remove(db, dims, entry[0], offset, box))
+        continue;
+      if(((gint *) offsettoptr(db, entry[0]))[RTREE_NODE_COUNT_POS]) {
+        rtree_node_box((gint *) offsettoptr(db, entry[0]), dims, ebox);
+        rtree_set_box(entry, dims, ebox);
+        return 1;
+      }
+      /* Child became empty */
+      wg_free_object(db, &(dbmemsegh(db)->indexhash_area_header),
+        entry[0]);
+      removed = 1;
+    }
+
+    if(removed) {
+      memmove(entry, RTREE_ENTRY(node, i+1, dims),
+        (node[RTREE_NODE_COUNT_POS]-i-1)*RTREE_ENTRY_SIZE(dims)*sizeof(gint));
+      node[RTREE_NODE_COUNT_POS]--;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Collect the records in a subtree that are inside a box
+ *  returns 0 on success, -1 on error.
+ */
+static gint rtree_search(void *db, gint dims, gint nodeoffset,
+  double *box, gint **offsets, gint *count, gint *size) {
+  double ebox[2*MAX_INDEX_FIELDS];
+  gint *node = (gint *) offsettoptr(db, nodeoffset);
+  gint i;
+
+  for(i=0; i<node[RTREE_NODE_COUNT_POS]; i++) {
+    gint *entry = RTREE_ENTRY(node, i, dims);
+
+    rtree_get_box(entry, dims, ebox);
+    if(!rtree_overlaps(ebox, box, dims))
+      continue;
+    if(node[RTREE_NODE_LEVEL_POS]) {
+      if(rtree_search(db, dims, entry[0], box, offsets, count, size))
+        return -1;
+    }
+    else {
+      if(*count == *size) {
+        gint *tmp = (gint *) realloc(*offsets, 2*(*size)*sizeof(gint));
+        if(!tmp) {
+          show_index_error(db, "Failed to allocate memory");
+          return -1;
+        }
+        *offsets = tmp;
+        *size *= 2;
+      }
+      (*offsets)[(*count)++] = entry[0];
+    }
+  }
+  return 0;
+}
+
+/** Free the nodes of a subtree */
+static void rtree_free_nodes(void *db, gint dims, gint nodeoffset) {
+  gint *node = (gint *) offsettoptr(db, nodeoffset);
+  gint i;
+
+  if(node[RTREE_NODE_LEVEL_POS]) {
+    for(i=0; i<node[RTREE_NODE_COUNT_POS]; i++)
+      rtree_free_nodes(db, dims, RTREE_ENTRY(node, i, dims)[0]);
+  }
+  wg_free_object(db, &(dbmemsegh(db)->indexhash_area_header), nodeoffset);
+}
+
+/** Add a data row to the R-tree index
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint rtree_add_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  double box[2*MAX_INDEX_FIELDS];
+  gint dims = hdr->fields, root = RTREE_ROOT_NODE(hdr), split;
+  gint *node;
+
+  if(rtree_row_point(db, hdr, rec, box))
+    return 0; /* not indexed */
+  if(rtree_insert(db, dims, root, ptrtooffset(db, rec), box, &split))
+    return -1;
+
+  if(split) {
+    /* Grow the tree */
+    gint newroot = rtree_new_node(db, dims,
+      ((gint *) offsettoptr(db, root))[RTREE_NODE_LEVEL_POS] + 1);
+    if(!newroot)
+      return -1;
+    node = (gint *) offsettoptr(db, newroot);
+    RTREE_ENTRY(node, 0, dims)[0] = root;
+    rtree_node_box((gint *) offsettoptr(db, root), dims, box);
+    rtree_set_box(RTREE_ENTRY(node, 0, dims), dims, box);
+    RTREE_ENTRY(node, 1, dims)[0] = split;
+    rtree_node_box((gint *) offsettoptr(db, split), dims, box);
+    rtree_set_box(RTREE_ENTRY(node, 1, dims), dims, box);
+    node[RTREE_NODE_COUNT_POS] = 2;
+    RTREE_ROOT_NODE(hdr) = newroot;
+  }
+  return 0;
+}
+
+/** Remove a data row from the R-tree index
+ *  returns:
+ *  0 - on success
+ *  -1 - if error
+ */
+static gint rtree_remove_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  double box[2*MAX_INDEX_FIELDS];
+  gint dims = hdr->fields;
+  gint *node;
+
+  if(rtree_row_point(db, hdr, rec, box))
+    return 0; /* not indexed */
+  if(!rtree_remove(db, dims, RTREE_ROOT_NODE(hdr), ptrtooffset(db, rec), box))
+    return show_index_error(db, "rtree_remove_row: record not found");
+
+  /* Shrink the tree while the root has a single child */
+  node = (gint *) offsettoptr(db, RTREE_ROOT_NODE(hdr));
+  while(node[RTREE_NODE_LEVEL_POS] && node[RTREE_NODE_COUNT_POS] == 1) {
+    gint child = RTREE_ENTRY(node, 0, dims)[0];
+    wg_free_object(db, &(dbmemsegh(db)->indexhash_area_header),
+      RTREE_ROOT_NODE(hdr));
+    RTREE_ROOT_NODE(hdr) = child;
+    node = (gint *) offsettoptr(db, child);
+  }
+  if(!node[RTREE_NODE_COUNT_POS])
+    node[RTREE_NODE_LEVEL_POS] = 0;
+  return 0;
+}
+
+/*
+ * Item for bulk loading. The key is the coordinate that the
+ * items are currently sorted by.
+ */
+struct rtree_item {
+  double key;
+  gint offset;
+  double point[1]; /* actual size is the number of dimensions */
+};
+
+#define RTREE_ITEM(items, i, size) \
+        ((struct rtree_item *) ((char *) (items) + (i)*(size)))
+
+static int compare_rtree_items(const void *a, const void *b) {
+  double x = ((struct rtree_item *) a)->key;
+  double y = ((struct rtree_item *) b)->key;
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/** Sort the items into the order of the leaves (STR tiling)
+ *  The items are sorted by the first coordinate and cut into
+ *  slabs, then each slab is sorted by the next coordinate, and so on.
+ */
+static void rtree_str_sort(void *items, gint count, gint size,
+  gint dim, gint dims) {
+  gint pages = (count + RTREE_MAX_ENTRIES - 1) / RTREE_MAX_ENTRIES;
+  gint slabs, slabsize, i;
+
+  for(i=0; i<count; i++)
+    RTREE_ITEM(items, i, size)->key = RTREE_ITEM(items, i, size)->point[dim];
+  qsort(items, count, size, compare_rtree_items);
+  if(dim == dims - 1)
+    return;
+
+  /* pages^(1/remaining dimensions) slabs, rounded up */
+  for(slabs=1;; slabs++) {
+    gint p = 1, k;
+    for(k=0; k<dims-dim && p<pages; k++)
+      p *= slabs;
+    if(p >= pages)
+      break;
+  }
+  slabsize = ((pages + slabs - 1) / slabs) * RTREE_MAX_ENTRIES;
+  for(i=0; i<count; i+=slabsize) {
+    rtree_str_sort(RTREE_ITEM(items, i, size),
+      (count - i < slabsize ? count - i : slabsize), size, dim + 1, dims);
+  }
+}
+
+/** Pack sorted items into nodes of one level
+ *  The items are replaced by the new nodes (with the centers of
+ *  the nodes as the points).
+ *  returns the number of nodes, -1 on error.
+ */
+static gint rtree_pack(void *db, gint dims, void *items, gint count,
+  gint size, gint level) {
+  double box[2*MAX_INDEX_FIELDS];
+  gint i, j, k, nodes = 0;
+
+  for(i=0; i<count; i+=RTREE_MAX_ENTRIES, nodes++) {
+    gint offset = rtree_new_node(db, dims, level);
+    gint *node;
+    struct rtree_item *item;
+    if(!offset)
+      return -1;
+    node = (gint *) offsettoptr(db, offset);
+
+    for(j=i; j<count && j<i+RTREE_MAX_ENTRIES; j++) {
+      gint *entry = RTREE_ENTRY(node, j-i, dims);
+      item = RTREE_ITEM(items, j, size);
+      entry[0] = item->offset;
+      if(level) {
+        rtree_node_box((gint *) offsettoptr(db, item->offset), dims, box);
+      } else {
+        for(k=0; k<dims; k++)
+          box[k] = box[dims+k] = item->point[k];
+      }
+      rtree_set_box(entry, dims, box);
+    }
+    node[RTREE_NODE_COUNT_POS] = j - i;
+
+    item = RTREE_ITEM(items, nodes, size);
+    item->offset = offset;
+    rtree_node_box(node, dims, box);
+    for(k=0; k<dims; k++)
+      item->point[k] = (box[k] + box[dims+k]) / 2;
+  }
+  return nodes;
+}
+
+/*
+ * Create R-tree index.
+ * Returns 0 on success
+ * Returns -1 on failure.
+ */
+static gint create_rtree_index(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint dims = hdr->fields, column = max_index_column(hdr);
+  gint size = sizeof(struct rtree_item) + (dims-1)*sizeof(double);
+  gint count = 0, capacity = 1024, level = 0;
+  double box[2*MAX_INDEX_FIELDS];
+  void *items, *rec;
+
+  items = malloc(capacity * size);
+  if(!items) {
+    show_index_error(db, "Failed to allocate memory");
+    return -1;
+  }
+
+  /* Collect the points of the existing records */
+  rec = wg_get_first_record(db);
+  while(rec != NULL) {
+    if(column < wg_get_record_len(db, rec) && MATCH_TEMPLATE(db, hdr, rec) &&\
+      !rtree_row_point(db, hdr, rec, box)) {
+      struct rtree_item *item;
+      if(count == capacity) {
+        void *tmp = realloc(items, 2 * capacity * size);
+        if(!tmp) {
+          free(items);
+          show_index_error(db, "Failed to allocate memory");
+          return -1;
+        }
+        items = tmp;
+        capacity *= 2;
+      }
+      item = RTREE_ITEM(items, count, size);
+      item->offset = ptrtooffset(db, rec);
+      memcpy(item->point, box, dims*sizeof(double));
+      count++;
+    }
+    rec = wg_get_next_record(db, rec);
+  }
+
+  /* Build the tree bottom up */
+  if(!count) {
+    RTREE_ROOT_NODE(hdr) = rtree_new_node(db, dims, 0);
+  }
+  else {
+    gint nodes = count;
+    do {
+      rtree_str_sort(items, nodes, size, 0, dims);
+      nodes = rtree_pack(db, dims, items, nodes, size, level++);
+    } while(nodes > 1);
+    RTREE_ROOT_NODE(hdr) = (nodes < 0 ? 0 : RTREE_ITEM(items, 0, size)->offset);
+  }
+  free(items);
+  if(!RTREE_ROOT_NODE(hdr))
+    return -1;
+
+#ifdef WG_NO_ERRPRINT
+#else
+  fprintf(stderr,"new R-tree index created on %d columns into slot %d"\
+    " and %d data rows inserted\n",
+    (int) dims, (int) index_id, (int) count);
+#endif
+  return 0;
+}
+
+/** Drop an R-tree index by id
+ *  returns:
+ *  0 - on success
+ *  -1 - error
+ */
+static gint drop_rtree_index(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+
+  if(RTREE_ROOT_NODE(hdr))
+    rtree_free_nodes(db, hdr->fields, RTREE_ROOT_NODE(hdr));
+  RTREE_ROOT_NODE(hdr) = 0;
+  return 0;
+}
+
+/* -------------- R-tree index public functions -------------- */
+
+/** Get the R-tree coordinate of a value.
+ *  Integers, doubles and fixpoint values are converted to doubles.
+ *  The conversion preserves the order of the values of each type,
+ *  so searching with the converted bounds finds all the matching
+ *  rows (the rows still need to be checked against the exact bounds).
+ *  returns 0 on success
+ *  returns -1 if the value has no coordinate (including NaN)
+ */
+gint wg_rtree_coord(void *db, gint enc, double *coord) {
+  switch(wg_get_encoded_type(db, enc)) {
+    case WG_INTTYPE:
+      *coord = (double) wg_decode_int(db, enc);
+      break;
+    case WG_DOUBLETYPE:
+      *coord = wg_decode_double(db, enc);
+      break;
+    case WG_FIXPOINTTYPE:
+      *coord = wg_decode_fixpoint(db, enc);
+      break;
+    default:
+      return -1;
+  }
+  if(*coord != *coord)
+    return -1;
+  return 0;
+}
+
+/** Find the rows inside a box in an R-tree index.
+ *  The box is given as the lower corner followed by the upper
+ *  corner, with the coordinates in the order of the indexed columns
+ *  (as in the index header). Both corners are inclusive.
+ *  *offsets is set to a newly allocated array of record offsets.
+ *  returns the number of records (*offsets is not allocated if 0)
+ *  returns -1 on error.
+ */
+gint wg_search_rtree(void *db, gint index_id, double *box, gint **offsets) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint count = 0, size = 64;
+
+  *offsets = (gint *) malloc(size * sizeof(gint));
+  if(!(*offsets)) {
+    show_index_error(db, "Failed to allocate memory");
+    return -1;
+  }
+  if(rtree_search(db, hdr->fields, RTREE_ROOT_NODE(hdr), box, offsets,
+    &count, &size)) {
+    free(*offsets);
+    return -1;
+  }
+  if(!count)
+    free(*offsets);
+  return count;
+}
+
+/* ----------------- Index template functions -------------- */
+
+/** Insert into list
+ *
+ * helper function to insert list elements. Takes address of
+ * a variable containing an offset to the first element (that
+ * offset may be 0 for empty lists or when appending).
+ */
+static gint insert_into_list(void *db, gint *head, gint value) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint old = *head;
+
+  *head = wg_alloc_fixlen_object(db, &dbh->listcell_area_header);
+  if(*head) {
+    gcell *listelem = (gcell *) offsettoptr(db, *head);
+    listelem->car = value;
+    listelem->cdr = old;
+  }
+  return *head;
+}
+
+/** Delete from list
+ *
+ * helper function to delete list elements. Deletes the current
+ * element.
+ */
+static void delete_from_list(void *db, gint *head) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gcell *listelem = (gcell *) offsettoptr(db, *head);
+
+  *head = listelem->cdr;
   /* Free the vacated list element */
   wg_free_fixlen_object(db, &dbh->listcell_area_header,
     ptrtooffset(db, listelem));
@@ -1914,86 +4370,557 @@ nextelem:
     ilist = &ilistelem->cdr;
   }
 
-  return 0;
+  return 0;
+}
+
+/** Remove index template
+ *
+ * Caller should make sure that the template is no longer
+ * referenced by any indexes before calling this.
+ */
+static gint remove_index_template(void *db, gint template_offset) {
+  gint *ilist;
+  void *rec;
+  db_memsegment_header* dbh = dbmemsegh(db);
+  wg_index_template *tmpl;
+
+  tmpl = (wg_index_template *) offsettoptr(db, template_offset);
+
+  /* Delete the database record */
+  rec = offsettoptr(db, tmpl->offset_matchrec);
+  wg_delete_record(db, rec);
+
+  /* Remove from template list */
+  ilist = &dbh->index_control_area_header.index_template_list;
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(ilistelem->car == template_offset) {
+      delete_from_list(db, ilist);
+      break;
+    }
+    ilist = &ilistelem->cdr;
+  }
+
+  /* Free the template */
+  wg_free_fixlen_object(db, &dbh->indextmpl_area_header, template_offset);
+
+  return 0;
+}
+
+/** Check if a record matches a template
+ *
+ * Returns 1 if they match
+ * Otherwise, returns 0
+ */
+gint wg_match_template(void *db, wg_index_template *tmpl, void *rec) {
+  void *matchrec;
+  gint reclen, mreclen;
+  int i;
+
+#ifdef CHECK
+  /* Paranoia */
+  if(!tmpl->offset_matchrec) {
+    show_index_error(db, "Invalid match record template");
+    return 0;
+  }
+#endif
+
+  matchrec = offsettoptr(db, tmpl->offset_matchrec);
+  mreclen = wg_get_record_len(db, matchrec);
+  reclen = wg_get_record_len(db, rec);
+  if(mreclen > reclen) {
+    /* Match records always end in a fixed column, so
+     * this is guaranteed to be a mismatch
+     */
+    return 0;
+  }
+  else if(mreclen < reclen) {
+    /* Fields outside the template always match */
+    reclen = mreclen;
+  }
+  for(i=0; i<reclen; i++) {
+    gint enc = wg_get_field(db, matchrec, i);
+    if(wg_get_encoded_type(db, enc) != WG_VARTYPE) {
+      if(WG_COMPARE(db, enc, wg_get_field(db, rec, i)) != WG_EQUAL)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+#endif
+
+/* ----------------- Index statistics functions -------------- */
+
+/*
+ * Each index keeps the number of rows, the number of NULL values
+ * in the first indexed column, a HyperLogLog sketch of the keys for
+ * estimating the number of distinct keys and an equi-depth histogram
+ * of the numeric values in the first indexed column. The counts and
+ * the sketch are updated when rows are added to or removed from the
+ * index. Removing a row does not affect the sketch, so the distinct
+ * count may be overestimated after deletes. The histogram buckets
+ * are fixed when the statistics are refreshed, later rows only
+ * change the row counts of the buckets (and the outer bounds).
+ * Refreshing happens when the index is created and on demand
+ * (see wg_refresh_index_stats()).
+ */
+
+#define STATS_HLL_SIZE (1<<WG_INDEX_HLL_BITS)
+
+/** FNV-1a hash of a byte array
+ */
+static unsigned int stats_hash_bytes(unsigned int h, const void *data,
+  gint len) {
+  const unsigned char *p = (const unsigned char *) data;
+  while(len-- > 0) {
+    h ^= *p++;
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/** Hash the key of a row for the distinct count sketch
+ *  Numbers are hashed by value and strings by contents, so that
+ *  the hash does not depend on where the value is stored.
+ */
+static unsigned int stats_key_hash(void *db, wg_index_header *hdr,
+  void *rec) {
+  unsigned int h = 2166136261U;
+  gint i;
+
+  for(i=0; i<hdr->fields; i++) {
+    gint enc = wg_get_field(db, rec, hdr->rec_field_index[i]);
+    gint type = wg_get_encoded_type(db, enc);
+    double d;
+    char *str;
+
+    h = stats_hash_bytes(h, &type, sizeof(gint));
+    if(!wg_rtree_coord(db, enc, &d)) {
+      if(d == 0)
+        d = 0; /* -0.0 */
+      h = stats_hash_bytes(h, &d, sizeof(double));
+    }
+    else if(type == WG_STRTYPE && (str = wg_decode_str(db, enc)) != NULL) {
+      h = stats_hash_bytes(h, str, strlen(str));
+    }
+    else {
+      h = stats_hash_bytes(h, &enc, sizeof(gint));
+    }
+  }
+
+  /* Mix the bits, as the sketch uses both ends of the hash */
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return h;
+}
+
+/** Check if a row is counted in the index statistics
+ *  (JSON indexes skip array and object records)
+ */
+static gint stats_row_counted(void *db, wg_index_header *hdr, void *rec) {
+  if(hdr->type == WG_INDEX_TYPE_TTREE_JSON ||\
+    hdr->type == WG_INDEX_TYPE_HASH_JSON)
+    return is_plain_record(rec);
+  return 1;
+}
+
+/** Find the histogram bucket of a value
+ *  returns the bucket number, -1 if the value is outside the histogram.
+ */
+static gint stats_find_bucket(struct __wg_index_stats *st, double value) {
+  gint i;
+  if(!st->buckets || value < st->bound[0] || value > st->bound[st->buckets])
+    return -1;
+  for(i=0; i<st->buckets-1; i++) {
+    if(value < st->bound[i+1])
+      break;
+  }
+  return i;
+}
+
+/** Count a row and add its key to the sketch
+ */
+static void stats_count_row(void *db, wg_index_header *hdr, void *rec) {
+  struct __wg_index_stats *st = &hdr->stats;
+  unsigned int h, w;
+  unsigned char rank = 1;
+
+  st->rows++;
+  if(!wg_get_field(db, rec, hdr->rec_field_index[0]))
+    st->nulls++;
+
+  h = stats_key_hash(db, hdr, rec);
+  w = h >> WG_INDEX_HLL_BITS;
+  while(!(w & 1) && rank <= 32 - WG_INDEX_HLL_BITS) {
+    w >>= 1;
+    rank++;
+  }
+  if(rank > st->hll[h & (STATS_HLL_SIZE-1)])
+    st->hll[h & (STATS_HLL_SIZE-1)] = rank;
+}
+
+/** Update the statistics when a row is added to an index
+ */
+static void stats_add_row(void *db, wg_index_header *hdr, void *rec) {
+  struct __wg_index_stats *st = &hdr->stats;
+  gint bucket;
+  double d;
+
+  if(!stats_row_counted(db, hdr, rec))
+    return;
+  stats_count_row(db, hdr, rec);
+  if(!wg_rtree_coord(db, wg_get_field(db, rec, hdr->rec_field_index[0]),
+    &d)) {
+    if(!st->buckets) {
+      st->buckets = 1;
+      st->bound[0] = st->bound[1] = d;
+    }
+    else if(d < st->bound[0])
+      st->bound[0] = d;
+    else if(d > st->bound[st->buckets])
+      st->bound[st->buckets] = d;
+    bucket = stats_find_bucket(st, d);
+    st->bucket_rows[bucket]++;
+  }
+}
+
+/** Update the statistics when a row is removed from an index
+ */
+static void stats_remove_row(void *db, wg_index_header *hdr, void *rec) {
+  struct __wg_index_stats *st = &hdr->stats;
+  gint first, bucket;
+  double d;
+
+  if(!stats_row_counted(db, hdr, rec))
+    return;
+  if(st->rows > 0)
+    st->rows--;
+  first = wg_get_field(db, rec, hdr->rec_field_index[0]);
+  if(!first && st->nulls > 0)
+    st->nulls--;
+  if(!wg_rtree_coord(db, first, &d)) {
+    bucket = stats_find_bucket(st, d);
+    if(bucket >= 0 && st->bucket_rows[bucket] > 0)
+      st->bucket_rows[bucket]--;
+  }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *((const double *) a), y = *((const double *) b);
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/** Natural logarithm for x >= 1
+ *  (avoids depending on the math library)
+ */
+static double stats_log(double x) {
+  double res = 0, y, y2, term;
+  int i;
+  while(x >= 2) {
+    x /= 2;
+    res += 0.69314718055994531;
+  }
+  /* ln(x) = 2 atanh((x-1)/(x+1)) */
+  y = (x - 1) / (x + 1);
+  y2 = y * y;
+  term = y;
+  for(i=1; i<40; i+=2) {
+    res += 2 * term / i;
+    term *= y2;
+  }
+  return res;
+}
+
+/** Estimate the number of distinct keys from the sketch
+ */
+static gint stats_distinct(struct __wg_index_stats *st) {
+  double sum = 0, est, m = STATS_HLL_SIZE;
+  gint i, zeros = 0;
+
+  if(!st->rows)
+    return 0;
+  for(i=0; i<STATS_HLL_SIZE; i++) {
+    sum += 1.0 / (double) ((wg_uint) 1 << st->hll[i]);
+    if(!st->hll[i])
+      zeros++;
+  }
+  est = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+  if(est <= 2.5 * m && zeros)
+    est = m * stats_log(m / zeros); /* linear counting */
+  if(est < 1)
+    return 1;
+  return (est > st->rows ? st->rows : (gint) (est + 0.5));
+}
+
+/** Recompute the statistics of an index from the data
+ *  returns 0 on success, -1 on error.
+ */
+static gint refresh_index_stats(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  struct __wg_index_stats *st = &hdr->stats;
+  gint column = max_index_column(hdr);
+  gint count = 0, size = 1024, i, j;
+  double *values, d;
+  void *rec;
+
+  values = (double *) malloc(size * sizeof(double));
+  if(!values) {
+    show_index_error(db, "Failed to allocate memory");
+    return -1;
+  }
+  memset(st, 0, sizeof(struct __wg_index_stats));
+
+  rec = wg_get_first_record(db);
+  while(rec != NULL) {
+    if(column < wg_get_record_len(db, rec) && MATCH_TEMPLATE(db, hdr, rec) &&\
+      stats_row_counted(db, hdr, rec)) {
+      stats_count_row(db, hdr, rec);
+      if(!wg_rtree_coord(db, wg_get_field(db, rec, hdr->rec_field_index[0]),
+        &d)) {
+        if(count == size) {
+          double *tmp = (double *) realloc(values, 2 * size * sizeof(double));
+          if(!tmp) {
+            free(values);
+            show_index_error(db, "Failed to allocate memory");
+            return -1;
+          }
+          values = tmp;
+          size *= 2;
+        }
+        values[count++] = d;
+      }
+    }
+    rec = wg_get_next_record(db, rec);
+  }
+
+  /* Equi-depth histogram: the buckets have (nearly) the same number
+   * of values. */
+  if(count > 0) {
+    qsort(values, count, sizeof(double), compare_doubles);
+    st->buckets = (count < WG_INDEX_HIST_BUCKETS ?
+      count : WG_INDEX_HIST_BUCKETS);
+    for(i=0; i<=st->buckets; i++) {
+      st->bound[i] = values[(i * (count-1)) / st->buckets];
+    }
+    for(i=0, j=0; i<count; i++) {
+      while(j < st->buckets-1 && values[i] >= st->bound[j+1])
+        j++;
+      st->bucket_rows[j]++;
+    }
+  }
+  free(values);
+  return 0;
+}
+
+/** Find the header of an index by id
+ *  The index may be in use or being built.
+ *  returns NULL if the index is not found.
+ */
+static wg_index_header *find_index_header(void *db, gint index_id) {
+  gint *ilist = &dbmemsegh(db)->index_control_area_header.index_list;
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(ilistelem->car == index_id)
+      return (wg_index_header *) offsettoptr(db, index_id);
+    ilist = &ilistelem->cdr;
+  }
+  if(find_building_index(db, index_id))
+    return (wg_index_header *) offsettoptr(db, index_id);
+  return NULL;
+}
+
+/* ----------------- Index statistics public functions ------------ */
+
+/** Get the statistics of an index
+ *  stats->distinct is an estimate. The histogram covers the numeric
+ *  values of the first indexed column: bucket i contains the values
+ *  in the range [bound[i], bound[i+1]), the last bucket includes the
+ *  upper bound.
+ *  returns 0 on success, -1 on error.
+ */
+gint wg_get_index_stats(void *db, gint index_id, wg_index_stats *stats) {
+  wg_index_header *hdr;
+  gint i;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    show_index_error(db, "Invalid database pointer in wg_get_index_stats");
+    return -1;
+  }
+#endif
+  hdr = find_index_header(db, index_id);
+  if(!hdr) {
+    show_index_error_nr(db, "Invalid index_id", index_id);
+    return -1;
+  }
+
+  stats->rows = hdr->stats.rows;
+  stats->distinct = stats_distinct(&hdr->stats);
+  stats->nulls = hdr->stats.nulls;
+  stats->buckets = hdr->stats.buckets;
+  for(i=0; i<=stats->buckets; i++)
+    stats->bound[i] = hdr->stats.bound[i];
+  for(i=0; i<stats->buckets; i++)
+    stats->bucket_rows[i] = hdr->stats.bucket_rows[i];
+  return 0;
+}
+
+/** Recompute the statistics of an index
+ *  Scans the data, so this should be done after large changes to
+ *  the data, rather than routinely. Requires a write lock.
+ *  returns 0 on success, -1 on error.
+ */
+gint wg_refresh_index_stats(void *db, gint index_id) {
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    show_index_error(db, "Invalid database pointer in wg_refresh_index_stats");
+    return -1;
+  }
+#endif
+  if(find_building_index(db, index_id)) {
+    show_index_error(db, "Index is being built");
+    return -1;
+  }
+  if(!find_index_header(db, index_id)) {
+    show_index_error_nr(db, "Invalid index_id", index_id);
+    return -1;
+  }
+  if(((wg_index_header *) offsettoptr(db, index_id))->type ==\
+    WG_INDEX_TYPE_HASH_PATH)
+    return 0; /* JSON path index has no statistics */
+  /* Pending rows are not in the index yet */
+  if(wg_flush_indexes(db))
+    return -1;
+  return refresh_index_stats(db, index_id);
+}
+
+/* ----------------- Covering index functions -------------- */
+
+/** Create an entry for a covering index
+ *
+ * The entry is a special record that has the indexed and included
+ * fields of the data row in the same positions as the row itself.
+ * The remaining fields are WG_ILLEGAL. Fields beyond the end of the
+ * data row are left out, so the entry is never longer than the row.
+ * The offset of the row is kept in the backlinks slot of the header
+ * (see INDEX_ENTRY_RECORD).
+ *
+ * Returns offset of the entry.
+ * Returns 0 on error.
+ */
+static gint create_index_entry(void *db, wg_index_header *hdr, void *rec) {
+  gint offset, length, i;
+  gint *entry;
+
+  length = max_covered_column(hdr) + 1;
+  i = wg_get_record_len(db, rec);
+  if(length > i)
+    length = i;
+
+  offset = wg_alloc_gints(db, &(dbmemsegh(db)->datarec_area_header),
+    length + RECORD_HEADER_GINTS);
+  if(!offset) {
+    show_index_error(db, "Failed to allocate an index entry");
+    return 0;
+  }
+
+  entry = (gint *) offsettoptr(db, offset);
+  entry[RECORD_META_POS] = RECORD_META_NOTDATA;
+  entry[RECORD_BACKLINKS_POS] = ptrtooffset(db, rec);
+  for(i=0; i<length; i++)
+    entry[RECORD_HEADER_GINTS + i] = WG_ILLEGAL;
+
+  for(i=0; i<hdr->fields; i++) {
+    gint col = hdr->rec_field_index[i];
+    entry[RECORD_HEADER_GINTS + col] = wg_get_field(db, rec, col);
+  }
+  for(i=0; i<hdr->include_count; i++) {
+    gint col = hdr->rec_include_index[i];
+    if(col < length)
+      entry[RECORD_HEADER_GINTS + col] = wg_get_field(db, rec, col);
+  }
+  return offset;
 }
 
-/** Remove index template
+/** Find the entry of a data row in a covering index
  *
- * Caller should make sure that the template is no longer
- * referenced by any indexes before calling this.
+ * Returns offset of the entry.
+ * Returns 0 if the row is not in the index.
  */
-static gint remove_index_template(void *db, gint template_offset) {
-  gint *ilist;
-  void *rec;
-  db_memsegment_header* dbh = dbmemsegh(db);
-  wg_index_template *tmpl;
-
-  tmpl = (wg_index_template *) offsettoptr(db, template_offset);
+static gint find_index_entry(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
 
-  /* Delete the database record */
-  rec = offsettoptr(db, tmpl->offset_matchrec);
-  wg_delete_record(db, rec);
+  if(hdr->type == WG_INDEX_TYPE_TTREE) {
+    struct wg_tnode *node;
+    gint slot = ttree_find_row(db, index_id, rec, &node);
+    if(slot >= 0)
+      return node->array_of_values[slot];
+  } else {
+    gint i, reclist;
+    gint values[MAX_INDEX_FIELDS];
+    gint rowoffset = ptrtooffset(db, rec);
 
-  /* Remove from template list */
-  ilist = &dbh->index_control_area_header.index_template_list;
-  while(*ilist) {
-    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
-    if(ilistelem->car == template_offset) {
-      delete_from_list(db, ilist);
-      break;
+    for(i=0; i<hdr->fields; i++) {
+      values[i] = wg_get_field(db, rec, hdr->rec_field_index[i]);
+    }
+    reclist = hash_recurse(db, hdr, NULL, 0, values, hdr->fields, NULL,
+      HASHIDX_OP_FIND, 0);
+    while(reclist > 0) {
+      gcell *rec_cell = (gcell *) offsettoptr(db, reclist);
+      if(INDEX_ENTRY_RECORD(db, hdr, rec_cell->car) == rowoffset)
+        return rec_cell->car;
+      reclist = rec_cell->cdr;
     }
-    ilist = &ilistelem->cdr;
   }
-
-  /* Free the template */
-  wg_free_fixlen_object(db, &dbh->indextmpl_area_header, template_offset);
-
   return 0;
 }
 
-/** Check if a record matches a template
+/** Copy an included field of a data row to its index entry
  *
- * Returns 1 if they match
- * Otherwise, returns 0
+ * Included fields do not affect the position of the entry in
+ * the index, so the entry is updated in place. If the row has no
+ * entry yet (a raw record that is being initialized field by field),
+ * nothing is done; the entry will pick up the value when it is created.
  */
-gint wg_match_template(void *db, wg_index_template *tmpl, void *rec) {
-  void *matchrec;
-  gint reclen, mreclen;
-  int i;
+static void update_index_entry(void *db, gint index_id, void *rec,
+  gint column) {
+  gint entry = find_index_entry(db, index_id, rec);
+  if(entry && column < wg_get_record_len(db, offsettoptr(db, entry)))
+    dbstore(db, entry + (RECORD_HEADER_GINTS + column)*sizeof(gint),
+      wg_get_field(db, rec, column));
+}
 
-#ifdef CHECK
-  /* Paranoia */
-  if(!tmpl->offset_matchrec) {
-    show_index_error(db, "Invalid match record template");
-    return 0;
-  }
-#endif
+/** Check if a covering index holds the given columns.
+ *
+ * returns 1 if all the columns are indexed or included.
+ * returns 0 otherwise (also for indexes without included columns)
+ */
+gint wg_index_covers_columns(void *db, wg_index_header *hdr,
+  gint *columns, gint count) {
+  gint i, j;
 
-  matchrec = offsettoptr(db, tmpl->offset_matchrec);
-  mreclen = wg_get_record_len(db, matchrec);
-  reclen = wg_get_record_len(db, rec);
-  if(mreclen > reclen) {
-    /* Match records always end in a fixed column, so
-     * this is guaranteed to be a mismatch
-     */
+  if(!hdr->include_count)
     return 0;
-  }
-  else if(mreclen < reclen) {
-    /* Fields outside the template always match */
-    reclen = mreclen;
-  }
-  for(i=0; i<reclen; i++) {
-    gint enc = wg_get_field(db, matchrec, i);
-    if(wg_get_encoded_type(db, enc) != WG_VARTYPE) {
-      if(WG_COMPARE(db, enc, wg_get_field(db, rec, i)) != WG_EQUAL)
-        return 0;
+  for(i=0; i<count; i++) {
+    for(j=0; j<hdr->fields; j++) {
+      if(hdr->rec_field_index[j] == columns[i])
+        goto covered;
     }
+    for(j=0; j<hdr->include_count; j++) {
+      if(hdr->rec_include_index[j] == columns[i])
+        goto covered;
+    }
+    return 0;
+covered:
+    ;
   }
   return 1;
 }
 
-#endif
-
 /* ----------------- General index functions --------------- */
 
 /*
@@ -2018,6 +4945,32 @@ static gint sort_columns(gint *sorted_cols, gint *columns,
   return i;
 }
 
+/** Find the largest column number of an index.
+ *  Records shorter than this are not indexed. The columns of
+ *  a hash index are sorted, T-tree index columns are kept in
+ *  key order.
+ */
+static gint max_index_column(wg_index_header *hdr) {
+  gint i, max_col = hdr->rec_field_index[0];
+  for(i=1; i<hdr->fields; i++) {
+    if(hdr->rec_field_index[i] > max_col)
+      max_col = hdr->rec_field_index[i];
+  }
+  return max_col;
+}
+
+/** Find the largest column number stored in the entries of
+ *  a covering index (indexed or included).
+ */
+static gint max_covered_column(wg_index_header *hdr) {
+  gint i, max_col = max_index_column(hdr);
+  for(i=0; i<hdr->include_count; i++) {
+    if(hdr->rec_include_index[i] > max_col)
+      max_col = hdr->rec_include_index[i];
+  }
+  return max_col;
+}
+
 /** Create an index.
  *
  * Single-column backward compatibility wrapper.
@@ -2031,12 +4984,21 @@ gint wg_create_index(void *db, gint column, gint type,
 /** Create an index.
  *
  * Arguments -
- * type - WG_INDEX_TYPE_TTREE - single-column T-tree index
+ * type - WG_INDEX_TYPE_TTREE - T-tree index (single or multi-column)
  *        WG_INDEX_TYPE_TTREE_JSON - T-tree for JSON schema
  *        WG_INDEX_TYPE_HASH - multi-column hash index
  *        WG_INDEX_TYPE_HASH_JSON - hash index with JSON features
+ *        WG_INDEX_TYPE_BITMAP - bitmap index (single column, for
+ *          columns with few distinct values)
+ *        WG_INDEX_TYPE_TRIGRAM - trigram index for substring search
+ *          (single column)
+ *        WG_INDEX_TYPE_RTREE - R-tree index on numeric columns, for
+ *          box queries (multi-column)
+ *        WG_INDEX_TYPE_HASH_PATH - JSON path index (column 0 only,
+ *          one per database)
  *
- * columns - array of column numbers
+ * columns - array of column numbers. For a T-tree index, the order
+ *   of the columns defines the (lexicographic) order of the index keys.
  * col_count - size of the column number array
  *
  * matchrec - array of gints
@@ -2047,15 +5009,48 @@ gint wg_create_index(void *db, gint column, gint type,
  */
 gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
   gint *matchrec, gint reclen)
+{
+  return wg_create_covering_index(db, columns, col_count, NULL, 0,
+    type, matchrec, reclen);
+}
+
+/** Create an index with included columns.
+ *
+ * Arguments are the same as for wg_create_multi_index(), with the
+ * addition of:
+ *
+ * include - array of column numbers whose values are copied into
+ *   the index entries (WG_INDEX_TYPE_TTREE and WG_INDEX_TYPE_HASH only).
+ *   The included columns are not part of the index key. Queries
+ *   that use the index can read them without accessing the
+ *   data records (see wg_fetch_values()).
+ * include_count - size of the include array, 0 if there are no
+ *   included columns.
+ */
+gint wg_create_covering_index(void *db, gint *columns, gint col_count,
+  gint *include, gint include_count, gint type, gint *matchrec, gint reclen)
+{
+  return (create_index(db, columns, col_count, include, include_count,
+    type, matchrec, reclen, 0) > 0 ? 0 : -1);
+}
+
+/** Create an index, either by scanning all the rows or for
+ *  an online build (see wg_start_index_build()).
+ *  returns the index id on success, -1 on error.
+ */
+static gint create_index(void *db, gint *columns, gint col_count,
+  gint *include, gint include_count, gint type, gint *matchrec, gint reclen,
+  gint online)
 {
   gint index_id, template_offset = 0, i;
   wg_index_header *hdr;
 #ifdef USE_INDEX_TEMPLATE
   wg_index_template *tmpl = NULL;
-  gint fixed_columns = 0;
 #endif
   gint *ilist[MAX_INDEX_FIELDS];
   gint sorted_cols[MAX_INDEX_FIELDS];
+  gint all_cols[2*MAX_INDEX_FIELDS], all_sorted[2*MAX_INDEX_FIELDS];
+  gint *key_cols;
   db_memsegment_header* dbh = dbmemsegh(db);
 
   /* Check the arguments */
@@ -2068,6 +5063,10 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
     show_index_error(db, "columns list is a NULL pointer");
     return -1;
   }
+  if(include_count && !include) {
+    show_index_error(db, "include list is a NULL pointer");
+    return -1;
+  }
 #endif
 
 #ifdef USE_CHILD_DB
@@ -2078,6 +5077,10 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
   }
 #endif
 
+  if(type == WG_INDEX_TYPE_HASH_PATH)
+    return create_path_index(db, columns, col_count, include_count,
+      matchrec, online);
+
   /* Column count validation */
   if(col_count < 1) {
     show_index_error(db, "need at least one indexed column");
@@ -2086,9 +5089,13 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
     show_index_error_nr(db, "Max allowed indexed fields",
       MAX_INDEX_FIELDS);
     return -1;
-  } else if(col_count > 1 &&\
-    (type == WG_INDEX_TYPE_TTREE || type == WG_INDEX_TYPE_TTREE_JSON)) {
-    show_index_error(db, "Cannot create a T-tree index on multiple columns");
+  } else if(col_count > 1 && type == WG_INDEX_TYPE_TTREE_JSON) {
+    show_index_error(db, "Cannot create a JSON T-tree index on multiple columns");
+    return -1;
+  } else if(col_count > 1 && (type == WG_INDEX_TYPE_BITMAP ||\
+    type == WG_INDEX_TYPE_TRIGRAM)) {
+    show_index_error(db, "Cannot create a bitmap or trigram index on "\
+      "multiple columns");
     return -1;
   }
 
@@ -2097,6 +5104,39 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
     return -1;
   }
 
+  /* Included columns validation */
+  if(include_count < 0 || include_count > MAX_INDEX_FIELDS) {
+    show_index_error_nr(db, "Max allowed included fields",
+      MAX_INDEX_FIELDS);
+    return -1;
+  } else if(include_count && type != WG_INDEX_TYPE_TTREE &&\
+    type != WG_INDEX_TYPE_HASH) {
+    show_index_error(db, "Included columns not allowed for this index type");
+    return -1;
+  }
+
+  if(include_count) {
+    memcpy(all_cols, columns, col_count * sizeof(gint));
+    memcpy(all_cols + col_count, include, include_count * sizeof(gint));
+    if(sort_columns(all_sorted, all_cols, col_count + include_count) <\
+      col_count + include_count) {
+      show_index_error(db, "Included columns must be unique and not indexed");
+      return -1;
+    }
+    if(all_sorted[col_count + include_count - 1] > MAX_INDEXED_FIELDNR) {
+      show_index_error_nr(db, "Max allowed column number",
+        MAX_INDEXED_FIELDNR);
+      return -1;
+    }
+  }
+
+  /* T-tree keeps the columns in the order given, as that determines
+   * the order of the composite keys. Other indexes use sorted columns. */
+  if(type == WG_INDEX_TYPE_TTREE)
+    key_cols = columns;
+  else
+    key_cols = sorted_cols;
+
   for(i=0; i<col_count; i++) {
     if(sorted_cols[i] > MAX_INDEXED_FIELDNR) {
       show_index_error_nr(db, "Max allowed column number",
@@ -2134,15 +5174,113 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
       return -1;
     }
     tmpl = (wg_index_template *) offsettoptr(db, template_offset);
-    fixed_columns = tmpl->fixed_columns;
   }
 #endif
 
+  /* Add new index header */
+  index_id = wg_alloc_fixlen_object(db, &dbh->indexhdr_area_header);
+  if(!index_id) {
+    show_index_error(db, "Failed to allocate index header");
+    return -1;
+  }
+
+  /* Set up the header */
+  hdr = (wg_index_header *) offsettoptr(db, index_id);
+  hdr->type = type;
+  hdr->fields = col_count;
+  for(i=0; i < col_count; i++) {
+    hdr->rec_field_index[i] = key_cols[i];
+  }
+  hdr->include_count = include_count;
+  for(i=0; i < include_count; i++) {
+    hdr->rec_include_index[i] = include[i];
+  }
+  hdr->template_offset = template_offset;
+  hdr->version = 0;
+  hdr->build_cursor = 0;
+  memset(&hdr->stats, 0, sizeof(struct __wg_index_stats));
+
+  if(find_index_lists(db, hdr, ilist)) {
+    wg_free_fixlen_object(db, &dbh->indexhdr_area_header, index_id);
+    return -1;
+  }
+#ifdef USE_INDEX_TEMPLATE
+  if(tmpl)
+    tmpl->refcount++;
+#endif
+
+  if(online) {
+    /* The rows are added by wg_continue_index_build() */
+    void *rec = wg_get_first_record(db);
+    if(init_index(db, index_id))
+      return -1;
+    hdr->build_cursor = (rec ? ptrtooffset(db, rec) : 0);
+    if(!insert_into_list(db,
+      &dbh->index_control_area_header.index_build_list, index_id))
+      return -1;
+    return index_id;
+  }
+
+  /* create the actual index */
+  switch(hdr->type) {
+    case WG_INDEX_TYPE_TTREE:
+      if(create_ttree_index(db, index_id))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_HASH:
+    case WG_INDEX_TYPE_HASH_JSON:
+      if(create_hash_index(db, index_id))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_BITMAP:
+      if(create_bitmap_index(db, index_id))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_TRIGRAM:
+      if(create_trigram_index(db, index_id))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_RTREE:
+      if(create_rtree_index(db, index_id))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_TTREE_JSON:
+      /* Return an error, until proper implementation exists */
+    default:
+      show_index_error(db, "Invalid index type");
+      return -1;
+  }
+
+  if(link_index(db, index_id, ilist))
+    return -1;
+  if(refresh_index_stats(db, index_id))
+    return -1;
+  return index_id;
+}
+
+/** Find the positions of a new index in the index lists of its columns
+ *  Checks that there is no identical index.
+ *  ilist should have room for MAX_INDEX_FIELDS pointers.
+ *  returns 0 on success, -1 on error.
+ */
+static gint find_index_lists(void *db, wg_index_header *hdr, gint **ilist) {
+  gint sorted_cols[MAX_INDEX_FIELDS], fixed_columns = 0, i;
+  wg_index_header *other;
+  db_memsegment_header* dbh = dbmemsegh(db);
+
   /* Scan to the end of index chain for each column. If templates are used,
    * new indexes are inserted in between list elements to maintain
    * the chains sorted by number of fixed columns.
    */
-  for(i=0; i<col_count; i++) {
+  sort_columns(sorted_cols, hdr->rec_field_index, hdr->fields);
+#ifdef USE_INDEX_TEMPLATE
+  if(hdr->template_offset) {
+    fixed_columns = ((wg_index_template *) \
+      offsettoptr(db, hdr->template_offset))->fixed_columns;
+  }
+#endif
+
+  for(i=0; i<hdr->fields; i++) {
     gint column = sorted_cols[i];
     ilist[i] = &dbh->index_control_area_header.index_table[column];
     while(*(ilist[i])) {
@@ -2152,21 +5290,27 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
         show_index_error(db, "Invalid header in index list");
         return -1;
       }
-      hdr = (wg_index_header *) offsettoptr(db, ilistelem->car);
+      other = (wg_index_header *) offsettoptr(db, ilistelem->car);
 
       /* If this is the first column, check for a matching index.
        * Note that this is simplified by having the column lists sorted.
        */
-      if(!i && hdr->type==type && template_offset==hdr->template_offset &&\
-                                        hdr->fields==col_count) {
+      if(!i && other->type==hdr->type &&\
+          other->template_offset==hdr->template_offset &&\
+          other->fields==hdr->fields &&\
+          other->include_count==hdr->include_count) {
         gint j, match = 1;
         /* Compare the field lists */
-        for(j=0; j<col_count; j++) {
-          if(hdr->rec_field_index[j] != sorted_cols[j]) {
+        for(j=0; j<hdr->fields; j++) {
+          if(other->rec_field_index[j] != hdr->rec_field_index[j]) {
             match = 0;
             break;
           }
         }
+        for(j=0; j<hdr->include_count && match; j++) {
+          if(other->rec_include_index[j] != hdr->rec_include_index[j])
+            match = 0;
+        }
         if(match) {
           show_index_error(db, "Identical index already exists on the column");
           return -1;
@@ -2174,9 +5318,9 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
       }
 
 #ifdef USE_INDEX_TEMPLATE
-      if(hdr->template_offset) {
+      if(other->template_offset) {
         wg_index_template *t = \
-          (wg_index_template *) offsettoptr(db, hdr->template_offset);
+          (wg_index_template *) offsettoptr(db, other->template_offset);
         if(t->fixed_columns < fixed_columns)
           break; /* new template is more promising, insert here */
       }
@@ -2191,43 +5335,20 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
     }
   }
 
-  /* Add new index header */
-  index_id = wg_alloc_fixlen_object(db, &dbh->indexhdr_area_header);
-
-  for(i=0; i<col_count; i++) {
-    if(!insert_into_list(db, ilist[i], index_id)) {
-      if(i) {
-        /* XXX: need to clean up the earlier inserts :-( */
-        return -1;
-      } else {
-        return -1;
-      }
-    }
-  }
+  return 0;
+}
 
-  /* Set up the header */
-  hdr = (wg_index_header *) offsettoptr(db, index_id);
-  hdr->type = type;
-  hdr->fields = col_count;
-  for(i=0; i < col_count; i++) {
-    hdr->rec_field_index[i] = sorted_cols[i];
-  }
-  hdr->template_offset = template_offset;
+/** Add an index to the index lists, making it available for queries
+ *  ilist contains the positions found by find_index_lists().
+ *  returns 0 on success, -1 on error.
+ */
+static gint link_index(void *db, gint index_id, gint **ilist) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint i;
 
-  /* create the actual index */
-  switch(hdr->type) {
-    case WG_INDEX_TYPE_TTREE:
-      create_ttree_index(db, index_id);
-      break;
-    case WG_INDEX_TYPE_HASH:
-    case WG_INDEX_TYPE_HASH_JSON:
-      if(create_hash_index(db, index_id))
-        return -1;
-      break;
-    case WG_INDEX_TYPE_TTREE_JSON:
-      /* Return an error, until proper implementation exists */
-    default:
-      show_index_error(db, "Invalid index type");
+  for(i=0; i<hdr->fields; i++) {
+    if(!insert_into_list(db, ilist[i], index_id))
       return -1;
   }
 
@@ -2236,19 +5357,32 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
      &dbh->index_control_area_header.index_list ,index_id))
     return -1;
 
+  /* Included columns are looked up when their values change */
+  for(i=0; i<hdr->include_count; i++) {
+    if(!insert_into_list(db,
+      &(dbh->index_control_area_header.index_include_table[hdr->rec_include_index[i]]),
+      index_id))
+      return -1;
+  }
+
 #ifdef USE_INDEX_TEMPLATE
   if(hdr->template_offset) {
-    int i;
+    wg_index_template *tmpl = \
+      (wg_index_template *) offsettoptr(db, hdr->template_offset);
+    void *matchrec = offsettoptr(db, tmpl->offset_matchrec);
+    gint reclen = wg_get_record_len(db, matchrec);
+
     /* Update the template index */
     for(i=0; i<reclen; i++) {
-      if(wg_get_encoded_type(db, matchrec[i]) != WG_VARTYPE) {
+      if(wg_get_encoded_type(db,
+        wg_get_field(db, matchrec, i)) != WG_VARTYPE) {
         /* No checking/sorting required here, so we can insert
          * the new element at the head of the list.
          */
         if(!insert_into_list(db,
           &(dbh->index_control_area_header.index_template_table[i]),
           index_id))
-          return 0;
+          return -1;
       }
     }
   }
@@ -2256,15 +5390,11 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
 
   /* increase index counter */
   dbh->index_control_area_header.number_of_indexes++;
-#ifdef USE_INDEX_TEMPLATE
-  if(tmpl)
-    tmpl->refcount++;
-#endif
+  dbh->index_control_area_header.index_epoch++;
 
   return 0;
 }
 
-
 /** Drop index by index id
 *
 *  returns:
@@ -2272,12 +5402,25 @@ gint wg_create_multi_index(void *db, gint *columns, gint col_count, gint type,
 *  -1 - error
 */
 gint wg_drop_index(void *db, gint index_id){
-  int i;
+  int i, building = 0;
   wg_index_header *hdr = NULL;
   gint *ilist;
   gcell *ilistelem;
   db_memsegment_header* dbh = dbmemsegh(db);
 
+  /* The hash table of a JSON path index cannot be freed (see
+   * drop_hash_index()), so it is rejected before it is unlinked. */
+  hdr = find_index_header(db, index_id);
+  if(hdr && hdr->type == WG_INDEX_TYPE_HASH_PATH) {
+    show_index_error(db, "Cannot drop JSON path index: not implemented");
+    return -1;
+  }
+  hdr = NULL;
+
+  /* Pending rows may refer to this index */
+  if(wg_flush_indexes(db))
+    return -1;
+
   /* Locate the header */
   ilist = &dbh->index_control_area_header.index_list;
   while(*ilist) {
@@ -2291,16 +5434,41 @@ gint wg_drop_index(void *db, gint index_id){
     ilist = &ilistelem->cdr;
   }
 
+  if(!hdr) {
+    /* The index may still be in the build, in which case it is
+     * not in the other lists either. */
+    ilist = find_building_index(db, index_id);
+    if(ilist) {
+      hdr = (wg_index_header *) offsettoptr(db, index_id);
+      delete_from_list(db, ilist);
+      building = 1;
+    }
+  }
+
   if(!hdr) {
     show_index_error_nr(db, "Invalid index for delete", index_id);
     return -1;
   }
 
-  /* Remove the index from index table */
-  for(i=0; i<hdr->fields; i++) {
-    int column = hdr->rec_field_index[i];
+  /* Remove the index from index table */
+  for(i=0; i<hdr->fields; i++) {
+    int column = hdr->rec_field_index[i];
+
+    ilist = &dbh->index_control_area_header.index_table[column];
+    while(*ilist) {
+      ilistelem = (gcell *) offsettoptr(db, *ilist);
+      if(ilistelem->car == index_id) {
+        delete_from_list(db, ilist);
+        break;
+      }
+      ilist = &ilistelem->cdr;
+    }
+  }
+
+  for(i=0; i<hdr->include_count; i++) {
+    int column = hdr->rec_include_index[i];
 
-    ilist = &dbh->index_control_area_header.index_table[column];
+    ilist = &dbh->index_control_area_header.index_include_table[column];
     while(*ilist) {
       ilistelem = (gcell *) offsettoptr(db, *ilist);
       if(ilistelem->car == index_id) {
@@ -2348,6 +5516,15 @@ gint wg_drop_index(void *db, gint index_id){
       if(drop_hash_index(db, index_id))
         return -1;
       break;
+    case WG_INDEX_TYPE_BITMAP:
+    case WG_INDEX_TYPE_TRIGRAM:
+      if(drop_bitmap_index(db, index_id))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_RTREE:
+      if(drop_rtree_index(db, index_id))
+        return -1;
+      break;
     default:
       show_index_error(db, "Invalid index type");
       return -1;
@@ -2366,7 +5543,10 @@ gint wg_drop_index(void *db, gint index_id){
   wg_free_fixlen_object(db, &dbh->indexhdr_area_header, index_id);
 
   /* decrement index counter */
-  dbh->index_control_area_header.number_of_indexes--;
+  if(!building) {
+    dbh->index_control_area_header.number_of_indexes--;
+    dbh->index_control_area_header.index_epoch++;
+  }
 
   return 0;
 }
@@ -2426,6 +5606,14 @@ gint wg_multi_column_to_index_id(void *db, gint *columns, gint col_count,
   }
 #endif
 
+  /* JSON path index is not in the column lists */
+  if(type == WG_INDEX_TYPE_HASH_PATH) {
+    gint *plist = &dbh->index_control_area_header.index_path_list;
+    if(col_count == 1 && columns[0] == 0 && !template_offset && *plist)
+      return ((gcell *) offsettoptr(db, *plist))->car;
+    return -1;
+  }
+
   /* Column count validation */
   if(col_count < 1) {
     show_index_error(db, "need at least one indexed column");
@@ -2467,8 +5655,11 @@ gint wg_multi_column_to_index_id(void *db, gint *columns, gint col_count,
          hdr->template_offset == template_offset) {
 #endif
         if(hdr->fields == col_count) {
+          /* T-tree column order is significant */
+          gint *key_cols = (hdr->type == WG_INDEX_TYPE_TTREE ?
+            columns : sorted_cols);
           for(i=0; i<col_count; i++) {
-            if(hdr->rec_field_index[i]!=sorted_cols[i])
+            if(hdr->rec_field_index[i]!=key_cols[i])
               goto nextindex;
           }
           return ilistelem->car; /* index id */
@@ -2605,6 +5796,13 @@ void * wg_get_all_indexes(void *db, gint *count) {
     }
   }
 
+  ilist = &dbh->index_control_area_header.index_path_list;
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    res[(*count)++] = ilistelem->car;
+    ilist = &ilistelem->cdr;
+  }
+
   if(*count != dbh->index_control_area_header.number_of_indexes) {
     show_index_error(db, "Index control area is corrupted");
     free(res);
@@ -2616,12 +5814,12 @@ void * wg_get_all_indexes(void *db, gint *count) {
 #define INDEX_ADD_ROW(d, h, i, r) \
   switch(h->type) { \
     case WG_INDEX_TYPE_TTREE: \
-      if(ttree_add_row(d, i, r)) \
+      if(ttree_versioned_add_row(d, i, r)) \
         return -2; \
       break; \
     case WG_INDEX_TYPE_TTREE_JSON: \
       if(is_plain_record(r)) { \
-        if(ttree_add_row(d, i, r)) \
+        if(ttree_versioned_add_row(d, i, r)) \
           return -2; \
       } \
       break; \
@@ -2635,20 +5833,33 @@ void * wg_get_all_indexes(void *db, gint *count) {
           return -2; \
       } \
       break; \
+    case WG_INDEX_TYPE_BITMAP: \
+      if(bitmap_add_row(d, i, r)) \
+        return -2; \
+      break; \
+    case WG_INDEX_TYPE_TRIGRAM: \
+      if(trigram_add_row(d, i, r)) \
+        return -2; \
+      break; \
+    case WG_INDEX_TYPE_RTREE: \
+      if(rtree_add_row(d, i, r)) \
+        return -2; \
+      break; \
     default: \
       show_index_error(db, "unknown index type, ignoring"); \
       break; \
-  }
+  } \
+  stats_add_row(d, h, r);
 
 #define INDEX_REMOVE_ROW(d, h, i, r) \
   switch(h->type) { \
     case WG_INDEX_TYPE_TTREE: \
-      if(ttree_remove_row(d, i, r) < -2) \
+      if(ttree_versioned_remove_row(d, i, r) < -2) \
         return -2; \
       break; \
     case WG_INDEX_TYPE_TTREE_JSON: \
       if(is_plain_record(r)) { \
-        if(ttree_remove_row(d, i, r) < -2) \
+        if(ttree_versioned_remove_row(d, i, r) < -2) \
           return -2; \
       } \
       break; \
@@ -2662,10 +5873,23 @@ void * wg_get_all_indexes(void *db, gint *count) {
           return -2; \
       } \
       break; \
+    case WG_INDEX_TYPE_BITMAP: \
+      if(bitmap_remove_row(d, i, r) < -2) \
+        return -2; \
+      break; \
+    case WG_INDEX_TYPE_TRIGRAM: \
+      if(trigram_remove_row(d, i, r) < -2) \
+        return -2; \
+      break; \
+    case WG_INDEX_TYPE_RTREE: \
+      if(rtree_remove_row(d, i, r) < -2) \
+        return -2; \
+      break; \
     default: \
       show_index_error(db, "unknown index type, ignoring"); \
       break; \
-  }
+  } \
+  stats_remove_row(d, h, r);
 
 /** Add data of one field to all indexes
  * Loops over indexes in one field and inserts the data into
@@ -2700,8 +5924,10 @@ gint wg_index_add_field(void *db, void *rec, gint column) {
     if(ilistelem->car) {
       wg_index_header *hdr = \
         (wg_index_header *) offsettoptr(db, ilistelem->car);
-      if(reclen > hdr->rec_field_index[hdr->fields - 1]) {
-        if(MATCH_TEMPLATE(db, hdr, rec)) {
+      if(reclen > max_index_column(hdr)) {
+        if(MATCH_TEMPLATE(db, hdr, rec) &&\
+          !index_row_pending(db, ilistelem->car, rec) &&\
+          queue_index_row(db, ilistelem->car, rec)) {
           INDEX_ADD_ROW(db, hdr, ilistelem->car, rec)
         }
       }
@@ -2720,8 +5946,10 @@ gint wg_index_add_field(void *db, void *rec, gint column) {
     if(ilistelem->car) {
       wg_index_header *hdr = \
         (wg_index_header *) offsettoptr(db, ilistelem->car);
-      if(reclen > hdr->rec_field_index[hdr->fields - 1]) {
-        if(MATCH_TEMPLATE(db, hdr, rec)) {
+      if(reclen > max_index_column(hdr)) {
+        if(MATCH_TEMPLATE(db, hdr, rec) &&\
+          !index_row_pending(db, ilistelem->car, rec) &&\
+          queue_index_row(db, ilistelem->car, rec)) {
           INDEX_ADD_ROW(db, hdr, ilistelem->car, rec)
         }
       }
@@ -2730,6 +5958,28 @@ gint wg_index_add_field(void *db, void *rec, gint column) {
   }
 #endif
 
+  /* Finally, refresh the copies of the field in covering indexes.
+   * This is done last, as the row may have been (re-)entered into
+   * a template index above.
+   */
+  ilist = &dbh->index_control_area_header.index_include_table[column];
+  while(*ilist) {
+    ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(ilistelem->car) {
+      wg_index_header *hdr = \
+        (wg_index_header *) offsettoptr(db, ilistelem->car);
+      if(reclen > max_index_column(hdr)) {
+        if(MATCH_TEMPLATE(db, hdr, rec) &&\
+          !index_row_pending(db, ilistelem->car, rec)) {
+          update_index_entry(db, ilistelem->car, rec, column);
+        }
+      }
+    }
+    ilist = &ilistelem->cdr;
+  }
+
+  if(dbh->index_control_area_header.index_build_list)
+    return update_building_indexes(db, rec, column, 1);
   return 0;
 }
 
@@ -2763,7 +6013,7 @@ gint wg_index_add_rec(void *db, void *rec) {
       if(ilistelem->car) {
         wg_index_header *hdr = \
           (wg_index_header *) offsettoptr(db, ilistelem->car);
-        if(hdr->rec_field_index[hdr->fields - 1] == i) {
+        if(max_index_column(hdr) == i) {
           /* Only add the record if we're at the last column
            * of the index. This way we ensure that a.) a record
            * is entered once into a multi-column index and b.) the
@@ -2773,7 +6023,8 @@ gint wg_index_add_rec(void *db, void *rec) {
            * also the last column, therefore the above is valid,
            * altough the check is unnecessary.
            */
-          if(MATCH_TEMPLATE(db, hdr, rec)) {
+          if(MATCH_TEMPLATE(db, hdr, rec) &&\
+            queue_index_row(db, ilistelem->car, rec)) {
             INDEX_ADD_ROW(db, hdr, ilistelem->car, rec)
           }
         }
@@ -2814,7 +6065,7 @@ gint wg_index_add_rec(void *db, void *rec) {
           }
         }
         if(firstmatch==i &&\
-          reclen > hdr->rec_field_index[hdr->fields - 1]) {
+          reclen > max_index_column(hdr)) {
           /* The record matches AND this is the first time we
            * see this index. Update it.
            */
@@ -2827,6 +6078,8 @@ nexttmpl1:
 #endif
 
   }
+  if(dbh->index_control_area_header.index_build_list)
+    return update_building_indexes(db, rec, -1, 1);
   return 0;
 }
 
@@ -2865,9 +6118,12 @@ gint wg_index_del_field(void *db, void *rec, gint column) {
       wg_index_header *hdr = \
         (wg_index_header *) offsettoptr(db, ilistelem->car);
 
-      if(reclen > hdr->rec_field_index[hdr->fields - 1]) {
-        if(MATCH_TEMPLATE(db, hdr, rec)) {
+      if(reclen > max_index_column(hdr)) {
+        if(MATCH_TEMPLATE(db, hdr, rec) &&\
+          !index_row_pending(db, ilistelem->car, rec)) {
           INDEX_REMOVE_ROW(db, hdr, ilistelem->car, rec)
+          /* With deferred updates, the row is added back later */
+          queue_index_row(db, ilistelem->car, rec);
         }
       }
     }
@@ -2883,9 +6139,12 @@ gint wg_index_del_field(void *db, void *rec, gint column) {
       wg_index_header *hdr = \
         (wg_index_header *) offsettoptr(db, ilistelem->car);
 
-      if(reclen > hdr->rec_field_index[hdr->fields - 1]) {
-        if(MATCH_TEMPLATE(db, hdr, rec)) {
+      if(reclen > max_index_column(hdr)) {
+        if(MATCH_TEMPLATE(db, hdr, rec) &&\
+          !index_row_pending(db, ilistelem->car, rec)) {
           INDEX_REMOVE_ROW(db, hdr, ilistelem->car, rec)
+          /* With deferred updates, the row is added back later */
+          queue_index_row(db, ilistelem->car, rec);
         }
       }
     }
@@ -2893,6 +6152,8 @@ gint wg_index_del_field(void *db, void *rec, gint column) {
   }
 #endif
 
+  if(dbh->index_control_area_header.index_build_list)
+    return update_building_indexes(db, rec, column, 0);
   return 0;
 }
 
@@ -2925,11 +6186,13 @@ gint wg_index_del_rec(void *db, void *rec) {
       if(ilistelem->car) {
         wg_index_header *hdr = \
           (wg_index_header *) offsettoptr(db, ilistelem->car);
-        if(hdr->rec_field_index[hdr->fields - 1] == i) {
+        if(max_index_column(hdr) == i) {
           /* Only update once per index. See also comment for
            * wg_index_add_rec function.
            */
-          if(MATCH_TEMPLATE(db, hdr, rec)) {
+          /* A pending row is not in the index */
+          if(!unqueue_index_row(db, ilistelem->car, rec) &&\
+            MATCH_TEMPLATE(db, hdr, rec)) {
             INDEX_REMOVE_ROW(db, hdr, ilistelem->car, rec)
           }
         }
@@ -2966,7 +6229,7 @@ gint wg_index_del_rec(void *db, void *rec) {
           }
         }
         if(firstmatch==i &&\
-          reclen > hdr->rec_field_index[hdr->fields - 1]) {
+          reclen > max_index_column(hdr)) {
           /* The record matches AND this is the first time we
            * see this index. Update it.
            */
@@ -2979,9 +6242,521 @@ nexttmpl2:
 #endif
 
   }
+  if(dbh->index_control_area_header.index_build_list)
+    return update_building_indexes(db, rec, -1, 0);
+  return 0;
+}
+
+/* ------------- deferred index maintenance ------------------- */
+
+/*
+ * When index updates are deferred (see wg_defer_indexes()), a row
+ * that is modified is removed from the indexes on the modified column
+ * right away, while it still has the old values. Adding it back is
+ * postponed: the row is recorded as pending for the index, so that
+ * further updates to the same row only need to check the pending set.
+ * wg_flush_indexes() then adds each pending row once, with its final
+ * values. The pending set is a hash table in local memory, owned by
+ * the database handle.
+ */
+
+#define PENDING_HASH(i, r, m) \
+  ((gint) ((((((wg_uint) (r)) >> 3) * 2654435761U) ^ \
+  (((wg_uint) (i)) >> 3)) & (m)))
+#define PENDING_INITIAL_SIZE 1024
+
+/** Get the deferred index data of a handle
+ *  returns NULL if index updates are not deferred.
+ */
+static db_handle_indexdata *deferred_indexdata(void *db) {
+#ifdef USE_DATABASE_HANDLE
+  db_handle_indexdata *idata = \
+    (db_handle_indexdata *) (((db_handle *) db)->indexdata);
+  if(idata && idata->defer)
+    return idata;
+#endif
+  return NULL;
+}
+
+/** Find the slot of a pending row
+ *  returns the slot number, -1 if the row is not pending.
+ */
+static gint find_pending_slot(db_handle_indexdata *idata, gint index_id,
+  gint rec) {
+  gint mask = idata->size - 1;
+  gint i = PENDING_HASH(index_id, rec, mask);
+
+  for(;;) { /* there is always an empty slot */
+    gint *slot = idata->slots + 2*i;
+    if(!slot[0])
+      return -1;
+    if(slot[0] == index_id && slot[1] == rec)
+      return i;
+    i = (i + 1) & mask;
+  }
+}
+
+/** Resize the pending set, dropping the removed rows
+ *  returns 0 on success, -1 on error.
+ */
+static gint resize_pending(void *db, db_handle_indexdata *idata,
+  gint size) {
+  gint *old = idata->slots, oldsize = idata->size, i;
+
+  idata->slots = (gint *) calloc(2*size, sizeof(gint));
+  if(!idata->slots) {
+    idata->slots = old;
+    return show_index_error(db, "Failed to allocate pending index rows");
+  }
+  idata->size = size;
+  idata->used = idata->count;
+  for(i=0; i<oldsize; i++) {
+    if(old[2*i] > 0) {
+      gint j = PENDING_HASH(old[2*i], old[2*i+1], size - 1);
+      while(idata->slots[2*j])
+        j = (j + 1) & (size - 1);
+      idata->slots[2*j] = old[2*i];
+      idata->slots[2*j+1] = old[2*i+1];
+    }
+  }
+  free(old);
+  return 0;
+}
+
+/** Check if a row is pending for an index
+ *  returns 1 if the row is pending (it is currently not in the index).
+ */
+static gint index_row_pending(void *db, gint index_id, void *rec) {
+  db_handle_indexdata *idata = deferred_indexdata(db);
+  if(!idata || !idata->count)
+    return 0;
+  return (find_pending_slot(idata, index_id, ptrtooffset(db, rec)) >= 0);
+}
+
+/** Add a row to the pending set of an index
+ *  The row must not be in the index.
+ *  returns 0 if the row is pending, -1 if the row should be
+ *  added to the index immediately (updates are not deferred or
+ *  the pending set could not be extended).
+ */
+static gint queue_index_row(void *db, gint index_id, void *rec) {
+  db_handle_indexdata *idata = deferred_indexdata(db);
+  gint offset = ptrtooffset(db, rec), i;
+
+  if(!idata)
+    return -1;
+  if(4*(idata->used + 1) > 3*idata->size) {
+    gint size = idata->size;
+    if(4*(idata->count + 1) > size)
+      size *= 2;
+    if(resize_pending(db, idata, size))
+      return -1;
+  }
+  if(find_pending_slot(idata, index_id, offset) >= 0)
+    return 0;
+
+  i = PENDING_HASH(index_id, offset, idata->size - 1);
+  while(idata->slots[2*i] > 0)
+    i = (i + 1) & (idata->size - 1);
+  if(!idata->slots[2*i])
+    idata->used++;
+  idata->slots[2*i] = index_id;
+  idata->slots[2*i+1] = offset;
+  idata->count++;
+  return 0;
+}
+
+/** Remove a row from the pending set of an index
+ *  returns 1 if the row was pending, 0 otherwise.
+ */
+static gint unqueue_index_row(void *db, gint index_id, void *rec) {
+  db_handle_indexdata *idata = deferred_indexdata(db);
+  gint i;
+
+  if(!idata || !idata->count)
+    return 0;
+  i = find_pending_slot(idata, index_id, ptrtooffset(db, rec));
+  if(i < 0)
+    return 0;
+  idata->slots[2*i] = -1; /* removed, keeps the probe chain intact */
+  idata->count--;
+  return 1;
+}
+
+/** Compare pending rows, by index and record offset
+ */
+static int compare_pending(const void *a, const void *b) {
+  const gint *pa = (const gint *) a, *pb = (const gint *) b;
+  if(pa[0] != pb[0])
+    return (pa[0] < pb[0] ? -1 : 1);
+  if(pa[1] != pb[1])
+    return (pa[1] < pb[1] ? -1 : 1);
+  return 0;
+}
+
+/** Add a pending row to an index
+ *  returns 0 on success, -2 on error.
+ */
+static gint flush_index_row(void *db, gint index_id, void *rec) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+
+  if(wg_get_record_len(db, rec) > max_index_column(hdr)) {
+    if(MATCH_TEMPLATE(db, hdr, rec)) {
+      INDEX_ADD_ROW(db, hdr, index_id, rec)
+    }
+  }
+  return 0;
+}
+
+/** Start or stop deferring index updates
+ *  While deferring, rows that are modified through this database
+ *  handle are added back to the indexes by wg_flush_indexes() (also
+ *  called by wg_end_write() and before a query is built), instead of
+ *  on every wg_set_field() call. Stopping flushes the pending rows.
+ *  returns 0 on success, -1 on error, -2 if the indexes could not
+ *  be updated.
+ */
+gint wg_defer_indexes(void *db, gint defer) {
+#ifdef USE_DATABASE_HANDLE
+  db_handle_indexdata **idata = \
+    (db_handle_indexdata **) &(((db_handle *) db)->indexdata);
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    show_index_error(db, "Invalid database pointer in wg_defer_indexes");
+    return -1;
+  }
+#endif
+
+  if(!defer) {
+    gint err = wg_flush_indexes(db);
+    if(*idata)
+      (*idata)->defer = 0;
+    return err;
+  }
+  if(!(*idata)) {
+    *idata = (db_handle_indexdata *) malloc(sizeof(db_handle_indexdata));
+    if(!(*idata))
+      return show_index_error(db, "Failed to allocate deferred index data");
+    memset(*idata, 0, sizeof(db_handle_indexdata));
+  }
+  if(!(*idata)->slots) {
+    (*idata)->slots = (gint *) calloc(2*PENDING_INITIAL_SIZE, sizeof(gint));
+    if(!(*idata)->slots)
+      return show_index_error(db, "Failed to allocate pending index rows");
+    (*idata)->size = PENDING_INITIAL_SIZE;
+  }
+  (*idata)->defer = 1;
+  return 0;
+#else
+  return show_index_error(db, "Deferred index updates not supported");
+#endif
+}
+
+/** Add the pending rows to the indexes
+ *  The rows are added index by index, in the order of their offsets.
+ *  Deferring continues, if it was turned on.
+ *  returns 0 on success, -1 on error, -2 if the indexes could not
+ *  be updated.
+ */
+gint wg_flush_indexes(void *db) {
+  db_handle_indexdata *idata = deferred_indexdata(db);
+  gint *rows, count, i, j, err = 0;
+
+  if(!idata || !idata->count)
+    return 0;
+
+  count = idata->count;
+  rows = (gint *) malloc(2*count*sizeof(gint));
+  if(!rows)
+    return show_index_error(db, "Failed to allocate pending index rows");
+  for(i=0, j=0; i<idata->size; i++) {
+    if(idata->slots[2*i] > 0) {
+      rows[2*j] = idata->slots[2*i];
+      rows[2*j+1] = idata->slots[2*i+1];
+      j++;
+    }
+  }
+  memset(idata->slots, 0, 2*idata->size*sizeof(gint));
+  idata->count = idata->used = 0;
+
+  qsort(rows, count, 2*sizeof(gint), compare_pending);
+  for(i=0; i<count; i++) {
+    if(flush_index_row(db, rows[2*i], offsettoptr(db, rows[2*i+1])))
+      err = -2;
+  }
+  free(rows);
+  return err;
+}
+
+/** Free the deferred index data of a handle
+ *  Normally called when closing the database connection.
+ */
+void wg_cleanup_handle_indexdata(void *db) {
+#ifdef USE_DATABASE_HANDLE
+  db_handle_indexdata *idata = \
+    (db_handle_indexdata *) (((db_handle *) db)->indexdata);
+  if(idata) {
+    if(idata->slots)
+      free(idata->slots);
+    free(idata);
+    ((db_handle *) db)->indexdata = NULL;
+  }
+#endif
+}
+
+/* ------------- online index creation ------------------- */
+
+/*
+ * An index that is built online is created empty and added to
+ * index_build_list. wg_continue_index_build() scans the rows in
+ * chunks, in the order of their offsets, so that the lock can be
+ * released between the chunks. build_cursor is the offset of the
+ * next row to scan. Rows before the cursor are maintained by the
+ * writers (see update_building_indexes()) like in a normal index,
+ * rows after it are picked up by the scan with their current values.
+ * When the scan completes, the index is added to the index lists and
+ * becomes available to queries.
+ */
+
+/** Initialize the structure of an empty index
+ *  returns 0 on success, -1 on error.
+ */
+static gint init_index(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+
+  switch(hdr->type) {
+    case WG_INDEX_TYPE_TTREE:
+      if(ttree_init_root(db, hdr))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_HASH:
+    case WG_INDEX_TYPE_HASH_JSON:
+      if(wg_create_hash(db, HASHIDX_ARRAYP(hdr), 0))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_BITMAP:
+    case WG_INDEX_TYPE_TRIGRAM:
+      if(bitmap_init_dir(db, hdr))
+        return -1;
+      break;
+    case WG_INDEX_TYPE_RTREE:
+      RTREE_ROOT_NODE(hdr) = rtree_new_node(db, hdr->fields, 0);
+      if(!RTREE_ROOT_NODE(hdr))
+        return -1;
+      break;
+    default:
+      show_index_error(db, "Invalid index type");
+      return -1;
+  }
+  return 0;
+}
+
+/** Find an index that is being built
+ *  returns the pointer to the list element, NULL if not found.
+ */
+static gint *find_building_index(void *db, gint index_id) {
+  gint *ilist = &dbmemsegh(db)->index_control_area_header.index_build_list;
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(ilistelem->car == index_id)
+      return ilist;
+    ilist = &ilistelem->cdr;
+  }
+  return NULL;
+}
+
+/** Update the indexes being built after a row was modified
+ *  column is the modified column, -1 if the whole row was added
+ *  or is about to be deleted. add is non-0 after adding or changing
+ *  the values, 0 before removing them.
+ *  returns 0 on success, -2 on error.
+ */
+static gint update_building_indexes(void *db, void *rec, gint column,
+  gint add) {
+  gint offset = ptrtooffset(db, rec);
+  gint reclen = wg_get_record_len(db, rec);
+  gint *ilist = &dbmemsegh(db)->index_control_area_header.index_build_list;
+
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    wg_index_header *hdr = \
+      (wg_index_header *) offsettoptr(db, ilistelem->car);
+    ilist = &ilistelem->cdr;
+
+    if(hdr->build_cursor && offset >= hdr->build_cursor)
+      continue; /* not scanned yet */
+    if(reclen <= max_index_column(hdr) || !MATCH_TEMPLATE(db, hdr, rec))
+      continue;
+    if(column >= 0 && !index_uses_column(db, hdr, column)) {
+      gint i;
+      if(!add)
+        continue;
+      /* Refresh the copy of an included column */
+      for(i=0; i<hdr->include_count; i++) {
+        if(hdr->rec_include_index[i] == column) {
+          update_index_entry(db, ilistelem->car, rec, column);
+          break;
+        }
+      }
+      continue;
+    }
+
+    if(add) {
+      INDEX_ADD_ROW(db, hdr, ilistelem->car, rec)
+    } else {
+      INDEX_REMOVE_ROW(db, hdr, ilistelem->car, rec)
+    }
+  }
+
+  if(column < 0 && !add) {
+    /* The deleted row may be the next one to scan */
+    ilist = &dbmemsegh(db)->index_control_area_header.index_build_list;
+    while(*ilist) {
+      gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+      wg_index_header *hdr = \
+        (wg_index_header *) offsettoptr(db, ilistelem->car);
+      if(hdr->build_cursor == offset) {
+        void *next = wg_get_next_record(db, rec);
+        hdr->build_cursor = (next ? ptrtooffset(db, next) : 0);
+      }
+      ilist = &ilistelem->cdr;
+    }
+  }
+  return 0;
+}
+
+/** Check if the value of a column determines the membership
+ *  or position of a row in an index.
+ */
+static gint index_uses_column(void *db, wg_index_header *hdr, gint column) {
+  gint i;
+  for(i=0; i<hdr->fields; i++) {
+    if(hdr->rec_field_index[i] == column)
+      return 1;
+  }
+#ifdef USE_INDEX_TEMPLATE
+  if(hdr->template_offset) {
+    wg_index_template *tmpl = \
+      (wg_index_template *) offsettoptr(db, hdr->template_offset);
+    void *matchrec = offsettoptr(db, tmpl->offset_matchrec);
+    if(column < wg_get_record_len(db, matchrec) &&\
+      wg_get_encoded_type(db, wg_get_field(db, matchrec, column)) !=\
+      WG_VARTYPE)
+      return 1;
+  }
+#endif
   return 0;
 }
 
+/** Start building an index online
+ *  Arguments are the same as for wg_create_covering_index().
+ *  The index is created empty and is not used by queries until
+ *  the build is completed by wg_continue_index_build(). Rows that
+ *  are modified in the meantime are handled by the build.
+ *  returns the index id on success, -1 on error.
+ */
+gint wg_start_index_build(void *db, gint *columns, gint col_count,
+  gint *include, gint include_count, gint type, gint *matchrec, gint reclen)
+{
+  return create_index(db, columns, col_count, include, include_count,
+    type, matchrec, reclen, 1);
+}
+
+/** Continue building an index online
+ *  Adds up to rows records to the index. The caller should hold
+ *  the write lock for the duration of this call only, so that the
+ *  other clients can access the database between the calls.
+ *  returns 1 if the index was completed and is now in use,
+ *  returns 0 if there are rows left to scan,
+ *  returns -1 on error (invalid arguments), -2 if the index could
+ *  not be updated.
+ */
+gint wg_continue_index_build(void *db, gint index_id, gint rows) {
+  wg_index_header *hdr;
+  gint *ilist[MAX_INDEX_FIELDS];
+  gint *buildp;
+  void *rec;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    show_index_error(db, "Invalid database pointer in wg_continue_index_build");
+    return -1;
+  }
+#endif
+  buildp = find_building_index(db, index_id);
+  if(!buildp) {
+    show_index_error(db, "Index is not being built");
+    return -1;
+  }
+  hdr = (wg_index_header *) offsettoptr(db, index_id);
+
+  rec = (hdr->build_cursor ? offsettoptr(db, hdr->build_cursor) : NULL);
+  while(rec && rows-- > 0) {
+    if(flush_index_row(db, index_id, rec))
+      return -2;
+    rec = wg_get_next_record(db, rec);
+  }
+  hdr->build_cursor = (rec ? ptrtooffset(db, rec) : 0);
+  if(rec)
+    return 0;
+
+  /* Scan complete, make the index available. The positions in the
+   * index lists are found again, as other indexes may have been
+   * created or dropped during the build.
+   */
+  if(find_index_lists(db, hdr, ilist))
+    return -1;
+  delete_from_list(db, buildp);
+  if(link_index(db, index_id, ilist))
+    return -1;
+  if(refresh_index_stats(db, index_id))
+    return -1;
+  return 1;
+}
+
+/** Get the progress of an online index build
+ *  returns the percentage of the data area scanned (100 if the
+ *  index is in use), -1 if the index was not found.
+ */
+gint wg_index_build_progress(void *db, gint index_id) {
+  db_area_header *area = &dbmemsegh(db)->datarec_area_header;
+  wg_index_header *hdr;
+  double total = 0, scanned = 0;
+  gint i;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    show_index_error(db, "Invalid database pointer in wg_index_build_progress");
+    return -1;
+  }
+#endif
+  if(!find_building_index(db, index_id)) {
+    gint *ilist = &dbmemsegh(db)->index_control_area_header.index_list;
+    while(*ilist) {
+      gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+      if(ilistelem->car == index_id)
+        return 100;
+      ilist = &ilistelem->cdr;
+    }
+    return -1;
+  }
+  hdr = (wg_index_header *) offsettoptr(db, index_id);
+  if(!hdr->build_cursor)
+    return 99; /* waiting for the final call */
+
+  for(i=0; i<=area->last_subarea_index; i++) {
+    db_subarea_header *sub = &area->subarea_array[i];
+    total += sub->size;
+    if(hdr->build_cursor >= sub->offset + sub->size)
+      scanned += sub->size;
+    else if(hdr->build_cursor > sub->offset)
+      scanned += hdr->build_cursor - sub->offset;
+  }
+  i = (gint) (total > 0 ? 100 * scanned / total : 0);
+  return (i > 99 ? 99 : i);
+}
+
 /* --------------- error handling ------------------------------*/
 
 /** called with err msg
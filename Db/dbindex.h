@@ -68,6 +68,10 @@
 #define WG_INDEX_TYPE_TTREE_JSON    51
 #define WG_INDEX_TYPE_HASH          60
 #define WG_INDEX_TYPE_HASH_JSON     61
+#define WG_INDEX_TYPE_HASH_PATH     62
+#define WG_INDEX_TYPE_BITMAP        70
+#define WG_INDEX_TYPE_TRIGRAM       80
+#define WG_INDEX_TYPE_RTREE         90
 
 /* Index header helpers */
 #define TTREE_ROOT_NODE(x) (x->ctl.t.offset_root_node)
@@ -76,13 +80,58 @@
 #define TTREE_MAX_NODE(x) (x->ctl.t.offset_max_node)
 #endif
 #define HASHIDX_ARRAYP(x) (&(x->ctl.h.hasharea))
+#define BITMAP_VALUE_DIR(x) (x->ctl.b.value_dir)
+#define RTREE_ROOT_NODE(x) (x->ctl.r.offset_root_node)
+
+/* T-tree key helpers. Single column index is keyed by the encoded
+ * field value. Composite (multi-column) index is keyed by the record
+ * offset and the columns are compared lexicographically in the order
+ * given at index creation. Search keys for a composite index are
+ * offsets to gint arrays laid out like records, unused trailing
+ * columns are WG_ILLEGAL (see wg_compare_ttree_keys()).
+ */
+#define TTREE_KEY(d, h, r) ((h)->fields == 1 ? \
+        wg_get_field(d, r, (h)->rec_field_index[0]) : ptrtooffset(d, r))
+#define TTREE_COMPARE(d, h, a, b) ((h)->fields == 1 ? \
+        WG_COMPARE(d, a, b) : wg_compare_ttree_keys(d, h, a, b))
+#define TTREE_KEYBUF_SIZE (RECORD_HEADER_GINTS + MAX_INDEXED_FIELDNR + 1)
+
+/* Covering index helpers. An index with included columns stores
+ * offsets of index entries (special records holding copies of the
+ * covered fields) instead of data row offsets. The entry keeps the
+ * offset of its row in the backlinks slot.
+ */
+#define COVERING_ENTRY_RECORD(d, o) \
+        dbfetch(d, (o) + RECORD_BACKLINKS_POS*sizeof(gint))
+#define INDEX_ENTRY_RECORD(d, h, o) ((h)->include_count ? \
+        COVERING_ENTRY_RECORD(d, o) : (o))
+
+/* Bitmap index helpers. Records are numbered by their offset (records
+ * are 8-byte aligned). The high bits of the number select a chunk
+ * and the low 16 bits the position of the record inside the chunk.
+ */
+#define BITMAP_CHUNK_BITS   16
+#define BITMAP_CHUNK_SIZE   (1<<BITMAP_CHUNK_BITS)
+#define BITMAP_WORD_BITS    (8*sizeof(wg_uint))
+#define BITMAP_CHUNK_WORDS  (BITMAP_CHUNK_SIZE/BITMAP_WORD_BITS)
+#define BITMAP_RECORD_NR(o) ((o) >> 3)
+#define BITMAP_RECORD_OFFSET(k, l) \
+        ((((k) << BITMAP_CHUNK_BITS) | (l)) << 3)
+
+/* JSON path index: max number of object keys in the path of an entry.
+ * The nesting of the documents is also limited by WG_COMPARE_REC_DEPTH.
+ */
+#define PATH_INDEX_MAX_KEYS 8
 
 /* ====== data structures ======== */
 
 /** structure of t-node
 *   (array of data pointers, pointers to parent/children nodes, control data)
-*   overall size is currently 64 bytes (cache line?) if array size is 10,
-*   with extra node chaining pointers the array size defaults to 8.
+*   overall size is 64 bytes (cache line?) on 32-bit platforms if array
+*   size is 10, not counting subtree_count. With extra node chaining
+*   pointers the array size defaults to 8.
+*   subtree_count is the number of elements in the node and all its
+*   descendants, it allows finding elements by their position.
 */
 struct wg_tnode{
   gint parent_offset;
@@ -91,6 +140,7 @@ struct wg_tnode{
   short number_of_elements;
   unsigned char left_subtree_height;
   unsigned char right_subtree_height;
+  gint subtree_count;   /** elements in this subtree */
   gint array_of_values[WG_TNODE_ARRAY_SIZE];
   gint left_child_offset;
   gint right_child_offset;
@@ -100,6 +150,28 @@ struct wg_tnode{
 #endif
 };
 
+/** deferred index updates of a database handle
+*   (kept in local memory, see wg_defer_indexes())
+*/
+typedef struct {
+  gint defer;           /** non-0 if index updates are deferred */
+  gint count;           /** number of pending rows */
+  gint used;            /** used slots, including removed rows */
+  gint size;            /** number of slots, a power of 2 */
+  gint *slots;          /** (index id, record offset) pairs */
+} db_handle_indexdata;
+
+/** index statistics (see wg_get_index_stats())
+*/
+typedef struct {
+  gint rows;            /** rows in the index */
+  gint distinct;        /** estimated number of distinct keys */
+  gint nulls;           /** rows with NULL in the first indexed column */
+  gint buckets;         /** histogram buckets, 0 if no numeric values */
+  double bound[WG_INDEX_HIST_BUCKETS+1];  /** bucket boundaries */
+  gint bucket_rows[WG_INDEX_HIST_BUCKETS]; /** rows in each bucket */
+} wg_index_stats;
+
 /* ==== Protos ==== */
 
 /* API functions (copied in indexapi.h) */
@@ -108,6 +180,8 @@ gint wg_create_index(void *db, gint column, gint type,
   gint *matchrec, gint reclen);
 gint wg_create_multi_index(void *db, gint *columns, gint col_count,
   gint type, gint *matchrec, gint reclen);
+gint wg_create_covering_index(void *db, gint *columns, gint col_count,
+  gint *include, gint include_count, gint type, gint *matchrec, gint reclen);
 gint wg_drop_index(void *db, gint index_id);
 gint wg_column_to_index_id(void *db, gint column, gint type,
   gint *matchrec, gint reclen);
@@ -116,10 +190,24 @@ gint wg_multi_column_to_index_id(void *db, gint *columns, gint col_count,
 gint wg_get_index_type(void *db, gint index_id);
 void * wg_get_index_template(void *db, gint index_id, gint *reclen);
 void * wg_get_all_indexes(void *db, gint *count);
+gint wg_defer_indexes(void *db, gint defer);
+gint wg_flush_indexes(void *db);
+gint wg_start_index_build(void *db, gint *columns, gint col_count,
+  gint *include, gint include_count, gint type, gint *matchrec, gint reclen);
+gint wg_continue_index_build(void *db, gint index_id, gint rows);
+gint wg_index_build_progress(void *db, gint index_id);
+gint wg_get_index_stats(void *db, gint index_id, wg_index_stats *stats);
+gint wg_refresh_index_stats(void *db, gint index_id);
 
 /* WhiteDB internal functions */
 
+void wg_cleanup_handle_indexdata(void *db);
+
 gint wg_search_ttree_index(void *db, gint index_id, gint key);
+gint wg_index_read_begin(void *db, gint index_id);
+gint wg_index_read_retry(void *db, gint index_id, gint version);
+gint wg_compare_ttree_keys(void *db, wg_index_header *hdr, gint a, gint b);
+gint wg_init_ttree_key(void *db, gint *keybuf);
 
 #ifndef TTREE_CHAINED_NODES
 gint wg_ttree_find_glb_node(void *db, gint nodeoffset);
@@ -127,16 +215,31 @@ gint wg_ttree_find_lub_node(void *db, gint nodeoffset);
 gint wg_ttree_find_leaf_predecessor(void *db, gint nodeoffset);
 gint wg_ttree_find_leaf_successor(void *db, gint nodeoffset);
 #endif
-gint wg_search_ttree_rightmost(void *db, gint rootoffset,
+gint wg_search_ttree_rightmost(void *db, gint index_id, gint rootoffset,
   gint key, gint *result, struct wg_tnode *rb_node);
-gint wg_search_ttree_leftmost(void *db, gint rootoffset,
+gint wg_search_ttree_leftmost(void *db, gint index_id, gint rootoffset,
   gint key, gint *result, struct wg_tnode *lb_node);
 gint wg_search_tnode_first(void *db, gint nodeoffset, gint key,
-  gint column);
+  gint index_id);
 gint wg_search_tnode_last(void *db, gint nodeoffset, gint key,
-  gint column);
+  gint index_id);
+gint wg_ttree_rank(void *db, gint nodeoffset, gint slot);
+gint wg_ttree_select(void *db, gint rootoffset, gint pos, gint *slot);
 
 gint wg_search_hash(void *db, gint index_id, gint *values, gint count);
+gint wg_index_covers_columns(void *db, wg_index_header *hdr,
+  gint *columns, gint count);
+
+gint wg_bitmap_value_count(void *db, gint index_id);
+gint wg_bitmap_value(void *db, gint index_id, gint i, gint *set);
+gint wg_bitmap_set_card(void *db, gint set);
+gint wg_bitmap_chunk_count(void *db, gint set);
+gint wg_bitmap_chunk_key(void *db, gint set, gint i);
+gint wg_bitmap_or_chunk(void *db, gint set, gint key, wg_uint *words);
+gint wg_bitmap_find_set(void *db, gint index_id, gint value);
+gint wg_trigram_keys(void *db, gint enc, gint **keys);
+gint wg_rtree_coord(void *db, gint enc, double *coord);
+gint wg_search_rtree(void *db, gint index_id, double *box, gint **offsets);
 
 #ifdef USE_INDEX_TEMPLATE
 gint wg_match_template(void *db, wg_index_template *tmpl, void *rec);
@@ -146,6 +249,9 @@ gint wg_index_add_field(void *db, void *rec, gint column);
 gint wg_index_add_rec(void *db, void *rec);
 gint wg_index_del_field(void *db, void *rec, gint column);
 gint wg_index_del_rec(void *db, void *rec);
+gint wg_path_index_add_field(void *db, void *rec, gint column);
+gint wg_path_index_del_field(void *db, void *rec, gint column);
+gint wg_path_index_del_rec(void *db, void *rec);
 
 
 #endif /* DEFINED_DBINDEX_H */
@@ -55,6 +55,7 @@ extern "C" {
 #endif
 #include "dballoc.h"
 #include "dblock.h"
+#include "dbindex.h"
 
 #if (LOCK_PROTO==TFQUEUE)
 #ifdef __linux__
@@ -105,6 +106,8 @@ extern "C" {
 #if defined(__ARM_EABI__) && defined(__linux__)
 typedef int (kernel_cmpxchg_t) (int oldval, int newval, int *ptr);
 #define kernel_cmpxchg (*(kernel_cmpxchg_t *) 0xffff0fc0)
+typedef void (kernel_dmb_t) (void);
+#define kernel_dmb (*(kernel_dmb_t *) 0xffff0fa0)
 #endif
 
 /* For easier testing of GCC version */
@@ -456,6 +459,28 @@ gint wg_compare_and_swap(volatile gint *ptr, gint oldv, gint newv) {
 #endif
 }
 
+/** Full memory barrier. Loads and stores before the barrier
+ *  are completed before any that follow it.
+ */
+
+void wg_memory_barrier(void) {
+#if defined(DUMMY_ATOMIC_OPS)
+  /* nothing to do */
+#elif defined(__GNUC__)
+#if defined(_MIPS_ARCH)
+  __asm__ __volatile__("sync" : : : "memory");
+#elif (GCC_VERSION < 40400) && defined(__ARM_EABI__) && defined(__linux__)
+  kernel_dmb();
+#else /* try gcc intrinsic */
+  __sync_synchronize();
+#endif
+#elif defined(_WIN32)
+  MemoryBarrier();
+#else
+#error Atomic operations not implemented for this compiler
+#endif
+}
+
 /* ----------- read and write transaction support ----------- */
 
 /*
@@ -475,10 +500,12 @@ gint wg_start_write(void * db) {
 }
 
 /** End write transaction
- *   Current implementation: release database level exclusive lock
+ *   Current implementation: apply deferred index updates and
+ *   release database level exclusive lock
  */
 
 gint wg_end_write(void * db, gint lock) {
+  wg_flush_indexes(db);
   return db_wulock(db, lock);
 }
 
@@ -78,6 +78,7 @@ gint wg_end_read(void * dbase, gint lock);  /* end read transaction */
 /* WhiteDB internal functions */
 
 gint wg_compare_and_swap(volatile gint *ptr, gint oldv, gint newv);
+void wg_memory_barrier(void);
 gint wg_init_locks(void * db); /* (re-) initialize locking subsystem */
 
 #if (LOCK_PROTO==RPSPIN)
@@ -56,6 +56,8 @@ extern "C" {
 #include "dbfeatures.h"
 #include "dbmem.h"
 #include "dblog.h"
+#include "dbindex.h"
+#include "dbquery.h"
 
 /* ====== Private headers and defs ======== */
 
@@ -342,7 +344,9 @@ void* wg_attach_memsegment(const char* dbasename, gint minsize,
  * returns 0 if OK
  */
 int wg_detach_database(void* dbase) {
-  int err = detach_shared_memory(dbmemseg(dbase));
+  int err;
+  wg_flush_indexes(dbase); /* deferred updates must reach the indexes */
+  err = detach_shared_memory(dbmemseg(dbase));
 #ifdef USE_DATABASE_HANDLE
   if(!err) {
     free_dbhandle(dbase);
@@ -451,6 +455,8 @@ static void free_dbhandle(void *dbhandle) {
 #ifdef USE_DBLOG
   wg_cleanup_handle_logdata(dbhandle);
 #endif
+  wg_cleanup_handle_indexdata(dbhandle);
+  wg_cleanup_handle_querycache(dbhandle);
   free(dbhandle);
 }
 
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /* ====== Private headers and defs ======== */
 
@@ -44,15 +45,59 @@ extern "C" {
 #include "dbschema.h"
 #include "dbhash.h"
 
-/* T-tree based scoring */
-#define TTREE_SCORE_EQUAL 5
-#define TTREE_SCORE_BOUND 2
+/* Index template scoring */
 #define TTREE_SCORE_NULL -1 /** penalty for null values, which
                              *  are likely to be abundant */
 #define TTREE_SCORE_MASK 5  /** matching field in template */
 
+/* Query planner cost units. The cost of checking a row against the
+ * argument list is the unit, the others are relative to it. */
+#define PLAN_COST_ROW 1.0     /** fetch and check a row */
+#define PLAN_COST_ENTRY 0.1   /** step to the next index entry */
+#define PLAN_COST_SET 0.3     /** add a row to a result set */
+#define PLAN_COST_SEEK 0.5    /** descend one level of an index */
+#define PLAN_COST_BITMAP 0.02 /** process a row in a bitmap */
+#define PLAN_COST_DOC 4.0     /** check a JSON document against a clause */
+
+/* Default selectivities if the column has no statistics */
+#define PLAN_SEL_EQUAL 0.05
+#define PLAN_SEL_RANGE 0.33
+#define PLAN_SEL_NOT_EQUAL 0.9
+#define PLAN_SEL_CONTAINS 0.1
+
+#define PLAN_MAX_CANDIDATES 32 /** indexes considered for an intersection */
+
+/* Seconds of processor time since s (see wg_query_stats) */
+#define QUERY_TIME(s) ((double) (clock() - (s)) / CLOCKS_PER_SEC)
+
 /* Query flags for internal use */
 #define QUERY_FLAGS_PREFETCH 0x1000
+#define QUERY_FLAGS_DESCENDING 0x2000  /* T-tree range read backwards */
+
+/* Condition flags for internal use. The arguments of a disjunction
+ * all have WG_COND_OR set, the first one also has QUERY_COND_GROUP.
+ */
+#define QUERY_COND_GROUP 0x4000
+#define is_grouped_arg(a) ((a)->cond & WG_COND_OR)
+
+/* Kinds of argument values, set by compile_arglist(). A field with the
+ * same encoding as the value is compared without decoding it.
+ */
+#define QUERY_COND_SMALLINT 0x8000  /* smallint, 3 tag bits */
+#define QUERY_COND_TAGGED 0x10000   /* fixpoint or date, 8 tag bits */
+#define QUERY_COND_TIME 0x20000     /* time, 8 tag bits, unsigned */
+#define QUERY_COND_STR 0x40000      /* string, compared with strcmp() */
+#define QUERY_COND_KINDS (QUERY_COND_SMALLINT|QUERY_COND_TAGGED|\
+  QUERY_COND_TIME|QUERY_COND_STR)
+#define QUERY_COND_FLAGS (WG_COND_OR|QUERY_COND_GROUP|QUERY_COND_KINDS)
+
+#define QUERY_COMPILE_MAXARGS 32    /* longest argument list reordered */
+#define QUERY_BATCH_SIZE 64         /* rows checked together */
+
+#define QUERY_GROUP_INITSIZE 64     /* initial hash slots of GROUP BY */
+#define QUERY_ORDER_INITSIZE 256    /* initial rows in the ORDER BY heap */
+
+#define JOIN_ENTRY_GINTS 4          /* size of a join hash table entry */
 
 #define QUERY_RESULTSET_PAGESIZE 63  /* mpool is aligned, so we can align
                                       * the result pages too by selecting an
@@ -85,20 +130,175 @@ typedef struct {
   gint res_count;                 /** number of rows in results */
 } query_result_set;
 
+/** JSON path index lookup of a document query clause */
+typedef struct {
+  gint reclist;                   /** documents of the most selective key */
+  gint size;                      /** length of reclist, -1 if none */
+  gint exact;                     /** reclist matches the clause exactly */
+  gint done;                      /** clause is already applied */
+} json_path_probe;
+
+/** Group table of wg_query_group() */
+typedef struct {
+  wg_query_groups *res;           /** groups found so far */
+  gint alloc;                     /** groups allocated in res */
+  gint size;                      /** hash table slots, a power of 2 */
+  gint *slots;                    /** group numbers, -1 if free */
+  wg_uint *hashes;                /** hash of the key of each group */
+} query_group_table;
+
+/** Hash table of the inner rows of a join. The entries are
+ *  (key, row offset, hash, next entry) tuples, chained from the
+ *  buckets. */
+typedef struct {
+  gint size;                      /** buckets, a power of 2 */
+  gint *buckets;                  /** first entry, -1 if empty */
+  gint count;                     /** number of entries */
+  gint *entries;                  /** JOIN_ENTRY_GINTS per entry */
+} join_hash_table;
+
+/** Cached result of a prefetch query. The entry is shared by the
+ *  cache and the query objects that read it. */
+typedef struct query_cache_entry {
+  struct query_cache_entry *next; /** next entry in the bucket */
+  wg_uint hash;                   /** hash of the key */
+  gint *key;                      /** normalised query (see cache_key()) */
+  gint keylen;                    /** size of key in gints */
+  gint refcount;                  /** users: the cache and the queries */
+  gint used;                      /** tick of the last use */
+  wg_query result;                /** query state after prefetching */
+} query_cache_entry;
+
+/** Query result cache of a database handle */
+typedef struct {
+  gint size;                      /** maximum number of entries */
+  gint count;                     /** number of entries */
+  gint buckets_count;             /** buckets, a power of 2 */
+  query_cache_entry **buckets;    /** entries, chained by hash */
+  gint write_epoch;               /** epochs of the cached results */
+  gint index_epoch;
+  gint tick;                      /** incremented on each lookup */
+  gint hits;
+  gint misses;
+} query_cache;
+
 /* ======= Private protos ================ */
 
-static gint most_restricting_column(void *db,
-  wg_query_arg *arglist, gint argc, gint *index_id);
+static gint column_stats(void *db, gint column, wg_index_stats *stats);
+static double histogram_fraction(wg_index_stats *stats, int have_lo,
+  double lo, int have_hi, double hi);
+static double column_selectivity(void *db, wg_query_arg *arglist,
+  gint argc, gint column, int range);
+static double plan_seek_cost(double rows);
+static double table_rows(void *db);
+static double index_selectivity(void *db, wg_index_header *hdr,
+  wg_query_arg *arglist, gint argc, double *probes);
+static double bitmap_cost(void *db, wg_query_arg *arglist, gint argc,
+  double table, double *rows);
+static gint plan_query(void *db, wg_query_arg *arglist, gint argc,
+  gint set_plans, wg_query_plan *plan);
+static gint plan_valid(void *db, wg_query_plan *plan);
+static int template_score(void *db, wg_index_header *hdr,
+  wg_query_arg *arglist, gint argc);
+static gint column_bounds(void *db, wg_query_arg *arglist, gint argc,
+  gint col, gint *start_bound, gint *end_bound,
+  int *start_inclusive, int *end_inclusive);
+static gint in_list_values(void *db, gint value, gint **values);
+static gint prefix_range(void *db, gint value, gint *buf, gint *list);
+static gint prefix_match(void *db, gint encoded, gint prefix);
+static gint sort_values(void *db, gint *values, gint count);
+static gint find_in_arg(wg_query_arg *arglist, gint argc, gint column);
+static gint compare_result(gint cond, gint cr);
+static gint check_condition(void *db, gint encoded, gint cond, gint value);
+static gint check_arg(void *db, gint encoded, wg_query_arg *arg);
 static gint check_arglist(void *db, void *rec, wg_query_arg *arglist,
   gint argc);
+static gint check_arglist_batch(void *db, gint *offsets, gint count,
+  wg_query_arg *arglist, gint argc);
+static gint checked_group_size(wg_query_arg *arglist, gint argc, gint i);
+static gint arg_kind(void *db, wg_query_arg *arg);
+static double arg_rank(void *db, wg_query_arg *arglist, gint size);
+static void compile_arglist(void *db, wg_query_arg *arglist, gint argc);
+static gint group_size(wg_query_arg *arglist, gint argc, gint i);
+static gint group_column(wg_query_arg *arglist, gint size);
+static gint group_args(void *db, wg_query_arg *arglist, gint argc,
+  gint *listbuf);
+static gint check_arg_value(void *db, gint cond, gint value);
 static gint prepare_params(void *db, void *matchrec, gint reclen,
-  wg_query_arg *arglist, gint argc,
+  wg_query_arg *arglist, gint argc, gint group,
   wg_query_arg **farglist, gint *fargc);
-static gint find_ttree_bounds(void *db, gint index_id, gint col,
+static gint find_ttree_bounds(void *db, gint index_id,
   gint start_bound, gint end_bound, gint start_inclusive, gint end_inclusive,
   gint *curr_offset, gint *curr_slot, gint *end_offset, gint *end_slot);
+static gint setup_query(void *db, wg_query *query,
+  wg_query_arg *full_arglist, gint fargc, gint flags, wg_query_arg *argbuf);
+static gint hash_cursor(void *db, wg_query *query,
+  wg_query_arg *arglist, gint argc);
+static gint find_column_index(void *db, gint column, gint type);
+static gint batch_size(query_result_set *set, wg_uint rowlimit);
+static gint append_checked(void *db, wg_query *query, query_result_set *set,
+  gint *batch, gint count, wg_query_arg *arglist, gint argc);
+static gint rtree_box(void *db, wg_index_header *hdr,
+  wg_query_arg *arglist, gint argc, double *box);
+static gint rtree_query(void *db, wg_query *query, gint index_id,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit);
+static gint bitmap_query(void *db, wg_query *query, wg_query_arg *arglist,
+  gint argc, wg_uint rowlimit);
+static gint *sorted_in_list(void *db, gint value, gint *count);
+static gint index_rows(void *db, gint index_id, gint epoch,
+  wg_query_arg *arglist, gint argc, query_result_set *set);
+static gint intersect_query(void *db, wg_query *query, wg_query_plan *plan,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit);
 static wg_query *internal_build_query(void *db, void *matchrec, gint reclen,
-  wg_query_arg *arglist, gint argc, gint flags, wg_uint rowlimit);
+  wg_query_arg *arglist, gint argc, gint flags, wg_uint rowlimit,
+  wg_query_plan *plan);
+static gint order_index(void *db, gint column);
+static gint order_compare(void *db, gint *a, gint *b, gint order);
+static void order_sift_down(void *db, gint *heap, gint count, gint i,
+  gint order);
+static gint order_rows(void *db, wg_query *query, gint column, gint order,
+  wg_uint limit);
+
+static gint ttree_aggregate(void *db, wg_query *query,
+  wg_query_aggr *specs, gint count);
+static wg_query *build_count_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit);
+static gint aggregate_number(void *db, gint enc, double *number);
+static gint init_aggregates(void *db, wg_query_aggr *specs, gint count);
+static void aggregate_value(void *db, wg_query_aggr *spec, gint enc);
+
+static wg_uint hash_group_bytes(wg_uint hash, char *bytes, gint len);
+static wg_uint hash_group_key(void *db, gint *keys, gint count);
+static gint init_group_table(void *db, query_group_table *tbl,
+  wg_query_groups *groups, gint key_count, gint aggr_count);
+static gint grow_group_table(void *db, query_group_table *tbl);
+static gint find_group(void *db, query_group_table *tbl, gint *keys,
+  wg_query_aggr *init);
+static void free_group_table(void *db, query_group_table *tbl);
+static wg_query_groups *group_query(void *db, wg_query *query,
+  wg_uint rowlimit, gint *columns, gint col_count, wg_query_aggr *specs,
+  gint count);
+static gint next_record_offset(void *db, gint offset);
+static gint slice_query(void *db, wg_query *query, wg_query *slice,
+  gint part, gint parts, wg_uint *rowlimit);
+static void merge_aggregate(void *db, wg_query_aggr *dest,
+  wg_query_aggr *src);
+
+static gint join_hash_index(void *db, gint column);
+static join_hash_table *build_join_table(void *db, gint column,
+  wg_query_arg *arglist, gint argc);
+
+static query_cache *handle_query_cache(void *db);
+static gint cache_key_value(void *db, gint enc, gint **key, gint *size,
+  gint pos);
+static int compare_cache_args(const void *a, const void *b);
+static gint cache_key(void *db, wg_query_arg *arglist, gint argc,
+  wg_uint rowlimit, gint **key);
+static void release_cache_entry(void *db, query_cache_entry *entry);
+static void clear_query_cache(void *db, query_cache *cache);
+static void evict_cache_entry(void *db, query_cache *cache);
+static wg_query *cached_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit);
 
 static query_result_set *create_resultset(void *db);
 static void free_resultset(void *db, query_result_set *set);
@@ -116,9 +316,25 @@ static gint check_and_merge_recursively(void *db, void *rec,
 static gint prepare_json_arglist(void *db, wg_json_query_arg *arglist,
   wg_json_query_arg **sorted_arglist, gint argc,
   gint *index_id, gint *vindex_id, gint *kindex_id);
+static gint reclist_length(void *db, gint reclist);
+static gint probe_json_value(void *db, gint index_id, gint enc, gint *path,
+  gint depth, gint nesting, gint levels, json_path_probe *probe);
+static gint probe_json_arg(void *db, gint index_id, wg_json_query_arg *arg,
+  json_path_probe *probe);
+static query_result_set *reclist_resultset(void *db, gint reclist);
+static query_result_set *check_json_arg(void *db, query_result_set *docs,
+  wg_json_query_arg *arg, gint *examined);
+static gint path_json_query(void *db, gint index_id,
+  wg_json_query_arg *arglist, gint argc, wg_query **query);
+static wg_query *json_query_object(void *db, query_result_set *res);
 
 static gint encode_query_param_unistr(void *db, const char *data, gint type,
   const char *extdata, int length);
+static int longstr_param_len(gint type, int length);
+static gint unistr_param_size(gint type, const char *extdata, int extlen,
+  int length);
+static gint fill_query_param_unistr(void *db, void *dptr, const char *data,
+  gint type, const char *extdata, int extlen, int length);
 
 static gint show_query_error(void* db, char* errmsg);
 /*static gint show_query_error_nr(void* db, char* errmsg, gint nr);*/
@@ -127,265 +343,1140 @@ static gint show_query_error(void* db, char* errmsg);
 
 
 
-/** Find most restricting column from query argument list
- *  This is probably a reasonable approach to optimize queries
- *  based on T-tree indexes, but might be difficult to combine
- *  with hash indexes.
- *  XXX: currently only considers the existence of T-tree
- *  index and nothing else.
+/** Find a single column index that has the statistics of a column
+ *  returns 0 and fills stats if found, -1 otherwise.
  */
-static gint most_restricting_column(void *db,
-  wg_query_arg *arglist, gint argc, gint *index_id) {
-
-  struct column_score {
-    gint column;
-    int score;
-    int index_id;
-  };
-  struct column_score *sc;
-  int i, j, mrc_score = -1;
-  gint mrc = -1;
+static gint column_stats(void *db, gint column, wg_index_stats *stats) {
   db_memsegment_header* dbh = dbmemsegh(db);
+  gint *ilist;
 
-  sc = (struct column_score *) malloc(argc * sizeof(struct column_score));
-  if(!sc) {
-    show_query_error(db, "Failed to allocate memory");
+  if(column > MAX_INDEXED_FIELDNR)
     return -1;
+  ilist = &dbh->index_control_area_header.index_table[column];
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(ilistelem->car) {
+      wg_index_header *hdr = \
+        (wg_index_header *) offsettoptr(db, ilistelem->car);
+      if(hdr->fields == 1 && !hdr->template_offset &&\
+        hdr->type != WG_INDEX_TYPE_TTREE_JSON &&\
+        hdr->type != WG_INDEX_TYPE_HASH_JSON &&\
+        hdr->type != WG_INDEX_TYPE_TRIGRAM)
+        return wg_get_index_stats(db, ilistelem->car, stats);
+    }
+    ilist = &ilistelem->cdr;
+  }
+  return -1;
+}
+
+/** Estimate the fraction of the rows in a range using a histogram
+ *  The range is bounded from the sides where have_lo or have_hi
+ *  is set. Both ends are treated as inclusive.
+ */
+static double histogram_fraction(wg_index_stats *stats, int have_lo,
+  double lo, int have_hi, double hi) {
+  double found = 0;
+  gint i;
+
+  if(!stats->rows)
+    return 0;
+  for(i=0; i<stats->buckets; i++) {
+    double b0 = stats->bound[i], b1 = stats->bound[i+1], from, to;
+    from = (have_lo && lo > b0 ? lo : b0);
+    to = (have_hi && hi < b1 ? hi : b1);
+    if(to < from)
+      continue;
+    if(b1 > b0)
+      found += stats->bucket_rows[i] * (to - from) / (b1 - b0);
+    else
+      found += stats->bucket_rows[i];
+  }
+  found /= stats->rows;
+  return (found > 1 ? 1 : found);
+}
+
+/** Estimate the fraction of rows that satisfy the conditions on a column
+ *  Uses the statistics of an index on the column, if there is one.
+ *  If range is non-0, a list of values is estimated as the range from
+ *  the smallest to the largest value.
+ */
+static double column_selectivity(void *db, wg_query_arg *arglist,
+  gint argc, gint column, int range) {
+  wg_index_stats stats;
+  gint sb = WG_ILLEGAL, eb = WG_ILLEGAL, i;
+  int si = 0, ei = 0, have_stats;
+  double sel = 1, lo = 0, hi = 0, eqsel = PLAN_SEL_EQUAL;
+
+  have_stats = !column_stats(db, column, &stats) && stats.rows > 0;
+  if(have_stats)
+    eqsel = 1.0 / (stats.distinct - (stats.nulls ? 1 : 0) > 0 ?
+      stats.distinct - (stats.nulls ? 1 : 0) : 1);
+  column_bounds(db, arglist, argc, column, &sb, &eb, &si, &ei);
+
+  if(!range && (i = find_in_arg(arglist, argc, column)) >= 0) {
+    /* List of values */
+    gint *values;
+    sel = in_list_values(db, arglist[i].value, &values) * eqsel;
+    if(sel > 1)
+      sel = 1;
+  }
+  else if(sb != WG_ILLEGAL && eb != WG_ILLEGAL &&\
+    WG_COMPARE(db, sb, eb) == WG_EQUAL) {
+    /* Equality */
+    if(have_stats && !sb)
+      sel = (double) stats.nulls / stats.rows;
+    else
+      sel = eqsel;
+  }
+  else if(sb != WG_ILLEGAL || eb != WG_ILLEGAL) {
+    int have_lo = (sb != WG_ILLEGAL && !wg_rtree_coord(db, sb, &lo));
+    int have_hi = (eb != WG_ILLEGAL && !wg_rtree_coord(db, eb, &hi));
+    if(have_stats && stats.buckets &&\
+      (have_lo || sb == WG_ILLEGAL) && (have_hi || eb == WG_ILLEGAL))
+      sel = histogram_fraction(&stats, have_lo, lo, have_hi, hi);
+    else if(sb != WG_ILLEGAL && eb != WG_ILLEGAL)
+      sel = PLAN_SEL_RANGE * PLAN_SEL_RANGE;
+    else
+      sel = PLAN_SEL_RANGE;
   }
 
-  /* Scan through the arguments and calculate accumulated score
-   * for each column. */
+  /* Conditions that do not restrict the range */
   for(i=0; i<argc; i++) {
-    /* As a side effect, we're initializing the score array
-     * in the same loop */
-    sc[i].column = -1;
-    sc[i].score = 0;
-    sc[i].index_id = 0;
+    if(arglist[i].column != column)
+      continue;
+    if(arglist[i].cond == WG_COND_NOT_EQUAL)
+      sel *= PLAN_SEL_NOT_EQUAL;
+    else if(arglist[i].cond == WG_COND_CONTAINS)
+      sel *= PLAN_SEL_CONTAINS;
+  }
+  return sel;
+}
 
-    /* Locate the slot for the column */
-    for(j=0; j<argc; j++) {
-      if(sc[j].column == -1) {
-        sc[j].column = arglist[i].column;
-        break;
+/** Estimate the cost of locating a key in an index
+ */
+static double plan_seek_cost(double rows) {
+  double cost = PLAN_COST_SEEK;
+  while(rows > 1) {
+    rows /= 2;
+    cost += PLAN_COST_SEEK;
+  }
+  return cost;
+}
+
+/** Estimate the number of rows in the database
+ *  The largest index without a template is assumed to contain
+ *  all the rows. JSON indexes are not used, as they count the
+ *  values inside documents.
+ */
+static double table_rows(void *db) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint *ilist = &dbh->index_control_area_header.index_list;
+  double rows = 0, trows = 0;
+
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    wg_index_stats stats;
+    if(ilistelem->car && !wg_get_index_stats(db, ilistelem->car, &stats)) {
+      wg_index_header *hdr = \
+        (wg_index_header *) offsettoptr(db, ilistelem->car);
+      if(hdr->type == WG_INDEX_TYPE_TTREE_JSON ||\
+        hdr->type == WG_INDEX_TYPE_HASH_JSON) {
+        /* counts values inside documents */
+      } else if(!hdr->template_offset) {
+        if(stats.rows > rows)
+          rows = stats.rows;
+      } else if(stats.rows > trows) {
+        trows = stats.rows;
       }
-      if(sc[j].column == arglist[i].column) break;
     }
+    ilist = &ilistelem->cdr;
+  }
+  return (rows > 0 ? rows : trows);
+}
 
-    /* Apply our primitive scoring */
-    switch(arglist[i].cond) {
-      case WG_COND_EQUAL:
-        sc[j].score += TTREE_SCORE_EQUAL;
-        if(arglist[i].value == 0) /* NULL values get a small penalty */
-          sc[j].score += TTREE_SCORE_NULL;
-        break;
-      case WG_COND_LESSTHAN:
-      case WG_COND_GREATER:
-      case WG_COND_LTEQUAL:
-      case WG_COND_GTEQUAL:
-        /* these all qualify as a bound. So two bounds
-         * appearing in the argument list on the same column
-         * score higher than one bound. */
-        sc[j].score += TTREE_SCORE_BOUND;
-        break;
-      default:
-        /* Note that we consider WG_COND_NOT_EQUAL near useless */
-        break;
+/** Estimate the selectivity of an index for a query
+ *  The selectivity is the fraction of the rows of the index that
+ *  need to be visited. If probes is not NULL, a list of values on
+ *  the leading column of a T-tree index is looked up one value at a
+ *  time, instead of a single range. The number of lookups is stored
+ *  in *probes.
+ *  returns the selectivity, -1 if the index is not usable.
+ */
+static double index_selectivity(void *db, wg_index_header *hdr,
+  wg_query_arg *arglist, gint argc, double *probes) {
+  double sel = 1, box[2*MAX_INDEX_FIELDS], n = 1;
+  gint j, k, prefix = 0, *values;
+
+  if(probes)
+    *probes = 1;
+  switch(hdr->type) {
+    case WG_INDEX_TYPE_TTREE:
+      /* Equality conditions on the leading columns and the
+       * bounds of the column following them. */
+      for(k=0; k<hdr->fields; k++) {
+        gint sb = WG_ILLEGAL, eb = WG_ILLEGAL;
+        int si = 0, ei = 0;
+        column_bounds(db, arglist, argc, hdr->rec_field_index[k],
+          &sb, &eb, &si, &ei);
+        if(sb == WG_ILLEGAL && eb == WG_ILLEGAL)
+          break;
+        sel *= column_selectivity(db, arglist, argc,
+          hdr->rec_field_index[k], !k && !probes);
+        prefix++;
+        if(!k && probes &&\
+          (j = find_in_arg(arglist, argc, hdr->rec_field_index[0])) >= 0) {
+          n = in_list_values(db, arglist[j].value, &values);
+          continue; /* each value is looked up separately */
+        }
+        if(sb == WG_ILLEGAL || eb == WG_ILLEGAL || !si || !ei ||\
+          WG_COMPARE(db, sb, eb) != WG_EQUAL)
+          break;
+      }
+      if(!prefix)
+        return -1;
+      if(prefix == hdr->fields && hdr->fields > 1 && k == hdr->fields) {
+        /* Full key equality, the key statistics apply */
+        wg_index_stats stats;
+        if(!wg_get_index_stats(db, ptrtooffset(db, hdr), &stats) &&\
+          stats.distinct > 0 && n / stats.distinct < sel)
+          sel = n / stats.distinct;
+      }
+      if(probes)
+        *probes = n;
+      return sel;
+    case WG_INDEX_TYPE_HASH:
+      /* Lookup by all the key columns, each combination of the
+       * values in lists is looked up separately */
+      for(k=0; k<hdr->fields; k++) {
+        for(j=0; j<argc; j++) {
+          if(arglist[j].column == hdr->rec_field_index[k] &&\
+            (arglist[j].cond == WG_COND_EQUAL ||\
+            arglist[j].cond == WG_COND_IN))
+            break;
+        }
+        if(j == argc)
+          return -1;
+        if(arglist[j].cond == WG_COND_IN)
+          n *= in_list_values(db, arglist[j].value, &values);
+      }
+      if(probes)
+        *probes = n;
+      if(hdr->fields == 1) {
+        return column_selectivity(db, arglist, argc,
+          hdr->rec_field_index[0], 0);
+      } else {
+        wg_index_stats stats;
+        if(wg_get_index_stats(db, ptrtooffset(db, hdr), &stats) ||\
+          stats.distinct < 1)
+          sel = n * PLAN_SEL_EQUAL;
+        else
+          sel = n / stats.distinct;
+        return (sel > 1 ? 1 : sel);
+      }
+    case WG_INDEX_TYPE_RTREE:
+      if(rtree_box(db, hdr, arglist, argc, box))
+        return -1;
+      for(k=0; k<hdr->fields; k++) {
+        sel *= column_selectivity(db, arglist, argc,
+          hdr->rec_field_index[k], 0);
+      }
+      return sel;
+    default:
+      break;
+  }
+  return -1;
+}
+
+/** Estimate the bitmap index plan
+ *  Conditions on columns with a bitmap index and WG_COND_CONTAINS
+ *  conditions on columns with a trigram index are evaluated using
+ *  the record sets (see bitmap_query()).
+ *  returns the estimated cost, -1 if the plan is not applicable.
+ */
+static double bitmap_cost(void *db, wg_query_arg *arglist, gint argc,
+  double table, double *rows) {
+  double cost = 0, sel = 1;
+  gint i, used = 0, rest = 0;
+
+  for(i=0; i<argc; i++) {
+    wg_index_stats stats;
+    gint id = (is_grouped_arg(&arglist[i]) ? 0 :
+      find_column_index(db, arglist[i].column, WG_INDEX_TYPE_BITMAP));
+    if(id && !wg_get_index_stats(db, id, &stats)) {
+      double csel = column_selectivity(db, arglist, argc,
+        arglist[i].column, 0);
+      gint j;
+      cost += stats.rows * csel * PLAN_COST_BITMAP;
+      for(j=0; j<i; j++) {
+        if(arglist[j].column == arglist[i].column)
+          break;
+      }
+      if(j == i)
+        sel *= csel; /* selectivity covers all conditions on the column */
+      used++;
+      continue;
+    }
+    id = (arglist[i].cond == WG_COND_CONTAINS ?
+      find_column_index(db, arglist[i].column, WG_INDEX_TYPE_TRIGRAM) : 0);
+    if(id && wg_get_encoded_type(db, arglist[i].value) == WG_STRTYPE &&\
+      strlen(wg_decode_str(db, arglist[i].value)) >= 3 &&\
+      !wg_get_index_stats(db, id, &stats)) {
+      /* Each trigram of the string is a set of candidates */
+      cost += (strlen(wg_decode_str(db, arglist[i].value)) - 2) *\
+        stats.rows * PLAN_SEL_CONTAINS * PLAN_COST_BITMAP;
+      sel *= PLAN_SEL_CONTAINS;
+      used++;
     }
+    rest++;
   }
+  if(!used)
+    return -1;
+  *rows = table * sel;
+  return cost + *rows * (PLAN_COST_SET + (rest ? PLAN_COST_ROW : 0));
+}
 
-  /* Now loop over the scores to find the best. */
+/** Make a plan for a query
+ *  The candidates are a full scan, a range or lookups in each usable
+ *  index, an intersection of several such ranges, bitmap indexes
+ *  and R-tree indexes. The cost of each is estimated from the index
+ *  statistics (see wg_get_index_stats()), assuming that the
+ *  conditions on different columns are independent. Plans that
+ *  produce the complete result set at once are only considered if
+ *  set_plans is non-0.
+ *  returns 0 on success, -1 on error.
+ */
+static gint plan_query(void *db, wg_query_arg *arglist, gint argc,
+  gint set_plans, wg_query_plan *plan) {
+  struct plan_index {
+    gint index_id;
+    gint type;
+    gint column;    /* leading column */
+    double sel;     /* fraction of the rows of the index */
+    double total;   /* rows in the index */
+    double probes;  /* number of lookups */
+    double rows;
+    double cost;
+  } cand[PLAN_MAX_CANDIDATES + 1]; /* the last one is a work slot */
+  db_memsegment_header* dbh = dbmemsegh(db);
+  double table = table_rows(db), sel = 1, rows, cost;
+  gint *ilist, ncand = 0, i, j;
+
+  /* Rows in the result, assuming independent columns */
   for(i=0; i<argc; i++) {
-    if(sc[i].column == -1) break;
-    /* Find the index on the column. The score is modified by the
-     * estimated quality of the index (0 if no index found).
-     */
-    if(sc[i].column <= MAX_INDEXED_FIELDNR) {
-      gint *ilist = &dbh->index_control_area_header.index_table[sc[i].column];
-      while(*ilist) {
-        gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
-        if(ilistelem->car) {
-          wg_index_header *hdr = \
-            (wg_index_header *) offsettoptr(db, ilistelem->car);
-
-          if(hdr->type == WG_INDEX_TYPE_TTREE) {
+    for(j=0; j<i; j++) {
+      if(arglist[j].column == arglist[i].column)
+        break;
+    }
+    if(j == i)
+      sel *= column_selectivity(db, arglist, argc, arglist[i].column, 0);
+  }
+
+  plan->type = WG_QPLAN_SCAN;
+  plan->count = 0;
+  plan->epoch = dbh->index_control_area_header.index_epoch;
+  plan->rows = table * sel; /* does not depend on the plan */
+  plan->cost = table * PLAN_COST_ROW;
+  if(!argc || !dbh->index_control_area_header.index_list)
+    return 0;
+
+  /* Single index plans. If there are more usable indexes than
+   * candidate slots, the ones with the fewest rows are kept. */
+  ilist = &dbh->index_control_area_header.index_list;
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    wg_index_header *hdr = (wg_index_header *) offsettoptr(db, ilistelem->car);
+    wg_index_stats stats;
+    double isel, probes = 1, seek;
+
+    ilist = &ilistelem->cdr;
+    if((hdr->type != WG_INDEX_TYPE_TTREE && !set_plans) ||\
+      template_score(db, hdr, arglist, argc) < 0 ||\
+      (isel = index_selectivity(db, hdr, arglist, argc,
+        (set_plans ? &probes : NULL))) < 0 ||\
+      wg_get_index_stats(db, ilistelem->car, &stats))
+      continue;
+
+    seek = plan_seek_cost(stats.rows);
+    cand[ncand].index_id = ilistelem->car;
+    cand[ncand].column = hdr->rec_field_index[0];
+    cand[ncand].sel = isel;
+    cand[ncand].total = stats.rows;
+    cand[ncand].probes = probes;
+    cand[ncand].rows = stats.rows * isel;
+    if(hdr->type == WG_INDEX_TYPE_TTREE && probes > 1) {
+      /* Lookup of each value in a list, compared to a single range
+       * from the smallest to the largest value. */
+      double rsel = index_selectivity(db, hdr, arglist, argc, NULL);
+      cand[ncand].type = WG_QPLAN_PROBE;
+      if(seek + stats.rows * rsel * (PLAN_COST_ENTRY + PLAN_COST_ROW) <\
+        probes * seek + cand[ncand].rows *\
+        (PLAN_COST_ENTRY + PLAN_COST_SET + PLAN_COST_ROW)) {
+        cand[ncand].type = WG_QPLAN_TTREE;
+        cand[ncand].sel = rsel;
+        cand[ncand].probes = 1;
+        cand[ncand].rows = stats.rows * rsel;
+      }
+    }
+    else {
+      cand[ncand].type = (hdr->type == WG_INDEX_TYPE_TTREE ? WG_QPLAN_TTREE :
+        (hdr->type == WG_INDEX_TYPE_HASH ? WG_QPLAN_HASH : WG_QPLAN_RTREE));
+    }
+    if(cand[ncand].type == WG_QPLAN_TTREE) {
+      cand[ncand].cost = seek +\
+        cand[ncand].rows * (PLAN_COST_ENTRY + PLAN_COST_ROW);
+    } else {
+      cand[ncand].cost = cand[ncand].probes * seek + cand[ncand].rows *\
+        (cand[ncand].type == WG_QPLAN_PROBE ? PLAN_COST_ENTRY : 0) +\
+        cand[ncand].rows * (PLAN_COST_SET + PLAN_COST_ROW);
+    }
+
+    if(cand[ncand].cost < plan->cost) {
+      plan->type = cand[ncand].type;
+      plan->count = 1;
+      plan->index_id[0] = cand[ncand].index_id;
+      plan->cost = cand[ncand].cost;
+    }
+    if(cand[ncand].type != WG_QPLAN_RTREE) {
+      if(ncand < PLAN_MAX_CANDIDATES) {
+        ncand++;
+      } else {
+        for(i=0, j=0; i<ncand; i++) {
+          if(cand[i].rows > cand[j].rows)
+            j = i;
+        }
+        if(cand[ncand].rows < cand[j].rows)
+          cand[j] = cand[ncand];
+      }
+    }
+  }
+
+  if(set_plans) {
+    struct plan_index tmp;
+    double isect_sel = 1, collect = 0;
+    gint used[WG_QPLAN_MAX_INDEXES], nused = 0;
+
+    /* Bitmap indexes */
+    cost = bitmap_cost(db, arglist, argc, table, &rows);
+    if(cost >= 0 && cost < plan->cost) {
+      plan->type = WG_QPLAN_BITMAP;
+      plan->count = 0;
+      plan->cost = cost;
+    }
+
+    /* Intersection: ranges are added starting from the smallest, as
+     * long as this reduces the cost. Each column is used once. */
+    for(i=0; i<ncand; i++) {
+      for(j=i+1; j<ncand; j++) {
+        if(cand[j].rows < cand[i].rows) {
+          tmp = cand[i];
+          cand[i] = cand[j];
+          cand[j] = tmp;
+        }
+      }
+    }
+    for(i=0; i<ncand && nused < WG_QPLAN_MAX_INDEXES; i++) {
+      double c;
+      for(j=0; j<nused; j++) {
+        if(cand[used[j]].column == cand[i].column)
+          break;
+      }
+      if(j < nused)
+        continue;
+      c = collect + cand[i].probes * plan_seek_cost(cand[i].total) +\
+        cand[i].rows * (PLAN_COST_ENTRY + PLAN_COST_SET);
+      rows = table * isect_sel * cand[i].sel;
+      if(nused && c + rows * PLAN_COST_ROW >=\
+        collect + table * isect_sel * PLAN_COST_ROW)
+        break; /* does not pay off */
+      collect = c;
+      isect_sel *= cand[i].sel;
+      used[nused++] = i;
+    }
+    cost = collect + table * isect_sel * PLAN_COST_ROW;
+    if(nused > 1 && cost < plan->cost) {
+      plan->type = WG_QPLAN_INTERSECT;
+      plan->count = nused;
+      for(j=0; j<nused; j++)
+        plan->index_id[j] = cand[used[j]].index_id;
+      plan->cost = cost;
+    }
+  }
+  return 0;
+}
+
+/** Check if a plan can still be used
+ */
+static gint plan_valid(void *db, wg_query_plan *plan) {
+  return (plan->epoch ==\
+    dbmemsegh(db)->index_control_area_header.index_epoch);
+}
+
+/** Score the template of an index against the query argument list
+ *  If index templates are available, we can increase the
+ *  score of the index if the template has any columns matching
+ *  the query parameters. On the other hand, in case of a
+ *  mismatch the index is unusable and has to be skipped.
+ *  The indexes are sorted in the order of fixed columns in
+ *  the template, so if there is a match, the search is
+ *  complete (remaining index are likely to be worse)
+ *
+ *  returns the score (0 if the index has no template)
+ *  returns -1 if the index is not usable for this query
+ */
+static int template_score(void *db, wg_index_header *hdr,
+  wg_query_arg *arglist, gint argc) {
+  int score = 0;
 #ifdef USE_INDEX_TEMPLATE
-            /* If index templates are available, we can increase the
-             * score of the index if the template has any columns matching
-             * the query parameters. On the other hand, in case of a
-             * mismatch the index is unusable and has to be skipped.
-             * The indexes are sorted in the order of fixed columns in
-             * the template, so if there is a match, the search is
-             * complete (remaining index are likely to be worse)
-             */
-            if(hdr->template_offset) {
-              wg_index_template *tmpl = \
-                (wg_index_template *) offsettoptr(db, hdr->template_offset);
-              void *matchrec = offsettoptr(db, tmpl->offset_matchrec);
-              gint reclen = wg_get_record_len(db, matchrec);
-              for(j=0; j<reclen; j++) {
-                gint enc = wg_get_field(db, matchrec, j);
-                if(wg_get_encoded_type(db, enc) != WG_VARTYPE) {
-                  /* defined column in matchrec. The score is increased
-                   * if arglist has a WG_COND_EQUAL column with the same
-                   * value. In any other case the index is not usable.
-                   */
-                  int match = 0, k;
-                  for(k=0; k<argc; k++) {
-                    if(arglist[k].column == j) {
-                      if(arglist[k].cond == WG_COND_EQUAL &&\
-                        WG_COMPARE(db, enc, arglist[k].value) == WG_EQUAL) {
-                        match = 1;
-                      }
-                      else
-                        goto nextindex;
-                    }
-                  }
-                  if(match) {
-                    sc[i].score += TTREE_SCORE_MASK;
-                    if(!enc)
-                      sc[i].score += TTREE_SCORE_NULL;
-                  }
-                  else
-                    goto nextindex;
-                }
-              }
+  if(hdr->template_offset) {
+    int j;
+    wg_index_template *tmpl = \
+      (wg_index_template *) offsettoptr(db, hdr->template_offset);
+    void *matchrec = offsettoptr(db, tmpl->offset_matchrec);
+    gint reclen = wg_get_record_len(db, matchrec);
+    for(j=0; j<reclen; j++) {
+      gint enc = wg_get_field(db, matchrec, j);
+      if(wg_get_encoded_type(db, enc) != WG_VARTYPE) {
+        /* defined column in matchrec. The score is increased
+         * if arglist has a WG_COND_EQUAL column with the same
+         * value. In any other case the index is not usable.
+         */
+        int match = 0, k;
+        for(k=0; k<argc; k++) {
+          if(arglist[k].column == j) {
+            if(arglist[k].cond == WG_COND_EQUAL &&\
+              WG_COMPARE(db, enc, arglist[k].value) == WG_EQUAL) {
+              match = 1;
             }
-#endif
-            sc[i].index_id = ilistelem->car;
-            break;
+            else
+              return -1;
           }
         }
-#ifdef USE_INDEX_TEMPLATE
-nextindex:
-#endif
-        ilist = &ilistelem->cdr;
+        if(match) {
+          score += TTREE_SCORE_MASK;
+          if(!enc)
+            score += TTREE_SCORE_NULL;
+        }
+        else
+          return -1;
       }
     }
-    if(!sc[i].index_id)
-      sc[i].score = 0; /* no index, score reset */
-    if(sc[i].score > mrc_score) {
-      mrc_score = sc[i].score;
-      mrc = sc[i].column;
-      *index_id = sc[i].index_id;
+  }
+#endif
+  return score;
+}
+
+/** Get the values of a WG_COND_IN argument
+ *  The value of the argument is a record (or a list, see
+ *  wg_encode_query_param_list()) that holds the values.
+ *  returns the number of values, *values points to the first one.
+ */
+static gint in_list_values(void *db, gint value, gint **values) {
+  gint *list = (gint *) offsettoptr(db, decode_datarec_offset(value));
+  *values = list + RECORD_HEADER_GINTS;
+  return getusedobjectwantedgintsnr(*list) - RECORD_HEADER_GINTS;
+}
+
+/** Store the range of the values that begin with a prefix
+ *  The value of a WG_COND_PREFIX argument (a string or URI) is
+ *  replaced by a list (see in_list_values()) of the value itself
+ *  and the smallest value that is greater than all the values that
+ *  begin with it. The storage of the second value follows the list
+ *  in buf. Strings that consist of 0xFF bytes only (including the
+ *  empty string) have no such value, WG_ILLEGAL is stored instead.
+ *  The range of URIs is limited to the namespace (the URI prefix)
+ *  of the value.
+ *
+ *  If buf is NULL, nothing is stored.
+ *
+ *  returns the size of the storage (in gints), *list is set to the
+ *  encoded list.
+ */
+static gint prefix_range(void *db, gint value, gint *buf, gint *list) {
+  gint type = wg_get_encoded_type(db, value), head, size = 0;
+  gint next = WG_ILLEGAL;
+  char *str, *ext = NULL;
+  int len, extlen = 0;
+
+  if(type == WG_URITYPE) {
+    str = wg_decode_uri(db, value);
+    ext = wg_decode_uri_prefix(db, value);
+    if(!ext)
+      ext = ""; /* same as an empty namespace, see wg_compare() */
+    extlen = strlen(ext);
+  } else
+    str = wg_decode_str(db, value);
+
+  /* The last byte that can be incremented */
+  for(len=strlen(str); len>0 && (unsigned char) str[len-1] == 0xFF; len--);
+  if(len)
+    size = unistr_param_size(type, ext, extlen, len);
+  else if(type == WG_URITYPE)
+    size = unistr_param_size(type, ext, extlen + 1, 0);
+
+  head = RECORD_HEADER_GINTS + 2;
+  if((head * sizeof(gint)) % 8)
+    head++; /* keep the value aligned */
+  if(!buf)
+    return head + size / sizeof(gint);
+
+  if(len) {
+    /* The same string up to the last byte that is incremented */
+    next = fill_query_param_unistr(db, buf + head, str, type, ext, extlen,
+      len);
+    if(type == WG_URITYPE)
+      wg_decode_uri(db, next)[len-1]++;
+    else
+      wg_decode_str(db, next)[len-1]++;
+  } else if(type == WG_URITYPE) {
+    /* Empty URI in the next namespace: the namespace is extended by
+     * a byte of 1 (terminating 0 of ext is copied first). */
+    next = fill_query_param_unistr(db, buf + head, "", type, ext,
+      extlen + 1, 0);
+    wg_decode_uri_prefix(db, next)[extlen] = 1;
+  }
+
+  buf[0] = (RECORD_HEADER_GINTS + 2) * sizeof(gint);
+  buf[RECORD_META_POS] = RECORD_META_NOTDATA|RECORD_META_MATCH;
+  buf[RECORD_BACKLINKS_POS] = 0;
+  buf[RECORD_HEADER_GINTS] = value;
+  buf[RECORD_HEADER_GINTS + 1] = next;
+  *list = encode_datarec_offset(ptrtooffset(db, buf));
+  return head + size / sizeof(gint);
+}
+
+/** Check if an encoded value begins with a prefix
+ *  The prefix is a string or URI. The language of strings is ignored,
+ *  URIs need to have the same namespace.
+ *  returns 1 if the value matches, 0 otherwise
+ */
+static gint prefix_match(void *db, gint encoded, gint prefix) {
+  gint type = wg_get_encoded_type(db, prefix);
+  char *str, *pstr;
+
+  if(wg_get_encoded_type(db, encoded) != type)
+    return 0;
+  if(type == WG_URITYPE) {
+    char *ns = wg_decode_uri_prefix(db, encoded);
+    char *pns = wg_decode_uri_prefix(db, prefix);
+    if(strcmp((ns ? ns : ""), (pns ? pns : "")))
+      return 0;
+    str = wg_decode_uri(db, encoded);
+    pstr = wg_decode_uri(db, prefix);
+  } else if(type == WG_STRTYPE) {
+    str = wg_decode_str(db, encoded);
+    pstr = wg_decode_str(db, prefix);
+  } else
+    return 0;
+  return !strncmp(str, pstr, strlen(pstr));
+}
+
+/** Sort an array of encoded values and remove the duplicates
+ *  (Shell sort, the lists are not expected to be very long)
+ *  returns the number of unique values.
+ */
+static gint sort_values(void *db, gint *values, gint count) {
+  gint gap, i, j, k;
+
+  for(gap = count/2; gap > 0; gap /= 2) {
+    for(i=gap; i<count; i++) {
+      gint tmp = values[i];
+      for(j=i; j>=gap &&\
+        WG_COMPARE(db, values[j-gap], tmp) == WG_GREATER; j-=gap)
+        values[j] = values[j-gap];
+      values[j] = tmp;
     }
   }
+  for(i=1, k=(count ? 1 : 0); i<count; i++) {
+    if(WG_COMPARE(db, values[k-1], values[i]) != WG_EQUAL)
+      values[k++] = values[i];
+  }
+  return k;
+}
 
-  /* TODO: does the best score have no index? In that case,
-   * try to locate an index that would restrict at least
-   * some columns.
-   */
-  free(sc);
-  return mrc;
+/** Find the WG_COND_IN argument of a column
+ *  Arguments that are a part of a disjunction are not considered.
+ *  returns the position of the argument, -1 if there is none.
+ */
+static gint find_in_arg(wg_query_arg *arglist, gint argc, gint column) {
+  gint i;
+  for(i=0; i<argc; i++) {
+    if(arglist[i].column == column && arglist[i].cond == WG_COND_IN)
+      return i;
+  }
+  return -1;
+}
+
+/** Check the result of comparing a value to an argument value
+ *  cr is WG_EQUAL, WG_LESSTHAN or WG_GREATER.
+ *  returns 1 if the comparison satisfies the condition
+ *  returns 0 otherwise
+ */
+static gint compare_result(gint cond, gint cr) {
+  switch(cond & ~QUERY_COND_FLAGS) {
+    case WG_COND_EQUAL:
+      return (cr == WG_EQUAL);
+    case WG_COND_LESSTHAN:
+      return (cr == WG_LESSTHAN);
+    case WG_COND_GREATER:
+      return (cr == WG_GREATER);
+    case WG_COND_LTEQUAL:
+      return (cr != WG_GREATER);
+    case WG_COND_GTEQUAL:
+      return (cr != WG_LESSTHAN);
+    case WG_COND_NOT_EQUAL:
+      return (cr != WG_EQUAL);
+    default:
+      break;
+  }
+  return 1;
+}
+
+/** Check an encoded value against a condition
+ *  returns 1 if the value matches
+ *  returns 0 if the value fails the condition
+ */
+static gint check_condition(void *db, gint encoded, gint cond, gint value) {
+  switch(cond & ~QUERY_COND_FLAGS) {
+    case WG_COND_EQUAL:
+    case WG_COND_LESSTHAN:
+    case WG_COND_GREATER:
+    case WG_COND_LTEQUAL:
+    case WG_COND_GTEQUAL:
+    case WG_COND_NOT_EQUAL:
+      return compare_result(cond, WG_COMPARE(db, encoded, value));
+    case WG_COND_CONTAINS:
+      return (wg_get_encoded_type(db, encoded) == WG_STRTYPE &&\
+        wg_get_encoded_type(db, value) == WG_STRTYPE &&\
+        strstr(wg_decode_str(db, encoded), wg_decode_str(db, value)) != NULL);
+    case WG_COND_IN:
+      {
+        gint *values, count = in_list_values(db, value, &values), i;
+        for(i=0; i<count; i++) {
+          if(WG_COMPARE(db, encoded, values[i]) == WG_EQUAL)
+            return 1;
+        }
+        return 0;
+      }
+    case WG_COND_PREFIX:
+      if(wg_get_encoded_type(db, value) == WG_RECORDTYPE) {
+        /* range made by prefix_range() */
+        gint *values;
+        in_list_values(db, value, &values);
+        value = values[0];
+      }
+      return prefix_match(db, encoded, value);
+    default:
+      break;
+  }
+  return 1;
+}
+
+/** Check an encoded value against an argument
+ *  If compile_arglist() has found the kind of the argument value
+ *  and the value has the same encoding, the encoded values are
+ *  compared directly: the tag bits are equal and the order of the
+ *  remaining bits is the order of the decoded values. Strings skip
+ *  the type checks of wg_compare(). Other values are checked with
+ *  check_condition().
+ *  returns 1 if the value matches
+ *  returns 0 if the value fails the condition
+ */
+static gint check_arg(void *db, gint encoded, wg_query_arg *arg) {
+  gint cond = arg->cond, value = arg->value;
+
+  if(cond & (QUERY_COND_SMALLINT|QUERY_COND_TAGGED)) {
+    /* fixpoint and date have the same size of the tag */
+    gint mask = (cond & QUERY_COND_SMALLINT ? SMALLINTMASK : FIXPOINTMASK);
+    if((encoded & mask) == (value & mask))
+      return compare_result(cond, (encoded == value ? WG_EQUAL :
+        (encoded < value ? WG_LESSTHAN : WG_GREATER)));
+  }
+  else if(cond & QUERY_COND_TIME) {
+    /* time of day may not fit in a signed int with the tag,
+     * see decode_time() */
+    if(istime(encoded))
+      return compare_result(cond, (encoded == value ? WG_EQUAL :
+        ((unsigned int) encoded < (unsigned int) value ?
+        WG_LESSTHAN : WG_GREATER)));
+  }
+  else if(cond & QUERY_COND_STR) {
+    if(encoded == value)
+      return compare_result(cond, WG_EQUAL);
+    if(wg_get_encoded_type(db, encoded) == WG_STRTYPE) {
+      /* lang is ignored, as in wg_compare() */
+      int res = strcmp(wg_decode_str(db, encoded), wg_decode_str(db, value));
+      return compare_result(cond, (res > 0 ? WG_GREATER :
+        (res < 0 ? WG_LESSTHAN : WG_EQUAL)));
+    }
+  }
+  return check_condition(db, encoded, cond, value);
 }
 
 /** Check a record against list of conditions
+ *  The fields are read directly from the record. The list may be
+ *  compiled with compile_arglist() first, which puts the conditions
+ *  most likely to fail first.
  *  returns 1 if the record matches
  *  returns 0 if the record fails at least one condition
  */
 static gint check_arglist(void *db, void *rec, wg_query_arg *arglist,
   gint argc) {
 
+  gint *fields = ((gint *) rec) + RECORD_HEADER_GINTS;
   int i, reclen;
 
-  reclen = wg_get_record_len(db, rec);
+  reclen = getusedobjectwantedgintsnr(*((gint *) rec)) - RECORD_HEADER_GINTS;
   for(i=0; i<argc; i++) {
-    gint encoded;
-    if(arglist[i].column < reclen)
-      encoded = wg_get_field(db, rec, arglist[i].column);
-    else
+    if(arglist[i].cond & QUERY_COND_GROUP) {
+      /* Disjunction, one of the arguments needs to match */
+      int match = 0;
+      do {
+        if(!match && arglist[i].column < reclen &&\
+          check_arg(db, fields[arglist[i].column], &arglist[i]))
+          match = 1;
+        i++;
+      } while(i<argc && is_grouped_arg(&arglist[i]) &&\
+        !(arglist[i].cond & QUERY_COND_GROUP));
+      if(!match)
+        return 0;
+      i--;
+      continue;
+    }
+    if(arglist[i].column >= reclen)
       return 0; /* XXX: should shorter records always fail?
                  * other possiblities here: compare to WG_ILLEGAL
                  * or WG_NULLTYPE. Current idea is based on SQL
                  * concept of comparisons to NULL always failing.
                  */
 
-    switch(arglist[i].cond) {
-      case WG_COND_EQUAL:
-        if(WG_COMPARE(db, encoded, arglist[i].value) != WG_EQUAL)
-          return 0;
-        break;
-      case WG_COND_LESSTHAN:
-        if(WG_COMPARE(db, encoded, arglist[i].value) != WG_LESSTHAN)
-          return 0;
-        break;
-      case WG_COND_GREATER:
-        if(WG_COMPARE(db, encoded, arglist[i].value) != WG_GREATER)
-          return 0;
-        break;
-      case WG_COND_LTEQUAL:
-        if(WG_COMPARE(db, encoded, arglist[i].value) == WG_GREATER)
-          return 0;
-        break;
-      case WG_COND_GTEQUAL:
-        if(WG_COMPARE(db, encoded, arglist[i].value) == WG_LESSTHAN)
-          return 0;
-        break;
-      case WG_COND_NOT_EQUAL:
-        if(WG_COMPARE(db, encoded, arglist[i].value) == WG_EQUAL)
-          return 0;
-        break;
-      default:
-        break;
-    }
+    if(!check_arg(db, fields[arglist[i].column], &arglist[i]))
+      return 0;
   }
 
   return 1;
 }
 
-/** Prepare query parameters
- *
- * - Validates matchrec and arglist
- * - Converts external pointers to locally allocated data
- * - Builds an unified argument list
- *
- * Returns 0 on success, non-0 on error.
- *
- * If the function was successful, *farglist will be set to point
- * to a newly allocated unified argument list and *fargc will be set
- * to indicate the size of *farglist.
- *
- * If there was an error, *farglist and *fargc may be in
- * an undetermined state.
+/** Check a batch of records against list of conditions
+ *  offsets holds count record offsets. The conditions are applied
+ *  one at a time (a disjunction as a whole) to all the records that
+ *  have not failed yet, so that the loop runs the same comparison on
+ *  the consecutive records. The offsets of the matching records are
+ *  moved to the beginning of the array, keeping their order.
+ *  returns the number of matching records
  */
-static gint prepare_params(void *db, void *matchrec, gint reclen,
-  wg_query_arg *arglist, gint argc,
-  wg_query_arg **farglist, gint *fargc) {
-  int i;
+static gint check_arglist_batch(void *db, gint *offsets, gint count,
+  wg_query_arg *arglist, gint argc) {
+  gint i, j, k, size;
 
-  if(matchrec) {
-    /* Get the correct length of matchrec data area and the pointer
-     * to the beginning of the data. If matchrec is a plain array in
-     * local memory (indicated by NON-zero reclen) we will skip this step.
-     */
-    if(!reclen) {
-      reclen = wg_get_record_len(db, matchrec);
-      matchrec = wg_get_record_dataarray(db, matchrec);
-    }
-#ifdef CHECK
-    if(!reclen) {
-      show_query_error(db, "Zero-length match record argument");
-      return -1;
+  for(i=0; i<argc && count; i+=size) {
+    size = checked_group_size(arglist, argc, i);
+    for(j=0, k=0; j<count; j++) {
+      if(check_arglist(db, offsettoptr(db, offsets[j]), arglist + i, size))
+        offsets[k++] = offsets[j];
     }
-#endif
+    count = k;
   }
+  return count;
+}
 
-#ifdef CHECK
-  if(arglist && !argc) {
-    show_query_error(db, "Zero-length argument list");
-    return -1;
+/** Find the number of arguments that are checked together
+ *  returns the size of the disjunction that begins at arglist[i]
+ *  (see group_args()), 1 for other arguments.
+ */
+static gint checked_group_size(wg_query_arg *arglist, gint argc, gint i) {
+  gint size = 1;
+  if(arglist[i].cond & QUERY_COND_GROUP) {
+    while(i + size < argc && is_grouped_arg(&arglist[i + size]) &&\
+      !(arglist[i + size].cond & QUERY_COND_GROUP))
+      size++;
   }
-  if(!arglist && argc) {
-    show_query_error(db, "Invalid argument list (NULL)");
-    return -1;
+  return size;
+}
+
+/** Find the kind of an argument value (see check_arg())
+ *  returns one of QUERY_COND_KINDS, 0 if the value has no fast path.
+ */
+static gint arg_kind(void *db, wg_query_arg *arg) {
+  gint value = arg->value;
+
+  switch(arg->cond & ~QUERY_COND_FLAGS) {
+    case WG_COND_EQUAL:
+    case WG_COND_LESSTHAN:
+    case WG_COND_GREATER:
+    case WG_COND_LTEQUAL:
+    case WG_COND_GTEQUAL:
+    case WG_COND_NOT_EQUAL:
+      break;
+    default:
+      return 0;
   }
-#endif
+  if(issmallint(value))
+    return QUERY_COND_SMALLINT;
+  else if(isfixpoint(value) || isdate(value))
+    return QUERY_COND_TAGGED;
+  else if(istime(value))
+    return QUERY_COND_TIME;
+  else if(wg_get_encoded_type(db, value) == WG_STRTYPE)
+    return QUERY_COND_STR;
+  return 0;
+}
 
-  /* Determine total number of query parameters (number of arguments
-   * in arglist and non-wildcard fields of matchrec).
-   */
-  *fargc = argc;
-  if(matchrec) {
-    for(i=0; i<reclen; i++) {
+/** Estimate the order in which to check the arguments
+ *  arglist holds a single argument or a disjunction of size
+ *  arguments. Arguments that reject more rows for the cost of checking
+ *  them should be checked first.
+ *  returns the cost of the check per rejected row
+ */
+static double arg_rank(void *db, wg_query_arg *arglist, gint size) {
+  double sel = 0, cost = 0;
+  gint i;
+
+  for(i=0; i<size; i++) {
+    wg_query_arg arg = arglist[i];
+    arg.cond &= ~QUERY_COND_FLAGS;
+    sel += column_selectivity(db, &arg, 1, arg.column, 0);
+    if(arglist[i].cond & (QUERY_COND_KINDS & ~QUERY_COND_STR))
+      cost += 1;
+    else if(arg.cond == WG_COND_IN) {
+      gint *values;
+      cost += in_list_values(db, arg.value, &values);
+    }
+    else if(arg.cond == WG_COND_CONTAINS)
+      cost += 4;
+    else
+      cost += 2;
+  }
+  if(sel >= 1)
+    return cost * 1e6; /* rejects nothing, check last */
+  return cost / (1 - sel);
+}
+
+/** Compile an argument list for checking the rows
+ *  Sets the kind of the value of each argument (see check_arg())
+ *  and orders the arguments by arg_rank() so that check_arglist()
+ *  can return as early as possible. Disjunctions are kept whole.
+ *  The list is not usable for planning the query after this.
+ */
+static void compile_arglist(void *db, wg_query_arg *arglist, gint argc) {
+  wg_query_arg tmp[QUERY_COMPILE_MAXARGS];
+  double rank[QUERY_COMPILE_MAXARGS];
+  gint start[QUERY_COMPILE_MAXARGS], size[QUERY_COMPILE_MAXARGS];
+  gint i, j, k, n, units = 0;
+
+  for(i=0; i<argc; i++)
+    arglist[i].cond |= arg_kind(db, &arglist[i]);
+  if(argc < 2 || argc > QUERY_COMPILE_MAXARGS)
+    return;
+
+  for(i=0; i<argc; i+=n) {
+    double r;
+    n = checked_group_size(arglist, argc, i);
+    r = arg_rank(db, arglist + i, n);
+
+    /* insertion sort, equal ranks keep their order */
+    for(k=units++; k>0 && rank[k-1] > r; k--) {
+      rank[k] = rank[k-1];
+      start[k] = start[k-1];
+      size[k] = size[k-1];
+    }
+    rank[k] = r;
+    start[k] = i;
+    size[k] = n;
+  }
+
+  for(i=0, j=0; i<units; j+=size[i++])
+    memcpy(tmp + j, arglist + start[i], size[i] * sizeof(wg_query_arg));
+  memcpy(arglist, tmp, argc * sizeof(wg_query_arg));
+}
+
+/** Find the size of a disjunction
+ *  The arguments following arglist[i] that have WG_COND_OR set
+ *  are alternatives to it.
+ *  returns the number of arguments in the disjunction (1 if none).
+ */
+static gint group_size(wg_query_arg *arglist, gint argc, gint i) {
+  gint size = 1;
+  while(i + size < argc && (arglist[i + size].cond & WG_COND_OR))
+    size++;
+  return size;
+}
+
+/** Check if a disjunction is a list of values of a column
+ *  returns the column if the arguments are WG_COND_EQUAL and WG_COND_IN
+ *  conditions on a single column, -1 otherwise.
+ */
+static gint group_column(wg_query_arg *arglist, gint size) {
+  gint i;
+  for(i=0; i<size; i++) {
+    gint cond = arglist[i].cond & ~WG_COND_OR;
+    if(arglist[i].column != arglist[0].column ||\
+      (cond != WG_COND_EQUAL && cond != WG_COND_IN))
+      return -1;
+  }
+  return arglist[0].column;
+}
+
+/** Combine the disjunctions of an argument list
+ *  A disjunction of WG_COND_EQUAL and WG_COND_IN conditions on a
+ *  single column is replaced by a WG_COND_IN argument with all the
+ *  values. The list is stored in listbuf, laid out like a record.
+ *  The arguments of other disjunctions are marked with the internal
+ *  flags (see QUERY_COND_GROUP). The values of WG_COND_PREFIX
+ *  arguments are replaced by their ranges, also stored in listbuf
+ *  (see prefix_range()).
+ *
+ *  If listbuf is NULL, the argument list is not changed.
+ *
+ *  returns the new number of arguments, or the size of listbuf needed
+ *  (in gints) if listbuf is NULL.
+ */
+static gint group_args(void *db, wg_query_arg *arglist, gint argc,
+  gint *listbuf) {
+  gint i, j, k, size, need = 0;
+
+  for(i=0, k=0; i<argc; i+=size) {
+    size = group_size(arglist, argc, i);
+    if(size > 1 && group_column(arglist + i, size) >= 0) {
+      gint *list = listbuf, count = 0, len;
+      for(j=i; j<i+size; j++) {
+        if((arglist[j].cond & ~WG_COND_OR) == WG_COND_IN) {
+          gint *values, n = in_list_values(db, arglist[j].value, &values);
+          if(list)
+            memcpy(list + RECORD_HEADER_GINTS + count, values,
+              n * sizeof(gint));
+          count += n;
+        } else {
+          if(list)
+            list[RECORD_HEADER_GINTS + count] = arglist[j].value;
+          count++;
+        }
+      }
+      len = RECORD_HEADER_GINTS + count;
+      if((len * sizeof(gint)) % 8)
+        len++; /* keep the next list aligned */
+      if(!listbuf) {
+        need += len;
+        continue;
+      }
+      list[0] = (RECORD_HEADER_GINTS + count) * sizeof(gint);
+      list[RECORD_META_POS] = RECORD_META_NOTDATA|RECORD_META_MATCH;
+      list[RECORD_BACKLINKS_POS] = 0;
+      listbuf += len;
+      arglist[k].column = arglist[i].column;
+      arglist[k].cond = WG_COND_IN;
+      arglist[k++].value = encode_datarec_offset(ptrtooffset(db, list));
+    }
+    else {
+      for(j=i; j<i+size; j++) {
+        gint len = 0, range = 0;
+        if((arglist[j].cond & ~WG_COND_OR) == WG_COND_PREFIX) {
+          len = prefix_range(db, arglist[j].value, listbuf, &range);
+          need += len;
+        }
+        if(!listbuf)
+          continue;
+        arglist[k] = arglist[j];
+        if(len) {
+          arglist[k].value = range;
+          listbuf += len;
+        }
+        if(size == 1)
+          arglist[k].cond &= ~WG_COND_OR; /* nothing to OR with */
+        else if(j == i)
+          arglist[k].cond |= QUERY_COND_GROUP|WG_COND_OR;
+        k++;
+      }
+    }
+  }
+  return (listbuf ? k : need);
+}
+
+/** Check that the value of an argument suits the condition
+ *  returns 0 if it does, -1 otherwise.
+ */
+static gint check_arg_value(void *db, gint cond, gint value) {
+  gint type = wg_get_encoded_type(db, value);
+
+  switch(cond & ~WG_COND_OR) {
+    case WG_COND_IN:
+      if(type != WG_RECORDTYPE) {
+        show_query_error(db, "WG_COND_IN needs a list of values");
+        return -1;
+      }
+      break;
+    case WG_COND_PREFIX:
+      if(type != WG_STRTYPE && type != WG_URITYPE) {
+        show_query_error(db, "WG_COND_PREFIX needs a string or URI value");
+        return -1;
+      }
+      break;
+    default:
+      break;
+  }
+  return 0;
+}
+
+/** Prepare query parameters
+ *
+ * - Validates matchrec and arglist
+ * - Converts external pointers to locally allocated data
+ * - Builds an unified argument list
+ * - Combines the disjunctions and stores the ranges of prefixes
+ *   (see group_args()), if group is non-0
+ *
+ * Returns 0 on success, non-0 on error.
+ *
+ * If the function was successful, *farglist will be set to point
+ * to a newly allocated unified argument list and *fargc will be set
+ * to indicate the size of *farglist.
+ *
+ * If there was an error, *farglist and *fargc may be in
+ * an undetermined state.
+ */
+static gint prepare_params(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, gint group,
+  wg_query_arg **farglist, gint *fargc) {
+  int i;
+
+  if(matchrec) {
+    /* Get the correct length of matchrec data area and the pointer
+     * to the beginning of the data. If matchrec is a plain array in
+     * local memory (indicated by NON-zero reclen) we will skip this step.
+     */
+    if(!reclen) {
+      reclen = wg_get_record_len(db, matchrec);
+      matchrec = wg_get_record_dataarray(db, matchrec);
+    }
+#ifdef CHECK
+    if(!reclen) {
+      show_query_error(db, "Zero-length match record argument");
+      return -1;
+    }
+#endif
+  }
+
+  for(i=0; i<argc; i++) {
+    if(check_arg_value(db, arglist[i].cond, arglist[i].value))
+      return -1;
+  }
+
+#ifdef CHECK
+  if(arglist && !argc) {
+    show_query_error(db, "Zero-length argument list");
+    return -1;
+  }
+  if(!arglist && argc) {
+    show_query_error(db, "Invalid argument list (NULL)");
+    return -1;
+  }
+#endif
+
+  /* Determine total number of query parameters (number of arguments
+   * in arglist and non-wildcard fields of matchrec).
+   */
+  *fargc = argc;
+  if(matchrec) {
+    for(i=0; i<reclen; i++) {
       if(wg_get_encoded_type(db, ((gint *) matchrec)[i]) != WG_VARTYPE)
         (*fargc)++;
     }
@@ -393,15 +1484,20 @@ static gint prepare_params(void *db, void *matchrec, gint reclen,
 
   if(*fargc) {
     wg_query_arg *tmp = NULL;
+    gint argsize = *fargc * sizeof(wg_query_arg);
+    gint listsize = (group ? group_args(db, arglist, argc, NULL) : 0);
 
     /* The simplest way to treat matchrec is to convert it to
      * arglist. While doing this, we will create a local copy of the
      * argument list, which has the side effect of allowing the caller
      * to free the original arglist after wg_make_query() returns. The
      * local copy will be attached to the query object and needs to
-     * survive beyond that.
+     * survive beyond that. The lists of values of combined
+     * disjunctions are stored after the arguments.
      */
-    tmp = (wg_query_arg *) malloc(*fargc * sizeof(wg_query_arg));
+    if(argsize % 8)
+      argsize += 8 - argsize % 8;
+    tmp = (wg_query_arg *) malloc(argsize + listsize * sizeof(gint));
     if(!tmp) {
       show_query_error(db, "Failed to allocate memory");
       return -2;
@@ -426,6 +1522,9 @@ static gint prepare_params(void *db, void *matchrec, gint reclen,
       }
     }
 
+    if(group)
+      *fargc = group_args(db, tmp, *fargc,
+        (gint *) ((char *) tmp + argsize));
     *farglist = tmp;
   }
   else {
@@ -435,6 +1534,133 @@ static gint prepare_params(void *db, void *matchrec, gint reclen,
   return 0;
 }
 
+/** Find the bounds of a column from the query argument list
+ *
+ * The bounds are encoded values, WG_ILLEGAL if the column is not
+ * bounded from that side. All the range and equality conditions on
+ * the column are combined into the tightest bounds. A list of values
+ * is bounded by its smallest and largest value, a prefix by its range
+ * (see prefix_range()). Disjunctions are ignored.
+ *
+ * returns 1 if the column has conditions that cannot be satisfied by
+ * a continuous range of index values (the rows need to be checked
+ * against the full argument list), 0 otherwise.
+ */
+static gint column_bounds(void *db, wg_query_arg *arglist, gint argc,
+  gint col, gint *start_bound, gint *end_bound,
+  int *start_inclusive, int *end_inclusive) {
+  int i;
+  gint full_check = 0;
+
+  for(i=0; i<argc; i++) {
+    if(arglist[i].column != col || is_grouped_arg(&arglist[i])) continue;
+    switch(arglist[i].cond) {
+      case WG_COND_EQUAL:
+        /* Set bounds as if we had val >= 1 & val <= 1 */
+        if(*start_bound==WG_ILLEGAL ||\
+          WG_COMPARE(db, *start_bound, arglist[i].value)==WG_LESSTHAN) {
+          *start_bound = arglist[i].value;
+          *start_inclusive = 1;
+        }
+        if(*end_bound==WG_ILLEGAL ||\
+          WG_COMPARE(db, *end_bound, arglist[i].value)==WG_GREATER) {
+          *end_bound = arglist[i].value;
+          *end_inclusive = 1;
+        }
+        break;
+      case WG_COND_LESSTHAN:
+        /* No earlier right bound or new end bound is a smaller
+         * value (reducing the result set). The result set is also
+         * possibly reduced if the value is equal, because this
+         * condition is non-inclusive. */
+        if(*end_bound==WG_ILLEGAL ||\
+          WG_COMPARE(db, *end_bound, arglist[i].value)!=WG_LESSTHAN) {
+          *end_bound = arglist[i].value;
+          *end_inclusive = 0;
+        }
+        break;
+      case WG_COND_GREATER:
+        /* No earlier left bound or new left bound is >= of old value */
+        if(*start_bound==WG_ILLEGAL ||\
+          WG_COMPARE(db, *start_bound, arglist[i].value)!=WG_GREATER) {
+          *start_bound = arglist[i].value;
+          *start_inclusive = 0;
+        }
+        break;
+      case WG_COND_LTEQUAL:
+        /* Similar to "less than", but inclusive */
+        if(*end_bound==WG_ILLEGAL ||\
+          WG_COMPARE(db, *end_bound, arglist[i].value)==WG_GREATER) {
+          *end_bound = arglist[i].value;
+          *end_inclusive = 1;
+        }
+        break;
+      case WG_COND_GTEQUAL:
+        /* Similar to "greater", but inclusive */
+        if(*start_bound==WG_ILLEGAL ||\
+          WG_COMPARE(db, *start_bound, arglist[i].value)==WG_LESSTHAN) {
+          *start_bound = arglist[i].value;
+          *start_inclusive = 1;
+        }
+        break;
+      case WG_COND_PREFIX:
+        {
+          /* The range made by prefix_range() holds exactly the
+           * values that begin with the prefix */
+          gint *values;
+          in_list_values(db, arglist[i].value, &values);
+          if(*start_bound==WG_ILLEGAL ||\
+            WG_COMPARE(db, *start_bound, values[0])==WG_LESSTHAN) {
+            *start_bound = values[0];
+            *start_inclusive = 1;
+          }
+          if(values[1] == WG_ILLEGAL)
+            full_check = 1; /* not bounded by the end of the range */
+          else if(*end_bound==WG_ILLEGAL ||\
+            WG_COMPARE(db, *end_bound, values[1])!=WG_LESSTHAN) {
+            *end_bound = values[1];
+            *end_inclusive = 0;
+          }
+        }
+        break;
+      case WG_COND_IN:
+        {
+          gint *values, count, k, lo = WG_ILLEGAL, hi = WG_ILLEGAL;
+          count = in_list_values(db, arglist[i].value, &values);
+          for(k=0; k<count; k++) {
+            if(lo==WG_ILLEGAL || WG_COMPARE(db, lo, values[k])==WG_GREATER)
+              lo = values[k];
+            if(hi==WG_ILLEGAL || WG_COMPARE(db, hi, values[k])==WG_LESSTHAN)
+              hi = values[k];
+          }
+          if(lo != WG_ILLEGAL && (*start_bound==WG_ILLEGAL ||\
+            WG_COMPARE(db, *start_bound, lo)==WG_LESSTHAN)) {
+            *start_bound = lo;
+            *start_inclusive = 1;
+          }
+          if(hi != WG_ILLEGAL && (*end_bound==WG_ILLEGAL ||\
+            WG_COMPARE(db, *end_bound, hi)==WG_GREATER)) {
+            *end_bound = hi;
+            *end_inclusive = 1;
+          }
+        }
+        /* fall through - the values between the bounds need checking */
+      case WG_COND_NOT_EQUAL:
+      case WG_COND_CONTAINS:
+        /* Force use of full argument list to check each row in the result
+         * set since we have a condition we cannot satisfy using
+         * a continuous range of T-tree values alone
+         */
+        full_check = 1;
+        break;
+      default:
+        show_query_error(db, "Invalid condition (ignoring)");
+        break;
+    }
+  }
+  return full_check;
+}
+
 /*
  * Locate the node offset and slot for start and end bound
  * in a T-tree index.
@@ -442,7 +1668,7 @@ static gint prepare_params(void *db, void *matchrec, gint reclen,
  * return -1 on error
  * return 0 on success
  */
-static gint find_ttree_bounds(void *db, gint index_id, gint col,
+static gint find_ttree_bounds(void *db, gint index_id,
   gint start_bound, gint end_bound, gint start_inclusive, gint end_inclusive,
   gint *curr_offset, gint *curr_slot, gint *end_offset, gint *end_slot)
 {
@@ -473,10 +1699,10 @@ static gint find_ttree_bounds(void *db, gint index_id, gint col,
        * node for the given value and the first slot that
        * is equal or greater than the given value.
        */
-      co = wg_search_ttree_leftmost(db,
+      co = wg_search_ttree_leftmost(db, index_id,
         TTREE_ROOT_NODE(hdr), start_bound, &boundtype, NULL);
       if(boundtype == REALLY_BOUNDING_NODE) {
-        cs = wg_search_tnode_first(db, co, start_bound, col);
+        cs = wg_search_tnode_first(db, co, start_bound, index_id);
         if(cs == -1) {
           show_query_error(db, "Starting index node was bad");
           return -1;
@@ -496,10 +1722,10 @@ static gint find_ttree_bounds(void *db, gint index_id, gint col,
       /* For non-inclusive, we need the rightmost node and
        * the last slot+1. The latter may overflow into next node.
        */
-      co = wg_search_ttree_rightmost(db,
+      co = wg_search_ttree_rightmost(db, index_id,
         TTREE_ROOT_NODE(hdr), start_bound, &boundtype, NULL);
       if(boundtype == REALLY_BOUNDING_NODE) {
-        cs = wg_search_tnode_last(db, co, start_bound, col);
+        cs = wg_search_tnode_last(db, co, start_bound, index_id);
         if(cs == -1) {
           show_query_error(db, "Starting index node was bad");
           return -1;
@@ -545,10 +1771,10 @@ static gint find_ttree_bounds(void *db, gint index_id, gint col,
       /* Find the rightmost node with a given value and the
        * righmost slot that is equal or smaller than that value
        */
-      eo = wg_search_ttree_rightmost(db,
+      eo = wg_search_ttree_rightmost(db, index_id,
         TTREE_ROOT_NODE(hdr), end_bound, &boundtype, NULL);
       if(boundtype == REALLY_BOUNDING_NODE) {
-        es = wg_search_tnode_last(db, eo, end_bound, col);
+        es = wg_search_tnode_last(db, eo, end_bound, index_id);
         if(es == -1) {
           show_query_error(db, "Ending index node was bad");
           return -1;
@@ -570,11 +1796,11 @@ static gint find_ttree_bounds(void *db, gint index_id, gint col,
       /* For non-inclusive, we need the leftmost node and
        * the first slot-1.
        */
-      eo = wg_search_ttree_leftmost(db,
+      eo = wg_search_ttree_leftmost(db, index_id,
         TTREE_ROOT_NODE(hdr), end_bound, &boundtype, NULL);
       if(boundtype == REALLY_BOUNDING_NODE) {
         es = wg_search_tnode_first(db, eo,
-          end_bound, col);
+          end_bound, index_id);
         if(es == -1) {
           show_query_error(db, "Ending index node was bad");
           return -1;
@@ -644,88 +1870,707 @@ static gint find_ttree_bounds(void *db, gint index_id, gint col,
   return 0;
 }
 
-/** Create a query object.
- *
- * matchrec - array of encoded integers. Can be a pointer to a database record
- * or a user-allocated array. If reclen is 0, it is treated as a native
- * database record. If reclen is non-zero, reclen number of gint-sized
- * words is read, starting from the pointer.
- *
- * Fields of type WG_VARTYPE in matchrec are treated as wildcards. Other
- * types, including NULL, are used as "equals" conditions.
- *
- * arglist - array of wg_query_arg objects. The size is must be given
- * by argc.
- *
- * flags - type of query requested and other parameters
+/** Find an index of the given type on a column
+ *  Indexes with templates are not used.
+ *  returns the index id, 0 if there is none.
+ */
+static gint find_column_index(void *db, gint column, gint type) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint *ilist;
+
+  if(column > MAX_INDEXED_FIELDNR)
+    return 0;
+  ilist = &dbh->index_control_area_header.index_table[column];
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(ilistelem->car) {
+      wg_index_header *hdr = \
+        (wg_index_header *) offsettoptr(db, ilistelem->car);
+      if(hdr->type == type && !hdr->template_offset)
+        return ilistelem->car;
+    }
+    ilist = &ilistelem->cdr;
+  }
+  return 0;
+}
+
+/** Find the number of candidate rows to check at once
+ *  The batch does not go past the row limit, so the rows are examined
+ *  as if they were checked one at a time.
+ */
+static gint batch_size(query_result_set *set, wg_uint rowlimit) {
+  if(rowlimit && rowlimit - set->res_count < QUERY_BATCH_SIZE)
+    return (gint) (rowlimit - set->res_count);
+  return QUERY_BATCH_SIZE;
+}
+
+/** Check a batch of candidate rows and add the matching ones to
+ *  a result set (see check_arglist_batch()). The batch array is
+ *  overwritten.
+ *  returns 0 on success, -1 on error
+ */
+static gint append_checked(void *db, wg_query *query, query_result_set *set,
+  gint *batch, gint count, wg_query_arg *arglist, gint argc) {
+  gint i;
+
+  query->stats.examined += count;
+  if(argc)
+    count = check_arglist_batch(db, batch, count, arglist, argc);
+  query->stats.matched += count;
+  for(i=0; i<count; i++) {
+    if(append_resultset(db, set, batch[i]))
+      return -1;
+  }
+  return 0;
+}
+
+/** Find the bounding box of a query in an R-tree index
+ *  An R-tree index is usable if each of its columns is bounded from
+ *  both sides by values of the same numeric type. Rows that have
+ *  other values in the columns are not in the index, but they cannot
+ *  match such bounds either.
  *
- * rowlimit - maximum number of rows fetched. Only has an effect if
- * QUERY_FLAGS_PREFETCH is set.
+ *  returns 0 and fills the box if the index is usable
+ *  returns -1 otherwise
+ */
+static gint rtree_box(void *db, wg_index_header *hdr,
+  wg_query_arg *arglist, gint argc, double *box) {
+  gint i;
+
+  if(hdr->type != WG_INDEX_TYPE_RTREE)
+    return -1;
+  for(i=0; i<hdr->fields; i++) {
+    gint sb = WG_ILLEGAL, eb = WG_ILLEGAL;
+    int si = 0, ei = 0;
+    column_bounds(db, arglist, argc, hdr->rec_field_index[i],
+      &sb, &eb, &si, &ei);
+    if(sb == WG_ILLEGAL || eb == WG_ILLEGAL ||\
+      wg_get_encoded_type(db, sb) != wg_get_encoded_type(db, eb) ||\
+      wg_rtree_coord(db, sb, &box[i]) ||\
+      wg_rtree_coord(db, eb, &box[hdr->fields + i]))
+      return -1;
+  }
+  return 0;
+}
+
+/** Run a query using an R-tree index
+ *  The rows found inside the bounding box are checked against the
+ *  full argument list, as the box is inclusive and built from
+ *  converted values.
  *
- * returns NULL if constructing the query fails. Otherwise returns a pointer
- * to a wg_query object.
+ *  returns 1 if the query was built (as a prefetch query)
+ *  returns 0 if the index is not usable
+ *  returns -1 on error
  */
-static wg_query *internal_build_query(void *db, void *matchrec, gint reclen,
-  wg_query_arg *arglist, gint argc, gint flags, wg_uint rowlimit) {
+static gint rtree_query(void *db, wg_query *query, gint index_id,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit) {
+  double box[2*MAX_INDEX_FIELDS];
+  query_result_set *set;
+  gint *offsets = NULL;
+  gint count, i, n;
 
-  wg_query *query;
-  wg_query_arg *full_arglist;
-  gint fargc = 0;
-  gint col, index_id = -1;
-  int i;
+  if(rtree_box(db, (wg_index_header *) offsettoptr(db, index_id),
+    arglist, argc, box))
+    return 0;
 
-#ifdef CHECK
-  if (!dbcheck(db)) {
-    /* XXX: currently show_query_error would work too */
-#ifdef WG_NO_ERRPRINT
-#else
-    fprintf(stderr, "Invalid database pointer in wg_make_query.\n");
-#endif
-    return NULL;
+  count = wg_search_rtree(db, index_id, box, &offsets);
+  if(count < 0)
+    return -1;
+  if(!(set = create_resultset(db))) {
+    if(count)
+      free(offsets);
+    return -1;
   }
-#endif
 
-  /* Check and prepare the parameters. If there was an error,
-   * prepare_params() does it's own cleanup so we can (and should)
-   * return immediately.
-   */
-  if(prepare_params(db, matchrec, reclen, arglist, argc,
-    &full_arglist, &fargc)) {
-    return NULL;
+  compile_arglist(db, arglist, argc);
+  for(i=0; i<count; i+=n) {
+    n = batch_size(set, rowlimit);
+    if(n > count - i)
+      n = count - i;
+    if(append_checked(db, query, set, offsets + i, n, arglist, argc)) {
+      free(offsets);
+      free_resultset(db, set);
+      return -1;
+    }
+    if(rowlimit && set->res_count >= rowlimit)
+      break;
   }
+  if(count)
+    free(offsets);
 
-  query = (wg_query *) malloc(sizeof(wg_query));
-  if(!query) {
+  query->qtype = WG_QTYPE_PREFETCH;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->column = -1;
+  query->curr_page = set->first_page;
+  query->curr_pidx = 0;
+  query->res_count = set->res_count;
+  query->mpool = set->mpool;
+  free(set); /* contents were inherited, dispose of the struct */
+  return 1;
+}
+
+/** Run a query using bitmap and trigram indexes
+ *  Conditions on columns that have a bitmap index are evaluated
+ *  by combining the record sets of the matching values: the sets of
+ *  one condition are OR-ed and the conditions are AND-ed. This is
+ *  done one chunk of records at a time, on uncompressed bitmaps so
+ *  that the loops operate on whole words. The chunks are taken from
+ *  the most selective condition. Remaining conditions are checked
+ *  on the records.
+ *
+ *  A WG_COND_CONTAINS condition on a column with a trigram index
+ *  adds the record set of each trigram of the searched string
+ *  as a separate condition. This gives the candidate rows, the
+ *  condition itself is then checked on the rows.
+ *
+ *  returns 1 if the query was built (as a prefetch query)
+ *  returns 0 if the indexes are not applicable
+ *  returns -1 on error
+ */
+static gint bitmap_query(void *db, wg_query *query, wg_query_arg *arglist,
+  gint argc, wg_uint rowlimit) {
+
+  struct bitmap_cond {
+    gint *sets;     /* record sets of the matching values */
+    gint count;
+    gint card;      /* total number of records in the sets */
+  } *bc = NULL;
+  struct bitmap_arg {
+    gint index_id;  /* bitmap or trigram index, 0 if none */
+    gint *keys;     /* trigrams of the searched string */
+    gint nkeys;
+  } *ba = NULL;
+  wg_uint words[BITMAP_CHUNK_WORDS], tmp[BITMAP_CHUNK_WORDS];
+  wg_query_arg *rest = NULL;
+  query_result_set *set = NULL;
+  gint *cursor = NULL;
+  gint batch[QUERY_BATCH_SIZE], n, size;
+  gint nbc = 0, restc = 0, drv = 0;
+  gint i, j, retv = -1;
+
+  ba = (struct bitmap_arg *) malloc(argc * sizeof(struct bitmap_arg));
+  if(!ba) {
     show_query_error(db, "Failed to allocate memory");
-    if(full_arglist) free(full_arglist);
-    return NULL;
+    return -1;
   }
-
-  if(fargc) {
-    /* Find the best (hopefully) index to base the query on.
-     * Then initialise the query object to the first row in the
-     * query result set.
-     * XXX: only considering T-tree indexes now. */
-    col = most_restricting_column(db, full_arglist, fargc, &index_id);
+  memset(ba, 0, argc * sizeof(struct bitmap_arg));
+  for(i=0; i<argc; i++) {
+    ba[i].index_id = (is_grouped_arg(&arglist[i]) ? 0 :
+      find_column_index(db, arglist[i].column, WG_INDEX_TYPE_BITMAP));
+    if(ba[i].index_id) {
+      nbc++;
+    }
+    else if(arglist[i].cond == WG_COND_CONTAINS) {
+      gint id = find_column_index(db, arglist[i].column,
+        WG_INDEX_TYPE_TRIGRAM);
+      if(id) {
+        ba[i].nkeys = wg_trigram_keys(db, arglist[i].value, &ba[i].keys);
+        if(ba[i].nkeys < 0) {
+          ba[i].nkeys = 0;
+          goto done;
+        }
+        if(ba[i].nkeys) {
+          /* Searched string is long enough to have trigrams */
+          ba[i].index_id = id;
+          nbc += ba[i].nkeys;
+        }
+      }
+    }
   }
-  else {
-    /* Create a "full scan" query with no arguments. */
-    index_id = -1;
-    full_arglist = NULL; /* redundant/paranoia */
+  if(!nbc) {
+    retv = 0;
+    goto done;
   }
 
-  if(index_id > 0) {
-    int start_inclusive = 0, end_inclusive = 0;
-    gint start_bound = WG_ILLEGAL; /* encoded values */
-    gint end_bound = WG_ILLEGAL;
+  bc = (struct bitmap_cond *) malloc(nbc * sizeof(struct bitmap_cond));
+  rest = (wg_query_arg *) malloc(argc * sizeof(wg_query_arg));
+  if(!bc || !rest) {
+    show_query_error(db, "Failed to allocate memory");
+    nbc = 0;
+    goto done;
+  }
 
-    query->qtype = WG_QTYPE_TTREE;
-    query->column = col;
-    query->curr_offset = 0;
-    query->curr_slot = -1;
-    query->end_offset = 0;
-    query->end_slot = -1;
-    query->direction = 1;
+  /* Collect the record sets of each condition */
+  for(i=0, j=0; i<argc; i++) {
+    if(ba[i].nkeys) {
+      gint k;
+      for(k=0; k<ba[i].nkeys; k++, j++) {
+        gint s = wg_bitmap_find_set(db, ba[i].index_id, ba[i].keys[k]);
+        bc[j].count = bc[j].card = 0;
+        bc[j].sets = (gint *) malloc(sizeof(gint));
+        if(!bc[j].sets) {
+          show_query_error(db, "Failed to allocate memory");
+          nbc = j;
+          goto done;
+        }
+        if(s) {
+          bc[j].sets[bc[j].count++] = s;
+          bc[j].card = wg_bitmap_set_card(db, s);
+        }
+        if(bc[j].card < bc[drv].card)
+          drv = j;
+      }
+      /* The candidate rows are checked for the substring */
+      rest[restc++] = arglist[i];
+    }
+    else if(ba[i].index_id) {
+      gint k, vcount = wg_bitmap_value_count(db, ba[i].index_id);
+      bc[j].count = bc[j].card = 0;
+      bc[j].sets = (gint *) malloc((vcount ? vcount : 1) * sizeof(gint));
+      if(!bc[j].sets) {
+        show_query_error(db, "Failed to allocate memory");
+        nbc = j;
+        goto done;
+      }
+      for(k=0; k<vcount; k++) {
+        gint s, v = wg_bitmap_value(db, ba[i].index_id, k, &s);
+        if(check_condition(db, v, arglist[i].cond, arglist[i].value)) {
+          bc[j].sets[bc[j].count++] = s;
+          bc[j].card += wg_bitmap_set_card(db, s);
+        }
+      }
+      if(bc[j].card < bc[drv].card)
+        drv = j;
+      j++;
+    } else {
+      rest[restc++] = arglist[i];
+    }
+  }
+  compile_arglist(db, rest, restc);
+
+  if(!(set = create_resultset(db)))
+    goto done;
+  if(!(cursor = (gint *) malloc((bc[drv].count ? bc[drv].count : 1) *\
+    sizeof(gint)))) {
+    show_query_error(db, "Failed to allocate memory");
+    goto done;
+  }
+  memset(cursor, 0, bc[drv].count * sizeof(gint));
+
+  /* Walk the chunks of the driving condition in ascending order */
+  for(;;) {
+    gint key = -1;
+
+    for(i=0; i<bc[drv].count; i++) {
+      if(cursor[i] < wg_bitmap_chunk_count(db, bc[drv].sets[i])) {
+        gint k = wg_bitmap_chunk_key(db, bc[drv].sets[i], cursor[i]);
+        if(key < 0 || k < key)
+          key = k;
+      }
+    }
+    if(key < 0)
+      break; /* all chunks done */
+
+    memset(words, 0, sizeof(words));
+    for(i=0; i<bc[drv].count; i++) {
+      if(cursor[i] < wg_bitmap_chunk_count(db, bc[drv].sets[i]) &&\
+        wg_bitmap_chunk_key(db, bc[drv].sets[i], cursor[i]) == key) {
+        wg_bitmap_or_chunk(db, bc[drv].sets[i], key, words);
+        cursor[i]++;
+      }
+    }
+
+    for(j=0; j<nbc; j++) {
+      gint found = 0, w;
+      if(j == drv)
+        continue;
+      memset(tmp, 0, sizeof(tmp));
+      for(i=0; i<bc[j].count; i++)
+        found |= wg_bitmap_or_chunk(db, bc[j].sets[i], key, tmp);
+      if(!found)
+        break;
+      for(w=0; w<(gint) BITMAP_CHUNK_WORDS; w++)
+        words[w] &= tmp[w];
+    }
+    if(j < nbc)
+      continue; /* some condition has no records in this chunk */
+
+    /* The records of the chunk are checked in batches */
+    size = batch_size(set, rowlimit);
+    for(i=0, n=0; i<(gint) BITMAP_CHUNK_WORDS; i++) {
+      wg_uint w = words[i];
+      gint b = i * BITMAP_WORD_BITS;
+      for(; w; w >>= 1, b++) {
+        if(w & 1) {
+          batch[n++] = BITMAP_RECORD_OFFSET(key, b);
+          if(n < size)
+            continue;
+          if(append_checked(db, query, set, batch, n, rest, restc))
+            goto done;
+          if(rowlimit && set->res_count >= rowlimit)
+            goto complete;
+          size = batch_size(set, rowlimit);
+          n = 0;
+        }
+      }
+    }
+    if(n) {
+      if(append_checked(db, query, set, batch, n, rest, restc))
+        goto done;
+      if(rowlimit && set->res_count >= rowlimit)
+        goto complete;
+    }
+  }
+
+complete:
+  query->qtype = WG_QTYPE_PREFETCH;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->column = -1;
+  query->curr_page = set->first_page;
+  query->curr_pidx = 0;
+  query->res_count = set->res_count;
+  query->mpool = set->mpool;
+  free(set); /* contents were inherited, dispose of the struct */
+  set = NULL;
+  retv = 1;
+
+done:
+  if(set)
+    free_resultset(db, set);
+  if(bc) {
+    for(j=0; j<nbc; j++)
+      free(bc[j].sets);
+    free(bc);
+  }
+  if(rest)
+    free(rest);
+  if(cursor)
+    free(cursor);
+  for(i=0; i<argc; i++) {
+    if(ba[i].nkeys)
+      free(ba[i].keys);
+  }
+  free(ba);
+  return retv;
+}
+
+/** Make a sorted copy of the values of a WG_COND_IN argument
+ *  Duplicate values are removed.
+ *  returns the array (to be freed by the caller), NULL on error.
+ */
+static gint *sorted_in_list(void *db, gint value, gint *count) {
+  gint *values, *copy;
+
+  *count = in_list_values(db, value, &values);
+  copy = (gint *) malloc((*count ? *count : 1) * sizeof(gint));
+  if(!copy) {
+    show_query_error(db, "Failed to allocate memory");
+    return NULL;
+  }
+  memcpy(copy, values, *count * sizeof(gint));
+  *count = sort_values(db, copy, *count);
+  return copy;
+}
+
+/** Collect the rows of an index that match the conditions on its columns
+ *  Lists of values are looked up one value at a time, in sorted order:
+ *  each combination of the values of the key columns of a hash index
+ *  and each value of the leading column of a T-tree index. The other
+ *  conditions on the columns of a T-tree index are applied by a
+ *  query on the index.
+ *
+ *  returns 0 on success
+ *  returns 1 if the index is not applicable
+ *  returns -1 on error
+ */
+static gint index_rows(void *db, gint index_id, gint epoch,
+  wg_query_arg *arglist, gint argc, query_result_set *set) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint *lists[MAX_INDEX_FIELDS], counts[MAX_INDEX_FIELDS];
+  gint pos[MAX_INDEX_FIELDS], values[MAX_INDEX_FIELDS];
+  wg_query_arg *subargs = NULL;
+  gint i, j, k, retv = -1;
+
+  for(k=0; k<hdr->fields; k++)
+    lists[k] = NULL;
+
+  if(hdr->type == WG_INDEX_TYPE_HASH) {
+    for(k=0; k<hdr->fields; k++) {
+      for(j=0; j<argc; j++) {
+        if(arglist[j].column == hdr->rec_field_index[k] &&\
+          (arglist[j].cond == WG_COND_EQUAL ||\
+          arglist[j].cond == WG_COND_IN))
+          break;
+      }
+      if(j == argc) {
+        retv = 1;
+        goto done;
+      }
+      if(arglist[j].cond == WG_COND_IN) {
+        if(!(lists[k] = sorted_in_list(db, arglist[j].value, &counts[k])))
+          goto done;
+        if(!counts[k]) {
+          retv = 0; /* no values, no rows */
+          goto done;
+        }
+      } else {
+        values[k] = arglist[j].value;
+        counts[k] = 1;
+      }
+      pos[k] = 0;
+    }
+
+    /* Walk the combinations like an odometer */
+    for(;;) {
+      gint list;
+      for(k=0; k<hdr->fields; k++) {
+        if(lists[k])
+          values[k] = lists[k][pos[k]];
+      }
+      list = wg_search_hash(db, index_id, values, hdr->fields);
+      if(list < 0)
+        goto done;
+      while(list > 0) {
+        gcell *cell = (gcell *) offsettoptr(db, list);
+        if(append_resultset(db, set, INDEX_ENTRY_RECORD(db, hdr, cell->car)))
+          goto done;
+        list = cell->cdr;
+      }
+      for(k=hdr->fields-1; k>=0; k--) {
+        if(++pos[k] < counts[k])
+          break;
+        pos[k] = 0;
+      }
+      if(k < 0)
+        break;
+    }
+  } else {
+    /* Conditions on the indexed columns are given to a T-tree query.
+     * A list on the leading column is replaced by each value in turn. */
+    wg_query_plan subplan;
+    gint subc = 0, probe = -1;
+
+    if(!(subargs = (wg_query_arg *) malloc(argc * sizeof(wg_query_arg)))) {
+      show_query_error(db, "Failed to allocate memory");
+      goto done;
+    }
+    for(j=0; j<argc; j++) {
+      if(is_grouped_arg(&arglist[j]))
+        continue;
+      for(k=0; k<hdr->fields; k++) {
+        if(arglist[j].column == hdr->rec_field_index[k])
+          break;
+      }
+      if(k == hdr->fields)
+        continue;
+      if(!k && probe < 0 && arglist[j].cond == WG_COND_IN)
+        probe = subc;
+      subargs[subc] = arglist[j];
+      if(arglist[j].cond == WG_COND_PREFIX) {
+        /* the range is made again by internal_build_query() */
+        gint *values;
+        in_list_values(db, arglist[j].value, &values);
+        subargs[subc].value = values[0];
+      }
+      subc++;
+    }
+    if(!subc) {
+      retv = 1;
+      goto done;
+    }
+    counts[0] = 1;
+    if(probe >= 0) {
+      if(!(lists[0] = sorted_in_list(db, subargs[probe].value, &counts[0])))
+        goto done;
+      subargs[probe].cond = WG_COND_EQUAL;
+    }
+
+    subplan.type = WG_QPLAN_TTREE;
+    subplan.count = 1;
+    subplan.index_id[0] = index_id;
+    subplan.epoch = epoch;
+    subplan.rows = subplan.cost = 0;
+    for(i=0; i<counts[0]; i++) {
+      wg_query *sub;
+      void *rec;
+
+      if(probe >= 0)
+        subargs[probe].value = lists[0][i];
+      sub = internal_build_query(db, NULL, 0, subargs, subc, 0, 0, &subplan);
+      if(!sub)
+        goto done;
+      while((rec = wg_fetch(db, sub))) {
+        if(append_resultset(db, set, ptrtooffset(db, rec))) {
+          wg_free_query(db, sub);
+          goto done;
+        }
+      }
+      wg_free_query(db, sub);
+    }
+  }
+  retv = 0;
+
+done:
+  for(k=0; k<hdr->fields; k++) {
+    if(lists[k])
+      free(lists[k]);
+  }
+  if(subargs)
+    free(subargs);
+  return retv;
+}
+
+/** Run a query using the row sets of hash and T-tree indexes
+ *  The rows of each index of the plan that match the conditions on
+ *  the indexed columns are collected into a set and the sets are
+ *  intersected. The remaining rows are checked against the full
+ *  argument list. Plans with a single hash index or lookups of a
+ *  list of values are also run here.
+ *
+ *  returns 1 if the query was built (as a prefetch query)
+ *  returns 0 if the indexes are not applicable
+ *  returns -1 on error
+ */
+static gint intersect_query(void *db, wg_query *query, wg_query_plan *plan,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit) {
+  query_result_set *set = NULL, *result;
+  gint i, offset;
+
+  for(i=0; i<plan->count; i++) {
+    query_result_set *next;
+    gint res;
+
+    if(!(next = create_resultset(db)))
+      goto error;
+    res = index_rows(db, plan->index_id[i], plan->epoch, arglist, argc, next);
+    if(res) {
+      free_resultset(db, next);
+      if(set)
+        free_resultset(db, set);
+      return (res < 0 ? -1 : 0);
+    }
+
+    if(set) {
+      query_result_set *isect = intersect_resultset(db, set, next);
+      free_resultset(db, set);
+      free_resultset(db, next);
+      if(!(set = isect))
+        goto error;
+    } else {
+      set = next;
+    }
+    if(!set->res_count)
+      break; /* the rest cannot add rows */
+  }
+
+  if(!set && !(set = create_resultset(db)))
+    goto error;
+  if(!(result = create_resultset(db)))
+    goto error;
+  compile_arglist(db, arglist, argc);
+  rewind_resultset(db, set);
+  for(;;) {
+    gint batch[QUERY_BATCH_SIZE], n = 0, size = batch_size(result, rowlimit);
+    while(n < size && (offset = fetch_resultset(db, set)))
+      batch[n++] = offset;
+    if(!n)
+      break;
+    if(append_checked(db, query, result, batch, n, arglist, argc)) {
+      free_resultset(db, result);
+      goto error;
+    }
+    if(rowlimit && result->res_count >= rowlimit)
+      break;
+  }
+  free_resultset(db, set);
+
+  query->qtype = WG_QTYPE_PREFETCH;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->column = -1;
+  query->curr_page = result->first_page;
+  query->curr_pidx = 0;
+  query->res_count = result->res_count;
+  query->mpool = result->mpool;
+  free(result); /* contents were inherited, dispose of the struct */
+  return 1;
+
+error:
+  if(set)
+    free_resultset(db, set);
+  return -1;
+}
+
+/** Set up the cursor of a hash index lookup
+ *
+ * The index of query->plan must be a hash index with an equality
+ * condition on each of its columns. query->curr_record is set to the
+ * list of rows of the hash entry, 0 if there is none and -1 on error.
+ *
+ * returns 1 if the cursor was set up, 0 if the index is not applicable.
+ */
+static gint hash_cursor(void *db, wg_query *query,
+  wg_query_arg *arglist, gint argc) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db,
+    query->plan.index_id[0]);
+  gint values[MAX_INDEX_FIELDS];
+  gint i, k;
+
+  if(hdr->type != WG_INDEX_TYPE_HASH)
+    return 0;
+  for(k=0; k<hdr->fields; k++) {
+    for(i=0; i<argc; i++) {
+      if(arglist[i].column == hdr->rec_field_index[k] &&\
+        arglist[i].cond == WG_COND_EQUAL)
+        break;
+    }
+    if(i == argc)
+      return 0;
+    values[k] = arglist[i].value;
+  }
+
+  query->qtype = WG_QTYPE_HASH;
+  query->column = -1; /* the rows are checked against all conditions */
+  query->curr_record = wg_search_hash(db, query->plan.index_id[0],
+    values, hdr->fields);
+  return 1;
+}
+
+/** Set up the cursor of a T-tree, hash or full scan query
+ *
+ * Uses the index of query->plan (if it is a T-tree plan) to find the
+ * range of rows and attaches the argument list to the query. A hash
+ * plan with equality conditions on all the columns of a hash index
+ * reads the list of rows of the matching hash entry; all the
+ * conditions are checked on the rows. The
+ * argument list is either full_arglist or a reduced copy that is
+ * stored in argbuf (fargc elements), or newly allocated if argbuf is
+ * NULL. The attached list is compiled (see compile_arglist()).
+ *
+ * returns 0 on success, 1 if the query is known to be empty and -1
+ * on error.
+ */
+static gint setup_query(void *db, wg_query *query,
+  wg_query_arg *full_arglist, gint fargc, gint flags, wg_query_arg *argbuf) {
+  gint col = -1, index_id = -1;
+  gint used_cols[MAX_INDEX_FIELDS]; /* columns satisfied by index bounds */
+  gint used_count = 0;
+  int i;
+
+  if(query->plan.type == WG_QPLAN_TTREE) {
+    index_id = query->plan.index_id[0];
+    col = ((wg_index_header *) offsettoptr(db, index_id))->rec_field_index[0];
+  }
+
+  if(index_id > 0) {
+    wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+    int start_inclusive = 0, end_inclusive = 0;
+    gint start_bound = WG_ILLEGAL; /* encoded values or composite keys */
+    gint end_bound = WG_ILLEGAL;
+    gint start_key[TTREE_KEYBUF_SIZE], end_key[TTREE_KEYBUF_SIZE];
+    int empty = 0;
+
+    query->qtype = WG_QTYPE_TTREE;
+    query->column = col;
+    query->curr_offset = 0;
+    query->curr_slot = -1;
+    query->end_offset = 0;
+    query->end_slot = -1;
+    query->direction = 1;
+    if(hdr->include_count)
+      query->cover_index = index_id;
 
     /* Determine the bounds for the given column/index.
      *
@@ -748,94 +2593,110 @@ static wg_query *internal_build_query(void *db, void *matchrec, gint reclen,
      *      containing 1. The result set begins with that value, scan left
      *      until the end of chain is reached.
      */
-    for(i=0; i<fargc; i++) {
-      if(full_arglist[i].column != col) continue;
-      switch(full_arglist[i].cond) {
-        case WG_COND_EQUAL:
-          /* Set bounds as if we had val >= 1 & val <= 1 */
-          if(start_bound==WG_ILLEGAL ||\
-            WG_COMPARE(db, start_bound, full_arglist[i].value)==WG_LESSTHAN) {
-            start_bound = full_arglist[i].value;
-            start_inclusive = 1;
-          }
-          if(end_bound==WG_ILLEGAL ||\
-            WG_COMPARE(db, end_bound, full_arglist[i].value)==WG_GREATER) {
-            end_bound = full_arglist[i].value;
-            end_inclusive = 1;
-          }
-          break;
-        case WG_COND_LESSTHAN:
-          /* No earlier right bound or new end bound is a smaller
-           * value (reducing the result set). The result set is also
-           * possibly reduced if the value is equal, because this
-           * condition is non-inclusive. */
-          if(end_bound==WG_ILLEGAL ||\
-            WG_COMPARE(db, end_bound, full_arglist[i].value)!=WG_LESSTHAN) {
-            end_bound = full_arglist[i].value;
-            end_inclusive = 0;
-          }
-          break;
-        case WG_COND_GREATER:
-          /* No earlier left bound or new left bound is >= of old value */
-          if(start_bound==WG_ILLEGAL ||\
-            WG_COMPARE(db, start_bound, full_arglist[i].value)!=WG_GREATER) {
-            start_bound = full_arglist[i].value;
-            start_inclusive = 0;
-          }
-          break;
-        case WG_COND_LTEQUAL:
-          /* Similar to "less than", but inclusive */
-          if(end_bound==WG_ILLEGAL ||\
-            WG_COMPARE(db, end_bound, full_arglist[i].value)==WG_GREATER) {
-            end_bound = full_arglist[i].value;
-            end_inclusive = 1;
-          }
-          break;
-        case WG_COND_GTEQUAL:
-          /* Similar to "greater", but inclusive */
-          if(start_bound==WG_ILLEGAL ||\
-            WG_COMPARE(db, start_bound, full_arglist[i].value)==WG_LESSTHAN) {
-            start_bound = full_arglist[i].value;
-            start_inclusive = 1;
-          }
-          break;
-        case WG_COND_NOT_EQUAL:
-          /* Force use of full argument list to check each row in the result
-           * set since we have a condition we cannot satisfy using
-           * a continuous range of T-tree values alone
-           */
+    if(hdr->fields == 1) {
+      if(column_bounds(db, full_arglist, fargc, col,
+        &start_bound, &end_bound, &start_inclusive, &end_inclusive))
+        query->column = -1;
+      used_cols[used_count++] = col;
+
+      /* Simple sanity check. Is start_bound greater than end_bound? */
+      if(start_bound!=WG_ILLEGAL && end_bound!=WG_ILLEGAL &&\
+        WG_COMPARE(db, start_bound, end_bound) == WG_GREATER) {
+        empty = 1;
+      }
+    } else {
+      /* Composite index. Equality conditions on the leading columns
+       * and the bounds of the column following them form a single
+       * continuous range of keys:
+       * a = 1 & b = 2 & c > 3 ==>
+       *      start key is (1, 2, 3) non-inclusive, end key is (1, 2, *)
+       *      inclusive where * matches any value.
+       */
+      gint *start_col = start_key + RECORD_HEADER_GINTS;
+      gint *end_col = end_key + RECORD_HEADER_GINTS;
+      gint skey = wg_init_ttree_key(db, start_key);
+      gint ekey = wg_init_ttree_key(db, end_key);
+      int k;
+
+      start_inclusive = end_inclusive = 1;
+      for(k=0; k<hdr->fields; k++) {
+        gint kcol = hdr->rec_field_index[k];
+        gint sb = WG_ILLEGAL, eb = WG_ILLEGAL;
+        int si = 0, ei = 0;
+        gint full_check = column_bounds(db, full_arglist, fargc, kcol,
+          &sb, &eb, &si, &ei);
+
+        if(sb==WG_ILLEGAL && eb==WG_ILLEGAL)
+          break; /* column not bounded, rest of the key is unused */
+        if(full_check)
           query->column = -1;
-          break;
-        default:
-          show_query_error(db, "Invalid condition (ignoring)");
-          break;
+        used_cols[used_count++] = kcol;
+
+        if(sb!=WG_ILLEGAL && eb!=WG_ILLEGAL) {
+          gint cr = WG_COMPARE(db, sb, eb);
+          if(cr == WG_GREATER) {
+            empty = 1;
+            break;
+          } else if(cr == WG_EQUAL && si && ei) {
+            /* Equality, continue with the next column */
+            start_col[kcol] = end_col[kcol] = sb;
+            continue;
+          }
+        }
+
+        /* Range ends the usable part of the key */
+        if(sb!=WG_ILLEGAL) {
+          start_col[kcol] = sb;
+          start_inclusive = si;
+        }
+        if(eb!=WG_ILLEGAL) {
+          end_col[kcol] = eb;
+          end_inclusive = ei;
+        }
+        break;
       }
+
+      /* If the leading column has no bound, the key is unbounded */
+      if(start_col[hdr->rec_field_index[0]] != WG_ILLEGAL)
+        start_bound = skey;
+      if(end_col[hdr->rec_field_index[0]] != WG_ILLEGAL)
+        end_bound = ekey;
     }
 
-    /* Simple sanity check. Is start_bound greater than end_bound? */
-    if(start_bound!=WG_ILLEGAL && end_bound!=WG_ILLEGAL &&\
-      WG_COMPARE(db, start_bound, end_bound) == WG_GREATER) {
+    if(empty) {
       /* return empty query */
       query->argc = 0;
       query->arglist = NULL;
-      free(full_arglist);
-      return query;
+      return 1;
     }
 
     /* Now find the bounding nodes for the query */
-    if(find_ttree_bounds(db, index_id, col,
+    if(find_ttree_bounds(db, index_id,
         start_bound, end_bound, start_inclusive, end_inclusive,
         &query->curr_offset, &query->curr_slot, &query->end_offset,
         &query->end_slot)) {
-      free(query);
-      free(full_arglist);
-      return NULL;
+      return -1;
     }
+    if(query->curr_offset)
+      query->stats.tnodes++;
 
-    /* XXX: here we can reverse the direction and switch the start and
-     * end nodes/slots, if "descending" sort order is needed.
+    /* Descending order: reverse the direction and switch the start
+     * and end nodes/slots.
      */
+    if((flags & QUERY_FLAGS_DESCENDING) && query->curr_offset) {
+      gint tmp = query->curr_offset;
+      query->curr_offset = query->end_offset;
+      query->end_offset = tmp;
+      tmp = query->curr_slot;
+      query->curr_slot = query->end_slot;
+      query->end_slot = tmp;
+      query->direction = -1;
+    }
 
+  } else if(query->plan.type == WG_QPLAN_HASH &&\
+    hash_cursor(db, query, full_arglist, fargc)) {
+    if(query->curr_record < 0)
+      return -1;
   } else {
     /* Nothing better than full scan available */
     void *rec;
@@ -849,35 +2710,59 @@ static wg_query *internal_build_query(void *db, void *matchrec, gint reclen,
       query->curr_record = ptrtooffset(db, rec);
     else
       query->curr_record = 0;
+    query->end_offset = 0; /* read to the end of the table */
   }
 
   /* Now attach the argument list to the query. If the query is based
    * on a column index, we will create a slimmer copy that does not contain
-   * the conditions already satisfied by the index bounds.
+   * the conditions already satisfied by the index bounds. Disjunctions
+   * are always kept whole. Lists of values combined from disjunctions
+   * and the ranges of prefixes are stored in the full argument list,
+   * so it is kept if there are any lists, or ranges that are not
+   * covered by the index bounds.
    */
+  for(i=0; i<fargc; i++) {
+    if(full_arglist[i].cond == WG_COND_IN)
+      query->column = -1;
+    else if((full_arglist[i].cond & ~WG_COND_OR) == WG_COND_PREFIX) {
+      int k;
+      for(k=0; k<used_count; k++) {
+        if(full_arglist[i].column == used_cols[k]) break;
+      }
+      if(k == used_count || is_grouped_arg(&full_arglist[i]))
+        query->column = -1;
+    }
+  }
   if(query->column == -1) {
     query->arglist = full_arglist;
     query->argc = fargc;
   }
   else {
-    int cnt = 0;
+    int cnt = 0, k;
     for(i=0; i<fargc; i++) {
-      if(full_arglist[i].column != query->column)
+      for(k=0; k<used_count; k++) {
+        if(full_arglist[i].column == used_cols[k]) break;
+      }
+      if(k == used_count || is_grouped_arg(&full_arglist[i]))
         cnt++;
     }
 
     /* The argument list is reduced, but still contains columns */
     if(cnt) {
       int j;
-      query->arglist = (wg_query_arg *) malloc(cnt * sizeof(wg_query_arg));
+      if(argbuf)
+        query->arglist = argbuf;
+      else
+        query->arglist = (wg_query_arg *) malloc(cnt * sizeof(wg_query_arg));
       if(!query->arglist) {
         show_query_error(db, "Failed to allocate memory");
-        free(query);
-        free(full_arglist);
-        return NULL;
+        return -1;
       }
       for(i=0, j=0; i<fargc; i++) {
-        if(full_arglist[i].column != query->column) {
+        for(k=0; k<used_count; k++) {
+          if(full_arglist[i].column == used_cols[k]) break;
+        }
+        if(k == used_count || is_grouped_arg(&full_arglist[i])) {
           query->arglist[j].column = full_arglist[i].column;
           query->arglist[j].cond = full_arglist[i].cond;
           query->arglist[j++].value = full_arglist[i].value;
@@ -886,89 +2771,562 @@ static wg_query *internal_build_query(void *db, void *matchrec, gint reclen,
     } else
       query->arglist = NULL;
     query->argc = cnt;
-    free(full_arglist); /* Now we have a reduced argument list, free
-                         * the original one */
   }
 
-  /* Now handle any post-processing required.
+  /* If the index entries hold all the columns in the argument list,
+   * the rows can be checked without accessing the data records.
    */
-  if(flags & QUERY_FLAGS_PREFETCH) {
-    query_result_page **prevnext;
-    query_result_page *currpage;
-    void *rec;
-
-    query->curr_page = NULL; /* initialize as empty */
-    query->curr_pidx = 0;
-    query->res_count = 0;
-
-    /* XXX: could move this inside the loop (speeds up empty
-     * query, slows down other queries) */
-    query->mpool = wg_create_mpool(db, sizeof(query_result_page));
-    if(!query->mpool) {
-      show_query_error(db, "Failed to allocate result memory pool");
-      wg_free_query(db, query);
-      return NULL;
-    }
-
-    i = QUERY_RESULTSET_PAGESIZE;
-    prevnext = (query_result_page **) &(query->curr_page);
-
-    while((rec = wg_fetch(db, query))) {
-      if(i >= QUERY_RESULTSET_PAGESIZE) {
-        currpage = (query_result_page *) \
-          wg_alloc_mpool(db, query->mpool, sizeof(query_result_page));
-        if(!currpage) {
-          show_query_error(db, "Failed to allocate a resultset row");
-          wg_free_query(db, query);
-          return NULL;
-        }
-        memset(currpage->rows, 0, sizeof(gint) * QUERY_RESULTSET_PAGESIZE);
-        *prevnext = currpage;
-        prevnext = &(currpage->next);
-        currpage->next = NULL;
-        i = 0;
-      }
-      currpage->rows[i++] = ptrtooffset(db, rec);
-      query->res_count++;
-      if(rowlimit && query->res_count >= rowlimit)
+  if(query->cover_index) {
+    wg_index_header *hdr = \
+      (wg_index_header *) offsettoptr(db, query->cover_index);
+    query->cover_args = 1;
+    for(i=0; i<query->argc; i++) {
+      if(!wg_index_covers_columns(db, hdr, &query->arglist[i].column, 1)) {
+        query->cover_args = 0;
         break;
+      }
     }
-
-    /* Finally, convert the query type. */
-    query->qtype = WG_QTYPE_PREFETCH;
   }
 
-  return query;
+  compile_arglist(db, query->arglist, query->argc);
+  return 0;
 }
 
-/** Create a query object and pre-fetch all data rows.
+/** Create a query object.
  *
- * Allocates enough space to hold all row offsets, fetches them and stores
- * them in an array. Isolation is not guaranteed in any way, shape or form,
- * but can be implemented on top by the user.
+ * matchrec - array of encoded integers. Can be a pointer to a database record
+ * or a user-allocated array. If reclen is 0, it is treated as a native
+ * database record. If reclen is non-zero, reclen number of gint-sized
+ * words is read, starting from the pointer.
+ *
+ * Fields of type WG_VARTYPE in matchrec are treated as wildcards. Other
+ * types, including NULL, are used as "equals" conditions.
+ *
+ * arglist - array of wg_query_arg objects. The size is must be given
+ * by argc.
+ *
+ * flags - type of query requested and other parameters
+ *
+ * rowlimit - maximum number of rows fetched. Only has an effect if
+ * QUERY_FLAGS_PREFETCH is set.
+ *
+ * plan - plan made earlier for the same arguments (see plan_query()).
+ * Ignored if NULL or if the indexes have changed since.
  *
  * returns NULL if constructing the query fails. Otherwise returns a pointer
  * to a wg_query object.
  */
-wg_query *wg_make_query(void *db, void *matchrec, gint reclen,
-  wg_query_arg *arglist, gint argc) {
+static wg_query *internal_build_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, gint flags, wg_uint rowlimit,
+  wg_query_plan *plan) {
 
-  return internal_build_query(db,
-    matchrec, reclen, arglist, argc, QUERY_FLAGS_PREFETCH, 0);
-}
+  wg_query *query;
+  wg_query_arg *full_arglist;
+  gint fargc = 0, res;
+  clock_t start = clock();
+  int i;
 
-/** Create a query object and pre-fetch rowlimit number of rows.
- *
- * returns NULL if constructing the query fails. Otherwise returns a pointer
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    /* XXX: currently show_query_error would work too */
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_make_query.\n");
+#endif
+    return NULL;
+  }
+#endif
+
+  /* Rows with deferred index updates must be visible to the query */
+  if(wg_flush_indexes(db))
+    return NULL;
+
+  /* Check and prepare the parameters. If there was an error,
+   * prepare_params() does it's own cleanup so we can (and should)
+   * return immediately.
+   */
+  if(prepare_params(db, matchrec, reclen, arglist, argc, 1,
+    &full_arglist, &fargc)) {
+    return NULL;
+  }
+
+  query = (wg_query *) malloc(sizeof(wg_query));
+  if(!query) {
+    show_query_error(db, "Failed to allocate memory");
+    if(full_arglist) free(full_arglist);
+    return NULL;
+  }
+  query->cover_index = 0;
+  query->cover_args = 0;
+  query->curr_entry = 0;
+  query->cache_entry = NULL;
+  memset(&query->stats, 0, sizeof(wg_query_stats));
+
+  if(!fargc)
+    full_arglist = NULL; /* redundant/paranoia */
+
+  /* Find the cheapest (hopefully) way to run the query. Plans other
+   * than a T-tree range or a full scan produce the complete result set
+   * at once, so they can only be used for prefetch queries.
+   */
+  if(plan && plan_valid(db, plan) && ((flags & QUERY_FLAGS_PREFETCH) ||\
+    plan->type == WG_QPLAN_TTREE || plan->type == WG_QPLAN_SCAN)) {
+    query->plan = *plan;
+  }
+  else if(plan_query(db, full_arglist, fargc,
+    (flags & QUERY_FLAGS_PREFETCH), &query->plan)) {
+    free(query);
+    if(full_arglist) free(full_arglist);
+    return NULL;
+  }
+
+  if(query->plan.type != WG_QPLAN_TTREE &&\
+    query->plan.type != WG_QPLAN_SCAN) {
+    if(query->plan.type == WG_QPLAN_RTREE)
+      res = rtree_query(db, query, query->plan.index_id[0],
+        full_arglist, fargc, rowlimit);
+    else if(query->plan.type == WG_QPLAN_BITMAP)
+      res = bitmap_query(db, query, full_arglist, fargc, rowlimit);
+    else
+      res = intersect_query(db, query, &query->plan,
+        full_arglist, fargc, rowlimit);
+    if(res) {
+      free(full_arglist);
+      if(res < 0) {
+        free(query);
+        return NULL;
+      }
+      query->stats.time = QUERY_TIME(start);
+      return query;
+    }
+    /* The indexes were not applicable after all, use a plan that
+     * does not depend on the values */
+    if(plan_query(db, full_arglist, fargc, 0, &query->plan)) {
+      free(query);
+      free(full_arglist);
+      return NULL;
+    }
+  }
+
+  res = setup_query(db, query, full_arglist, fargc, flags, NULL);
+  if(res < 0) {
+    free(query);
+    free(full_arglist);
+    return NULL;
+  }
+  if(query->arglist != full_arglist)
+    free(full_arglist); /* a reduced argument list is used */
+  if(res > 0) {
+    query->stats.time = QUERY_TIME(start);
+    return query; /* empty query */
+  }
+
+  /* Now handle any post-processing required.
+   */
+  if(flags & QUERY_FLAGS_PREFETCH) {
+    query_result_page **prevnext;
+    query_result_page *currpage;
+    void *rec;
+
+    query->curr_page = NULL; /* initialize as empty */
+    query->curr_pidx = 0;
+    query->res_count = 0;
+
+    /* XXX: could move this inside the loop (speeds up empty
+     * query, slows down other queries) */
+    query->mpool = wg_create_mpool(db, sizeof(query_result_page));
+    if(!query->mpool) {
+      show_query_error(db, "Failed to allocate result memory pool");
+      wg_free_query(db, query);
+      return NULL;
+    }
+
+    i = QUERY_RESULTSET_PAGESIZE;
+    prevnext = (query_result_page **) &(query->curr_page);
+
+    while((rec = wg_fetch(db, query))) {
+      if(i >= QUERY_RESULTSET_PAGESIZE) {
+        currpage = (query_result_page *) \
+          wg_alloc_mpool(db, query->mpool, sizeof(query_result_page));
+        if(!currpage) {
+          show_query_error(db, "Failed to allocate a resultset row");
+          wg_free_query(db, query);
+          return NULL;
+        }
+        memset(currpage->rows, 0, sizeof(gint) * QUERY_RESULTSET_PAGESIZE);
+        *prevnext = currpage;
+        prevnext = &(currpage->next);
+        currpage->next = NULL;
+        i = 0;
+      }
+      /* Covering index: keep the entry, the row can be found from it */
+      currpage->rows[i++] = (query->cover_index ?
+        query->curr_entry : ptrtooffset(db, rec));
+      query->res_count++;
+      if(rowlimit && query->res_count >= rowlimit)
+        break;
+    }
+
+    /* Finally, convert the query type. The rows are returned
+     * again from the result pages. */
+    query->qtype = WG_QTYPE_PREFETCH;
+    query->stats.returned = 0;
+  }
+
+  query->stats.time = QUERY_TIME(start);
+  return query;
+}
+
+/** Find a T-tree index that gives the order of a column
+ *  The column must be the leading column of the index.
+ *  returns the index id, 0 if there is none.
+ */
+static gint order_index(void *db, gint column) {
+  db_memsegment_header* dbh = dbmemsegh(db);
+  gint *ilist;
+
+  if(column > MAX_INDEXED_FIELDNR)
+    return 0;
+  ilist = &dbh->index_control_area_header.index_table[column];
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    if(ilistelem->car) {
+      wg_index_header *hdr = \
+        (wg_index_header *) offsettoptr(db, ilistelem->car);
+      if(hdr->type == WG_INDEX_TYPE_TTREE && !hdr->template_offset &&\
+        hdr->rec_field_index[0] == column)
+        return ilistelem->car;
+    }
+    ilist = &ilistelem->cdr;
+  }
+  return 0;
+}
+
+/** Compare two (key, row offset) pairs in the order of a query
+ *  Rows with equal keys are ordered by their offset.
+ *  returns a positive value if a comes after b.
+ */
+static gint order_compare(void *db, gint *a, gint *b, gint order) {
+  gint cr = WG_COMPARE(db, a[0], b[0]);
+  if(cr == WG_EQUAL)
+    return (a[1] > b[1]) - (a[1] < b[1]);
+  return (order == WG_ORDER_DESC ? -cr : cr);
+}
+
+/** Move a heap element down to its place
+ *  The heap holds (key, row offset) pairs, the root is the one
+ *  that comes last in the order.
+ */
+static void order_sift_down(void *db, gint *heap, gint count, gint i,
+  gint order) {
+  for(;;) {
+    gint c = 2*i + 1, tmp;
+    if(c >= count)
+      break;
+    if(c + 1 < count &&\
+      order_compare(db, &heap[2*(c+1)], &heap[2*c], order) > 0)
+      c++;
+    if(order_compare(db, &heap[2*c], &heap[2*i], order) <= 0)
+      break;
+    tmp = heap[2*i]; heap[2*i] = heap[2*c]; heap[2*c] = tmp;
+    tmp = heap[2*i+1]; heap[2*i+1] = heap[2*c+1]; heap[2*c+1] = tmp;
+    i = c;
+  }
+}
+
+/** Sort the rows of a query and keep the first limit rows
+ *  The rows are read from the query and kept in a heap of limit
+ *  elements (all the rows if limit is 0), which is then sorted. The
+ *  query is converted to a prefetch query that returns the rows
+ *  in order.
+ *  returns 0 on success, -1 on error.
+ */
+static gint order_rows(void *db, wg_query *query, gint column, gint order,
+  wg_uint limit) {
+  query_result_set *set;
+  gint *heap, size, count = 0, i;
+  void *rec;
+
+  size = (limit && limit < QUERY_ORDER_INITSIZE ?
+    (gint) limit : QUERY_ORDER_INITSIZE);
+  heap = (gint *) malloc(2 * size * sizeof(gint));
+  if(!heap) {
+    show_query_error(db, "Failed to allocate memory");
+    return -1;
+  }
+
+  while((rec = wg_fetch(db, query))) {
+    gint elem[2];
+    if(wg_get_record_len(db, rec) <= column)
+      continue;
+    elem[0] = wg_get_field(db, rec, column);
+    elem[1] = ptrtooffset(db, rec);
+    if(!limit || (wg_uint) count < limit) {
+      /* Add as a leaf and move up */
+      if(count == size) {
+        gint *newheap = (gint *) realloc(heap, 4 * size * sizeof(gint));
+        if(!newheap) {
+          show_query_error(db, "Failed to allocate memory");
+          free(heap);
+          return -1;
+        }
+        heap = newheap;
+        size *= 2;
+      }
+      for(i=count++; i>0 &&\
+        order_compare(db, elem, &heap[2*((i-1)/2)], order) > 0;
+        i=(i-1)/2) {
+        heap[2*i] = heap[2*((i-1)/2)];
+        heap[2*i+1] = heap[2*((i-1)/2)+1];
+      }
+      heap[2*i] = elem[0];
+      heap[2*i+1] = elem[1];
+    } else if(order_compare(db, elem, heap, order) < 0) {
+      /* Replaces the last row kept */
+      heap[0] = elem[0];
+      heap[1] = elem[1];
+      order_sift_down(db, heap, count, 0, order);
+    }
+  }
+
+  /* Sort by moving the root to the end */
+  for(i=count-1; i>0; i--) {
+    gint tmp;
+    tmp = heap[0]; heap[0] = heap[2*i]; heap[2*i] = tmp;
+    tmp = heap[1]; heap[1] = heap[2*i+1]; heap[2*i+1] = tmp;
+    order_sift_down(db, heap, i, 0, order);
+  }
+
+  if(!(set = create_resultset(db))) {
+    free(heap);
+    return -1;
+  }
+  for(i=0; i<count; i++) {
+    if(append_resultset(db, set, heap[2*i+1])) {
+      free_resultset(db, set);
+      free(heap);
+      return -1;
+    }
+  }
+  free(heap);
+
+  if(query->qtype == WG_QTYPE_PREFETCH && query->mpool)
+    wg_free_mpool(db, query->mpool);
+  if(query->arglist)
+    free(query->arglist);
+  query->qtype = WG_QTYPE_PREFETCH;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->column = -1;
+  query->cover_index = 0; /* the offsets are rows */
+  query->stats.returned = 0;
+  query->curr_page = set->first_page;
+  query->curr_pidx = 0;
+  query->res_count = set->res_count;
+  query->mpool = set->mpool;
+  free(set); /* contents were inherited, dispose of the struct */
+  return 0;
+}
+
+/** Create a query object and pre-fetch all data rows.
+ *
+ * Allocates enough space to hold all row offsets, fetches them and stores
+ * them in an array. Isolation is not guaranteed in any way, shape or form,
+ * but can be implemented on top by the user.
+ *
+ * returns NULL if constructing the query fails. Otherwise returns a pointer
+ * to a wg_query object.
+ */
+wg_query *wg_make_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc) {
+
+  return cached_query(db, matchrec, reclen, arglist, argc, 0);
+}
+
+/** Create a query object and pre-fetch rowlimit number of rows.
+ *
+ * returns NULL if constructing the query fails. Otherwise returns a pointer
  * to a wg_query object.
  */
 wg_query *wg_make_query_rc(void *db, void *matchrec, gint reclen,
   wg_query_arg *arglist, gint argc, wg_uint rowlimit) {
 
-  return internal_build_query(db,
-    matchrec, reclen, arglist, argc, QUERY_FLAGS_PREFETCH, rowlimit);
+  return cached_query(db, matchrec, reclen, arglist, argc, rowlimit);
+}
+
+/** Create a query object with the rows in the order of a column
+ *
+ * The rows are returned in ascending (WG_ORDER_ASC) or descending
+ * (WG_ORDER_DESC) order of the values in the column, at most limit
+ * rows if limit is non-0. Rows that do not have the column are not
+ * returned, as with a T-tree index on the column.
+ *
+ * If there is a T-tree index that starts with the column and reading
+ * the index in order until limit rows are found is estimated to be
+ * cheaper than the best plan for the conditions, the index is used,
+ * backwards for the descending order. Otherwise the matching rows are
+ * passed through a heap of limit rows, so only the rows that are
+ * returned are sorted.
+ *
+ * returns NULL if constructing the query fails. Otherwise returns a pointer
+ * to a wg_query object.
+ */
+wg_query *wg_make_ordered_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, gint column, gint order,
+  wg_uint limit) {
+  wg_query *query;
+  wg_query_arg *full_arglist;
+  wg_query_plan plan;
+  gint fargc = 0, index_id, flags = QUERY_FLAGS_PREFETCH;
+  clock_t start = clock();
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    /* XXX: currently show_query_error would work too */
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_make_ordered_query.\n");
+#endif
+    return NULL;
+  }
+#endif
+  if(column < 0 || (order != WG_ORDER_ASC && order != WG_ORDER_DESC)) {
+    show_query_error(db, "Invalid order");
+    return NULL;
+  }
+  if(order == WG_ORDER_DESC)
+    flags |= QUERY_FLAGS_DESCENDING;
+
+  /* Plan for the conditions alone */
+  if(wg_flush_indexes(db) ||\
+    prepare_params(db, matchrec, reclen, arglist, argc, 1,
+      &full_arglist, &fargc))
+    return NULL;
+  if(plan_query(db, full_arglist, fargc, 1, &plan)) {
+    if(full_arglist) free(full_arglist);
+    return NULL;
+  }
+
+  index_id = order_index(db, column);
+  if(index_id && !(plan.type == WG_QPLAN_TTREE &&\
+    plan.index_id[0] == index_id)) {
+    /* The index range is read until limit rows are found. Assuming
+     * the matching rows are spread evenly, that is the fraction
+     * limit/rows of the range. */
+    wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+    wg_index_stats stats;
+    double sel, range, cost = plan.cost;
+
+    if(!wg_get_index_stats(db, index_id, &stats)) {
+      sel = index_selectivity(db, hdr, full_arglist, fargc, NULL);
+      if(sel < 0)
+        sel = 1; /* no conditions on the column */
+      range = stats.rows * sel;
+      if(limit && plan.rows > limit)
+        range *= limit / plan.rows;
+      cost = plan_seek_cost(stats.rows) +\
+        range * (PLAN_COST_ENTRY + PLAN_COST_ROW);
+    }
+    if(cost < plan.cost) {
+      plan.type = WG_QPLAN_TTREE;
+      plan.count = 1;
+      plan.index_id[0] = index_id;
+      plan.cost = cost;
+    }
+  }
+  if(full_arglist)
+    free(full_arglist);
+
+  if(plan.type == WG_QPLAN_TTREE && plan.index_id[0] == index_id) {
+    /* The index gives the order */
+    return internal_build_query(db, matchrec, reclen, arglist, argc,
+      flags, limit, &plan);
+  }
+
+  query = internal_build_query(db, matchrec, reclen, arglist, argc,
+    (plan.type == WG_QPLAN_TTREE || plan.type == WG_QPLAN_SCAN ?
+    0 : QUERY_FLAGS_PREFETCH), 0, &plan);
+  if(query && order_rows(db, query, column, order, limit)) {
+    wg_free_query(db, query);
+    return NULL;
+  }
+  if(query)
+    query->stats.time = QUERY_TIME(start);
+  return query;
 }
 
+/** Explain how a query would be run
+ *
+ *  Fills explain with the plan that wg_make_query() would use for the
+ *  same arguments and the types of the indexes in the plan. If the plan
+ *  is a T-tree range, the range bounds of the leading column of the
+ *  index are given too. The bounds are encoded values taken from the
+ *  arguments, so they can be used while the query parameters are kept.
+ *  The end of the range of a WG_COND_PREFIX argument is not one of the
+ *  arguments, so the range is given as unbounded from the end.
+ *  The query itself is not run.
+ *
+ *  returns 0 on success, -1 on error.
+ */
+gint wg_explain_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_query_explain *explain) {
+  wg_query_arg *full_arglist;
+  gint fargc = 0, i;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_explain_query.\n");
+#endif
+    return -1;
+  }
+#endif
+
+  if(wg_flush_indexes(db) ||\
+    prepare_params(db, matchrec, reclen, arglist, argc, 1,
+      &full_arglist, &fargc))
+    return -1;
+  if(!fargc)
+    full_arglist = NULL;
+  if(plan_query(db, full_arglist, fargc, 1, &explain->plan)) {
+    if(full_arglist) free(full_arglist);
+    return -1;
+  }
+
+  for(i=0; i<WG_QPLAN_MAX_INDEXES; i++) {
+    if(i < explain->plan.count) {
+      explain->index_type[i] = ((wg_index_header *) offsettoptr(db,
+        explain->plan.index_id[i]))->type;
+    } else
+      explain->index_type[i] = 0;
+  }
+  explain->column = -1;
+  explain->start_bound = explain->end_bound = WG_ILLEGAL;
+  explain->start_inclusive = explain->end_inclusive = 0;
+  if(explain->plan.type == WG_QPLAN_TTREE) {
+    wg_index_header *hdr = \
+      (wg_index_header *) offsettoptr(db, explain->plan.index_id[0]);
+    int si = 0, ei = 0;
+    explain->column = hdr->rec_field_index[0];
+    for(i=0; i<fargc; i++) {
+      if(full_arglist[i].cond == WG_COND_PREFIX) {
+        /* The end of the range is freed with the argument list */
+        gint *values;
+        in_list_values(db, full_arglist[i].value, &values);
+        values[1] = WG_ILLEGAL;
+      }
+    }
+    column_bounds(db, full_arglist, fargc, explain->column,
+      &explain->start_bound, &explain->end_bound, &si, &ei);
+    explain->start_inclusive = si;
+    explain->end_inclusive = ei;
+  }
+
+  if(full_arglist)
+    free(full_arglist);
+  return 0;
+}
 
 /** Return next record from the query object
  *  returns NULL if no more records
@@ -994,7 +3352,7 @@ void *wg_fetch(void *db, wg_query *query) {
     for(;;) {
       void *next;
 
-      if(!query->curr_record) {
+      if(!query->curr_record || query->curr_record == query->end_offset) {
         /* Query exhausted */
         return NULL;
       }
@@ -1011,13 +3369,18 @@ void *wg_fetch(void *db, wg_query *query) {
       /* Check the record against all conditions; if it does
        * not match, go to next iteration.
        */
+      query->stats.examined++;
       if(!query->arglist || \
-        check_arglist(db, rec, query->arglist, query->argc))
+        check_arglist(db, rec, query->arglist, query->argc)) {
+        query->stats.matched++;
+        query->stats.returned++;
         return rec;
+      }
     }
   }
   else if(query->qtype == WG_QTYPE_TTREE) {
     struct wg_tnode *node;
+    gint entry;
 
     for(;;) {
       if(!query->curr_offset) {
@@ -1025,7 +3388,13 @@ void *wg_fetch(void *db, wg_query *query) {
         return NULL;
       }
       node = (struct wg_tnode *) offsettoptr(db, query->curr_offset);
-      rec = offsettoptr(db, node->array_of_values[query->curr_slot]);
+      entry = node->array_of_values[query->curr_slot];
+      if(query->cover_index) {
+        query->curr_entry = entry;
+        rec = offsettoptr(db, COVERING_ENTRY_RECORD(db, entry));
+      } else {
+        rec = offsettoptr(db, entry);
+      }
 
       /* Increment the slot/and or node cursors before we
        * return. If the current node does not satisfy the
@@ -1050,67 +3419,2121 @@ void *wg_fetch(void *db, wg_query *query) {
             if(query->curr_offset) {
               node = (struct wg_tnode *) offsettoptr(db, query->curr_offset);
               query->curr_slot = node->number_of_elements - 1;
+              query->stats.tnodes++;
             }
 #ifdef CHECK
           }
 #endif
         } else if(query->curr_slot >= node->number_of_elements) {
 #ifdef CHECK
-          if(query->end_offset==query->curr_offset) {
-            /* This should not happen */
-            show_query_error(db, "Warning: end slot mismatch, possible bug");
-            query->curr_offset = 0;
-          } else {
+          if(query->end_offset==query->curr_offset) {
+            /* This should not happen */
+            show_query_error(db, "Warning: end slot mismatch, possible bug");
+            query->curr_offset = 0;
+          } else {
+#endif
+            query->curr_offset = TNODE_SUCCESSOR(db, node);
+            query->curr_slot = 0;
+            if(query->curr_offset)
+              query->stats.tnodes++;
+#ifdef CHECK
+          }
+#endif
+        }
+      }
+
+      /* If there are no extra conditions or the row satisfies
+       * all the conditions, we can return.
+       */
+      query->stats.examined++;
+      if(!query->arglist || \
+        check_arglist(db, (query->cover_args ? offsettoptr(db, entry) : rec),
+          query->arglist, query->argc)) {
+        query->stats.matched++;
+        query->stats.returned++;
+        return rec;
+      }
+    }
+  }
+  else if(query->qtype == WG_QTYPE_HASH) {
+    wg_index_header *hdr = (wg_index_header *) offsettoptr(db,
+      query->plan.index_id[0]);
+
+    while(query->curr_record) {
+      gcell *cell = (gcell *) offsettoptr(db, query->curr_record);
+      rec = offsettoptr(db, INDEX_ENTRY_RECORD(db, hdr, cell->car));
+      query->curr_record = cell->cdr;
+      query->stats.examined++;
+      if(!query->arglist || \
+        check_arglist(db, rec, query->arglist, query->argc)) {
+        query->stats.matched++;
+        query->stats.returned++;
+        return rec;
+      }
+    }
+    return NULL;
+  }
+  if(query->qtype == WG_QTYPE_PREFETCH) {
+    if(query->curr_page) {
+      query_result_page *currpage = (query_result_page *) query->curr_page;
+      gint offset = currpage->rows[query->curr_pidx++];
+      if(!offset) {
+        /* page not filled completely */
+        query->curr_page = NULL;
+        return NULL;
+      } else {
+        if(query->curr_pidx >= QUERY_RESULTSET_PAGESIZE) {
+          query->curr_page = (void *) (currpage->next);
+          query->curr_pidx = 0;
+        }
+      }
+      query->stats.returned++;
+      if(query->cover_index) {
+        query->curr_entry = offset;
+        return offsettoptr(db, COVERING_ENTRY_RECORD(db, offset));
+      }
+      return offsettoptr(db, offset);
+    }
+    else
+      return NULL;
+  }
+  else {
+    show_query_error(db, "Unsupported query type");
+    return NULL;
+  }
+}
+
+/** Return the next records from the query object
+ *
+ *  Stores up to n records in the out array, in the same order as
+ *  wg_fetch() would return them. The rows of a T-tree query are read
+ *  a node at a time and the rows of a prefetched query a result page
+ *  at a time. If the query is based on a covering index, the entry of
+ *  the last record is kept like wg_fetch() does.
+ *
+ *  returns the number of records stored, 0 if no more records and
+ *  -1 on error.
+ */
+gint wg_fetch_many(void *db, wg_query *query, void **out, gint n) {
+  gint count = 0;
+  void *rec;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_fetch_many.\n");
+#endif
+    return -1;
+  }
+  if(!query) {
+    show_query_error(db, "Invalid query object");
+    return -1;
+  }
+  if(n < 0 || (n && !out)) {
+    show_query_error(db, "Invalid output array");
+    return -1;
+  }
+#endif
+  if(query->qtype == WG_QTYPE_SCAN) {
+    while(count < n && query->curr_record &&\
+      query->curr_record != query->end_offset) {
+      void *next;
+      rec = offsettoptr(db, query->curr_record);
+      next = wg_get_next_record(db, rec);
+      query->curr_record = (next ? ptrtooffset(db, next) : 0);
+      query->stats.examined++;
+      if(!query->arglist || \
+        check_arglist(db, rec, query->arglist, query->argc))
+        out[count++] = rec;
+    }
+    query->stats.matched += count;
+  }
+  else if(query->qtype == WG_QTYPE_TTREE) {
+    gint dir = query->direction;
+
+    while(count < n && query->curr_offset) {
+      struct wg_tnode *node = \
+        (struct wg_tnode *) offsettoptr(db, query->curr_offset);
+      gint slot = query->curr_slot, last, run, entry;
+
+      /* The run of slots to read from this node */
+      if(query->curr_offset == query->end_offset)
+        last = query->end_slot;
+      else
+        last = (dir > 0 ? node->number_of_elements - 1 : 0);
+#ifdef CHECK
+      if((last - slot) * dir < 0) {
+        /* This should not happen */
+        show_query_error(db, "Warning: end slot mismatch, possible bug");
+        query->curr_offset = 0;
+        break;
+      }
+#endif
+      run = (last - slot) * dir + 1;
+      if(run > n - count)
+        run = n - count;
+      query->stats.examined += run;
+
+      if(!query->arglist && !query->cover_index) {
+        /* Every row in the run is a result */
+        for(; run > 0; run--, slot += dir)
+          out[count++] = offsettoptr(db, node->array_of_values[slot]);
+      } else {
+        for(; run > 0; run--, slot += dir) {
+          entry = node->array_of_values[slot];
+          if(query->cover_index)
+            rec = offsettoptr(db, COVERING_ENTRY_RECORD(db, entry));
+          else
+            rec = offsettoptr(db, entry);
+          if(!query->arglist || check_arglist(db,
+            (query->cover_args ? offsettoptr(db, entry) : rec),
+            query->arglist, query->argc)) {
+            if(query->cover_index)
+              query->curr_entry = entry;
+            out[count++] = rec;
+          }
+        }
+      }
+
+      /* Move the cursor past the slots that were read */
+      if(slot - dir != last)
+        query->curr_slot = slot;
+      else if(query->curr_offset == query->end_offset)
+        query->curr_offset = 0; /* last slot reached */
+      else if(dir > 0) {
+        query->curr_offset = TNODE_SUCCESSOR(db, node);
+        query->curr_slot = 0;
+        if(query->curr_offset)
+          query->stats.tnodes++;
+      } else {
+        query->curr_offset = TNODE_PREDECESSOR(db, node);
+        if(query->curr_offset) {
+          node = (struct wg_tnode *) offsettoptr(db, query->curr_offset);
+          query->curr_slot = node->number_of_elements - 1;
+          query->stats.tnodes++;
+        }
+      }
+    }
+    query->stats.matched += count;
+  }
+  else if(query->qtype == WG_QTYPE_HASH) {
+    wg_index_header *hdr = (wg_index_header *) offsettoptr(db,
+      query->plan.index_id[0]);
+    while(count < n && query->curr_record) {
+      gcell *cell = (gcell *) offsettoptr(db, query->curr_record);
+      rec = offsettoptr(db, INDEX_ENTRY_RECORD(db, hdr, cell->car));
+      query->curr_record = cell->cdr;
+      query->stats.examined++;
+      if(!query->arglist || \
+        check_arglist(db, rec, query->arglist, query->argc))
+        out[count++] = rec;
+    }
+    query->stats.matched += count;
+  }
+  else if(query->qtype == WG_QTYPE_PREFETCH) {
+    while(count < n && query->curr_page) {
+      query_result_page *currpage = (query_result_page *) query->curr_page;
+      gint *rows = currpage->rows + query->curr_pidx;
+      gint run = QUERY_RESULTSET_PAGESIZE - query->curr_pidx, i;
+
+      if(run > n - count)
+        run = n - count;
+      for(i=0; i<run && rows[i]; i++) {
+        if(query->cover_index) {
+          query->curr_entry = rows[i];
+          out[count++] = offsettoptr(db, COVERING_ENTRY_RECORD(db, rows[i]));
+        } else
+          out[count++] = offsettoptr(db, rows[i]);
+      }
+      if(i < run) {
+        /* page not filled completely */
+        query->curr_page = NULL;
+        break;
+      }
+      query->curr_pidx += run;
+      if(query->curr_pidx >= QUERY_RESULTSET_PAGESIZE) {
+        query->curr_page = (void *) (currpage->next);
+        query->curr_pidx = 0;
+      }
+    }
+  }
+  else {
+    show_query_error(db, "Unsupported query type");
+    return -1;
+  }
+  query->stats.returned += count;
+  return count;
+}
+
+/** Skip rows of the query result
+ *
+ *  Moves the query past the next n rows, as if they were fetched
+ *  with wg_fetch(). If the query is a T-tree range with no other
+ *  conditions, the new position is found from the element counts of
+ *  the T-tree (see wg_ttree_select()) without reading the rows in
+ *  between. Otherwise the rows are fetched and discarded.
+ *
+ *  returns the number of rows skipped, less than n if the result
+ *  ran out, and -1 on error.
+ */
+gint wg_query_skip(void *db, wg_query *query, gint n) {
+  void *rows[QUERY_BATCH_SIZE];
+  gint count = 0, got;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_query_skip.\n");
+#endif
+    return -1;
+  }
+  if(!query) {
+    show_query_error(db, "Invalid query object");
+    return -1;
+  }
+  if(n < 0) {
+    show_query_error(db, "Invalid number of rows");
+    return -1;
+  }
+#endif
+  if(query->qtype == WG_QTYPE_TTREE && !query->arglist) {
+    if(query->curr_offset && n > 0) {
+      gint pos = wg_ttree_rank(db, query->curr_offset, query->curr_slot);
+      gint left = (wg_ttree_rank(db, query->end_offset, query->end_slot) -
+        pos) * query->direction + 1;
+
+      if(n >= left) {
+        count = left;
+        query->curr_offset = 0; /* the query is exhausted */
+      } else {
+        gint rootoffset = query->curr_offset;
+        struct wg_tnode *node;
+
+        for(;;) {
+          node = (struct wg_tnode *) offsettoptr(db, rootoffset);
+          if(!node->parent_offset)
+            break;
+          rootoffset = node->parent_offset;
+        }
+        count = n;
+        query->curr_offset = wg_ttree_select(db, rootoffset,
+          pos + n * query->direction, &query->curr_slot);
+        if(!query->curr_offset) {
+          show_query_error(db, "Warning: row position not found, possible bug");
+          return -1;
+        }
+      }
+      query->stats.returned += count;
+    }
+    return count;
+  }
+
+  while(count < n) {
+    got = wg_fetch_many(db, query, rows,
+      (n - count < QUERY_BATCH_SIZE ? n - count : QUERY_BATCH_SIZE));
+    if(got < 0)
+      return -1;
+    if(!got)
+      break;
+    count += got;
+  }
+  return count;
+}
+
+/** Return next record from the query object and the values
+ *  of the requested columns.
+ *
+ *  The encoded values are stored in the values array, which must have
+ *  room for count elements. If the query is based on a covering index
+ *  that holds all the requested columns, the values are read from
+ *  the index entry and the record itself is not accessed. Columns that
+ *  the record does not have are returned as WG_ILLEGAL.
+ *
+ *  returns NULL if no more records
+ */
+void *wg_fetch_values(void *db, wg_query *query, gint *columns, gint count,
+  gint *values) {
+  void *rec, *src;
+  gint i, reclen;
+
+#ifdef CHECK
+  if(count < 0 || (count && (!columns || !values))) {
+    show_query_error(db, "Invalid column list");
+    return NULL;
+  }
+#endif
+
+  rec = wg_fetch(db, query);
+  if(!rec)
+    return NULL;
+
+  src = rec;
+  if(query->cover_index && wg_index_covers_columns(db,
+    (wg_index_header *) offsettoptr(db, query->cover_index), columns, count))
+    src = offsettoptr(db, query->curr_entry);
+
+  reclen = wg_get_record_len(db, src);
+  for(i=0; i<count; i++) {
+    if(columns[i] >= 0 && columns[i] < reclen)
+      values[i] = wg_get_field(db, src, columns[i]);
+    else
+      values[i] = WG_ILLEGAL;
+  }
+  return rec;
+}
+
+/** Aggregate the rows of a T-tree range from the index alone
+ *  Applies if the index bounds are the only conditions of the query
+ *  and the aggregates are row counts or the minimum and maximum of
+ *  the indexed column. Rows are counted from the positions of the ends
+ *  of the range in the T-tree (see wg_ttree_rank()), the minimum and
+ *  maximum are the values at the ends.
+ *  returns 1 if the specs were filled, 0 if not applicable.
+ */
+static gint ttree_aggregate(void *db, wg_query *query,
+  wg_query_aggr *specs, gint count) {
+  struct wg_tnode *node;
+  gint i, rows = 0, first = WG_ILLEGAL, last = WG_ILLEGAL;
+
+  if(query->qtype != WG_QTYPE_TTREE || query->arglist)
+    return 0;
+  for(i=0; i<count; i++) {
+    if(specs[i].type == WG_AGGR_COUNT && specs[i].column < 0)
+      continue;
+    if((specs[i].type == WG_AGGR_MIN || specs[i].type == WG_AGGR_MAX) &&\
+      specs[i].column == query->column)
+      continue;
+    return 0;
+  }
+
+  if(query->curr_offset) {
+    node = (struct wg_tnode *) offsettoptr(db, query->curr_offset);
+    first = wg_get_field(db,
+      offsettoptr(db, node->array_of_values[query->curr_slot]),
+      query->column);
+    node = (struct wg_tnode *) offsettoptr(db, query->end_offset);
+    last = wg_get_field(db,
+      offsettoptr(db, node->array_of_values[query->end_slot]),
+      query->column);
+    if(!first)
+      return 0; /* NULL values are skipped, needs a scan */
+
+    /* Elements from the start slot to the end slot */
+    rows = (wg_ttree_rank(db, query->end_offset, query->end_slot) -
+      wg_ttree_rank(db, query->curr_offset, query->curr_slot)) *
+      query->direction + 1;
+  }
+
+  for(i=0; i<count; i++) {
+    specs[i].count = rows;
+    if(specs[i].type == WG_AGGR_MIN)
+      specs[i].value = first;
+    else if(specs[i].type == WG_AGGR_MAX)
+      specs[i].value = last;
+  }
+  query->curr_offset = 0; /* the query is exhausted */
+  return 1;
+}
+
+/** Decode a numeric value for aggregation
+ *  returns 0 if the value is a number, -1 otherwise.
+ */
+static gint aggregate_number(void *db, gint enc, double *number) {
+  if(issmallint(enc)) {
+    *number = (double) decode_smallint(enc);
+    return 0;
+  }
+  switch(wg_get_encoded_type(db, enc)) {
+    case WG_INTTYPE:
+      *number = (double) wg_decode_int(db, enc);
+      return 0;
+    case WG_DOUBLETYPE:
+      *number = wg_decode_double(db, enc);
+      return 0;
+    case WG_FIXPOINTTYPE:
+      *number = wg_decode_fixpoint(db, enc);
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+/** Check the aggregate functions and clear the results
+ *  returns 0 if the functions are valid, -1 otherwise.
+ */
+static gint init_aggregates(void *db, wg_query_aggr *specs, gint count) {
+  gint i;
+
+  if(count < 1 || !specs) {
+    show_query_error(db, "Invalid aggregate list");
+    return -1;
+  }
+  for(i=0; i<count; i++) {
+    if(specs[i].type < WG_AGGR_COUNT || specs[i].type > WG_AGGR_AVG ||\
+      (specs[i].type != WG_AGGR_COUNT && specs[i].column < 0)) {
+      show_query_error(db, "Invalid aggregate function or column");
+      return -1;
+    }
+    specs[i].count = 0;
+    specs[i].value = WG_ILLEGAL;
+    specs[i].result = 0;
+  }
+  return 0;
+}
+
+/** Add a value to an aggregate
+ *  The sum is kept in the result of WG_AGGR_AVG, the caller divides
+ *  it by the count after the last value.
+ */
+static void aggregate_value(void *db, wg_query_aggr *spec, gint enc) {
+  double number;
+
+  if(enc == WG_ILLEGAL || !enc) {
+    if(spec->type == WG_AGGR_COUNT && spec->column < 0)
+      spec->count++;
+    return;
+  }
+  switch(spec->type) {
+    case WG_AGGR_COUNT:
+      spec->count++;
+      break;
+    case WG_AGGR_MIN:
+      if(spec->value == WG_ILLEGAL ||\
+        WG_COMPARE(db, enc, spec->value) == WG_LESSTHAN)
+        spec->value = enc;
+      spec->count++;
+      break;
+    case WG_AGGR_MAX:
+      if(spec->value == WG_ILLEGAL ||\
+        WG_COMPARE(db, enc, spec->value) == WG_GREATER)
+        spec->value = enc;
+      spec->count++;
+      break;
+    default:
+      if(!aggregate_number(db, enc, &number)) {
+        spec->result += number;
+        spec->count++;
+      }
+      break;
+  }
+}
+
+/** Compute aggregates over the rows matching the query parameters
+ *
+ *  The parameters are the same as for wg_make_query(). Each element
+ *  of specs gives an aggregate function and the column it applies to,
+ *  the results are stored in the same element. The rows are not
+ *  returned to the caller, the values are accumulated while scanning
+ *  the index or the database. If a T-tree index range holds exactly
+ *  the matching rows, counts and the minimum and maximum of the
+ *  indexed column are read from the index without visiting the rows.
+ *
+ *  NULL values and missing fields are not aggregated, except by
+ *  WG_AGGR_COUNT with a negative column, which counts rows. Sums and
+ *  averages use the numeric values (integers, doubles and fixpoints)
+ *  and skip the rest.
+ *
+ *  returns 0 on success, -1 on error.
+ */
+gint wg_query_aggregate(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_query_aggr *specs, gint count) {
+  wg_query *query;
+  gint i, *columns;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    /* XXX: currently show_query_error would work too */
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_query_aggregate.\n");
+#endif
+    return -1;
+  }
+#endif
+  if(init_aggregates(db, specs, count))
+    return -1;
+
+  /* Not prefetched, so that the index cursor is available */
+  query = internal_build_query(db, matchrec, reclen, arglist, argc, 0, 0,
+    NULL);
+  if(!query)
+    return -1;
+  if(ttree_aggregate(db, query, specs, count)) {
+    wg_free_query(db, query);
+    return 0;
+  }
+
+  columns = (gint *) malloc(2 * count * sizeof(gint));
+  if(!columns) {
+    show_query_error(db, "Failed to allocate memory");
+    wg_free_query(db, query);
+    return -1;
+  }
+  for(i=0; i<count; i++)
+    columns[i] = specs[i].column;
+
+  while(wg_fetch_values(db, query, columns, count, columns + count)) {
+    for(i=0; i<count; i++)
+      aggregate_value(db, &specs[i], columns[count + i]);
+  }
+
+  for(i=0; i<count; i++) {
+    if(specs[i].type == WG_AGGR_AVG && specs[i].count)
+      specs[i].result /= specs[i].count;
+  }
+  free(columns);
+  wg_free_query(db, query);
+  return 0;
+}
+
+/** Build a query for counting its rows
+ *  The query is planned like a prefetch query, so that the hash,
+ *  bitmap and intersection plans are used. A T-tree range or a full
+ *  scan is not prefetched, so that the rows are not collected and the
+ *  index cursor is available for ttree_aggregate().
+ *  returns NULL on error.
+ */
+static wg_query *build_count_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit) {
+  wg_query_arg *full_arglist;
+  wg_query_plan plan;
+  gint fargc = 0;
+
+  if(wg_flush_indexes(db) ||\
+    prepare_params(db, matchrec, reclen, arglist, argc, 1,
+      &full_arglist, &fargc))
+    return NULL;
+  if(plan_query(db, full_arglist, fargc, 1, &plan)) {
+    if(full_arglist) free(full_arglist);
+    return NULL;
+  }
+  if(full_arglist)
+    free(full_arglist);
+
+  return internal_build_query(db, matchrec, reclen, arglist, argc,
+    (plan.type == WG_QPLAN_TTREE || plan.type == WG_QPLAN_SCAN ?
+    0 : QUERY_FLAGS_PREFETCH), rowlimit, &plan);
+}
+
+/** Count the rows that match a query
+ *  Takes the same parameters as wg_make_query(). The query is planned
+ *  like in wg_make_query(). The rows of a hash, bitmap or intersection
+ *  plan are counted from the result set, the rows of a T-tree range or
+ *  a full scan are read without collecting them. If the index bounds
+ *  are the only conditions, the rows are counted from the T-nodes (see
+ *  ttree_aggregate()).
+ *  returns the number of rows, -1 on error.
+ */
+gint wg_query_count(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc) {
+  wg_query *query;
+  wg_query_aggr spec;
+  void *rows[QUERY_BATCH_SIZE];
+  gint n, count = 0;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_query_count.\n");
+#endif
+    return -1;
+  }
+#endif
+
+  query = build_count_query(db, matchrec, reclen, arglist, argc, 0);
+  if(!query)
+    return -1;
+  spec.type = WG_AGGR_COUNT;
+  spec.column = -1;
+  if(query->qtype == WG_QTYPE_PREFETCH)
+    count = query->res_count;
+  else if(ttree_aggregate(db, query, &spec, 1))
+    count = spec.count;
+  else {
+    while((n = wg_fetch_many(db, query, rows, QUERY_BATCH_SIZE)) > 0)
+      count += n;
+    if(n < 0)
+      count = -1;
+  }
+  wg_free_query(db, query);
+  return count;
+}
+
+/** Check if any row matches a query
+ *  Takes the same parameters as wg_make_query(). The rows are read
+ *  like in wg_query_count() until the first match.
+ *  returns 1 if a row matches, 0 if none and -1 on error.
+ */
+gint wg_query_exists(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc) {
+  wg_query *query;
+  gint found;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_query_exists.\n");
+#endif
+    return -1;
+  }
+#endif
+
+  query = build_count_query(db, matchrec, reclen, arglist, argc, 1);
+  if(!query)
+    return -1;
+  found = (wg_fetch(db, query) != NULL);
+  wg_free_query(db, query);
+  return found;
+}
+
+/** Add bytes to the hash of a group key
+ */
+static wg_uint hash_group_bytes(wg_uint hash, char *bytes, gint len) {
+  gint i;
+  for(i=0; i<len; i++)
+    hash = bytes[i] + (hash << 6) + (hash << 16) - hash;
+  return hash;
+}
+
+/** Hash the key of a group
+ *  Values that are not contained in the encoded value itself are
+ *  hashed by their type and decoded contents, read in place, so that
+ *  equal values stored in different places hash to the same value
+ *  without copying them (see wg_decode_for_hashing()).
+ */
+static wg_uint hash_group_key(void *db, gint *keys, gint count) {
+  wg_uint hash = 0;
+  gint i, enc, type, intdata;
+  double doubledata;
+  char *extra, zero = 0;
+
+  for(i=0; i<count; i++) {
+    enc = keys[i];
+    if(!enc || issmallint(enc)) {
+      hash = hash_group_bytes(hash, (char *) &enc, sizeof(gint));
+      continue;
+    }
+    type = wg_get_encoded_type(db, enc);
+    hash = hash_group_bytes(hash, (char *) &type, 1);
+    switch(type) {
+      case WG_INTTYPE:
+        intdata = wg_decode_int(db, enc);
+        hash = hash_group_bytes(hash, (char *) &intdata, sizeof(gint));
+        break;
+      case WG_DOUBLETYPE:
+        doubledata = wg_decode_double(db, enc);
+        hash = hash_group_bytes(hash, (char *) &doubledata, sizeof(double));
+        break;
+      case WG_FIXPOINTTYPE:
+        doubledata = wg_decode_fixpoint(db, enc);
+        hash = hash_group_bytes(hash, (char *) &doubledata, sizeof(double));
+        break;
+      case WG_STRTYPE:
+        hash = hash_group_bytes(hash, wg_decode_str(db, enc),
+          wg_decode_str_len(db, enc));
+        break;
+      case WG_URITYPE:
+        if((extra = wg_decode_uri_prefix(db, enc))) {
+          hash = hash_group_bytes(hash, extra,
+            wg_decode_uri_prefix_len(db, enc));
+          hash = hash_group_bytes(hash, &zero, 1);
+        }
+        hash = hash_group_bytes(hash, wg_decode_uri(db, enc),
+          wg_decode_uri_len(db, enc));
+        break;
+      case WG_XMLLITERALTYPE:
+        if((extra = wg_decode_xmlliteral_xsdtype(db, enc))) {
+          hash = hash_group_bytes(hash, extra,
+            wg_decode_xmlliteral_xsdtype_len(db, enc));
+          hash = hash_group_bytes(hash, &zero, 1);
+        }
+        hash = hash_group_bytes(hash, wg_decode_xmlliteral(db, enc),
+          wg_decode_xmlliteral_len(db, enc));
+        break;
+      default:
+        /* Other values are unique by their encoding */
+        hash = hash_group_bytes(hash, (char *) &enc, sizeof(gint));
+        break;
+    }
+  }
+  return hash;
+}
+
+/** Create a group table
+ *  If groups is not NULL, the table is built from the existing
+ *  groups and new groups are added to them.
+ *  returns 0 on success, -1 on error.
+ */
+static gint init_group_table(void *db, query_group_table *tbl,
+  wg_query_groups *groups, gint key_count, gint aggr_count) {
+  gint g, *newkeys;
+  wg_query_aggr *newaggr;
+
+  memset(tbl, 0, sizeof(query_group_table));
+  if(groups) {
+    tbl->res = groups;
+  } else {
+    tbl->res = (wg_query_groups *) malloc(sizeof(wg_query_groups));
+    if(!tbl->res)
+      goto nomem;
+    tbl->res->groups = 0;
+    tbl->res->key_count = key_count;
+    tbl->res->aggr_count = aggr_count;
+    tbl->res->keys = NULL;
+    tbl->res->aggr = NULL;
+  }
+  tbl->alloc = tbl->res->groups;
+  if(tbl->alloc < QUERY_GROUP_INITSIZE/2) {
+    tbl->alloc = QUERY_GROUP_INITSIZE/2;
+    newkeys = (gint *) realloc(tbl->res->keys,
+      tbl->alloc * key_count * sizeof(gint));
+    if(!newkeys)
+      goto nomem;
+    tbl->res->keys = newkeys;
+    newaggr = (wg_query_aggr *) realloc(tbl->res->aggr,
+      tbl->alloc * aggr_count * sizeof(wg_query_aggr));
+    if(!newaggr)
+      goto nomem;
+    tbl->res->aggr = newaggr;
+  }
+  tbl->hashes = (wg_uint *) malloc(tbl->alloc * sizeof(wg_uint));
+  if(!tbl->hashes)
+    goto nomem;
+  for(g=0; g<tbl->res->groups; g++)
+    tbl->hashes[g] = hash_group_key(db, &tbl->res->keys[g * key_count],
+      key_count);
+
+  tbl->size = QUERY_GROUP_INITSIZE/2;
+  if(!grow_group_table(db, tbl))
+    return 0;
+  goto error;
+
+nomem:
+  show_query_error(db, "Failed to allocate memory");
+error:
+  if(tbl->hashes)
+    free(tbl->hashes);
+  if(!groups && tbl->res)
+    wg_free_query_groups(db, tbl->res);
+  return -1;
+}
+
+/** Double the number of slots in a group table
+ *  The slots are filled again from the hashes of the groups.
+ *  returns 0 on success, -1 on error.
+ */
+static gint grow_group_table(void *db, query_group_table *tbl) {
+  gint size = tbl->size * 2, *slots, g, i;
+
+  while(size < 2 * tbl->res->groups)
+    size *= 2;
+  slots = (gint *) malloc(size * sizeof(gint));
+  if(!slots) {
+    show_query_error(db, "Failed to allocate memory");
+    return -1;
+  }
+  for(i=0; i<size; i++)
+    slots[i] = -1;
+  for(g=0; g<tbl->res->groups; g++) {
+    for(i=tbl->hashes[g] & (size-1); slots[i] >= 0; i=(i+1) & (size-1));
+    slots[i] = g;
+  }
+  if(tbl->slots)
+    free(tbl->slots);
+  tbl->slots = slots;
+  tbl->size = size;
+  return 0;
+}
+
+/** Find the group of a key, adding a new group if there is none
+ *  The aggregates of a new group are copied from init.
+ *  returns the number of the group, -1 on error.
+ */
+static gint find_group(void *db, query_group_table *tbl, gint *keys,
+  wg_query_aggr *init) {
+  wg_query_groups *res = tbl->res;
+  gint kc = res->key_count, ac = res->aggr_count, g, i, j;
+  wg_uint hash = hash_group_key(db, keys, kc);
+
+  for(i=hash & (tbl->size-1); (g = tbl->slots[i]) >= 0;
+    i=(i+1) & (tbl->size-1)) {
+    if(tbl->hashes[g] != hash)
+      continue;
+    for(j=0; j<kc; j++) {
+      gint a = res->keys[g * kc + j];
+      if(a != keys[j] && (!a || !keys[j] ||\
+        WG_COMPARE(db, a, keys[j]) != WG_EQUAL))
+        break;
+    }
+    if(j == kc)
+      return g;
+  }
+
+  /* New group */
+  if(res->groups == tbl->alloc) {
+    gint *newkeys;
+    wg_query_aggr *newaggr;
+    wg_uint *newhashes;
+    tbl->alloc *= 2;
+    newkeys = (gint *) realloc(res->keys, tbl->alloc * kc * sizeof(gint));
+    if(newkeys)
+      res->keys = newkeys;
+    newaggr = (wg_query_aggr *) realloc(res->aggr,
+      tbl->alloc * ac * sizeof(wg_query_aggr));
+    if(newaggr)
+      res->aggr = newaggr;
+    newhashes = (wg_uint *) realloc(tbl->hashes,
+      tbl->alloc * sizeof(wg_uint));
+    if(newhashes)
+      tbl->hashes = newhashes;
+    if(!newkeys || !newaggr || !newhashes) {
+      show_query_error(db, "Failed to allocate memory");
+      return -1;
+    }
+  }
+  g = res->groups++;
+  memcpy(&res->keys[g * kc], keys, kc * sizeof(gint));
+  memcpy(&res->aggr[g * ac], init, ac * sizeof(wg_query_aggr));
+  tbl->hashes[g] = hash;
+  tbl->slots[i] = g;
+  if(2 * res->groups > tbl->size && grow_group_table(db, tbl))
+    return -1;
+  return g;
+}
+
+/** Release the group table, keeping the groups
+ *  The group arrays are shrunk to the number of groups.
+ */
+static void free_group_table(void *db, query_group_table *tbl) {
+  wg_query_groups *res = tbl->res;
+
+  if(res->groups) {
+    gint *newkeys = (gint *) realloc(res->keys,
+      res->groups * res->key_count * sizeof(gint));
+    wg_query_aggr *newaggr = (wg_query_aggr *) realloc(res->aggr,
+      res->groups * res->aggr_count * sizeof(wg_query_aggr));
+    if(newkeys)
+      res->keys = newkeys;
+    if(newaggr)
+      res->aggr = newaggr;
+  }
+  free(tbl->slots);
+  free(tbl->hashes);
+}
+
+/** Merge an aggregate into another one of the same function
+ */
+static void merge_aggregate(void *db, wg_query_aggr *dest,
+  wg_query_aggr *src) {
+  switch(dest->type) {
+    case WG_AGGR_MIN:
+      if(src->value != WG_ILLEGAL && (dest->value == WG_ILLEGAL ||\
+        WG_COMPARE(db, src->value, dest->value) == WG_LESSTHAN))
+        dest->value = src->value;
+      break;
+    case WG_AGGR_MAX:
+      if(src->value != WG_ILLEGAL && (dest->value == WG_ILLEGAL ||\
+        WG_COMPARE(db, src->value, dest->value) == WG_GREATER))
+        dest->value = src->value;
+      break;
+    case WG_AGGR_SUM:
+      dest->result += src->result;
+      break;
+    case WG_AGGR_AVG:
+      if(dest->count + src->count)
+        dest->result = (dest->result * dest->count +\
+          src->result * src->count) / (dest->count + src->count);
+      break;
+    default:
+      break;
+  }
+  dest->count += src->count;
+}
+
+/** Group the rows of a query
+ *  Reads at most rowlimit rows (all rows if 0), see wg_query_group().
+ *  returns NULL on error.
+ */
+static wg_query_groups *group_query(void *db, wg_query *query,
+  wg_uint rowlimit, gint *columns, gint col_count, wg_query_aggr *specs,
+  gint count) {
+  query_group_table tbl;
+  gint i, g, *buf;
+  wg_uint rows = 0;
+
+  if(col_count < 1 || !columns) {
+    show_query_error(db, "Invalid column list");
+    return NULL;
+  }
+  for(i=0; i<col_count; i++) {
+    if(columns[i] < 0) {
+      show_query_error(db, "Invalid column list");
+      return NULL;
+    }
+  }
+  if(init_aggregates(db, specs, count))
+    return NULL;
+
+  /* The group columns are followed by the aggregated columns, the
+   * values are read in the second half of the buffer */
+  buf = (gint *) malloc(2 * (col_count + count) * sizeof(gint));
+  if(!buf) {
+    show_query_error(db, "Failed to allocate memory");
+    return NULL;
+  }
+  memcpy(buf, columns, col_count * sizeof(gint));
+  for(i=0; i<count; i++)
+    buf[col_count + i] = specs[i].column;
+  if(init_group_table(db, &tbl, NULL, col_count, count)) {
+    free(buf);
+    return NULL;
+  }
+
+  while((!rowlimit || rows++ < rowlimit) &&\
+    wg_fetch_values(db, query, buf, col_count + count,
+    buf + col_count + count)) {
+    gint *values = buf + col_count + count;
+    for(i=0; i<col_count; i++) {
+      if(values[i] == WG_ILLEGAL)
+        values[i] = 0; /* NULL */
+    }
+    if((g = find_group(db, &tbl, values, specs)) < 0) {
+      free_group_table(db, &tbl);
+      wg_free_query_groups(db, tbl.res);
+      free(buf);
+      return NULL;
+    }
+    for(i=0; i<count; i++)
+      aggregate_value(db, &tbl.res->aggr[g * count + i],
+        values[col_count + i]);
+  }
+
+  for(g=0; g<tbl.res->groups * count; g++) {
+    wg_query_aggr *aggr = &tbl.res->aggr[g];
+    if(aggr->type == WG_AGGR_AVG && aggr->count)
+      aggr->result /= aggr->count;
+  }
+  free(buf);
+  free_group_table(db, &tbl);
+  return tbl.res;
+}
+
+/** Get the offset of the record after a record of a full scan
+ *  returns 0 at the end of the table.
+ */
+static gint next_record_offset(void *db, gint offset) {
+  void *rec = wg_get_next_record(db, offsettoptr(db, offset));
+  return (rec ? ptrtooffset(db, rec) : 0);
+}
+
+/** Set up a slice of the remaining rows of a query
+ *  slice is made a copy of query that reads the part-th of parts
+ *  contiguous slices of the rows. The slice shares the argument list
+ *  and the result pages of the query. *rowlimit is set to the number
+ *  of rows of a prefetched slice and to 0 for the other query types.
+ *  returns 0 on success, -1 on error.
+ */
+static gint slice_query(void *db, wg_query *query, wg_query *slice,
+  gint part, gint parts, wg_uint *rowlimit) {
+  gint n = 0, start, stop, i;
+
+  *slice = *query;
+  *rowlimit = 0;
+  if(query->qtype == WG_QTYPE_TTREE) {
+    gint pos, rootoffset;
+    struct wg_tnode *node;
+
+    if(!query->curr_offset)
+      return 0;
+    pos = wg_ttree_rank(db, query->curr_offset, query->curr_slot);
+    n = (wg_ttree_rank(db, query->end_offset, query->end_slot) - pos) *\
+      query->direction + 1;
+    start = n * part / parts;
+    stop = n * (part + 1) / parts;
+    if(start == stop) {
+      slice->curr_offset = 0;
+      return 0;
+    }
+    rootoffset = query->curr_offset;
+    for(;;) {
+      node = (struct wg_tnode *) offsettoptr(db, rootoffset);
+      if(!node->parent_offset)
+        break;
+      rootoffset = node->parent_offset;
+    }
+    slice->curr_offset = wg_ttree_select(db, rootoffset,
+      pos + start * query->direction, &slice->curr_slot);
+    slice->end_offset = wg_ttree_select(db, rootoffset,
+      pos + (stop - 1) * query->direction, &slice->end_slot);
+    if(!slice->curr_offset || !slice->end_offset) {
+      show_query_error(db, "Warning: row position not found, possible bug");
+      return -1;
+    }
+  }
+  else if(query->qtype == WG_QTYPE_SCAN) {
+    gint offset;
+
+    for(offset = query->curr_record;
+      offset && offset != query->end_offset;
+      offset = next_record_offset(db, offset))
+      n++;
+    start = n * part / parts;
+    stop = n * (part + 1) / parts;
+    offset = query->curr_record;
+    for(i=0; i<start; i++)
+      offset = next_record_offset(db, offset);
+    slice->curr_record = offset;
+    for(; i<stop; i++)
+      offset = next_record_offset(db, offset);
+    slice->end_offset = offset;
+  }
+  else if(query->qtype == WG_QTYPE_PREFETCH) {
+    query_result_page *page = (query_result_page *) query->curr_page;
+
+    for(i=query->curr_pidx; page; page=page->next, i=0) {
+      if(page->next)
+        n += QUERY_RESULTSET_PAGESIZE - i;
+      else {
+        for(; i<QUERY_RESULTSET_PAGESIZE && page->rows[i]; i++)
+          n++;
+      }
+    }
+    start = n * part / parts;
+    stop = n * (part + 1) / parts;
+    if(start == stop) {
+      slice->curr_page = NULL;
+      return 0;
+    }
+    page = (query_result_page *) query->curr_page;
+    for(i=query->curr_pidx + start; i >= QUERY_RESULTSET_PAGESIZE;
+      i -= QUERY_RESULTSET_PAGESIZE)
+      page = page->next;
+    slice->curr_page = page;
+    slice->curr_pidx = i;
+    *rowlimit = stop - start;
+  }
+  else if(part) {
+    /* A hash index lookup is not divided */
+    slice->curr_record = 0;
+  }
+  return 0;
+}
+
+/** Group the rows of a query and compute aggregates for each group
+ *
+ *  The rows are grouped by the values of the columns (missing fields
+ *  are the same as NULL). Each element of specs gives an aggregate
+ *  function, as for wg_query_aggregate(). The remaining rows of the
+ *  query are consumed.
+ *
+ *  The groups are collected into a hash table in local memory. The
+ *  result holds the key values and the aggregates of each group in
+ *  two arrays, in the order the groups were first seen. It should
+ *  be released with wg_free_query_groups().
+ *
+ *  returns NULL on error.
+ */
+wg_query_groups *wg_query_group(void *db, wg_query *query,
+  gint *columns, gint col_count, wg_query_aggr *specs, gint count) {
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    /* XXX: currently show_query_error would work too */
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_query_group.\n");
+#endif
+    return NULL;
+  }
+  if(!query) {
+    show_query_error(db, "Invalid query object");
+    return NULL;
+  }
+#endif
+  return group_query(db, query, 0, columns, col_count, specs, count);
+}
+
+/** Group a part of the rows of a query
+ *
+ *  Like wg_query_group(), but only the part-th (counting from 0) of
+ *  parts contiguous slices of the remaining rows is read. The query
+ *  is not advanced, so that threads can group the slices of the same
+ *  query in parallel (each with its own specs, as they are written to)
+ *  and the partial results can be combined with wg_merge_query_groups().
+ *
+ *  The slices of a T-tree range are found from the element counts of
+ *  the T-tree (see wg_ttree_select()) and the slices of a prefetched
+ *  query from its result pages. In a full scan, the records before
+ *  the slice are stepped over without checking them. A hash index
+ *  lookup is not divided, all of it is read by part 0.
+ *
+ *  returns NULL on error.
+ */
+wg_query_groups *wg_query_group_part(void *db, wg_query *query,
+  gint part, gint parts, gint *columns, gint col_count,
+  wg_query_aggr *specs, gint count) {
+  wg_query slice;
+  wg_uint rowlimit;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_query_group_part.\n");
+#endif
+    return NULL;
+  }
+  if(!query) {
+    show_query_error(db, "Invalid query object");
+    return NULL;
+  }
+#endif
+  if(parts < 1 || part < 0 || part >= parts) {
+    show_query_error(db, "Invalid part number");
+    return NULL;
+  }
+  if(slice_query(db, query, &slice, part, parts, &rowlimit))
+    return NULL;
+  return group_query(db, &slice, rowlimit, columns, col_count, specs,
+    count);
+}
+
+/** Merge groups computed separately into another set of groups
+ *
+ *  Intended for combining the partial results of wg_query_group()
+ *  calls over disjoint sets of rows, for example, the slices of
+ *  wg_query_group_part() grouped by several threads.
+ *  The groups in src are added to dest, the aggregates of the groups
+ *  present in both are combined. The group columns and the aggregate
+ *  functions must be the same. src is not modified.
+ *
+ *  returns 0 on success, -1 on error.
+ */
+gint wg_merge_query_groups(void *db, wg_query_groups *dest,
+  wg_query_groups *src) {
+  query_group_table tbl;
+  wg_query_aggr *init;
+  gint i, g, d, kc, ac;
+
+  if(!dest || !src || dest->key_count != src->key_count ||\
+    dest->aggr_count != src->aggr_count) {
+    show_query_error(db, "Groups do not match");
+    return -1;
+  }
+  kc = dest->key_count;
+  ac = dest->aggr_count;
+  if(dest->groups && src->groups) {
+    for(i=0; i<ac; i++) {
+      if(dest->aggr[i].type != src->aggr[i].type ||\
+        dest->aggr[i].column != src->aggr[i].column) {
+        show_query_error(db, "Groups do not match");
+        return -1;
+      }
+    }
+  }
+  if(!src->groups)
+    return 0;
+
+  init = (wg_query_aggr *) malloc(ac * sizeof(wg_query_aggr));
+  if(!init) {
+    show_query_error(db, "Failed to allocate memory");
+    return -1;
+  }
+  memcpy(init, src->aggr, ac * sizeof(wg_query_aggr));
+  init_aggregates(db, init, ac);
+  if(init_group_table(db, &tbl, dest, kc, ac)) {
+    free(init);
+    return -1;
+  }
+
+  for(g=0; g<src->groups; g++) {
+    if((d = find_group(db, &tbl, &src->keys[g * kc], init)) < 0) {
+      free_group_table(db, &tbl);
+      free(init);
+      return -1;
+    }
+    for(i=0; i<ac; i++)
+      merge_aggregate(db, &dest->aggr[d * ac + i], &src->aggr[g * ac + i]);
+  }
+  free_group_table(db, &tbl);
+  free(init);
+  return 0;
+}
+
+/** Release the groups returned by wg_query_group()
+ */
+void wg_free_query_groups(void *db, wg_query_groups *groups) {
+  if(groups->keys)
+    free(groups->keys);
+  if(groups->aggr)
+    free(groups->aggr);
+  free(groups);
+}
+
+/** Find a hash index for the inner rows of a join
+ *  returns the index id, 0 if there is none.
+ */
+static gint join_hash_index(void *db, gint column) {
+  gint index_id = find_column_index(db, column, WG_INDEX_TYPE_HASH);
+  if(index_id &&\
+    ((wg_index_header *) offsettoptr(db, index_id))->fields != 1)
+    return 0;
+  return index_id;
+}
+
+/** Build the hash table of the inner rows of a join
+ *  returns the table, NULL on error.
+ */
+static join_hash_table *build_join_table(void *db, gint column,
+  wg_query_arg *arglist, gint argc) {
+  join_hash_table *tbl;
+  wg_query *query;
+  void *rec;
+  gint i;
+
+  query = internal_build_query(db, NULL, 0, arglist, argc,
+    QUERY_FLAGS_PREFETCH, 0, NULL);
+  if(!query)
+    return NULL;
+  tbl = (join_hash_table *) malloc(sizeof(join_hash_table));
+  if(!tbl)
+    goto nomem;
+  tbl->count = 0;
+  for(tbl->size = 16; tbl->size < 2 * (gint) query->res_count;
+    tbl->size *= 2);
+  tbl->buckets = (gint *) malloc(tbl->size * sizeof(gint));
+  tbl->entries = (gint *) malloc((query->res_count ? query->res_count : 1) *
+    JOIN_ENTRY_GINTS * sizeof(gint));
+  if(!tbl->buckets || !tbl->entries)
+    goto nomem;
+  for(i=0; i<tbl->size; i++)
+    tbl->buckets[i] = -1;
+
+  while((rec = wg_fetch(db, query))) {
+    gint key, *entry;
+    wg_uint hash;
+    if(wg_get_record_len(db, rec) <= column ||\
+      !(key = wg_get_field(db, rec, column)))
+      continue; /* NULL does not join */
+    hash = hash_group_key(db, &key, 1);
+    entry = &tbl->entries[tbl->count * JOIN_ENTRY_GINTS];
+    entry[0] = key;
+    entry[1] = ptrtooffset(db, rec);
+    entry[2] = (gint) hash;
+    entry[3] = tbl->buckets[hash & (tbl->size-1)];
+    tbl->buckets[hash & (tbl->size-1)] = tbl->count++;
+  }
+  wg_free_query(db, query);
+  return tbl;
+
+nomem:
+  show_query_error(db, "Failed to allocate memory");
+  if(tbl) {
+    if(tbl->buckets)
+      free(tbl->buckets);
+    if(tbl->entries)
+      free(tbl->entries);
+    free(tbl);
+  }
+  wg_free_query(db, query);
+  return NULL;
+}
+
+/** Join the rows of a query to other rows
+ *
+ *  The rows of the left query are joined to the rows (right) that
+ *  match the conditions in arglist (all rows if argc is 0), either by
+ *  equal values: the value in left_column of the left row is equal to
+ *  the value in right_column of the right row, or by reference: if
+ *  right_column is -1, left_column holds a record (WG_RECORDTYPE) and
+ *  that record is the right row. NULL values do not join. The pairs
+ *  are read with wg_fetch_join().
+ *
+ *  The method is chosen by the available indexes:
+ *  - WG_JOIN_REFERENCE: follows the reference, checking the
+ *    conditions on the record it points to.
+ *  - WG_JOIN_INDEX: if right_column has a T-tree or a hash index,
+ *    the matching right rows are looked up for each left row with
+ *    a prepared query (see wg_prepare_query()) that the value of the
+ *    left row is bound to.
+ *  - WG_JOIN_HASH: otherwise the right rows are read once and
+ *    collected into a hash table in local memory.
+ *
+ *  The left query is consumed by the join, but not released.
+ *  returns NULL on error.
+ */
+wg_join *wg_make_join(void *db, wg_query *left, gint left_column,
+  wg_query_arg *arglist, gint argc, gint right_column) {
+  wg_join *join;
+  gint index_id;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+    /* XXX: currently show_query_error would work too */
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_make_join.\n");
+#endif
+    return NULL;
+  }
+#endif
+  if(!left || left_column < 0 || right_column < -1 ||\
+    (argc && !arglist) || argc < 0) {
+    show_query_error(db, "Invalid join parameters");
+    return NULL;
+  }
+  join = (wg_join *) malloc(sizeof(wg_join));
+  if(!join) {
+    show_query_error(db, "Failed to allocate memory");
+    return NULL;
+  }
+  memset(join, 0, sizeof(wg_join));
+  join->left = left;
+  join->left_column = left_column;
+  join->right_column = right_column;
+
+  if(right_column < 0) {
+    /* The conditions are checked directly on the referenced rows */
+    join->type = WG_JOIN_REFERENCE;
+    if(wg_flush_indexes(db) || prepare_params(db, NULL, 0, arglist, argc, 1,
+      &join->arglist, &join->argc)) {
+      free(join);
+      return NULL;
+    }
+  }
+  else if((index_id = order_index(db, right_column)) ||\
+    (index_id = join_hash_index(db, right_column))) {
+    /* The key condition is added after the conditions. The lookup
+     * is prepared once with the plan made here and the key is bound
+     * for each left row. */
+    wg_query_arg *args;
+    wg_prepared_query *pq;
+
+    join->type = WG_JOIN_INDEX;
+    join->argc = argc + 1;
+    args = (wg_query_arg *) malloc(join->argc * sizeof(wg_query_arg));
+    if(!args) {
+      show_query_error(db, "Failed to allocate memory");
+      free(join);
+      return NULL;
+    }
+    if(argc)
+      memcpy(args, arglist, argc * sizeof(wg_query_arg));
+    args[argc].column = right_column;
+    args[argc].cond = WG_COND_EQUAL;
+    args[argc].value = 0;
+    pq = wg_prepare_query(db, NULL, 0, args, join->argc);
+    free(args);
+    if(!pq) {
+      free(join);
+      return NULL;
+    }
+    join->plan.type = (wg_get_index_type(db, index_id) ==\
+      WG_INDEX_TYPE_HASH ? WG_QPLAN_HASH : WG_QPLAN_TTREE);
+    join->plan.count = 1;
+    join->plan.index_id[0] = index_id;
+    join->plan.epoch =\
+      dbmemsegh(db)->index_control_area_header.index_epoch;
+    pq->plan = join->plan;
+    join->prepared = pq;
+  }
+  else {
+    join->type = WG_JOIN_HASH;
+    join->table = build_join_table(db, right_column, arglist, argc);
+    if(!join->table) {
+      free(join);
+      return NULL;
+    }
+  }
+  return join;
+}
+
+/** Return the next pair of rows of a join
+ *  The left row is returned, the right row is stored in *right.
+ *  returns NULL if there are no more pairs.
+ */
+void *wg_fetch_join(void *db, wg_join *join, void **right) {
+  void *rec;
+  gint key;
+
+  for(;;) {
+    /* Remaining right rows of the current left row */
+    if(join->curr_left) {
+      if(join->type == WG_JOIN_INDEX) {
+        if((rec = wg_fetch(db, join->inner))) {
+          *right = rec;
+          return join->curr_left;
+        }
+        join->inner = NULL; /* belongs to the prepared query */
+      }
+      else if(join->type == WG_JOIN_HASH) {
+        join_hash_table *tbl = (join_hash_table *) join->table;
+        while(join->curr_entry >= 0) {
+          gint *entry = &tbl->entries[join->curr_entry * JOIN_ENTRY_GINTS];
+          join->curr_entry = entry[3];
+          if((wg_uint) entry[2] == join->curr_hash &&\
+            WG_COMPARE(db, entry[0], join->curr_key) == WG_EQUAL) {
+            *right = offsettoptr(db, entry[1]);
+            return join->curr_left;
+          }
+        }
+      }
+      join->curr_left = NULL;
+    }
+
+    /* Next left row */
+    if(!(rec = wg_fetch(db, join->left)))
+      return NULL;
+    if(wg_get_record_len(db, rec) <= join->left_column ||\
+      !(key = wg_get_field(db, rec, join->left_column)))
+      continue;
+
+    switch(join->type) {
+      case WG_JOIN_REFERENCE:
+        if(wg_get_encoded_type(db, key) == WG_RECORDTYPE) {
+          void *ref = wg_decode_record(db, key);
+          if(!join->arglist ||\
+            check_arglist(db, ref, join->arglist, join->argc)) {
+            *right = ref;
+            return rec;
+          }
+        }
+        break;
+      case WG_JOIN_INDEX:
+        if(wg_bind_query(db, (wg_prepared_query *) join->prepared,
+          join->argc - 1, key))
+          return NULL;
+        join->inner = wg_exec_query(db,
+          (wg_prepared_query *) join->prepared);
+        if(!join->inner)
+          return NULL;
+        join->curr_left = rec;
+        break;
+      case WG_JOIN_HASH:
+        join->curr_key = key;
+        join->curr_hash = hash_group_key(db, &key, 1);
+        join->curr_entry = ((join_hash_table *) join->table)->\
+          buckets[join->curr_hash & \
+          (((join_hash_table *) join->table)->size-1)];
+        join->curr_left = rec;
+        break;
+      default:
+        show_query_error(db, "Unsupported join type");
+        return NULL;
+    }
+  }
+}
+
+/** Release the memory allocated for the join
+ *  The left query is not released.
+ */
+void wg_free_join(void *db, wg_join *join) {
+  if(join->arglist)
+    free(join->arglist);
+  if(join->prepared)
+    wg_free_prepared_query(db, (wg_prepared_query *) join->prepared);
+  if(join->table) {
+    join_hash_table *tbl = (join_hash_table *) join->table;
+    free(tbl->buckets);
+    free(tbl->entries);
+    free(tbl);
+  }
+  free(join);
+}
+
+/** Prepare a query for repeated execution
+ *
+ *  The arguments are the same as for wg_make_query(). The conditions
+ *  are stored in the prepared query so that the values can be changed
+ *  with wg_bind_query() and the query run with wg_exec_query() without
+ *  repeating the preparation. The plan is made on the first execution
+ *  and reused for as long as the indexes do not change.
+ *
+ *  The caller may free arglist and matchrec after the query is
+ *  prepared, but the values (encoded query parameters) must stay
+ *  valid while they are bound.
+ *
+ *  returns NULL on error.
+ */
+wg_prepared_query *wg_prepare_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc) {
+  wg_prepared_query *pq;
+  wg_query_arg *args = NULL;
+  gint fargc = 0;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_prepare_query.\n");
+#endif
+    return NULL;
+  }
+#endif
+
+  /* The arguments are kept uncombined, in the order they were given,
+   * so that they can be bound by their number. */
+  if(prepare_params(db, matchrec, reclen, arglist, argc, 0,
+    &args, &fargc)) {
+    return NULL;
+  }
+
+  pq = (wg_prepared_query *) malloc(sizeof(wg_prepared_query));
+  if(!pq) {
+    show_query_error(db, "Failed to allocate memory");
+    if(args) free(args);
+    return NULL;
+  }
+  memset(pq, 0, sizeof(wg_prepared_query));
+  pq->args = args;
+  pq->argc = fargc;
+  pq->plan.epoch = -1; /* not planned yet */
+
+  if(fargc) {
+    /* Buffers for the combined and the reduced argument lists */
+    pq->full_arglist = (wg_query_arg *) malloc(2 * fargc * \
+      sizeof(wg_query_arg));
+    /* group_args() needs the buffer even if there are no lists */
+    pq->listsize = group_args(db, args, fargc, NULL);
+    if(!pq->listsize)
+      pq->listsize = 1;
+    pq->listbuf = (gint *) malloc(pq->listsize * sizeof(gint));
+    if(!pq->full_arglist || !pq->listbuf) {
+      show_query_error(db, "Failed to allocate memory");
+      wg_free_prepared_query(db, pq);
+      return NULL;
+    }
+    pq->arglist = pq->full_arglist + fargc;
+  }
+  return pq;
+}
+
+/** Set the value of an argument of a prepared query
+ *
+ *  argnum is the position of the argument in the arglist given to
+ *  wg_prepare_query(). The non-wildcard fields of matchrec follow the
+ *  arglist, in the order of the fields. value is an encoded value, as
+ *  in wg_query_arg. The new value is used from the next wg_exec_query()
+ *  on.
+ *
+ *  returns 0 on success, -1 on error.
+ */
+gint wg_bind_query(void *db, wg_prepared_query *pq, gint argnum,
+  gint value) {
+  gint old, need, cond;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_bind_query.\n");
+#endif
+    return -1;
+  }
+#endif
+
+  if(argnum < 0 || argnum >= pq->argc) {
+    show_query_error(db, "Invalid argument number");
+    return -1;
+  }
+  cond = pq->args[argnum].cond & ~WG_COND_OR;
+  if(cond != WG_COND_IN && cond != WG_COND_PREFIX) {
+    pq->args[argnum].value = value;
+    return 0;
+  }
+
+  /* A list of values or a prefix may need more room for the
+   * combined lists and the ranges */
+  if(check_arg_value(db, cond, value))
+    return -1;
+  old = pq->args[argnum].value;
+  pq->args[argnum].value = value;
+  need = group_args(db, pq->args, pq->argc, NULL);
+  if(need > pq->listsize) {
+    gint *tmp = (gint *) realloc(pq->listbuf, need * sizeof(gint));
+    if(!tmp) {
+      show_query_error(db, "Failed to allocate memory");
+      pq->args[argnum].value = old;
+      return -1;
+    }
+    pq->listbuf = tmp;
+    pq->listsize = need;
+  }
+  return 0;
+}
+
+/** Run a prepared query with the current argument values
+ *
+ *  The query object that is returned belongs to the prepared query
+ *  and is reset in place by each execution, so it is valid until the
+ *  next wg_exec_query() or wg_free_prepared_query() call. It must not
+ *  be released with wg_free_query(). The rows are fetched with
+ *  wg_fetch() without collecting them first, so the execution does
+ *  not allocate memory unless the query needs to be planned again.
+ *
+ *  returns NULL on error.
+ */
+wg_query *wg_exec_query(void *db, wg_prepared_query *pq) {
+  wg_query *query = &pq->query;
+  gint fargc = pq->argc;
+  clock_t start = clock();
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_exec_query.\n");
+#endif
+    return NULL;
+  }
+#endif
+
+  /* Rows with deferred index updates must be visible to the query */
+  if(wg_flush_indexes(db))
+    return NULL;
+
+  if(fargc) {
+    memcpy(pq->full_arglist, pq->args, fargc * sizeof(wg_query_arg));
+    fargc = group_args(db, pq->full_arglist, fargc, pq->listbuf);
+  }
+
+  /* Only T-tree range and full scan plans are made, as they need
+   * no result buffers. A hash lookup plan set by wg_make_join() reads
+   * the rows of the hash entry (see hash_cursor()). */
+  if(!plan_valid(db, &pq->plan) &&\
+    plan_query(db, pq->full_arglist, fargc, 0, &pq->plan))
+    return NULL;
+
+  query->cover_index = 0;
+  query->cover_args = 0;
+  query->curr_entry = 0;
+  query->plan = pq->plan;
+  memset(&query->stats, 0, sizeof(wg_query_stats));
+  if(setup_query(db, query, pq->full_arglist, fargc, 0, pq->arglist) < 0)
+    return NULL;
+  query->stats.time = QUERY_TIME(start);
+  return query;
+}
+
+/** Release the memory allocated for the prepared query
+ */
+void wg_free_prepared_query(void *db, wg_prepared_query *pq) {
+  if(pq->args)
+    free(pq->args);
+  if(pq->full_arglist)
+    free(pq->full_arglist);
+  if(pq->listbuf)
+    free(pq->listbuf);
+  free(pq);
+}
+
+/** Release the memory allocated for the query
+ */
+void wg_free_query(void *db, wg_query *query) {
+  if(query->arglist)
+    free(query->arglist);
+  if(query->cache_entry)
+    release_cache_entry(db, (query_cache_entry *) query->cache_entry);
+  else if(query->qtype==WG_QTYPE_PREFETCH && query->mpool)
+    wg_free_mpool(db, query->mpool);
+  free(query);
+}
+
+/* ----------------- query result cache ------------------------*/
+
+/*
+ * The results of prefetch queries of a database handle can be kept in
+ * local memory and reused when the same query is made again. The key
+ * of a cached result is the normalised argument list (see cache_key()).
+ * A cached result is valid while the write epoch (incremented by every
+ * change of the rows) and the index epoch of the database stay the
+ * same, so the whole cache is dropped when either of them changes.
+ */
+
+/** Get the query cache of a database handle
+ *  returns NULL if caching is not enabled.
+ */
+static query_cache *handle_query_cache(void *db) {
+#ifdef USE_DATABASE_HANDLE
+  return (query_cache *) (((db_handle *) db)->querycache);
+#else
+  return NULL;
+#endif
+}
+
+/** Append an encoded value to a cache key
+ *  The value is stored as the number of bytes followed by its decoded
+ *  bytes (see wg_decode_for_hashing()), so that equal values given as
+ *  different query parameters have the same key. The key is grown
+ *  as needed.
+ *  returns the new length of the key, -1 if the value cannot be used
+ *  in a key or on error.
+ */
+static gint cache_key_value(void *db, gint enc, gint **key, gint *size,
+  gint pos) {
+  char *bytes, buf[sizeof(gint) + 1];
+  gint len, n;
+  int decoded = 0;
+
+  if(wg_get_encoded_type(db, enc) == WG_INTTYPE) {
+    /* Full range of values, the hashing bytes are truncated to int */
+    gint value = wg_decode_int(db, enc);
+    buf[0] = (char) WG_INTTYPE;
+    memcpy(buf + 1, &value, sizeof(gint));
+    bytes = buf;
+    len = sizeof(gint) + 1;
+  } else if((len = wg_decode_for_hashing(db, enc, &bytes)) > 0) {
+    decoded = 1;
+  } else
+    return -1;
+
+  n = 1 + (len + sizeof(gint) - 1) / sizeof(gint);
+  if(pos + n > *size) {
+    gint newsize = 2 * (pos + n);
+    gint *tmp = (gint *) realloc(*key, newsize * sizeof(gint));
+    if(!tmp) {
+      show_query_error(db, "Failed to allocate memory");
+      if(decoded)
+        free(bytes);
+      return -1;
+    }
+    *key = tmp;
+    *size = newsize;
+  }
+  (*key)[pos] = len;
+  (*key)[pos + n - 1] = 0; /* padding */
+  memcpy(*key + pos + 1, bytes, len);
+  if(decoded)
+    free(bytes);
+  return pos + n;
+}
+
+/** Order query arguments by column and condition
+ */
+static int compare_cache_args(const void *a, const void *b) {
+  const wg_query_arg *pa = (const wg_query_arg *) a;
+  const wg_query_arg *pb = (const wg_query_arg *) b;
+  if(pa->column != pb->column)
+    return (pa->column < pb->column ? -1 : 1);
+  if(pa->cond != pb->cond)
+    return (pa->cond < pb->cond ? -1 : 1);
+  return 0;
+}
+
+/** Make the cache key of a query
+ *  The key holds the row limit and the column, condition and decoded
+ *  values of each argument (of a unified argument list, see
+ *  prepare_params()). Without disjunctions the arguments are sorted
+ *  first, so the order they were given in does not matter.
+ *  Values that have no byte representation (anonymous constants)
+ *  are not cached.
+ *  returns the length of *key in gints, -1 if the query cannot be
+ *  cached or on error.
+ */
+static gint cache_key(void *db, wg_query_arg *arglist, gint argc,
+  wg_uint rowlimit, gint **key) {
+  gint i, j, pos, size = 64, count, *values;
+
+  for(i=0; i<argc && !(arglist[i].cond & QUERY_COND_FLAGS); i++);
+  if(i == argc && argc > 1)
+    qsort(arglist, argc, sizeof(wg_query_arg), compare_cache_args);
+
+  *key = (gint *) malloc(size * sizeof(gint));
+  if(!*key) {
+    show_query_error(db, "Failed to allocate memory");
+    return -1;
+  }
+  (*key)[0] = (gint) rowlimit;
+  (*key)[1] = argc;
+  for(i=0, pos=2; i<argc; i++) {
+    if(pos + 3 > size) {
+      gint *tmp = (gint *) realloc(*key, 2 * size * sizeof(gint));
+      if(!tmp) {
+        show_query_error(db, "Failed to allocate memory");
+        free(*key);
+        return -1;
+      }
+      *key = tmp;
+      size *= 2;
+    }
+    (*key)[pos++] = arglist[i].column;
+    (*key)[pos++] = arglist[i].cond;
+    if((arglist[i].cond & ~QUERY_COND_FLAGS) == WG_COND_IN) {
+      /* A list is stored in local memory, use the values */
+      count = in_list_values(db, arglist[i].value, &values);
+      (*key)[pos++] = count;
+    } else if((arglist[i].cond & ~QUERY_COND_FLAGS) == WG_COND_PREFIX) {
+      /* The range follows from the prefix */
+      in_list_values(db, arglist[i].value, &values);
+      count = 1;
+    } else {
+      values = &arglist[i].value;
+      count = 1;
+    }
+    for(j=0; j<count; j++) {
+      pos = cache_key_value(db, values[j], key, &size, pos);
+      if(pos < 0) {
+        free(*key);
+        return -1;
+      }
+    }
+  }
+  return pos;
+}
+
+/** Release a reference to a cached result
+ *  The result is freed when the cache and all the queries using
+ *  it have released it.
+ */
+static void release_cache_entry(void *db, query_cache_entry *entry) {
+  if(--entry->refcount > 0)
+    return;
+  if(entry->result.mpool)
+    wg_free_mpool(db, entry->result.mpool);
+  free(entry->key);
+  free(entry);
+}
+
+/** Drop all the results from the cache
+ */
+static void clear_query_cache(void *db, query_cache *cache) {
+  gint i;
+  for(i=0; i<cache->buckets_count; i++) {
+    query_cache_entry *entry = cache->buckets[i];
+    while(entry) {
+      query_cache_entry *next = entry->next;
+      release_cache_entry(db, entry);
+      entry = next;
+    }
+    cache->buckets[i] = NULL;
+  }
+  cache->count = 0;
+}
+
+/** Drop the least recently used result from the cache
+ */
+static void evict_cache_entry(void *db, query_cache *cache) {
+  query_cache_entry **victim = NULL, **prev;
+  gint i;
+
+  for(i=0; i<cache->buckets_count; i++) {
+    for(prev = &cache->buckets[i]; *prev; prev = &(*prev)->next) {
+      if(!victim || (*prev)->used < (*victim)->used)
+        victim = prev;
+    }
+  }
+  if(victim) {
+    query_cache_entry *entry = *victim;
+    *victim = entry->next;
+    release_cache_entry(db, entry);
+    cache->count--;
+  }
+}
+
+/** Create a prefetch query, using the query cache if enabled
+ *
+ *  If the same query (see cache_key()) was made earlier and the rows
+ *  have not changed since, the returned query shares the result pages
+ *  of the cached one. Otherwise the query is run and its result is
+ *  added to the cache.
+ *
+ *  returns NULL if constructing the query fails.
+ */
+static wg_query *cached_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit) {
+  query_cache *cache = handle_query_cache(db);
+  db_memsegment_header *dbh = dbmemsegh(db);
+  query_cache_entry *entry;
+  wg_query_arg *full_arglist;
+  wg_query *query;
+  gint fargc = 0, keylen, *key, i;
+  wg_uint hash = 0;
+
+  if(!cache)
+    return internal_build_query(db, matchrec, reclen, arglist, argc,
+      QUERY_FLAGS_PREFETCH, rowlimit, NULL);
+
+  if(prepare_params(db, matchrec, reclen, arglist, argc, 1,
+    &full_arglist, &fargc)) {
+    return NULL;
+  }
+  keylen = cache_key(db, full_arglist, fargc, rowlimit, &key);
+  if(full_arglist)
+    free(full_arglist);
+  if(keylen < 0)
+    return internal_build_query(db, matchrec, reclen, arglist, argc,
+      QUERY_FLAGS_PREFETCH, rowlimit, NULL);
+
+  /* The rows or the indexes have changed, the results are stale */
+  if(cache->write_epoch != dbh->write_epoch ||\
+    cache->index_epoch != dbh->index_control_area_header.index_epoch) {
+    clear_query_cache(db, cache);
+    cache->write_epoch = dbh->write_epoch;
+    cache->index_epoch = dbh->index_control_area_header.index_epoch;
+  }
+
+  for(i=0; i<keylen; i++)
+    hash = (wg_uint) key[i] + (hash << 6) + (hash << 16) - hash;
+  cache->tick++;
+  for(entry = cache->buckets[hash & (cache->buckets_count - 1)]; entry;
+    entry = entry->next) {
+    if(entry->hash == hash && entry->keylen == keylen &&\
+      !memcmp(entry->key, key, keylen * sizeof(gint)))
+      break;
+  }
+
+  if(entry) {
+    free(key);
+    query = (wg_query *) malloc(sizeof(wg_query));
+    if(!query) {
+      show_query_error(db, "Failed to allocate memory");
+      return NULL;
+    }
+    *query = entry->result;
+    memset(&query->stats, 0, sizeof(wg_query_stats)); /* nothing was run */
+    entry->refcount++;
+    entry->used = cache->tick;
+    cache->hits++;
+    return query;
+  }
+
+  cache->misses++;
+  query = internal_build_query(db, matchrec, reclen, arglist, argc,
+    QUERY_FLAGS_PREFETCH, rowlimit, NULL);
+  if(!query || query->qtype != WG_QTYPE_PREFETCH) {
+    free(key); /* nothing to share */
+    return query;
+  }
+  entry = (query_cache_entry *) malloc(sizeof(query_cache_entry));
+  if(!entry) {
+    free(key); /* the query works without caching */
+    return query;
+  }
+  if(cache->count >= cache->size)
+    evict_cache_entry(db, cache);
+
+  /* The result pages now belong to the entry */
+  entry->hash = hash;
+  entry->key = key;
+  entry->keylen = keylen;
+  entry->refcount = 2;
+  entry->used = cache->tick;
+  entry->result = *query;
+  entry->result.arglist = NULL;
+  entry->result.argc = 0;
+  entry->result.cache_entry = entry;
+  query->cache_entry = entry;
+  entry->next = cache->buckets[hash & (cache->buckets_count - 1)];
+  cache->buckets[hash & (cache->buckets_count - 1)] = entry;
+  cache->count++;
+  return query;
+}
+
+/** Enable the query result cache of the database handle
+ *
+ *  The results of wg_make_query() and wg_make_query_rc() are kept in
+ *  local memory and reused for the same query until the rows or the
+ *  indexes of the database change. size is the maximum number of
+ *  results kept, the least recently used ones are dropped first.
+ *  If size is 0, the cache is disabled. The cached results are dropped
+ *  when the size is changed, the hit and miss counters are kept.
+ *
+ *  returns 0 on success, -1 on error.
+ */
+gint wg_enable_query_cache(void *db, gint size) {
+#ifdef USE_DATABASE_HANDLE
+  query_cache **cache = (query_cache **) &(((db_handle *) db)->querycache);
+  query_cache_entry **buckets;
+  gint count = 16;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr, "Invalid database pointer in wg_enable_query_cache.\n");
 #endif
-            query->curr_offset = TNODE_SUCCESSOR(db, node);
-            query->curr_slot = 0;
-#ifdef CHECK
-          }
+    return -1;
+  }
 #endif
-        }
-      }
 
-      /* If there are no extra conditions or the row satisfies
-       * all the conditions, we can return.
-       */
-      if(!query->arglist || \
-        check_arglist(db, rec, query->arglist, query->argc))
-        return rec;
-    }
+  if(size < 0)
+    return show_query_error(db, "Invalid query cache size");
+  if(!size) {
+    wg_cleanup_handle_querycache(db);
+    return 0;
   }
-  if(query->qtype == WG_QTYPE_PREFETCH) {
-    if(query->curr_page) {
-      query_result_page *currpage = (query_result_page *) query->curr_page;
-      gint offset = currpage->rows[query->curr_pidx++];
-      if(!offset) {
-        /* page not filled completely */
-        query->curr_page = NULL;
-        return NULL;
-      } else {
-        if(query->curr_pidx >= QUERY_RESULTSET_PAGESIZE) {
-          query->curr_page = (void *) (currpage->next);
-          query->curr_pidx = 0;
-        }
-      }
-      return offsettoptr(db, offset);
+
+  while(count < size)
+    count *= 2;
+  buckets = (query_cache_entry **) calloc(count,
+    sizeof(query_cache_entry *));
+  if(!buckets)
+    return show_query_error(db, "Failed to allocate memory");
+  if(!(*cache)) {
+    *cache = (query_cache *) malloc(sizeof(query_cache));
+    if(!(*cache)) {
+      free(buckets);
+      return show_query_error(db, "Failed to allocate memory");
     }
-    else
-      return NULL;
+    memset(*cache, 0, sizeof(query_cache));
+  } else {
+    clear_query_cache(db, *cache);
+    free((*cache)->buckets);
   }
-  else {
-    show_query_error(db, "Unsupported query type");
-    return NULL;
+  (*cache)->buckets = buckets;
+  (*cache)->buckets_count = count;
+  (*cache)->size = size;
+  return 0;
+#else
+  return show_query_error(db, "Query cache not supported");
+#endif
+}
+
+/** Get the statistics of the query result cache
+ *  returns 0 on success, -1 if the cache is not enabled.
+ */
+gint wg_get_query_cache_stats(void *db, wg_query_cache_stats *stats) {
+  query_cache *cache;
+
+#ifdef CHECK
+  if (!dbcheck(db)) {
+#ifdef WG_NO_ERRPRINT
+#else
+    fprintf(stderr,
+      "Invalid database pointer in wg_get_query_cache_stats.\n");
+#endif
+    return -1;
   }
+#endif
+
+  cache = handle_query_cache(db);
+  if(!cache)
+    return -1;
+  stats->size = cache->size;
+  stats->entries = cache->count;
+  stats->hits = cache->hits;
+  stats->misses = cache->misses;
+  return 0;
 }
 
-/** Release the memory allocated for the query
+/** Free the query cache of a handle
+ *  Queries that still use cached results keep them until the
+ *  queries are freed.
  */
-void wg_free_query(void *db, wg_query *query) {
-  if(query->arglist)
-    free(query->arglist);
-  if(query->qtype==WG_QTYPE_PREFETCH && query->mpool)
-    wg_free_mpool(db, query->mpool);
-  free(query);
+void wg_cleanup_handle_querycache(void *db) {
+#ifdef USE_DATABASE_HANDLE
+  query_cache *cache = handle_query_cache(db);
+  if(cache) {
+    clear_query_cache(db, cache);
+    free(cache->buckets);
+    free(cache);
+    ((db_handle *) db)->querycache = NULL;
+  }
+#endif
 }
 
 /* ----------- query parameter preparing functions -------------*/
@@ -1215,6 +5638,31 @@ gint wg_encode_query_param_uri(void *db, const char *data, const char *prefix) {
   }
 }
 
+/* Encode a list of values for WG_COND_IN. The list is stored in
+ * local memory, laid out like a record. The values themselves
+ * are not copied.
+ */
+gint wg_encode_query_param_list(void *db, gint *values, gint count) {
+  gint *list;
+
+  if(count < 0 || (count && !values)) {
+    show_query_error(db, "Invalid list of values");
+    return WG_ILLEGAL;
+  }
+  list = (gint *) malloc((RECORD_HEADER_GINTS + count) * sizeof(gint));
+  if(!list) {
+    show_query_error(db, "Failed to encode query parameter");
+    return WG_ILLEGAL;
+  }
+  list[0] = (RECORD_HEADER_GINTS + count) * sizeof(gint);
+  list[RECORD_META_POS] = RECORD_META_NOTDATA|RECORD_META_MATCH|\
+    RECORD_META_LOCAL;
+  list[RECORD_BACKLINKS_POS] = 0;
+  if(count)
+    memcpy(list + RECORD_HEADER_GINTS, values, count * sizeof(gint));
+  return encode_datarec_offset(ptrtooffset(db, list));
+}
+
 /* Encode shortstr- or longstr-compatible data in local memory.
  * string type without lang is handled as "short", ignoring the
  * actual length. All other types require longstr storage to
@@ -1224,48 +5672,78 @@ static gint encode_query_param_unistr(void *db, const char *data, gint type,
   const char *extdata, int length) {
 
   void *dptr;
+  int extlen = (extdata ? strlen(extdata) : 0);
+
+  dptr=malloc(unistr_param_size(type, extdata, extlen, length));
+  if(!dptr) {
+    show_query_error(db, "Failed to encode query parameter");
+    return WG_ILLEGAL;
+  }
+  return fill_query_param_unistr(db, dptr, data, type, extdata, extlen,
+    length);
+}
+
+/* Size of the longstr part of the local storage (without extdata)
+ */
+static int longstr_param_len(gint type, int length) {
+  int dlen, lengints;
+
+  if(type != WG_BLOBTYPE)
+    length++; /* include the terminating 0 */
+
+  /* Determine storage size */
+  lengints = length / sizeof(gint);
+  if(length % sizeof(gint)) lengints++;
+  dlen = sizeof(gint) * (LONGSTR_HEADER_GINTS + lengints);
+
+  /* Emulate the behaviour of wg_alloc_gints() */
+  if(dlen < MIN_VARLENOBJ_SIZE) dlen = MIN_VARLENOBJ_SIZE;
+  if(dlen % 8) dlen += 4;
+  return dlen;
+}
+
+/* Size of the local storage of an encoded string value in bytes,
+ * rounded up so that the next value is aligned (see
+ * fill_query_param_unistr()).
+ */
+static gint unistr_param_size(gint type, const char *extdata, int extlen,
+  int length) {
+  gint size;
+  if(type == WG_STRTYPE && extdata == NULL)
+    size = length + 1;
+  else
+    size = longstr_param_len(type, length) + (extdata ? extlen + 1 : 0);
+  if(size % 8)
+    size += 8 - size % 8;
+  return size;
+}
+
+/* Encode a string value in the storage pointed to by dptr. The size
+ * of the storage is given by unistr_param_size(). extlen bytes of
+ * extdata are used.
+ */
+static gint fill_query_param_unistr(void *db, void *dptr, const char *data,
+  gint type, const char *extdata, int extlen, int length) {
+
   if(type == WG_STRTYPE && extdata == NULL) {
-    dptr=malloc(length+1);
-    if(!dptr) {
-      show_query_error(db, "Failed to encode query parameter");
-      return WG_ILLEGAL;
-    }
     memcpy((char *) dptr, data, length);
     ((char *) dptr)[length] = '\0';
     return encode_shortstr_offset(ptrtooffset(db, dptr));
   }
   else {
     size_t i;
-    int extlen = 0;
-    int dlen, lengints, lenrest;
+    int dlen = longstr_param_len(type, length), lenrest;
     gint offset, meta;
 
-    if(type != WG_BLOBTYPE)
-      length++; /* include the terminating 0 */
-
-    /* Determine storage size */
-    lengints = length / sizeof(gint);
-    lenrest = length % sizeof(gint);
-    if(lenrest) lengints++;
-    dlen = sizeof(gint) * (LONGSTR_HEADER_GINTS + lengints);
-
-    /* Emulate the behaviour of wg_alloc_gints() */
-    if(dlen < MIN_VARLENOBJ_SIZE) dlen = MIN_VARLENOBJ_SIZE;
-    if(dlen % 8) dlen += 4;
-
-    if(extdata) {
-      extlen = strlen(extdata);
-    }
-
-    dptr=malloc(dlen + (extdata ? extlen + 1 : 0));
-    if(!dptr) {
-      show_query_error(db, "Failed to encode query parameter");
-      return WG_ILLEGAL;
-    }
-    offset = ptrtooffset(db, dptr);
-
     /* Copy the data, fill the remainder with zeroes */
     memcpy((char *) dptr + (LONGSTR_HEADER_GINTS*sizeof(gint)), data, length);
+    if(type != WG_BLOBTYPE) {
+      /* include the terminating 0 */
+      *((char *)dptr + length + (LONGSTR_HEADER_GINTS*sizeof(gint))) = '\0';
+      length++;
+    }
+    lenrest = length % sizeof(gint);
+    offset = ptrtooffset(db, dptr);
     for(i=0; lenrest && i<sizeof(gint)-lenrest; i++) {
       *((char *)dptr + length + (LONGSTR_HEADER_GINTS*sizeof(gint)) + i) = '\0';
     }
@@ -1311,6 +5789,11 @@ gint wg_free_query_param(void* db, gint data) {
 
     switch(data&NORMALPTRMASK) {
       case DATARECBITS:
+        /* Only lists in local memory are freed, not database records */
+        offset = decode_datarec_offset(data);
+        if(dbfetch(db, offset + RECORD_META_POS*sizeof(gint)) &\
+          RECORD_META_LOCAL)
+          free(offsettoptr(db, offset));
         break;
       case SHORTSTRBITS:
         offset = decode_shortstr_offset(data);
@@ -1830,6 +6313,300 @@ static gint prepare_json_arglist(void *db, wg_json_query_arg *arglist,
   return 0;
 }
 
+/*
+ * Count the documents in a list returned by the hash index.
+ */
+static gint reclist_length(void *db, gint reclist) {
+  gint count = 0;
+  while(reclist) {
+    count++;
+    reclist = ((gcell *) offsettoptr(db, reclist))->cdr;
+  }
+  return count;
+}
+
+/*
+ * Look up the scalars of a structured clause value in the JSON path
+ * index. A document can only contain the value if it has the entries
+ * of all the scalars, so the one with the fewest documents is kept.
+ * The scalars directly in an array under the key of the clause are
+ * skipped, as the array may also be matched as an element of an
+ * array in the document (which is not indexed).
+ *
+ * returns 0 on success
+ * returns -1 on error
+ */
+static gint probe_json_value(void *db, gint index_id, gint enc, gint *path,
+  gint depth, gint nesting, gint levels, json_path_probe *probe)
+{
+  gint i, reclen;
+  void *rec;
+
+  if(wg_get_encoded_type(db, enc) != WG_RECORDTYPE) {
+    gint reclist, size;
+    if(depth < 2 || nesting > 1)
+      return 0;
+    path[depth] = enc;
+    reclist = wg_search_hash(db, index_id, path, depth + 1);
+    if(reclist < 0)
+      return -1;
+    size = reclist_length(db, reclist);
+    if(probe->size < 0 || size < probe->size) {
+      probe->reclist = reclist;
+      probe->size = size;
+    }
+    return 0;
+  }
+
+  if(levels < 1)
+    return 0;
+  rec = wg_decode_record(db, enc);
+  reclen = wg_get_record_len(db, rec);
+  for(i=0; i<reclen && probe->size; i++) {
+    gint fenc = wg_get_field(db, rec, i);
+    if(is_schema_object(rec)) {
+      void *kv;
+      if(depth >= PATH_INDEX_MAX_KEYS ||\
+        wg_get_encoded_type(db, fenc) != WG_RECORDTYPE)
+        continue;
+      kv = wg_decode_record(db, fenc);
+      if(wg_get_record_len(db, kv) <= WG_SCHEMA_VALUE_OFFSET)
+        continue;
+      path[depth] = wg_get_field(db, kv, WG_SCHEMA_KEY_OFFSET);
+      if(probe_json_value(db, index_id,
+        wg_get_field(db, kv, WG_SCHEMA_VALUE_OFFSET),
+        path, depth + 1, 0, levels - 1, probe))
+        return -1;
+    } else if(is_schema_array(rec)) {
+      if(probe_json_value(db, index_id, fenc, path, depth, nesting + 1,
+        levels - 1, probe))
+        return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Look up a document query clause in the JSON path index. The lookup
+ * of a key and a literal value gives the matching documents exactly,
+ * structured values are looked up by their contents (see above) and
+ * the documents need to be checked.
+ *
+ * returns 0 on success (probe->size is -1 if nothing could be looked up)
+ * returns -1 on error
+ */
+static gint probe_json_arg(void *db, gint index_id, wg_json_query_arg *arg,
+  json_path_probe *probe)
+{
+  gint path[PATH_INDEX_MAX_KEYS + 1];
+
+  probe->reclist = 0;
+  probe->size = -1;
+  probe->done = 0;
+  path[0] = arg->key;
+  if(wg_get_encoded_type(db, arg->value) != WG_RECORDTYPE) {
+    path[1] = arg->value;
+    probe->reclist = wg_search_hash(db, index_id, path, 2);
+    if(probe->reclist < 0)
+      return -1;
+    probe->size = reclist_length(db, probe->reclist);
+    probe->exact = 1;
+    return 0;
+  }
+  probe->exact = 0;
+  return probe_json_value(db, index_id, arg->value, path, 1, 0,
+    WG_COMPARE_REC_DEPTH, probe);
+}
+
+/*
+ * Create a result set of the unique documents in a hash index list.
+ * Returns NULL on error.
+ */
+static query_result_set *reclist_resultset(void *db, gint reclist) {
+  query_result_set *set, *unique;
+
+  if(!(set = create_resultset(db)))
+    return NULL;
+  while(reclist) {
+    gcell *rec_cell = (gcell *) offsettoptr(db, reclist);
+    if(append_resultset(db, set, rec_cell->car)) {
+      free_resultset(db, set);
+      return NULL;
+    }
+    reclist = rec_cell->cdr;
+  }
+  unique = unique_resultset(db, set);
+  free_resultset(db, set);
+  return unique;
+}
+
+/*
+ * Check a set of documents against a clause.
+ * Returns the (unique) matching documents.
+ * Returns NULL on error.
+ */
+static query_result_set *check_json_arg(void *db, query_result_set *docs,
+  wg_json_query_arg *arg, gint *examined)
+{
+  query_result_set *next_set, *unique;
+  gint offset;
+
+  if(!(next_set = create_resultset(db)))
+    return NULL;
+  rewind_resultset(db, docs);
+  while((offset = fetch_resultset(db, docs))) {
+    if(check_and_merge_recursively(db, offsettoptr(db, offset),
+      arg, next_set, WG_COMPARE_REC_DEPTH) < 0) {
+      free_resultset(db, next_set);
+      return NULL;
+    }
+    (*examined)++;
+  }
+  unique = unique_resultset(db, next_set);
+  free_resultset(db, next_set);
+  return unique;
+}
+
+/*
+ * Run a document query using the JSON path index.
+ *
+ * The clause with the fewest documents in the index gives the initial
+ * set. The other clauses are applied in the order of their size,
+ * either by intersecting with their documents from the index, or by
+ * checking the documents in the current set. The check is chosen when
+ * the current set is small compared to the index list, or when the
+ * index lookup of the clause is not exact.
+ *
+ * returns 0 on success, the query is returned in *query
+ * returns 1 if the index cannot be used for the clauses
+ * returns -1 on error
+ */
+static gint path_json_query(void *db, gint index_id,
+  wg_json_query_arg *arglist, gint argc, wg_query **query)
+{
+  json_path_probe *probe;
+  query_result_set *curr_res = NULL, *tmp_set;
+  gint i, step, driver = -1, examined = 0, intersected = 0;
+  double rows, cost;
+
+  if(!(probe = malloc(sizeof(json_path_probe) * argc)))
+    return show_query_error(db, "Failed to prepare query arguments");
+
+  for(i=0; i<argc; i++) {
+    if(probe_json_arg(db, index_id, &arglist[i], &probe[i])) {
+      free(probe);
+      return -1;
+    }
+    if(probe[i].size >= 0 && (driver < 0 ||\
+      probe[i].size < probe[driver].size ||\
+      (probe[i].size == probe[driver].size && probe[i].exact)))
+      driver = i;
+  }
+  if(driver < 0) {
+    free(probe);
+    return 1; /* no clause could be looked up */
+  }
+
+  rows = probe[driver].size;
+  cost = rows * (PLAN_COST_ENTRY + PLAN_COST_SET);
+  if(!(curr_res = reclist_resultset(db, probe[driver].reclist)))
+    goto error;
+  if(!probe[driver].exact) {
+    cost += curr_res->res_count * PLAN_COST_DOC;
+    if(!(tmp_set = check_json_arg(db, curr_res, &arglist[driver],
+      &examined)))
+      goto error;
+    free_resultset(db, curr_res);
+    curr_res = tmp_set;
+  }
+  probe[driver].done = 1;
+
+  for(step=1; step<argc && curr_res->res_count; step++) {
+    double icost, vcost;
+
+    /* Next clause: smallest index list, unknown size last */
+    for(i=0, driver=-1; i<argc; i++) {
+      if(probe[i].done)
+        continue;
+      if(driver < 0 || (probe[i].size >= 0 &&\
+        (probe[driver].size < 0 || probe[i].size < probe[driver].size)))
+        driver = i;
+    }
+    probe[driver].done = 1;
+
+    vcost = curr_res->res_count * PLAN_COST_DOC;
+    icost = probe[driver].size * (PLAN_COST_ENTRY + PLAN_COST_SET) +\
+      curr_res->res_count * PLAN_COST_SET;
+    if(probe[driver].exact && icost < vcost) {
+      query_result_set *next_set;
+      if(!(next_set = reclist_resultset(db, probe[driver].reclist)))
+        goto error;
+      tmp_set = intersect_resultset(db, curr_res, next_set);
+      free_resultset(db, next_set);
+      intersected = 1;
+      cost += icost;
+    } else {
+      tmp_set = check_json_arg(db, curr_res, &arglist[driver], &examined);
+      cost += vcost;
+    }
+    if(!tmp_set)
+      goto error;
+    free_resultset(db, curr_res);
+    curr_res = tmp_set;
+  }
+  free(probe);
+
+  if(!(*query = json_query_object(db, curr_res)))
+    return -1;
+  (*query)->plan.type = (intersected ? WG_QPLAN_INTERSECT : WG_QPLAN_HASH);
+  (*query)->plan.count = 1;
+  (*query)->plan.index_id[0] = index_id;
+  (*query)->plan.epoch = dbmemsegh(db)->index_control_area_header.index_epoch;
+  (*query)->plan.rows = rows;
+  (*query)->plan.cost = cost;
+  (*query)->stats.examined = examined;
+  (*query)->stats.matched = (*query)->res_count;
+  return 0;
+
+error:
+  if(curr_res)
+    free_resultset(db, curr_res);
+  free(probe);
+  return -1;
+}
+
+/*
+ * Create a prefetch query object that returns the documents of
+ * a result set. The result set is consumed.
+ * Returns NULL on error.
+ */
+static wg_query *json_query_object(void *db, query_result_set *res) {
+  wg_query *query = (wg_query *) malloc(sizeof(wg_query));
+  if(!query) {
+    free_resultset(db, res);
+    show_query_error(db, "Failed to allocate memory");
+    return NULL;
+  }
+  query->qtype = WG_QTYPE_PREFETCH;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->column = -1;
+  query->cover_index = 0;
+  query->cover_args = 0;
+  query->curr_entry = 0;
+  query->cache_entry = NULL;
+  memset(&query->plan, 0, sizeof(wg_query_plan)); /* not planned */
+  memset(&query->stats, 0, sizeof(wg_query_stats));
+
+  /* Copy the result. */
+  query->curr_page = res->first_page;
+  query->curr_pidx = 0;
+  query->res_count = res->res_count;
+  query->mpool = res->mpool;
+  free(res); /* contents were inherited, dispose of the struct */
+  return query;
+}
+
 /*
  * Find a list of documents that contain the key-value pairs.
  * Returns a prefetch query object.
@@ -1856,6 +6633,19 @@ wg_query *wg_make_json_query(void *db, wg_json_query_arg *arglist, gint argc) {
   }
 #endif
 
+  if(wg_flush_indexes(db))
+    return NULL;
+
+  /* The JSON path index finds the documents directly */
+  index_id = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_HASH_PATH, NULL, 0);
+  if(index_id > 0) {
+    gint err = path_json_query(db, index_id, arglist, argc, &query);
+    if(err < 0)
+      return NULL;
+    else if(!err)
+      return query;
+  }
+
   /* Sort the argument list. This also checks for usable indexes, so
    * we're calling it even if we have just one argument.
    */
@@ -1867,10 +6657,9 @@ wg_query *wg_make_json_query(void *db, wg_json_query_arg *arglist, gint argc) {
   if(sorted_arglist)
     arglist = sorted_arglist;
 
-  /* Iterate over the argument pairs.
-   * XXX: it is possible that getting the first set from index and
-   * doing a scan to check the remaining arguments is faster than
-   * doing the intersect operation of sets retrieved from index.
+  /* Iterate over the argument pairs. Unlike with the path index,
+   * the sets are always intersected, as the sizes are not known
+   * before reading them.
    */
   for(i=0; i<argc; i++) {
     query_result_set *next_set, *tmp_set;
@@ -1917,8 +6706,9 @@ wg_query *wg_make_json_query(void *db, wg_json_query_arg *arglist, gint argc) {
        * key field to reduce the number of records visited.
        */
       gint curr_offset = 0, curr_slot = -1, end_offset = 0, end_slot = -1;
+      wg_index_header *hdr = (wg_index_header *) offsettoptr(db, kindex_id);
 
-      if(find_ttree_bounds(db, kindex_id, WG_SCHEMA_KEY_OFFSET,
+      if(find_ttree_bounds(db, kindex_id,
           arglist[i].key, arglist[i].key, 1, 1,
           &curr_offset, &curr_slot, &end_offset, &end_slot)) {
         curr_offset = 0;
@@ -1927,7 +6717,8 @@ wg_query *wg_make_json_query(void *db, wg_json_query_arg *arglist, gint argc) {
       while(curr_offset) {
         gint rc;
         struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, curr_offset);
-        void *rec = offsettoptr(db, node->array_of_values[curr_slot]);
+        void *rec = offsettoptr(db, INDEX_ENTRY_RECORD(db, hdr,
+          node->array_of_values[curr_slot]));
 
         rc = check_and_merge_by_key(db, rec, &arglist[i], next_set);
         IF_ERR_CLEAN_UP(db, curr_res, next_set, sorted_arglist, rc)
@@ -2016,26 +6807,7 @@ wg_query *wg_make_json_query(void *db, wg_json_query_arg *arglist, gint argc) {
   }
   ARGLIST_CLEANUP(sorted_arglist)
 
-  /* Initialize query object */
-  query = (wg_query *) malloc(sizeof(wg_query));
-  if(!query) {
-    free_resultset(db, curr_res);
-    show_query_error(db, "Failed to allocate memory");
-    return NULL;
-  }
-  query->qtype = WG_QTYPE_PREFETCH;
-  query->arglist = NULL;
-  query->argc = 0;
-  query->column = -1;
-
-  /* Copy the result. */
-  query->curr_page = curr_res->first_page;
-  query->curr_pidx = 0;
-  query->res_count = curr_res->res_count;
-  query->mpool = curr_res->mpool;
-  free(curr_res); /* contents were inherited, dispose of the struct */
-
-  return query;
+  return json_query_object(db, curr_res);
 }
 
 /* ------------------ simple query functions -------------------*/
@@ -2044,8 +6816,12 @@ void *wg_find_record(void *db, gint fieldnr, gint cond, gint data,
     void* lastrecord) {
   gint index_id = -1;
 
+  if(wg_flush_indexes(db))
+    return NULL;
+
   /* find index on colum */
-  if(cond != WG_COND_NOT_EQUAL) {
+  if(cond != WG_COND_NOT_EQUAL && cond != WG_COND_CONTAINS &&\
+    cond != WG_COND_PREFIX) {
     index_id = wg_multi_column_to_index_id(db, &fieldnr, 1,
       WG_INDEX_TYPE_TTREE, NULL, 0);
   }
@@ -2057,6 +6833,14 @@ void *wg_find_record(void *db, gint fieldnr, gint cond, gint data,
     gint end_bound = WG_ILLEGAL;
     gint curr_offset = 0, curr_slot = -1, end_offset = 0, end_slot = -1;
     void *prev = NULL;
+    wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+
+    /* The first equal row is looked up without the database lock
+     * when possible (see wg_search_ttree_index()) */
+    if(cond == WG_COND_EQUAL && !lastrecord) {
+      gint rowoffset = wg_search_ttree_index(db, index_id, data);
+      return (rowoffset > 0 ? offsettoptr(db, rowoffset) : NULL);
+    }
 
     switch(cond) {
       case WG_COND_EQUAL:
@@ -2081,7 +6865,7 @@ void *wg_find_record(void *db, gint fieldnr, gint cond, gint data,
         return NULL;
     }
 
-    if(find_ttree_bounds(db, index_id, fieldnr,
+    if(find_ttree_bounds(db, index_id,
         start_bound, end_bound, start_inclusive, end_inclusive,
         &curr_offset, &curr_slot, &end_offset, &end_slot)) {
       return NULL;
@@ -2090,7 +6874,8 @@ void *wg_find_record(void *db, gint fieldnr, gint cond, gint data,
     /* We have the bounds, scan to lastrecord */
     while(curr_offset) {
       struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, curr_offset);
-      void *rec = offsettoptr(db, node->array_of_values[curr_slot]);
+      void *rec = offsettoptr(db, INDEX_ENTRY_RECORD(db, hdr,
+        node->array_of_values[curr_slot]));
 
       if(prev == lastrecord) {
         /* if lastrecord is NULL, first match returned */
@@ -2122,7 +6907,8 @@ void *wg_find_record(void *db, gint fieldnr, gint cond, gint data,
     }
   }
   else {
-    /* no index (or cond == WG_COND_NOT_EQUAL), do a scan */
+    /* no index (or cond is WG_COND_NOT_EQUAL, WG_COND_CONTAINS or
+     * WG_COND_PREFIX), do a scan */
     wg_query_arg arg;
     void *rec;
 
@@ -44,12 +44,39 @@
 #define WG_COND_GREATER     0x0008      /** > */
 #define WG_COND_LTEQUAL     0x0010      /** <= */
 #define WG_COND_GTEQUAL     0x0020      /** >= */
+#define WG_COND_CONTAINS    0x0040      /** substring (strings only) */
+#define WG_COND_IN          0x0080      /** in a list of values */
+#define WG_COND_OR          0x0100      /** flag: or the previous argument */
+#define WG_COND_PREFIX      0x0200      /** begins with (strings and URIs) */
 
 #define WG_QTYPE_TTREE      0x01
 #define WG_QTYPE_HASH       0x02
 #define WG_QTYPE_SCAN       0x04
 #define WG_QTYPE_PREFETCH   0x80
 
+#define WG_QPLAN_SCAN       0   /** check all rows */
+#define WG_QPLAN_TTREE      1   /** T-tree range */
+#define WG_QPLAN_HASH       2   /** hash index lookup */
+#define WG_QPLAN_INTERSECT  3   /** intersection of index ranges/lookups */
+#define WG_QPLAN_BITMAP     4   /** bitmap and trigram indexes */
+#define WG_QPLAN_RTREE      5   /** R-tree box search */
+#define WG_QPLAN_PROBE      6   /** T-tree lookup of each value in a list */
+
+#define WG_QPLAN_MAX_INDEXES 4
+
+#define WG_ORDER_ASC        0   /** ascending order */
+#define WG_ORDER_DESC       1   /** descending order */
+
+#define WG_JOIN_REFERENCE   1   /** follow record references */
+#define WG_JOIN_INDEX       2   /** index lookup for each left row */
+#define WG_JOIN_HASH        3   /** hash table of the right rows */
+
+#define WG_AGGR_COUNT       1   /** number of rows or values */
+#define WG_AGGR_SUM         2   /** sum of numeric values */
+#define WG_AGGR_MIN         3   /** smallest value */
+#define WG_AGGR_MAX         4   /** largest value */
+#define WG_AGGR_AVG         5   /** average of numeric values */
+
 /* ====== data structures ======== */
 
 /** Query argument list object */
@@ -64,6 +91,59 @@ typedef struct {
   gint value;       /** encoded value */
 } wg_json_query_arg;
 
+/** Query plan
+ *  The plan only refers to the indexes and the columns of the
+ *  conditions, the bounds are computed from the argument values when
+ *  the plan is executed. So the plan can be reused for queries that
+ *  differ by the argument values, while the indexes stay the same.
+ */
+typedef struct {
+  gint type;                /** plan type (WG_QPLAN_*) */
+  gint count;               /** number of indexes used */
+  gint index_id[WG_QPLAN_MAX_INDEXES]; /** indexes, in the order of use */
+  gint epoch;               /** index epoch when the plan was made */
+  double rows;              /** estimated number of rows */
+  double cost;              /** estimated cost (rows checked) */
+} wg_query_plan;
+
+/** Query plan with details (see wg_explain_query()) */
+typedef struct {
+  wg_query_plan plan;       /** plan the query would be run with */
+  gint index_type[WG_QPLAN_MAX_INDEXES]; /** types of the indexes */
+  gint column;              /** leading column of the T-tree index */
+  gint start_bound;         /** encoded lower bound, WG_ILLEGAL if none */
+  gint end_bound;           /** encoded upper bound, WG_ILLEGAL if none */
+  gint start_inclusive;     /** lower bound is in the range */
+  gint end_inclusive;       /** upper bound is in the range */
+} wg_query_explain;
+
+/** Execution counters of a query (see wg_query) */
+typedef struct {
+  gint examined;            /** rows checked against the conditions */
+  gint matched;             /** rows that satisfied the conditions */
+  gint returned;            /** rows returned by the fetch functions */
+  gint tnodes;              /** T-tree nodes read */
+  double time;              /** seconds spent creating the query */
+} wg_query_stats;
+
+/** Aggregate function and its result (see wg_query_aggregate()) */
+typedef struct {
+  gint type;        /** aggregate function (WG_AGGR_*) */
+  gint column;      /** column, -1 to count rows */
+  gint count;       /** result: number of rows or values aggregated */
+  gint value;       /** result: encoded minimum or maximum value */
+  double result;    /** result: sum or average */
+} wg_query_aggr;
+
+/** Groups and their aggregates (see wg_query_group()) */
+typedef struct {
+  gint groups;              /** number of groups */
+  gint key_count;           /** key values of each group */
+  gint aggr_count;          /** aggregates of each group */
+  gint *keys;               /** encoded key values, key_count per group */
+  wg_query_aggr *aggr;      /** aggregates, aggr_count per group */
+} wg_query_groups;
+
 /** Query object */
 typedef struct {
   gint qtype;           /** Query type (T-tree, hash, full scan, prefetch) */
@@ -85,8 +165,53 @@ typedef struct {
   void *curr_page;          /** current page of results */
   gint curr_pidx;           /** current index on page */
   wg_uint res_count;          /** number of rows in results */
+  /* Fields for covering index */
+  gint cover_index;         /** covering index used, 0 if none */
+  gint cover_args;          /** arglist can be checked on index entries */
+  gint curr_entry;          /** index entry of the last fetched row */
+  wg_query_plan plan;       /** plan the query was built with */
+  void *cache_entry;        /** shared cached result, NULL if none */
+  wg_query_stats stats;     /** counters of running the query */
 } wg_query;
 
+/** Join object (see wg_make_join()) */
+typedef struct {
+  gint type;                /** join method (WG_JOIN_*) */
+  wg_query *left;           /** query of the left rows */
+  gint left_column;         /** join column of the left rows */
+  gint right_column;        /** join column of the right rows, -1 if none */
+  wg_query_arg *arglist;    /** conditions of the right rows */
+  gint argc;                /** number of elements in arglist */
+  wg_query_plan plan;       /** plan of the index lookups */
+  void *prepared;           /** prepared index lookup (wg_prepared_query) */
+  wg_query *inner;          /** right rows of the current left row */
+  void *curr_left;          /** current left row */
+  gint curr_key;            /** join value of the current left row */
+  wg_uint curr_hash;        /** hash of the join value */
+  gint curr_entry;          /** next hash table entry to check */
+  void *table;              /** hash table of the right rows */
+} wg_join;
+
+/** Prepared query (see wg_prepare_query()) */
+typedef struct {
+  wg_query query;           /** query object reset by each execution */
+  wg_query_arg *args;       /** arguments with the bound values */
+  gint argc;                /** number of elements in args */
+  wg_query_arg *full_arglist; /** combined arguments of the execution */
+  wg_query_arg *arglist;    /** buffer of the reduced argument list */
+  gint *listbuf;            /** lists of values of combined disjunctions */
+  gint listsize;            /** size of listbuf in gints */
+  wg_query_plan plan;       /** plan reused while the indexes are the same */
+} wg_prepared_query;
+
+/** Query cache statistics (see wg_get_query_cache_stats()) */
+typedef struct {
+  gint size;                /** maximum number of cached results */
+  gint entries;             /** number of cached results */
+  gint hits;                /** queries answered from the cache */
+  gint misses;              /** queries that were run */
+} wg_query_cache_stats;
+
 /* ==== Protos ==== */
 
 wg_query *wg_make_query(void *db, void *matchrec, gint reclen,
@@ -95,8 +220,43 @@ wg_query *wg_make_query(void *db, void *matchrec, gint reclen,
 wg_query *wg_make_query_rc(void *db, void *matchrec, gint reclen,
   wg_query_arg *arglist, gint argc, wg_uint rowlimit);
 wg_query *wg_make_json_query(void *db, wg_json_query_arg *arglist, gint argc);
+wg_query *wg_make_ordered_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, gint column, gint order,
+  wg_uint limit);
+gint wg_explain_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_query_explain *explain);
 void *wg_fetch(void *db, wg_query *query);
+gint wg_fetch_many(void *db, wg_query *query, void **out, gint n);
+gint wg_query_skip(void *db, wg_query *query, gint n);
+void *wg_fetch_values(void *db, wg_query *query, gint *columns, gint count,
+  gint *values);
 void wg_free_query(void *db, wg_query *query);
+gint wg_query_aggregate(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_query_aggr *specs, gint count);
+gint wg_query_count(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc);
+gint wg_query_exists(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc);
+wg_query_groups *wg_query_group(void *db, wg_query *query,
+  gint *columns, gint col_count, wg_query_aggr *specs, gint count);
+wg_query_groups *wg_query_group_part(void *db, wg_query *query,
+  gint part, gint parts, gint *columns, gint col_count,
+  wg_query_aggr *specs, gint count);
+gint wg_merge_query_groups(void *db, wg_query_groups *dest,
+  wg_query_groups *src);
+void wg_free_query_groups(void *db, wg_query_groups *groups);
+wg_join *wg_make_join(void *db, wg_query *left, gint left_column,
+  wg_query_arg *arglist, gint argc, gint right_column);
+void *wg_fetch_join(void *db, wg_join *join, void **right);
+void wg_free_join(void *db, wg_join *join);
+wg_prepared_query *wg_prepare_query(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc);
+gint wg_bind_query(void *db, wg_prepared_query *pq, gint argnum,
+  gint value);
+wg_query *wg_exec_query(void *db, wg_prepared_query *pq);
+void wg_free_prepared_query(void *db, wg_prepared_query *pq);
+gint wg_enable_query_cache(void *db, gint size);
+gint wg_get_query_cache_stats(void *db, wg_query_cache_stats *stats);
 
 gint wg_encode_query_param_null(void *db, const char *data);
 gint wg_encode_query_param_record(void *db, void *data);
@@ -110,6 +270,7 @@ gint wg_encode_query_param_double(void *db, double data);
 gint wg_encode_query_param_str(void *db, const char *data, const char *lang);
 gint wg_encode_query_param_xmlliteral(void *db, const char *data, const char *xsdtype);
 gint wg_encode_query_param_uri(void *db, const char *data, const char *prefix);
+gint wg_encode_query_param_list(void *db, gint *values, gint count);
 gint wg_free_query_param(void* db, gint data);
 
 void *wg_find_record(void *db, gint fieldnr, gint cond, gint data,
@@ -139,4 +300,8 @@ void *wg_find_record_xmlliteral(void *db, gint fieldnr, gint cond, const char *d
 void *wg_find_record_uri(void *db, gint fieldnr, gint cond, const char *data,
 	const char *prefix, void* lastrecord);
 
+/* WhiteDB internal functions */
+
+void wg_cleanup_handle_querycache(void *db);
+
 #endif /* DEFINED_DBQUERY_H */
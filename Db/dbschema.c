@@ -188,19 +188,14 @@ static void *find_document_recursive(void *db, gint *rec, int depth) {
     return rec;
 
   if(depth > 0) {
-    gint backlink_list = *(rec + RECORD_BACKLINKS_POS);
-    if(backlink_list) {
-      gcell *next = (gcell *) offsettoptr(db, backlink_list);
-      for(;;) {
-        void *res = find_document_recursive(db,
-          (gint *) offsettoptr(db, next->car),
-          depth-1);
-        if(res)
-          return res; /* Something was found recursively */
-        if(!next->cdr)
-          break;
-        next = (gcell *) offsettoptr(db, next->cdr);
-      }
+    gint iter, parent = wg_first_backlink(db, rec, &iter);
+    while(parent) {
+      void *res = find_document_recursive(db,
+        (gint *) offsettoptr(db, parent),
+        depth-1);
+      if(res)
+        return res; /* Something was found recursively */
+      parent = wg_next_backlink(db, rec, &iter);
     }
   }
 
@@ -41,6 +41,23 @@ extern "C" {
 #define WG_INDEX_TYPE_TTREE_JSON    51
 #define WG_INDEX_TYPE_HASH          60
 #define WG_INDEX_TYPE_HASH_JSON     61
+#define WG_INDEX_TYPE_HASH_PATH     62
+#define WG_INDEX_TYPE_BITMAP        70
+#define WG_INDEX_TYPE_TRIGRAM       80
+#define WG_INDEX_TYPE_RTREE         90
+
+#define WG_INDEX_HIST_BUCKETS 16
+
+/* Public types */
+
+typedef struct {
+  wg_int rows;          /** rows in the index */
+  wg_int distinct;      /** estimated number of distinct keys */
+  wg_int nulls;         /** rows with NULL in the first indexed column */
+  wg_int buckets;       /** histogram buckets, 0 if no numeric values */
+  double bound[WG_INDEX_HIST_BUCKETS+1];  /** bucket boundaries */
+  wg_int bucket_rows[WG_INDEX_HIST_BUCKETS]; /** rows in each bucket */
+} wg_index_stats;
 
 /* Public protos */
 
@@ -48,6 +65,9 @@ wg_int wg_create_index(void *db, wg_int column, wg_int type,
   wg_int *matchrec, wg_int reclen);
 wg_int wg_create_multi_index(void *db, wg_int *columns, wg_int col_count,
   wg_int type, wg_int *matchrec, wg_int reclen);
+wg_int wg_create_covering_index(void *db, wg_int *columns, wg_int col_count,
+  wg_int *include, wg_int include_count, wg_int type, wg_int *matchrec,
+  wg_int reclen);
 wg_int wg_drop_index(void *db, wg_int index_id);
 wg_int wg_column_to_index_id(void *db, wg_int column, wg_int type,
   wg_int *matchrec, wg_int reclen);
@@ -56,6 +76,15 @@ wg_int wg_multi_column_to_index_id(void *db, wg_int *columns,
 wg_int wg_get_index_type(void *db, wg_int index_id);
 void * wg_get_index_template(void *db, wg_int index_id, wg_int *reclen);
 void * wg_get_all_indexes(void *db, wg_int *count);
+wg_int wg_defer_indexes(void *db, wg_int defer);
+wg_int wg_flush_indexes(void *db);
+wg_int wg_start_index_build(void *db, wg_int *columns, wg_int col_count,
+  wg_int *include, wg_int include_count, wg_int type, wg_int *matchrec,
+  wg_int reclen);
+wg_int wg_continue_index_build(void *db, wg_int index_id, wg_int rows);
+wg_int wg_index_build_progress(void *db, wg_int index_id);
+wg_int wg_get_index_stats(void *db, wg_int index_id, wg_index_stats *stats);
+wg_int wg_refresh_index_stats(void *db, wg_int index_id);
 
 #ifdef __cplusplus
 }
@@ -662,6 +662,7 @@ static wg_int encode_incomp(void* db, char* incomp) {
   else if (!strcmp(incomp,"greater"))  return WG_COND_GREATER;
   else if (!strcmp(incomp,"ltequal"))  return WG_COND_LTEQUAL;
   else if (!strcmp(incomp,"gtequal"))  return WG_COND_GTEQUAL;
+  else if (!strcmp(incomp,"contains"))  return WG_COND_CONTAINS;
   else err_clear_detach_halt(db,0,COND_ERR);
   return WG_COND_EQUAL; // this return never happens
 }
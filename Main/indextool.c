@@ -56,8 +56,10 @@ extern "C" {
 
 /* ======= Private protos ================ */
 
-void print_tree(void *db, FILE *file, struct wg_tnode *node, int col);
-int log_tree(void *db, char *file, struct wg_tnode *node, int col);
+void print_tree(void *db, FILE *file, struct wg_tnode *node, int col,
+  int multi);
+int log_tree(void *db, char *file, struct wg_tnode *node, int col,
+  int multi);
 void dump_hash(void *db, FILE *file, db_hash_area_header *ha);
 wg_index_header *get_index_by_id(void *db, gint index_id);
 
@@ -115,7 +117,7 @@ int main(int argc, char **argv) {
         }
         log_tree(db, a,
           (struct wg_tnode *) offsettoptr(db, TTREE_ROOT_NODE(hdr)),
-          hdr->rec_field_index[0]);
+          hdr->rec_field_index[0], (hdr->fields > 1));
       }
       else {
         fprintf(stderr, "Invalid index id.\n");
@@ -163,9 +165,17 @@ int main(int argc, char **argv) {
   return 0;
 }
 
-void print_tree(void *db, FILE *file, struct wg_tnode *node, int col){
+void print_tree(void *db, FILE *file, struct wg_tnode *node, int col,
+  int multi){
   int i;
   char strbuf[256];
+  wg_int minval = node->current_min, maxval = node->current_max;
+
+  /* composite index keys are record offsets, show the leading column */
+  if(multi && minval != WG_ILLEGAL) {
+    minval = wg_get_field(db, offsettoptr(db, minval), col);
+    maxval = wg_get_field(db, offsettoptr(db, maxval), col);
+  }
 
   fprintf(file,"<node offset = \"%d\">\n", (int) ptrtooffset(db, node));
   fprintf(file,"<data_count>%d",node->number_of_elements);
@@ -178,9 +188,9 @@ void print_tree(void *db, FILE *file, struct wg_tnode *node, int col){
   fprintf(file,"<successor>%d</successor>\n", (int) node->succ_offset);
   fprintf(file,"<predecessor>%d</predecessor>\n", (int) node->pred_offset);
 #endif
-  wg_snprint_value(db, node->current_min, strbuf, 255);
+  wg_snprint_value(db, minval, strbuf, 255);
   fprintf(file,"<min_max>%s ",strbuf);
-  wg_snprint_value(db, node->current_max, strbuf, 255);
+  wg_snprint_value(db, maxval, strbuf, 255);
   fprintf(file,"%s</min_max>\n",strbuf);
   fprintf(file,"<data>");
   for(i=0;i<node->number_of_elements;i++){
@@ -195,27 +205,28 @@ void print_tree(void *db, FILE *file, struct wg_tnode *node, int col){
   if(node->left_child_offset == 0)fprintf(file,"null");
   else{
     print_tree(db,file,
-      (struct wg_tnode *) offsettoptr(db,node->left_child_offset),col);
+      (struct wg_tnode *) offsettoptr(db,node->left_child_offset),col,multi);
   }
   fprintf(file,"</left_child>\n");
   fprintf(file,"<right_child>\n");
   if(node->right_child_offset == 0)fprintf(file,"null");
   else{
     print_tree(db,file,
-      (struct wg_tnode *) offsettoptr(db,node->right_child_offset),col);
+      (struct wg_tnode *) offsettoptr(db,node->right_child_offset),col,multi);
   }
   fprintf(file,"</right_child>\n");
   fprintf(file,"</node>\n");
 }
 
-int log_tree(void *db, char *file, struct wg_tnode *node, int col){
+int log_tree(void *db, char *file, struct wg_tnode *node, int col,
+  int multi){
 #ifdef _WIN32
   FILE *filee;
   fopen_s(&filee, file, "w");
 #else
   FILE *filee = fopen(file,"w");
 #endif
-  print_tree(db,filee,node,col);
+  print_tree(db,filee,node,col,multi);
   fflush(filee);
   fclose(filee);
   return 0;
@@ -112,13 +112,15 @@ gint parse_flag(char *arg);
 int parse_memmode(char *arg);
 wg_query_arg *make_arglist(void *db, char **argv, int argc, int *sz);
 void free_arglist(void *db, wg_query_arg *arglist, int sz);
-void query(void *db, char **argv, int argc);
+void query(void *db, char **argv, int argc, int explain);
+void print_query_plan(void *db, wg_query_explain *explain);
 void del(void *db, char **argv, int argc);
 void selectdata(void *db, int howmany, int startingat);
 int add_row(void *db, char **argv, int argc);
 wg_json_query_arg *make_json_arglist(void *db, char *json, int *sz,
  void **doc);
 void findjson(void *db, char *json);
+int parse_columns(char **argv, int argc, gint *cols);
 void segment_stats(void *db);
 void print_indexes(void *db, FILE *f);
 
@@ -168,13 +170,20 @@ void usage(char *prog) {
   printf("    info - print information about the memory database.\n"\
     "    add <value1> .. - store data row (only int or str recognized)\n"\
     "    select <number of rows> [start from] - print db contents.\n"\
-    "    query <col> \"<cond>\" <value> .. - basic query.\n"\
+    "    query [--explain] <col> \"<cond>\" <value> .. - basic query "\
+    "(--explain: show the plan and the execution counters).\n"\
     "    del <col> \"<cond>\" <value> .. - like query. Matching rows "\
     "are deleted from database.\n"\
     "    addjson [filename] - store a json document.\n"\
     "    findjson <json> - find documents with matching keys/values.\n"\
-    "    createindex <column> - create ttree index\n" \
+    "    createindex <columns> - create ttree index (composite, if "\
+    "several columns)\n" \
     "    createhash <columns> - create hash index (JSON support)\n" \
+    "    createpath - create JSON path index for document queries\n" \
+    "    createbitmap <column> - create bitmap index\n" \
+    "    createtrigram <column> - create trigram (substring) index\n" \
+    "    creatertree <columns> - create R-tree index (box queries on "\
+    "numeric columns)\n" \
     "    dropindex <index id> - delete an index\n" \
     "    listindex - list all indexes in database\n");
 #ifdef _WIN32
@@ -639,13 +648,18 @@ int main(int argc, char **argv) {
       break;
     }
     else if(argc>(i+3) && !strcmp(argv[i],"query")) {
+      int explain = !strcmp(argv[i+1], "--explain");
+      if(explain && argc<=(i+4)) {
+        fprintf(stderr, "Missing query parameters.\n");
+        exit(1);
+      }
       shmptr=wg_attach_existing_database(shmname);
       if(!shmptr) {
         fprintf(stderr, "Failed to attach to database.\n");
         exit(1);
       }
       /* Query handles it's own locking */
-      query(shmptr, argv+i+1, argc-i-1);
+      query(shmptr, argv+i+1+explain, argc-i-1-explain, explain);
       break;
     }
     else if(argc>i && !strcmp(argv[i],"addjson")){
@@ -682,45 +696,103 @@ int main(int argc, char **argv) {
       break;
     }
     else if(argc>(i+1) && !strcmp(argv[i], "createindex")) {
-      int col;
+      gint cols[MAX_INDEX_FIELDS], col_count;
+      col_count = parse_columns(&argv[i+1], argc-i-1, cols);
+      if(col_count < 0)
+        break;
       shmptr = (void *) wg_attach_database(shmname, shmsize);
       if(!shmptr) {
         fprintf(stderr, "Failed to attach to database.\n");
         exit(1);
       }
-      sscanf(argv[i+1], "%d", &col);
       WLOCK(shmptr, wlock);
-      wg_create_index(shmptr, col, WG_INDEX_TYPE_TTREE, NULL, 0);
+      wg_create_multi_index(shmptr, cols, col_count,
+        WG_INDEX_TYPE_TTREE, NULL, 0);
       WULOCK(shmptr, wlock);
       break;
     }
     else if(argc>(i+1) && !strcmp(argv[i], "createhash")) {
-      gint cols[MAX_INDEX_FIELDS], col_count, j;
+      gint cols[MAX_INDEX_FIELDS], col_count;
+      col_count = parse_columns(&argv[i+1], argc-i-1, cols);
+      if(col_count < 0)
+        break;
       shmptr = (void *) wg_attach_database(shmname, shmsize);
       if(!shmptr) {
         fprintf(stderr, "Failed to attach to database.\n");
         exit(1);
       }
-      col_count = 0;
-      for(j = i+1; j<argc; j++) {
-        int col;
-        sscanf(argv[j], "%d", &col);
-        cols[col_count++] = col;
-      }
       WLOCK(shmptr, wlock);
       wg_create_multi_index(shmptr, cols, col_count,
         WG_INDEX_TYPE_HASH_JSON, NULL, 0);
       WULOCK(shmptr, wlock);
       break;
     }
+    else if(!strcmp(argv[i], "createpath")) {
+      shmptr = (void *) wg_attach_database(shmname, shmsize);
+      if(!shmptr) {
+        fprintf(stderr, "Failed to attach to database.\n");
+        exit(1);
+      }
+      WLOCK(shmptr, wlock);
+      wg_create_index(shmptr, 0, WG_INDEX_TYPE_HASH_PATH, NULL, 0);
+      WULOCK(shmptr, wlock);
+      break;
+    }
+    else if(argc>(i+1) && !strcmp(argv[i], "createbitmap")) {
+      gint col;
+      if(parse_columns(&argv[i+1], 1, &col) < 0)
+        break;
+      shmptr = (void *) wg_attach_database(shmname, shmsize);
+      if(!shmptr) {
+        fprintf(stderr, "Failed to attach to database.\n");
+        exit(1);
+      }
+      WLOCK(shmptr, wlock);
+      wg_create_index(shmptr, col, WG_INDEX_TYPE_BITMAP, NULL, 0);
+      WULOCK(shmptr, wlock);
+      break;
+    }
+    else if(argc>(i+1) && !strcmp(argv[i], "createtrigram")) {
+      gint col;
+      if(parse_columns(&argv[i+1], 1, &col) < 0)
+        break;
+      shmptr = (void *) wg_attach_database(shmname, shmsize);
+      if(!shmptr) {
+        fprintf(stderr, "Failed to attach to database.\n");
+        exit(1);
+      }
+      WLOCK(shmptr, wlock);
+      wg_create_index(shmptr, col, WG_INDEX_TYPE_TRIGRAM, NULL, 0);
+      WULOCK(shmptr, wlock);
+      break;
+    }
+    else if(argc>(i+1) && !strcmp(argv[i], "creatertree")) {
+      gint cols[MAX_INDEX_FIELDS], col_count;
+      col_count = parse_columns(&argv[i+1], argc-i-1, cols);
+      if(col_count < 0)
+        break;
+      shmptr = (void *) wg_attach_database(shmname, shmsize);
+      if(!shmptr) {
+        fprintf(stderr, "Failed to attach to database.\n");
+        exit(1);
+      }
+      WLOCK(shmptr, wlock);
+      wg_create_multi_index(shmptr, cols, col_count,
+        WG_INDEX_TYPE_RTREE, NULL, 0);
+      WULOCK(shmptr, wlock);
+      break;
+    }
     else if(argc>(i+1) && !strcmp(argv[i], "dropindex")) {
       int index_id;
+      if(sscanf(argv[i+1], "%d", &index_id) != 1) {
+        fprintf(stderr, "Invalid index id: %s\n", argv[i+1]);
+        break;
+      }
       shmptr = (void *) wg_attach_database(shmname, shmsize);
       if(!shmptr) {
         fprintf(stderr, "Failed to attach to database.\n");
         exit(1);
       }
-      sscanf(argv[i+1], "%d", &index_id);
       WLOCK(shmptr, wlock);
       if(wg_drop_index(shmptr, index_id))
         fprintf(stderr, "Failed to drop index.\n");
@@ -807,6 +879,10 @@ wg_query_arg *make_arglist(void *db, char **argv, int argc, int *sz) {
         arglist[i].cond = WG_COND_LESSTHAN;
     else if(!strncmp(cond, ">", 1))
         arglist[i].cond = WG_COND_GREATER;
+    else if(!strcmp(cond, "contains"))
+        arglist[i].cond = WG_COND_CONTAINS;
+    else if(!strcmp(cond, "prefix"))
+        arglist[i].cond = WG_COND_PREFIX;
     else {
       fprintf(stderr, "invalid condition %s\n", cond);
       free_arglist(db, arglist, qargc);
@@ -833,12 +909,15 @@ void free_arglist(void *db, wg_query_arg *arglist, int sz) {
 }
 
 /** Basic query functionality
+ *  If explain is set, the query plan is printed before the rows
+ *  and the execution counters after them.
  */
-void query(void *db, char **argv, int argc) {
+void query(void *db, char **argv, int argc, int explain) {
   int qargc;
   void *rec = NULL;
   wg_query *q;
   wg_query_arg *arglist;
+  wg_query_explain plan;
   gint lock_id;
 
   arglist = make_arglist(db, argv, argc, &qargc);
@@ -850,6 +929,12 @@ void query(void *db, char **argv, int argc) {
     goto abrt1;
   }
 
+  if(explain) {
+    if(wg_explain_query(db, NULL, 0, arglist, qargc, &plan))
+      goto abrt2;
+    print_query_plan(db, &plan);
+  }
+
   q = wg_make_query(db, NULL, 0, arglist, qargc);
   if(!q)
     goto abrt2;
@@ -862,6 +947,12 @@ void query(void *db, char **argv, int argc) {
     rec = wg_fetch(db, q);
   }
 
+  if(explain) {
+    printf("rows examined: %d, matched: %d, returned: %d, "\
+      "T-tree nodes: %d, time: %.6f s\n", (int) q->stats.examined,
+      (int) q->stats.matched, (int) q->stats.returned,
+      (int) q->stats.tnodes, q->stats.time);
+  }
   wg_free_query(db, q);
 abrt2:
   wg_end_read(db, lock_id);
@@ -869,6 +960,39 @@ abrt1:
   free_arglist(db, arglist, qargc);
 }
 
+/** Print the plan of a query (see wg_explain_query())
+ */
+void print_query_plan(void *db, wg_query_explain *explain) {
+  static const char *plans[] = { "full scan", "T-tree range",
+    "hash lookup", "index intersection", "bitmap", "R-tree box",
+    "T-tree probes" };
+  wg_query_plan *plan = &explain->plan;
+  char buf[80];
+  int i;
+
+  printf("plan: %s", (plan->type >= 0 && plan->type <= WG_QPLAN_PROBE ?
+    plans[plan->type] : "unknown"));
+  for(i=0; i<plan->count; i++) {
+    printf("%s%d (type %d)", (i ? ", " : ", indexes "),
+      (int) plan->index_id[i], (int) explain->index_type[i]);
+  }
+  printf("\n");
+  if(explain->column != -1) {
+    printf("range on column %d: ", (int) explain->column);
+    if(explain->start_bound != WG_ILLEGAL) {
+      wg_snprint_value(db, explain->start_bound, buf, 79);
+      printf("%s%s", (explain->start_inclusive ? "[" : "("), buf);
+    } else
+      printf("(-");
+    if(explain->end_bound != WG_ILLEGAL) {
+      wg_snprint_value(db, explain->end_bound, buf, 79);
+      printf(" .. %s%s\n", buf, (explain->end_inclusive ? "]" : ")"));
+    } else
+      printf(" .. -)\n");
+  }
+  printf("estimated rows: %.1f, cost: %.1f\n", plan->rows, plan->cost);
+}
+
 /** Delete rows
  *  Like query(), except the selected rows are deleted.
  */
@@ -1012,6 +1136,23 @@ wg_json_query_arg *make_json_arglist(void *db, char *json, int *sz,
   return arglist;
 }
 
+/** Parse the column numbers of an index command
+ *  At most MAX_INDEX_FIELDS columns are read from argv.
+ *  returns the number of columns, -1 if an argument is not a number.
+ */
+int parse_columns(char **argv, int argc, gint *cols) {
+  int i;
+  for(i=0; i<argc && i<MAX_INDEX_FIELDS; i++) {
+    int col;
+    if(sscanf(argv[i], "%d", &col) != 1 || col < 0) {
+      fprintf(stderr, "Invalid column number: %s\n", argv[i]);
+      return -1;
+    }
+    cols[i] = col;
+  }
+  return i;
+}
+
 /** JSON query
  */
 void findjson(void *db, char *json) {
@@ -1103,7 +1244,7 @@ void print_indexes(void *db, FILE *f) {
     return;
   }
   else {
-    fprintf(f, "col\ttype\tmulti\tid\tmask\n");
+    fprintf(f, "col\ttype\tmulti\tid\tmask\trows\tdistinct\tnulls\n");
   }
 
   for(column=0; column<=MAX_INDEXED_FIELDNR; column++) {
@@ -1112,6 +1253,7 @@ void print_indexes(void *db, FILE *f) {
       gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
       if(ilistelem->car) {
         char typestr[3];
+        wg_index_stats stats;
         wg_index_header *hdr = \
           (wg_index_header *) offsettoptr(db, ilistelem->car);
         typestr[2] = '\0';
@@ -1132,10 +1274,22 @@ void print_indexes(void *db, FILE *f) {
             typestr[0] = '#';
             typestr[1] = 'J';
             break;
+          case WG_INDEX_TYPE_BITMAP:
+            typestr[0] = 'B';
+            typestr[1] = '\0';
+            break;
+          case WG_INDEX_TYPE_TRIGRAM:
+            typestr[0] = 'S';
+            typestr[1] = '\0';
+            break;
+          case WG_INDEX_TYPE_RTREE:
+            typestr[0] = 'R';
+            typestr[1] = '\0';
+            break;
           default:
             break;
         }
-        fprintf(f, "%d\t%s\t%d\t%d\t%s\n",
+        fprintf(f, "%d\t%s\t%d\t%d\t%s",
           column,
           typestr,
           (int) hdr->fields,
@@ -1145,10 +1299,30 @@ void print_indexes(void *db, FILE *f) {
 #else
           (hdr->template_offset ? "Y" : "N"));
 #endif
+        if(!wg_get_index_stats(db, ilistelem->car, &stats)) {
+          fprintf(f, "\t%d\t%d\t%.2f",
+            (int) stats.rows,
+            (int) stats.distinct,
+            (stats.rows ? (double) stats.nulls / stats.rows : 0.0));
+        }
+        fprintf(f, "\n");
       }
       ilist = &ilistelem->cdr;
     }
   }
+
+  /* JSON path index is not in the column lists */
+  ilist = &dbh->index_control_area_header.index_path_list;
+  while(*ilist) {
+    gcell *ilistelem = (gcell *) offsettoptr(db, *ilist);
+    fprintf(f, "%d\t%s\t%d\t%d\t%s\n", 0, "P", 1, (int) ilistelem->car,
+#ifndef USE_INDEX_TEMPLATE
+      "-");
+#else
+      "N");
+#endif
+    ilist = &ilistelem->cdr;
+  }
 }
 
 
@@ -359,6 +359,125 @@ class QueryTests(LowLevelQueryTest):
         # Database scan
         self.check_db_rows(dbsize * (50 * 50 - 10 * 40))
 
+    def test_fetch_many(self):
+        """Tests fetching rows in batches. The rows should be the
+        same as the ones returned by fetch()."""
+
+        self.make_testdata(2)
+        arglist = [(1, wgdb.COND_LESSTHAN, 1000)]
+
+        expected = []
+        query = wgdb.make_query(self.d, arglist = arglist)
+        rec = self.fetch(query)
+        while rec is not None:
+            expected.append(wgdb.get_field(self.d, rec, 2))
+            rec = self.fetch(query)
+        self.assertEqual(len(expected), 2 * 10 * 50)
+
+        for count in (1, 7, 2000):
+            query = wgdb.make_query(self.d, arglist = arglist)
+            rows = []
+            batch = wgdb.fetch_many(self.d, query, count)
+            while batch:
+                self.assertTrue(len(batch) <= count)
+                rows.extend([ wgdb.get_field(self.d, rec, 2) \
+                    for rec in batch ])
+                batch = wgdb.fetch_many(self.d, query, count)
+            self.assertEqual(rows, expected)
+
+    def test_explain(self):
+        """Tests the query plan description and the execution
+        counters of the query."""
+
+        self.make_testdata(1)
+        arglist = [(1, wgdb.COND_GREATER, 4000),
+            (1, wgdb.COND_LTEQUAL, 4500)]
+
+        plan = wgdb.explain_query(self.d, arglist = arglist)
+        self.assertEqual(plan["type"], wgdb.QPLAN_SCAN)
+        self.assertEqual(plan["column"], -1)
+        self.assertEqual(plan["indexes"], [])
+        self.assertEqual(plan["start"], None)
+
+        wgdb.createindex(self.d, 1)
+        plan = wgdb.explain_query(self.d, arglist = arglist)
+        self.assertEqual(plan["type"], wgdb.QPLAN_TTREE)
+        self.assertEqual(plan["column"], 1)
+        self.assertEqual(len(plan["indexes"]), 1)
+        self.assertEqual(plan["start"], 4000)
+        self.assertFalse(plan["start_inclusive"])
+        self.assertEqual(plan["end"], 4500)
+        self.assertTrue(plan["end_inclusive"])
+
+        query = wgdb.make_query(self.d, arglist = arglist)
+        cnt = 0
+        while self.fetch(query) is not None:
+            cnt += 1
+        self.assertEqual(cnt, 5 * 50)
+        stats = query.stats
+        self.assertEqual(stats["returned"], cnt)
+        self.assertEqual(stats["matched"], cnt)
+        self.assertEqual(stats["examined"], cnt)
+        self.assertTrue(stats["tnodes"] > 0)
+        self.assertTrue(stats["time"] >= 0)
+
+    def test_count(self):
+        """Tests counting the rows of a query"""
+
+        self.make_testdata(1)
+        arglist = [(1, wgdb.COND_GREATER, 4000),
+            (1, wgdb.COND_LTEQUAL, 4500)]
+        self.assertEqual(wgdb.query_count(self.d, arglist = arglist), 5 * 50)
+        self.assertTrue(wgdb.query_exists(self.d, arglist = arglist))
+
+        wgdb.createindex(self.d, 1)
+        self.assertEqual(wgdb.query_count(self.d, arglist = arglist), 5 * 50)
+        arglist = [(1, wgdb.COND_GREATER, 100000)]
+        self.assertEqual(wgdb.query_count(self.d, arglist = arglist), 0)
+        self.assertFalse(wgdb.query_exists(self.d, arglist = arglist))
+
+    def test_prefix(self):
+        """Tests string prefix conditions with and without an index"""
+
+        self.make_testdata(3)
+        for index in (False, True):
+            if index:
+                wgdb.createindex(self.d, 0)
+            for prefix, expected in (("1", 50*50), ("", 3*50*50),
+                ("3", 0), ("10", 50*50), ("100", 0)):
+                arglist = [(0, wgdb.COND_PREFIX, prefix)]
+                self.assertEqual(wgdb.query_count(self.d,
+                    arglist = arglist), expected)
+
+    def test_skip(self):
+        """Tests skipping rows of a query. The rows after the
+        skipped ones should be the same as without skipping."""
+
+        self.make_testdata(1)
+        arglist = [(1, wgdb.COND_GREATER, 4000)]
+
+        for index in (False, True):
+            if index:
+                wgdb.createindex(self.d, 1)
+            query = wgdb.make_query(self.d, arglist = arglist)
+            expected = wgdb.fetch_many(self.d, query, 9 * 50)
+            self.assertEqual(len(expected), 9 * 50)
+
+            # exec_query() reads the index range in place, so the
+            # skipped rows are not fetched
+            for make in (wgdb.make_query, wgdb.exec_query):
+                query = make(self.d, arglist = arglist)
+                self.assertEqual(wgdb.skip(self.d, query, 123), 123)
+                rows = wgdb.fetch_many(self.d, query, 10)
+                self.assertEqual([ wgdb.get_field(self.d, rec, 1) \
+                    for rec in rows ], [ wgdb.get_field(self.d, rec, 1) \
+                    for rec in expected[123:133] ])
+                if index and make == wgdb.exec_query:
+                    self.assertEqual(query.stats["examined"], 10)
+                self.assertEqual(wgdb.skip(self.d, query, 1000),
+                    9 * 50 - 133)
+                self.assertEqual(wgdb.fetch_many(self.d, query, 10), [])
+
 class QueryParamTests(LowLevelQueryTest):
     """Test query parameter encoding through the wgdb module"""
 
@@ -782,7 +901,7 @@ class WhiteDBCursor(WhiteDBTest):
         self.assertEqual(self.count_results(cur), 5)
 
     def test_fetch(self):
-        """Test the fetchall() and fetchone() functions"""
+        """Test the fetchall(), fetchmany() and fetchone() functions"""
 
         self.make_testdata()
         cur = self.d.cursor()
@@ -807,6 +926,15 @@ class WhiteDBCursor(WhiteDBTest):
             row = cur.fetchone()
         self.assertEqual(cnt, 8)
 
+        cur.execute(arglist = [(3, wgdb.COND_NOT_EQUAL, 9286)])
+        self.assertEqual(len(cur.fetchmany()), 1)
+        rows = cur.fetchmany(5)
+        self.assertEqual(len(rows), 5)
+        for row in rows:
+            self.assertNotEqual(row[3], 9286)
+        self.assertEqual(len(cur.fetchmany(5)), 2)
+        self.assertEqual(cur.fetchmany(5), [])
+
         cur.execute(arglist = [(3, wgdb.COND_NOT_EQUAL, 9286)])
         cur.close()
         with self.assertRaises(whitedb.ProgrammingError):
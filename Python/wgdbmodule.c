@@ -68,6 +68,7 @@ typedef struct {
 typedef struct {
   PyObject_HEAD
   wg_query *query;
+  wg_prepared_query *prepared; /* set if the query is run by exec_query() */
   wg_database *db;
   wg_query_arg *arglist;
   int argc;
@@ -135,6 +136,8 @@ static PyObject *wgdb_set_field(PyObject *self, PyObject *args,
 static PyObject *wgdb_set_new_field(PyObject *self, PyObject *args,
                                         PyObject *kwds);
 static PyObject *wgdb_get_field(PyObject *self, PyObject *args);
+static PyObject *decode_pyobject(PyObject *self, PyObject *db,
+  wg_int fdata);
 
 static PyObject *wgdb_start_write(PyObject *self, PyObject *args);
 static PyObject *wgdb_end_write(PyObject *self, PyObject *args);
@@ -145,7 +148,19 @@ static int parse_query_params(PyObject *self, PyObject *args,
                                     PyObject *kwds, wg_query_ob *query);
 static PyObject * wgdb_make_query(PyObject *self, PyObject *args,
                                         PyObject *kwds);
+static PyObject * wgdb_exec_query(PyObject *self, PyObject *args,
+                                        PyObject *kwds);
+static PyObject * wgdb_explain_query(PyObject *self, PyObject *args,
+                                        PyObject *kwds);
+static PyObject * count_query(PyObject *self, PyObject *args,
+                                        PyObject *kwds, int exists);
+static PyObject * wgdb_query_count(PyObject *self, PyObject *args,
+                                        PyObject *kwds);
+static PyObject * wgdb_query_exists(PyObject *self, PyObject *args,
+                                        PyObject *kwds);
 static PyObject * wgdb_fetch(PyObject *self, PyObject *args);
+static PyObject * wgdb_fetch_many(PyObject *self, PyObject *args);
+static PyObject * wgdb_skip(PyObject *self, PyObject *args);
 static PyObject * wgdb_free_query(PyObject *self, PyObject *args);
 static void free_query(wg_query_ob *obj);
 
@@ -157,6 +172,7 @@ static PyObject *wg_query_repr(wg_query_ob *obj);
 static PyObject *wg_query_get_res_count(wg_query_ob *obj, void *closure);
 static int wg_query_set_res_count(wg_query_ob *obj,
                                       PyObject *value, void *closure);
+static PyObject *wg_query_get_stats(wg_query_ob *obj, void *closure);
 static void wgdb_error_setstring(PyObject *self, char *err);
 
 /* ============= Private vars ============ */
@@ -233,6 +249,11 @@ static PyGetSetDef wg_query_getset[] = {
    (setter) wg_query_set_res_count,
    "Number of rows in the result set",  /* doc */
    NULL},                               /* closure, not used here */
+  {"stats",
+   (getter) wg_query_get_stats,
+   NULL,                                /* read only */
+   "Execution counters of the query",
+   NULL},
   {NULL}
 };
 
@@ -326,8 +347,24 @@ static PyMethodDef wgdb_methods[] = {
   {"make_query",  (PyCFunction) wgdb_make_query,
    METH_VARARGS | METH_KEYWORDS,
    "Create a query object."},
+  {"exec_query",  (PyCFunction) wgdb_exec_query,
+   METH_VARARGS | METH_KEYWORDS,
+   "Create a query object that reads the rows without collecting them."},
+  {"explain_query",  (PyCFunction) wgdb_explain_query,
+   METH_VARARGS | METH_KEYWORDS,
+   "Describe the plan of a query without running it."},
+  {"query_count",  (PyCFunction) wgdb_query_count,
+   METH_VARARGS | METH_KEYWORDS,
+   "Count the rows that match a query."},
+  {"query_exists",  (PyCFunction) wgdb_query_exists,
+   METH_VARARGS | METH_KEYWORDS,
+   "Check if any row matches a query."},
   {"fetch",  wgdb_fetch, METH_VARARGS,
    "Fetch next record from a query."},
+  {"fetch_many",  wgdb_fetch_many, METH_VARARGS,
+   "Fetch a list of next records from a query."},
+  {"skip",  wgdb_skip, METH_VARARGS,
+   "Skip next records of a query."},
   {"free_query",  wgdb_free_query, METH_VARARGS,
    "Unallocates the memory (local and shared) used by the query."},
   {"start_logging",  wgdb_start_logging, METH_VARARGS,
@@ -1374,7 +1411,7 @@ static PyObject *wgdb_set_new_field(PyObject *self, PyObject *args,
 
 static PyObject *wgdb_get_field(PyObject *self, PyObject *args) {
   PyObject *db = NULL, *rec = NULL;
-  wg_int fieldnr, fdata, ftype;
+  wg_int fieldnr, fdata;
 
   if(!PyArg_ParseTuple(args, "O!O!n", &wg_database_type, &db,
       &wg_record_type, &rec, &fieldnr))
@@ -1390,6 +1427,15 @@ static PyObject *wgdb_get_field(PyObject *self, PyObject *args) {
     return NULL;
   }
 
+  return decode_pyobject(self, db, fdata);
+}
+
+/** Convert an encoded value to a Python object
+ */
+static PyObject *decode_pyobject(PyObject *self, PyObject *db,
+  wg_int fdata) {
+  wg_int ftype;
+
   /* Decode the type */
   ftype = wg_get_encoded_type(((wg_database *) db)->db, fdata);
   if(!ftype) {
@@ -1747,6 +1793,7 @@ static PyObject * wgdb_make_query(PyObject *self, PyObject *args,
   if(!query) return NULL;
 
   query->query = NULL;
+  query->prepared = NULL;
   query->db = NULL;
   query->arglist = NULL;
   query->argc = 0;
@@ -1771,6 +1818,193 @@ static PyObject * wgdb_make_query(PyObject *self, PyObject *args,
   return (PyObject *) query;
 }
 
+/** Create a query object that is not prefetched.
+ *  Python wrapper to wg_prepare_query() and wg_exec_query(). The rows
+ *  are read from the index or the table as they are fetched, so
+ *  skip() can use the T-tree positions. The rows must not be changed
+ *  while the query is in use.
+ */
+
+static PyObject * wgdb_exec_query(PyObject *self, PyObject *args,
+                                        PyObject *kwds) {
+  wg_query_ob *query;
+
+  /* Build a new query object */
+  query = (wg_query_ob *) wg_query_type.tp_alloc(&wg_query_type, 0);
+  if(!query) return NULL;
+
+  query->query = NULL;
+  query->prepared = NULL;
+  query->db = NULL;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->matchrec = NULL;
+  query->reclen = 0;
+
+  /* Create the arglist and matchrec from parameters. */
+  if(!parse_query_params(self, args, kwds, query)) {
+    wg_query_dealloc(query);
+    return NULL;
+  }
+
+  query->prepared = wg_prepare_query(query->db->db, query->matchrec,
+    query->reclen, query->arglist, query->argc);
+  if(query->prepared)
+    query->query = wg_exec_query(query->db->db, query->prepared);
+
+  if(!query->query) {
+    wgdb_error_setstring(self, "Failed to create the query.");
+    wg_query_dealloc(query);
+    return NULL;
+  }
+  return (PyObject *) query;
+}
+
+/** Explain a query without running it.
+ *  Python wrapper to wg_explain_query(). Takes the same parameters
+ *  as make_query() and returns a dictionary describing the plan.
+ */
+
+static PyObject * wgdb_explain_query(PyObject *self, PyObject *args,
+                                        PyObject *kwds) {
+  wg_query_ob *query;
+  wg_query_explain explain;
+  PyObject *res = NULL, *indexes, *types, *start, *end;
+  int i;
+
+  /* Temporary query object holds the encoded parameters */
+  query = (wg_query_ob *) wg_query_type.tp_alloc(&wg_query_type, 0);
+  if(!query) return NULL;
+
+  query->query = NULL;
+  query->prepared = NULL;
+  query->db = NULL;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->matchrec = NULL;
+  query->reclen = 0;
+
+  if(!parse_query_params(self, args, kwds, query)) {
+    wg_query_dealloc(query);
+    return NULL;
+  }
+
+  if(wg_explain_query(query->db->db, query->matchrec, query->reclen,
+    query->arglist, query->argc, &explain)) {
+    wgdb_error_setstring(self, "Failed to explain the query.");
+    wg_query_dealloc(query);
+    return NULL;
+  }
+
+  indexes = PyList_New(explain.plan.count);
+  types = PyList_New(explain.plan.count);
+  if(indexes && types) {
+    for(i=0; i<explain.plan.count; i++) {
+      PyList_SET_ITEM(indexes, i,
+        Py_BuildValue("n", explain.plan.index_id[i]));
+      PyList_SET_ITEM(types, i, Py_BuildValue("n", explain.index_type[i]));
+    }
+
+    /* The bounds are decoded while the parameters still exist */
+    if(explain.start_bound != WG_ILLEGAL)
+      start = decode_pyobject(self, (PyObject *) query->db,
+        explain.start_bound);
+    else {
+      Py_INCREF(Py_None);
+      start = Py_None;
+    }
+    if(explain.end_bound != WG_ILLEGAL)
+      end = decode_pyobject(self, (PyObject *) query->db,
+        explain.end_bound);
+    else {
+      Py_INCREF(Py_None);
+      end = Py_None;
+    }
+
+    if(start && end) {
+      res = Py_BuildValue("{s:n,s:O,s:O,s:n,s:O,s:O,s:O,s:O,s:d,s:d}",
+        "type", explain.plan.type,
+        "indexes", indexes,
+        "index_types", types,
+        "column", explain.column,
+        "start", start,
+        "end", end,
+        "start_inclusive", (explain.start_inclusive ? Py_True : Py_False),
+        "end_inclusive", (explain.end_inclusive ? Py_True : Py_False),
+        "rows", explain.plan.rows,
+        "cost", explain.plan.cost);
+    }
+    Py_XDECREF(start);
+    Py_XDECREF(end);
+  }
+  Py_XDECREF(indexes);
+  Py_XDECREF(types);
+  wg_query_dealloc(query);
+  return res;
+}
+
+/** Count the rows of a query or check if there are any.
+ *  Common part of query_count() and query_exists().
+ */
+
+static PyObject * count_query(PyObject *self, PyObject *args,
+                                        PyObject *kwds, int exists) {
+  wg_query_ob *query;
+  wg_int res;
+
+  /* Temporary query object holds the encoded parameters */
+  query = (wg_query_ob *) wg_query_type.tp_alloc(&wg_query_type, 0);
+  if(!query) return NULL;
+
+  query->query = NULL;
+  query->prepared = NULL;
+  query->db = NULL;
+  query->arglist = NULL;
+  query->argc = 0;
+  query->matchrec = NULL;
+  query->reclen = 0;
+
+  if(!parse_query_params(self, args, kwds, query)) {
+    wg_query_dealloc(query);
+    return NULL;
+  }
+
+  if(exists)
+    res = wg_query_exists(query->db->db, query->matchrec, query->reclen,
+      query->arglist, query->argc);
+  else
+    res = wg_query_count(query->db->db, query->matchrec, query->reclen,
+      query->arglist, query->argc);
+  wg_query_dealloc(query);
+  if(res < 0) {
+    wgdb_error_setstring(self, "Failed to run the query.");
+    return NULL;
+  }
+  if(exists)
+    return PyBool_FromLong((long) res);
+  return Py_BuildValue("n", res);
+}
+
+/** Count the rows that match a query.
+ *  Python wrapper to wg_query_count(). Takes the same parameters
+ *  as make_query().
+ */
+
+static PyObject * wgdb_query_count(PyObject *self, PyObject *args,
+                                        PyObject *kwds) {
+  return count_query(self, args, kwds, 0);
+}
+
+/** Check if any row matches a query.
+ *  Python wrapper to wg_query_exists(). Takes the same parameters
+ *  as make_query().
+ */
+
+static PyObject * wgdb_query_exists(PyObject *self, PyObject *args,
+                                        PyObject *kwds) {
+  return count_query(self, args, kwds, 1);
+}
+
 /** Fetch next row from a query.
  *  Python wrapper for wg_fetch()
  */
@@ -1799,6 +2033,83 @@ static PyObject * wgdb_fetch(PyObject *self, PyObject *args) {
   return (PyObject *) rec;
 }
 
+/** Fetch next rows from a query.
+ *  Python wrapper for wg_fetch_many()
+ *  Returns a list of at most count records, an empty list if
+ *  there are no more rows.
+ */
+
+static PyObject * wgdb_fetch_many(PyObject *self, PyObject *args) {
+  PyObject *db = NULL, *query = NULL, *list;
+  wg_int count, i, n;
+  void **rows;
+
+  if(!PyArg_ParseTuple(args, "O!O!n", &wg_database_type, &db,
+      &wg_query_type, &query, &count))
+    return NULL;
+  if(count < 0) {
+    wgdb_error_setstring(self, "Invalid number of records.");
+    return NULL;
+  }
+
+  rows = (void **) malloc((count ? count : 1) * sizeof(void *));
+  if(!rows) {
+    wgdb_error_setstring(self, "Failed to allocate memory.");
+    return NULL;
+  }
+  n = wg_fetch_many(((wg_database *) db)->db,
+    ((wg_query_ob *) query)->query, rows, count);
+  if(n < 0) {
+    wgdb_error_setstring(self, "Failed to fetch records.");
+    free(rows);
+    return NULL;
+  }
+
+  list = PyList_New(n);
+  if(!list) {
+    free(rows);
+    return NULL;
+  }
+  for(i=0; i<n; i++) {
+    wg_record *rec = (wg_record *) wg_record_type.tp_alloc(&wg_record_type, 0);
+    if(!rec) {
+      Py_DECREF(list);
+      free(rows);
+      return NULL;
+    }
+    rec->rec = rows[i];
+    PyList_SET_ITEM(list, i, (PyObject *) rec);
+  }
+  free(rows);
+  return list;
+}
+
+/** Skip next rows of a query.
+ *  Python wrapper for wg_query_skip()
+ *  Returns the number of rows skipped.
+ */
+
+static PyObject * wgdb_skip(PyObject *self, PyObject *args) {
+  PyObject *db = NULL, *query = NULL;
+  wg_int count, n;
+
+  if(!PyArg_ParseTuple(args, "O!O!n", &wg_database_type, &db,
+      &wg_query_type, &query, &count))
+    return NULL;
+  if(count < 0) {
+    wgdb_error_setstring(self, "Invalid number of records.");
+    return NULL;
+  }
+
+  n = wg_query_skip(((wg_database *) db)->db,
+    ((wg_query_ob *) query)->query, count);
+  if(n < 0) {
+    wgdb_error_setstring(self, "Failed to skip records.");
+    return NULL;
+  }
+  return Py_BuildValue("n", n);
+}
+
 /** Free query.
  *  Python wrapper to wg_free_query()
  *  In addition, this function frees the local memory for
@@ -1838,7 +2149,9 @@ static void free_query(wg_query_ob *obj) {
      * XXX: this is hacky. db pointer may become significant
      * in the future, which makes this a timebomb.
      */
-    if(obj->query)
+    if(obj->prepared)
+      wg_free_prepared_query(obj->db->db, obj->prepared);
+    else if(obj->query)
       wg_free_query(obj->db->db, obj->query);
 
     if(obj->arglist) {
@@ -1955,6 +2268,21 @@ static PyObject *wg_query_get_res_count(wg_query_ob *obj, void *closure) {
   return Py_None; /* satisfy the compiler */
 }
 
+/** Get the execution counters of a query
+ */
+static PyObject *wg_query_get_stats(wg_query_ob *obj, void *closure) {
+  if(!obj->query) {
+    PyErr_SetString(PyExc_ValueError, "Invalid query object");
+    return NULL;
+  }
+  return Py_BuildValue("{s:n,s:n,s:n,s:n,s:d}",
+    "examined", obj->query->stats.examined,
+    "matched", obj->query->stats.matched,
+    "returned", obj->query->stats.returned,
+    "tnodes", obj->query->stats.tnodes,
+    "time", obj->query->stats.time);
+}
+
 /** Set the number of rows in a query result (not allowed)
  */
 static int wg_query_set_res_count(wg_query_ob *obj,
@@ -2048,6 +2376,17 @@ PyMODINIT_FUNC PyInit_wgdb(void)
   PyModule_AddIntConstant(m, "COND_GREATER", WG_COND_GREATER);
   PyModule_AddIntConstant(m, "COND_LTEQUAL", WG_COND_LTEQUAL);
   PyModule_AddIntConstant(m, "COND_GTEQUAL", WG_COND_GTEQUAL);
+  PyModule_AddIntConstant(m, "COND_CONTAINS", WG_COND_CONTAINS);
+  PyModule_AddIntConstant(m, "COND_PREFIX", WG_COND_PREFIX);
+
+  /* Expose query plan types */
+  PyModule_AddIntConstant(m, "QPLAN_SCAN", WG_QPLAN_SCAN);
+  PyModule_AddIntConstant(m, "QPLAN_TTREE", WG_QPLAN_TTREE);
+  PyModule_AddIntConstant(m, "QPLAN_HASH", WG_QPLAN_HASH);
+  PyModule_AddIntConstant(m, "QPLAN_INTERSECT", WG_QPLAN_INTERSECT);
+  PyModule_AddIntConstant(m, "QPLAN_BITMAP", WG_QPLAN_BITMAP);
+  PyModule_AddIntConstant(m, "QPLAN_RTREE", WG_QPLAN_RTREE);
+  PyModule_AddIntConstant(m, "QPLAN_PROBE", WG_QPLAN_PROBE);
 
   /* Initialize PyDateTime C API */
   PyDateTime_IMPORT;
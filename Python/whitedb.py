@@ -305,6 +305,67 @@ and record accessing functions."""
                 self.end_write()
         return query
 
+    def exec_query(self, matchrec=None, *arg, **kwarg):
+        """Create a query object that reads the rows as they are
+fetched. The rows must not be changed while the query is in use."""
+        if isinstance(matchrec, Record):
+            matchrec = matchrec.get__rec()
+
+        if self.locking:
+            self.start_write() # write lock for parameter encoding
+        try:
+            query = wgdb.exec_query(self._db,
+                matchrec, *arg, **kwarg)
+        finally:
+            if self.locking:
+                self.end_write()
+        return query
+
+    def explain_query(self, matchrec=None, *arg, **kwarg):
+        """Describe the plan of a query without running it."""
+        if isinstance(matchrec, Record):
+            matchrec = matchrec.get__rec()
+
+        if self.locking:
+            self.start_write() # write lock for parameter encoding
+        try:
+            plan = wgdb.explain_query(self._db,
+                matchrec, *arg, **kwarg)
+        finally:
+            if self.locking:
+                self.end_write()
+        return plan
+
+    def query_count(self, matchrec=None, *arg, **kwarg):
+        """Count the rows that match a query."""
+        if isinstance(matchrec, Record):
+            matchrec = matchrec.get__rec()
+
+        if self.locking:
+            self.start_write() # write lock for parameter encoding
+        try:
+            count = wgdb.query_count(self._db,
+                matchrec, *arg, **kwarg)
+        finally:
+            if self.locking:
+                self.end_write()
+        return count
+
+    def query_exists(self, matchrec=None, *arg, **kwarg):
+        """Check if any row matches a query."""
+        if isinstance(matchrec, Record):
+            matchrec = matchrec.get__rec()
+
+        if self.locking:
+            self.start_write() # write lock for parameter encoding
+        try:
+            found = wgdb.query_exists(self._db,
+                matchrec, *arg, **kwarg)
+        finally:
+            if self.locking:
+                self.end_write()
+        return found
+
     def fetch(self, query):
         """Get next record from query result set."""
         if self.locking:
@@ -320,6 +381,33 @@ and record accessing functions."""
         if not r:
             return None
         return self._new_record(r)
+
+    def fetch_many(self, query, count):
+        """Get a list of at most count next records from query
+result set."""
+        if self.locking:
+            self.start_read()
+        try:
+            r = wgdb.fetch_many(self._db, query, count)
+        except wgdb.error:
+            r = []
+        finally:
+            if self.locking:
+                self.end_read()
+
+        return [ self._new_record(rec) for rec in r ]
+
+    def skip(self, query, count):
+        """Skip at most count next records of query result set.
+Returns the number of records skipped."""
+        if self.locking:
+            self.start_read()
+        try:
+            r = wgdb.skip(self._db, query, count)
+        finally:
+            if self.locking:
+                self.end_read()
+        return r
         
     def free_query(self, cur):
         """Free query belonging to a cursor."""
@@ -343,6 +431,7 @@ records or argument lists. Does not currently support SQL."""
         self._query = None
         self._conn = conn
         self.rowcount = -1
+        self.arraysize = 1
 
     def get__query(self):
         """Return low level query object"""
@@ -358,14 +447,23 @@ records or argument lists. Does not currently support SQL."""
             raise ProgrammingError("No results to fetch.")
         return self._conn.fetch(self._query)
 
+    def fetchmany(self, size=None):
+        """Fetch the next size (default arraysize) records from the
+result set"""
+        if not self._query:
+            raise ProgrammingError("No results to fetch.")
+        if size is None:
+            size = self.arraysize
+        return self._conn.fetch_many(self._query, size)
+
     def fetchall(self):
         """Fetch all (remaining) records from the result set"""
         result = []
         while 1:
-            r = self.fetchone()
+            r = self.fetchmany(256)
             if not r:
                 break
-            result.append(r)
+            result.extend(r)
         return result
 
     # includes sql parameter for future extension. Current
@@ -575,6 +575,7 @@ static char* search(thread_data_p tdata, char* inparams[], char* invalues[],
   void *rec, *oldrec; 
   char* res;
   wg_query *wgquery;  // query datastructure built later
+  wg_prepared_query *wgprep=NULL; // unbuffered query for search and count
   wg_query_arg wgargs[MAXPARAMS]; 
   wg_int lock_id=0;  // non-0 iff lock set
   int searchtype=0; // 0: full scan, 1: record ids, 2: by fields             
@@ -765,10 +766,33 @@ static char* search(thread_data_p tdata, char* inparams[], char* invalues[],
       if (wgargs[i].value==WG_ILLEGAL) return err_clear_detach_halt(INTYPE_ERR,tdata);
     }   
     
-    // make the query structure       
-    wgquery = wg_make_query(db, NULL, 0, wgargs, i);
-    if (!wgquery) return err_clear_detach_halt(QUERY_ERR,tdata);
-    
+    // make the query structure: search and count read the rows in place,
+    // so index ranges are not collected first and from can be skipped
+    // without reading the rows; update and delete need the prefetched rows
+    if (opcode==SEARCH_CODE || opcode==COUNT_CODE) {
+      wgprep = wg_prepare_query(db, NULL, 0, wgargs, i);
+      if (!wgprep) return err_clear_detach_halt(QUERY_ERR,tdata);
+      wgquery = wg_exec_query(db, wgprep);
+      if (!wgquery) {
+        for(i=0;i<fcount;i++) wg_free_query_param(db, wgargs[i].value);
+        wg_free_prepared_query(db,wgprep);
+        return err_clear_detach_halt(QUERY_ERR,tdata);
+      }
+    } else {
+      wgquery = wg_make_query(db, NULL, 0, wgargs, i);
+      if (!wgquery) return err_clear_detach_halt(QUERY_ERR,tdata);
+    }
+
+    // skip the rows before from
+    if (from>0) {
+      if (wg_query_skip(db,wgquery,from)<0) {
+        for(i=0;i<fcount;i++) wg_free_query_param(db, wgargs[i].value);
+        if (wgprep) wg_free_prepared_query(db,wgprep);
+        else wg_free_query(db,wgquery);
+        return err_clear_detach_halt(QUERY_ERR,tdata);
+      }
+      rcount=from;
+    }
     // actually perform the query           
     if (tdata->maxdepth>MAX_DEPTH_HARD) tdata->maxdepth=MAX_DEPTH_HARD;
     while((rec = wg_fetch(db, wgquery))) {
@@ -792,7 +816,8 @@ static char* search(thread_data_p tdata, char* inparams[], char* invalues[],
     }   
     // free query datastructure, 
     for(i=0;i<fcount;i++) wg_free_query_param(db, wgargs[i].value);
-    wg_free_query(db,wgquery); 
+    if (wgprep) wg_free_prepared_query(db,wgprep);
+    else wg_free_query(db,wgquery);
   }
   // ----- cases  handled  ------
   // print a single number for count and delete
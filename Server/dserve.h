@@ -162,7 +162,7 @@ Content-Type: text/plain\r\n\r\n"
 #define DB_PARAM_ERR "use db=name with a numeric name for a concrete database"
 #define DB_ATTACH_ERR "no database found: use db=name with a numeric name for a concrete database"
 #define FIELD_ERR "unrecognized field: use an integer starting from 0"
-#define COND_ERR "unrecognized compare: use equal, not_equal, lessthan, greater, ltequal or gtequal"
+#define COND_ERR "unrecognized compare: use equal, not_equal, lessthan, greater, ltequal, gtequal, contains or prefix"
 #define INTYPE_ERR "unrecognized type: use null, int, double, str, char or record "
 #define INVALUE_ERR "did not find a value to use for comparison"
 #define INVALUE_TYPE_ERR "value does not match type"
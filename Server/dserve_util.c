@@ -50,6 +50,8 @@ wg_int encode_incomp(void* db, char* incomp) {
   else if (!strcmp(incomp,"greater"))  return WG_COND_GREATER; 
   else if (!strcmp(incomp,"ltequal"))  return WG_COND_LTEQUAL;   
   else if (!strcmp(incomp,"gtequal"))  return WG_COND_GTEQUAL; 
+  else if (!strcmp(incomp,"contains"))  return WG_COND_CONTAINS; 
+  else if (!strcmp(incomp,"prefix"))  return WG_COND_PREFIX; 
   else return BAD_WG_VALUE; //err_clear_detach_halt(COND_ERR);  
 }  
 
@@ -57,6 +57,9 @@ extern "C" {
 #else
 #include "../config.h"
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "../Db/dballoc.h"
 #include "../Db/dbdata.h"
 #include "../Db/dbhash.h"
@@ -65,6 +68,7 @@ extern "C" {
 #include "../Db/dbutil.h"
 #include "../Db/dbquery.h"
 #include "../Db/dbcompare.h"
+#include "../Db/dblock.h"
 #include "../Db/dblog.h"
 #include "../Db/dbschema.h"
 #include "../Db/dbjson.h"
@@ -94,6 +98,30 @@ static gint wg_test_index1(void *db, int magnitude, int printlevel);
 static gint wg_test_index2(void *db, int printlevel);
 static gint wg_test_index3(void *db, int magnitude, int printlevel);
 static gint wg_test_index4(void *db, int printlevel);
+static gint wg_test_index5(void *db, int printlevel);
+static gint wg_test_index6(void *db, int printlevel);
+static gint wg_test_index7(void *db, int printlevel);
+static gint wg_test_index8(void *db, int printlevel);
+static gint wg_test_index9(void *db, int printlevel);
+static gint wg_test_index10(void *db, int printlevel);
+static gint wg_test_index11(void *db, int printlevel);
+static gint wg_test_index12(void *db, int printlevel);
+static gint wg_test_index13(void *db, int printlevel);
+static gint wg_test_index14(void *db, int printlevel);
+static gint wg_test_index15(void *db, int printlevel);
+static gint wg_test_index16(void *db, int printlevel);
+static gint wg_test_index17(void *db, int printlevel);
+static gint wg_test_index18(void *db, int printlevel);
+static gint wg_test_index19(void *db, int printlevel);
+static gint wg_test_index20(void *db, int printlevel);
+static gint wg_test_index21(void *db, int printlevel);
+static gint wg_test_index22(void *db, int printlevel);
+static gint wg_test_index23(void *db, int printlevel);
+static gint wg_test_index24(void *db, int printlevel);
+static gint wg_test_index25(void *db, int printlevel);
+static gint wg_test_index26(void *db, int printlevel);
+static gint wg_test_index27(void *db, int printlevel);
+static gint wg_test_index28(void *db, int printlevel);
 static gint wg_check_childdb(void* db, int printlevel);
 static gint wg_check_schema(void* db, int printlevel);
 static gint wg_check_json_parsing(void* db, int printlevel);
@@ -182,6 +210,170 @@ int wg_run_tests(int tests, int printlevel) {
       wg_delete_local_database(db);
     }
 
+    if (OK_TO_CONTINUE(tmp)) {
+      /* composite index test on clean db */
+      db = wg_attach_local_database(800000);
+      tmp = wg_test_index5(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* covering index test on clean db */
+      db = wg_attach_local_database(800000);
+      tmp = wg_test_index6(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* bitmap index test on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index7(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* trigram index test on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index8(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* R-tree index test on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index9(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* deferred index updates on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index10(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* online index creation on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index11(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* index statistics on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index12(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* query planner on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index13(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* lists and disjunctions on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index14(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* aggregates on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index15(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* grouped aggregates on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index16(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* ordered queries on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index17(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* joins on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index18(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* prepared queries on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index19(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* batched fetch on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index20(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* query result cache on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index21(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* query explain on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index22(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* checking rows of mixed types on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index23(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
+    if (OK_TO_CONTINUE(tmp)) {
+      /* counting rows on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index24(db,printlevel);
+      wg_delete_local_database(db);
+    }
+    if (OK_TO_CONTINUE(tmp)) {
+      /* skipping rows, on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index25(db,printlevel);
+      wg_delete_local_database(db);
+    }
+    if (OK_TO_CONTINUE(tmp)) {
+      /* prefix conditions, on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index26(db,printlevel);
+      wg_delete_local_database(db);
+    }
+    if (OK_TO_CONTINUE(tmp)) {
+      /* JSON path index, on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index27(db,printlevel);
+      wg_delete_local_database(db);
+    }
+    if (OK_TO_CONTINUE(tmp)) {
+      /* lookups without the lock during writes, on clean db */
+      db = wg_attach_local_database(4000000);
+      tmp = wg_test_index28(db,printlevel);
+      wg_delete_local_database(db);
+    }
+
     if (OK_TO_CONTINUE(tmp)) {
       printf("\n***** Quick tests passed ******\n");
     } else {
@@ -1257,6 +1449,85 @@ static gint wg_check_backlinking(void* db, int printlevel) {
       0, (int) tmp);
     return 1;
   }
+
+  /* A record with many parents. The backlinks are converted to
+   * a set and back to a list when the parents are removed. Some
+   * parents refer to the record twice.
+   */
+  {
+    gint *parents[500];
+    gint enc;
+    int i, count;
+
+    rec = (gint *) wg_create_record(db, 1);
+    if(rec == NULL) {
+      if (p) printf("unexpected error: rec creation failed\n");
+      return 1;
+    }
+    enc = wg_encode_record(db, rec);
+    for(i=0; i<500; i++) {
+      parents[i] = (gint *) wg_create_record(db, 2);
+      if(parents[i] == NULL ||\
+        wg_set_field(db, parents[i], 0, enc) ||\
+        (!(i % 10) && wg_set_field(db, parents[i], 1, enc))) {
+        if (p) printf("check_backlinking: failed to link records\n");
+        return 1;
+      }
+    }
+
+    count = 0;
+    for(parent = wg_get_first_parent(db, rec); parent;
+      parent = wg_get_next_parent(db, rec, parent)) {
+      if(wg_get_field(db, parent, 0) != enc || ++count > 500) {
+        if (p) printf("check_backlinking: record had an invalid parent");
+        return 1;
+      }
+    }
+    if(count != 500) {
+      if (p) printf("check_backlinking: record had %d parents, expected %d\n",
+        count, 500);
+      return 1;
+    }
+
+    /* Remove the links, both by updating and deleting the parents */
+    for(i=0; i<497; i++) {
+      if(i % 2)
+        tmp = wg_set_field(db, parents[i], 0, 0) ||\
+          wg_set_field(db, parents[i], 1, 0);
+      else
+        tmp = wg_delete_record(db, parents[i]);
+      if(tmp) {
+        if (p) printf("check_backlinking: failed to unlink records\n");
+        return 1;
+      }
+    }
+
+    count = 0;
+    for(parent = wg_get_first_parent(db, rec); parent;
+      parent = wg_get_next_parent(db, rec, parent)) {
+      if((parent != parents[497] && parent != parents[498] &&\
+        parent != parents[499]) || ++count > 3) {
+        if (p) printf("check_backlinking: record had an invalid parent");
+        return 1;
+      }
+    }
+    if(count != 3) {
+      if (p) printf("check_backlinking: record had %d parents, expected %d\n",
+        count, 3);
+      return 1;
+    }
+
+    for(i=1; i<497; i+=2)
+      wg_delete_record(db, parents[i]);
+    for(i=497; i<500; i++)
+      wg_delete_record(db, parents[i]);
+    tmp = wg_delete_record(db, rec);
+    if(tmp != 0) {
+      if (p) printf("check_backlinking: deleting record, expected %d, received %d\n",
+        0, (int) tmp);
+      return 1;
+    }
+  }
   if (p>1) printf("********* check_backlinking: no errors ************\n");
 #else
   printf("check_backlinking: disabled, skipping checks\n");
@@ -2863,7 +3134,7 @@ static gint wg_test_index1(void *db, int magnitude, int printlevel) {
   const int dbsize = 50*magnitude, rand_updates = magnitude;
   int i, j;
   void *start = NULL, *rec = NULL;
-  gint oldv, newv;
+  gint oldv, newv, index_id;
   db_memsegment_header* dbh = dbmemsegh(db);
 
 #ifdef _WIN32
@@ -2915,8 +3186,10 @@ static gint wg_test_index1(void *db, int magnitude, int printlevel) {
   }
 
   /* 2nd loop: keep updating with random data */
+  index_id = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0);
   for(j=0; j<rand_updates; j++) {
     for(i=0; i<dbsize; i++) {
+      gint version;
       if(!i)
         rec = start;
       else
@@ -2927,6 +3200,7 @@ static gint wg_test_index1(void *db, int magnitude, int printlevel) {
 #else
       newv = random()>>4;
 #endif
+      version = wg_index_read_begin(db, index_id);
       if(wg_set_field(db, rec, 0, wg_encode_int(db, newv))) {
         if(printlevel) {
           printf("loop: %d row: %d old: %d new: %d\n",
@@ -2935,6 +3209,14 @@ static gint wg_test_index1(void *db, int magnitude, int printlevel) {
         }
         return -2;
       }
+      /* An optimistic read that overlaps the update must be retried */
+      if(!wg_index_read_retry(db, index_id, version) ||\
+        wg_index_read_retry(db, index_id,
+          wg_index_read_begin(db, index_id))) {
+        if(printlevel)
+          fprintf(stderr, "index version not updated.\n");
+        return -2;
+      }
       if(validate_index(db, start, dbsize, 0, printlevel)) {
         if(printlevel) {
           printf("loop: %d row: %d old: %d new: %d\n",
@@ -3296,74 +3578,4694 @@ static gint wg_test_index4(void *db, int printlevel) {
   return 0;
 }
 
-/** Validate a T-tree index
- *  1. validates a set of rows starting from *rec.
- *  2. checks tree balance
- *  3. checks tree min/max values
- *  returns 0 if no errors found
- *  returns -1 if value was not indexed
- *  returns -2 if there was another error
+/** Test composite (multi-column) T-tree index
+ *  Checks that the index stays ordered by the key columns
+ *  under inserts, updates and deletes, and that the queries
+ *  with equality on the leading column and range on the second
+ *  column return the correct rows in the index order.
  */
-static int validate_index(void *db, void *rec, int rows, int column,
-  int printlevel) {
-  gint index_id = wg_column_to_index_id(db, column,
-    WG_INDEX_TYPE_TTREE, NULL, 0);
-  gint tnode_offset;
-  wg_index_header *hdr;
+static gint wg_test_index5(void *db, int printlevel) {
+  const int dbsize = 200;
+  const int loops = 5;
+  int i, j, v2, lo;
+  void *rec = NULL;
+  gint columns[2], rev_columns[2];
+  gint index_id;
 
-  if(index_id == -1)
-    return -2;
+  if (printlevel>1)
+    printf("********* testing composite T-tree index ********** \n");
 
-  /* Check if all values are indexed */
-  while(rec && rows) {
-    if(wg_get_record_len(db, rec) > column) {
-      gint val = wg_get_field(db, rec, column);
-      if(wg_search_ttree_index(db, index_id, val) < 1) {
-        if(printlevel) {
-          printf("missing: %d\n", (int) val);
-        }
+#ifdef _WIN32
+  srand(102435356);
+#else
+  srandom(102435356); /* fixed seed for repeatable sequences */
+#endif
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+    for(j=0; j<3; j++) {
+#ifdef _WIN32
+      int newv = rand() % 10;
+#else
+      int newv = random() % 10;
+#endif
+      if(wg_set_field(db, rec, j, wg_encode_int(db, newv))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
         return -1;
       }
     }
-    rec = wg_get_next_record(db, rec);
-    rows--;
   }
 
-  hdr = (wg_index_header *) offsettoptr(db, index_id);
-
-  if(((struct wg_tnode *)(offsettoptr(db,
-    TTREE_ROOT_NODE(hdr))))->parent_offset != 0) {
+  /* Key order is column 2, then column 0 */
+  columns[0] = 2;
+  columns[1] = 0;
+  rev_columns[0] = 0;
+  rev_columns[1] = 2;
+  if(wg_create_multi_index(db, columns, 2, WG_INDEX_TYPE_TTREE, NULL, 0)) {
     if(printlevel)
-      printf("root node parent offset is not 0\n");
-    return -2;
+      fprintf(stderr, "composite index creation failed, aborting.\n");
+    return -3;
   }
-#ifdef TTREE_CHAINED_NODES
-  if(TTREE_MIN_NODE(hdr) == 0) {
+  index_id = wg_multi_column_to_index_id(db, columns, 2,
+    WG_INDEX_TYPE_TTREE, NULL, 0);
+  if(index_id == -1) {
     if(printlevel)
-      printf("min node offset is 0\n");
-    return -2;
+      fprintf(stderr, "composite index lookup failed, aborting.\n");
+    return -3;
   }
-  if(TTREE_MAX_NODE(hdr) == 0) {
+  if(wg_multi_column_to_index_id(db, rev_columns, 2,
+    WG_INDEX_TYPE_TTREE, NULL, 0) != -1) {
     if(printlevel)
-      printf("max node offset is 0\n");
-    return -2;
+      fprintf(stderr, "composite index found with wrong column order.\n");
+    return -3;
   }
+
+  for(j=0; j<loops; j++) {
+    int count, indexed;
+    gint tnode_offset, prev;
+    wg_index_header *hdr;
+
+    /* Modify the data: delete, update and add records */
+    count = 0;
+    rec = wg_get_first_record(db);
+    while(rec) {
+      int op;
+      void *curr = rec;
+      rec = wg_get_next_record(db, curr);
+#ifdef _WIN32
+      op = rand() % 4;
+#else
+      op = random() % 4;
 #endif
+      if(op == 0) {
+        if(wg_delete_record(db, curr) != 0) {
+          if(printlevel)
+            printf("Deleting a record failed\n");
+          return -1;
+        }
+      } else if(op == 1) {
+        if(wg_set_field(db, curr, count % 3,
+          wg_encode_int(db, count % 10))) {
+          if(printlevel)
+            printf("Updating a record failed\n");
+          return -1;
+        }
+      }
+      count++;
+    }
+    for(i=0; i<dbsize/4; i++) {
+      rec = wg_create_record(db, 3);
+      if(!rec ||\
+        wg_set_field(db, rec, 0, wg_encode_int(db, i % 10)) ||\
+        wg_set_field(db, rec, 1, wg_encode_int(db, i % 7)) ||\
+        wg_set_field(db, rec, 2, wg_encode_int(db, i % 3))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
+        return -1;
+      }
+    }
+
+    /* Validate the index: every record is present, the keys
+     * are in order and node min/max match the slots.
+     */
+    count = 0;
+    rec = wg_get_first_record(db);
+    while(rec) {
+      count++;
+      rec = wg_get_next_record(db, rec);
+    }
 
+    hdr = (wg_index_header *) offsettoptr(db, index_id);
 #ifdef TTREE_CHAINED_NODES
-  tnode_offset = TTREE_MIN_NODE(hdr);
+    tnode_offset = TTREE_MIN_NODE(hdr);
 #else
-  tnode_offset = wg_ttree_find_lub_node(db, TTREE_ROOT_NODE(hdr));
+    tnode_offset = wg_ttree_find_lub_node(db, TTREE_ROOT_NODE(hdr));
 #endif
-  while(tnode_offset) {
-    int diff;
-    gint minval, maxval;
-    struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, tnode_offset);
-
-    /* Check index tree balance */
-    diff = node->left_subtree_height - node->right_subtree_height;
-    if(diff < -1 || diff > 1)
+    indexed = 0;
+    prev = 0;
+    while(tnode_offset) {
+      struct wg_tnode *node = \
+        (struct wg_tnode *) offsettoptr(db, tnode_offset);
+      if(node->number_of_elements) {
+        if(node->current_min != node->array_of_values[0] ||\
+          node->current_max !=\
+          node->array_of_values[node->number_of_elements - 1]) {
+          if(printlevel)
+            printf("node %d min/max invalid\n", (int) tnode_offset);
+          return -2;
+        }
+      }
+      for(i=0; i<node->number_of_elements; i++) {
+        gint curr = node->array_of_values[i];
+        if(prev) {
+          void *a = offsettoptr(db, prev);
+          void *b = offsettoptr(db, curr);
+          int a2 = wg_decode_int(db, wg_get_field(db, a, 2));
+          int b2 = wg_decode_int(db, wg_get_field(db, b, 2));
+          if(a2 > b2 || (a2 == b2 &&\
+            wg_decode_int(db, wg_get_field(db, a, 0)) >\
+            wg_decode_int(db, wg_get_field(db, b, 0)))) {
+            if(printlevel)
+              printf("composite index out of order at node %d\n",
+                (int) tnode_offset);
+            return -2;
+          }
+        }
+        if(wg_search_ttree_index(db, index_id, curr) < 1) {
+          if(printlevel)
+            printf("composite index search failed\n");
+          return -2;
+        }
+        prev = curr;
+        indexed++;
+      }
+      tnode_offset = TNODE_SUCCESSOR(db, node);
+    }
+    if(indexed != count) {
+      if(printlevel)
+        printf("composite index has %d rows, expected %d\n",
+          indexed, count);
       return -2;
+    }
+
+    /* Queries: col2 = v2 AND col0 > lo AND col0 <= lo + 3, with a
+     * residual condition on column 1. Compare to a full scan.
+     */
+    for(v2=0; v2<10; v2+=3) {
+      for(lo=-1; lo<10; lo+=2) {
+        wg_query_arg arglist[4];
+        wg_query *query;
+        int expected = 0, found = 0, prev0 = -1;
+
+        arglist[0].column = 2;
+        arglist[0].cond = WG_COND_EQUAL;
+        arglist[0].value = wg_encode_query_param_int(db, v2);
+        arglist[1].column = 0;
+        arglist[1].cond = WG_COND_GREATER;
+        arglist[1].value = wg_encode_query_param_int(db, lo);
+        arglist[2].column = 0;
+        arglist[2].cond = WG_COND_LTEQUAL;
+        arglist[2].value = wg_encode_query_param_int(db, lo + 3);
+        arglist[3].column = 1;
+        arglist[3].cond = WG_COND_LESSTHAN;
+        arglist[3].value = wg_encode_query_param_int(db, 5);
+
+        rec = wg_get_first_record(db);
+        while(rec) {
+          int c0 = wg_decode_int(db, wg_get_field(db, rec, 0));
+          int c1 = wg_decode_int(db, wg_get_field(db, rec, 1));
+          int c2 = wg_decode_int(db, wg_get_field(db, rec, 2));
+          if(c2 == v2 && c0 > lo && c0 <= lo + 3 && c1 < 5)
+            expected++;
+          rec = wg_get_next_record(db, rec);
+        }
+
+        query = wg_make_query(db, NULL, 0, arglist, 4);
+        if(!query) {
+          if(printlevel)
+            printf("composite index query failed\n");
+          return -2;
+        }
+        while((rec = wg_fetch(db, query))) {
+          int c0 = wg_decode_int(db, wg_get_field(db, rec, 0));
+          if(c0 < prev0) {
+            /* rows should come in the index order */
+            if(printlevel)
+              printf("composite index query did not use the index\n");
+            wg_free_query(db, query);
+            return -2;
+          }
+          prev0 = c0;
+          found++;
+        }
+        wg_free_query(db, query);
+        for(i=0; i<4; i++)
+          wg_free_query_param(db, arglist[i].value);
+
+        if(found != expected) {
+          if(printlevel)
+            printf("composite index query returned %d rows, expected %d "\
+              "(col2 = %d, %d < col0 <= %d)\n", found, expected,
+              v2, lo, lo + 3);
+          return -2;
+        }
+      }
+    }
+  }
+
+  if (printlevel>1)
+    printf("********* composite index test successful ********** \n");
+  return 0;
+}
+
+/** Check the entry of a covering index against its data row.
+ *  returns 0 if the entry holds the indexed and included fields
+ *  of the row, -1 otherwise.
+ */
+static int check_covering_entry(void *db, wg_index_header *hdr,
+  gint entry, void *rec) {
+  void *e = offsettoptr(db, entry);
+  gint reclen = wg_get_record_len(db, rec);
+  gint elen = wg_get_record_len(db, e);
+  int i;
+
+  if(!is_special_record(e) || elen > reclen)
+    return -1;
+  for(i=0; i<hdr->fields; i++) {
+    gint col = hdr->rec_field_index[i];
+    if(col >= elen ||\
+      wg_get_field(db, e, col) != wg_get_field(db, rec, col))
+      return -1;
+  }
+  for(i=0; i<hdr->include_count; i++) {
+    gint col = hdr->rec_include_index[i];
+    if(col < reclen && (col >= elen ||\
+      wg_get_field(db, e, col) != wg_get_field(db, rec, col)))
+      return -1;
+  }
+  return 0;
+}
+
+/** Test covering indexes (indexes with included columns)
+ *  Checks that the index entries follow the data rows under inserts,
+ *  updates and deletes, and that queries return the included
+ *  values with wg_fetch_values().
+ */
+static gint wg_test_index6(void *db, int printlevel) {
+  const int dbsize = 200;
+  const int loops = 5;
+  int i, j, v;
+  void *rec = NULL;
+  gint tcol = 0, hcol = 1;
+  gint tinc[2], hinc[1];
+  gint tindex_id, hindex_id;
+  wg_index_header *thdr, *hhdr;
+
+  if (printlevel>1)
+    printf("********* testing covering indexes ********** \n");
+
+#ifdef _WIN32
+  srand(20481133);
+#else
+  srandom(20481133); /* fixed seed for repeatable sequences */
+#endif
+
+  for(i=0; i<dbsize; i++) {
+    /* some rows are too short to have the included columns */
+    int len = (i % 5 ? 4 : 2);
+    rec = wg_create_record(db, len);
+    if(!rec) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+    for(j=0; j<len; j++) {
+#ifdef _WIN32
+      int newv = rand() % 10;
+#else
+      int newv = random() % 10;
+#endif
+      if(wg_set_field(db, rec, j, wg_encode_int(db, newv))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
+        return -1;
+      }
+    }
+  }
+
+  tinc[0] = 3;
+  tinc[1] = 2;
+  hinc[0] = 3;
+  if(wg_create_covering_index(db, &tcol, 1, &tcol, 1,
+    WG_INDEX_TYPE_TTREE, NULL, 0) != -1) {
+    if(printlevel)
+      fprintf(stderr, "unusable covering index was created.\n");
+    return -3;
+  }
+  if(wg_create_covering_index(db, &tcol, 1, tinc, 2,
+    WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_covering_index(db, &hcol, 1, hinc, 1,
+    WG_INDEX_TYPE_HASH, NULL, 0)) {
+    if(printlevel)
+      fprintf(stderr, "covering index creation failed, aborting.\n");
+    return -3;
+  }
+  tindex_id = wg_column_to_index_id(db, tcol, WG_INDEX_TYPE_TTREE, NULL, 0);
+  hindex_id = wg_column_to_index_id(db, hcol, WG_INDEX_TYPE_HASH, NULL, 0);
+  if(tindex_id == -1 || hindex_id == -1) {
+    if(printlevel)
+      fprintf(stderr, "covering index lookup failed, aborting.\n");
+    return -3;
+  }
+  thdr = (wg_index_header *) offsettoptr(db, tindex_id);
+  hhdr = (wg_index_header *) offsettoptr(db, hindex_id);
+
+  for(j=0; j<loops; j++) {
+    int count, indexed;
+    gint tnode_offset;
+
+    /* Modify the data: delete, update and add records */
+    count = 0;
+    rec = wg_get_first_record(db);
+    while(rec) {
+      int op;
+      void *curr = rec;
+      rec = wg_get_next_record(db, curr);
+#ifdef _WIN32
+      op = rand() % 4;
+#else
+      op = random() % 4;
+#endif
+      if(op == 0) {
+        if(wg_delete_record(db, curr) != 0) {
+          if(printlevel)
+            printf("Deleting a record failed\n");
+          return -1;
+        }
+      } else if(op == 1) {
+        if(wg_set_field(db, curr, count % wg_get_record_len(db, curr),
+          wg_encode_int(db, count % 10))) {
+          if(printlevel)
+            printf("Updating a record failed\n");
+          return -1;
+        }
+      }
+      count++;
+    }
+    for(i=0; i<dbsize/4; i++) {
+      /* Raw records: included columns are set before the keys */
+      rec = wg_create_raw_record(db, 4);
+      if(!rec ||\
+        wg_set_new_field(db, rec, 3, wg_encode_int(db, i % 11)) ||\
+        wg_set_new_field(db, rec, 2, wg_encode_int(db, i % 3)) ||\
+        wg_set_new_field(db, rec, 1, wg_encode_int(db, i % 7)) ||\
+        wg_set_new_field(db, rec, 0, wg_encode_int(db, i % 10))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
+        return -1;
+      }
+    }
+
+    /* Validate the indexes: every record has an entry that holds
+     * the current values of the covered fields.
+     */
+    count = 0;
+    rec = wg_get_first_record(db);
+    while(rec) {
+      gint value = wg_get_field(db, rec, hcol);
+      gint reclist = wg_search_hash(db, hindex_id, &value, 1);
+      gint rowoffset = ptrtooffset(db, rec);
+
+      while(reclist > 0) {
+        gcell *rec_cell = (gcell *) offsettoptr(db, reclist);
+        if(COVERING_ENTRY_RECORD(db, rec_cell->car) == rowoffset)
+          break;
+        reclist = rec_cell->cdr;
+      }
+      if(reclist < 1 ||\
+        check_covering_entry(db, hhdr,
+          ((gcell *) offsettoptr(db, reclist))->car, rec)) {
+        if(printlevel)
+          printf("hash index entry missing or invalid\n");
+        return -2;
+      }
+      if(wg_search_ttree_index(db, tindex_id,
+        wg_get_field(db, rec, tcol)) < 1) {
+        if(printlevel)
+          printf("covering T-tree index search failed\n");
+        return -2;
+      }
+      count++;
+      rec = wg_get_next_record(db, rec);
+    }
+
+#ifdef TTREE_CHAINED_NODES
+    tnode_offset = TTREE_MIN_NODE(thdr);
+#else
+    tnode_offset = wg_ttree_find_lub_node(db, TTREE_ROOT_NODE(thdr));
+#endif
+    indexed = 0;
+    while(tnode_offset) {
+      struct wg_tnode *node = \
+        (struct wg_tnode *) offsettoptr(db, tnode_offset);
+      for(i=0; i<node->number_of_elements; i++) {
+        gint entry = node->array_of_values[i];
+        void *row = offsettoptr(db, COVERING_ENTRY_RECORD(db, entry));
+        if(is_special_record(row) ||\
+          check_covering_entry(db, thdr, entry, row)) {
+          if(printlevel)
+            printf("T-tree index entry invalid at node %d\n",
+              (int) tnode_offset);
+          return -2;
+        }
+        indexed++;
+      }
+      tnode_offset = TNODE_SUCCESSOR(db, node);
+    }
+    if(indexed != count) {
+      if(printlevel)
+        printf("covering index has %d rows, expected %d\n",
+          indexed, count);
+      return -2;
+    }
+
+    /* Queries: col0 = v AND col2 < 5. Compare to a full scan and
+     * check the values returned from the index entries.
+     */
+    for(v=0; v<10; v++) {
+      wg_query_arg arglist[2];
+      wg_query *query;
+      gint columns[3], values[3];
+      int expected = 0, found = 0;
+
+      arglist[0].column = 0;
+      arglist[0].cond = WG_COND_EQUAL;
+      arglist[0].value = wg_encode_query_param_int(db, v);
+      arglist[1].column = 2;
+      arglist[1].cond = WG_COND_LESSTHAN;
+      arglist[1].value = wg_encode_query_param_int(db, 5);
+      columns[0] = 3;
+      columns[1] = 0;
+      columns[2] = 1; /* not covered */
+
+      rec = wg_get_first_record(db);
+      while(rec) {
+        if(wg_get_record_len(db, rec) > 2 &&\
+          wg_decode_int(db, wg_get_field(db, rec, 0)) == v &&\
+          wg_decode_int(db, wg_get_field(db, rec, 2)) < 5)
+          expected++;
+        rec = wg_get_next_record(db, rec);
+      }
+
+      query = wg_make_query(db, NULL, 0, arglist, 2);
+      if(!query || query->cover_index != tindex_id || !query->cover_args) {
+        if(printlevel)
+          printf("covering index query failed\n");
+        if(query)
+          wg_free_query(db, query);
+        return -2;
+      }
+      while((rec = wg_fetch_values(db, query, columns,
+        (found % 2 ? 3 : 2), values))) {
+        if(is_special_record(rec) ||\
+          values[0] != wg_get_field(db, rec, 3) ||\
+          values[1] != wg_get_field(db, rec, 0) ||\
+          (found % 2 && values[2] != wg_get_field(db, rec, 1))) {
+          if(printlevel)
+            printf("covering index query returned invalid values\n");
+          wg_free_query(db, query);
+          return -2;
+        }
+        found++;
+      }
+      wg_free_query(db, query);
+      for(i=0; i<2; i++)
+        wg_free_query_param(db, arglist[i].value);
+
+      if(found != expected) {
+        if(printlevel)
+          printf("covering index query returned %d rows, expected %d "\
+            "(col0 = %d)\n", found, expected, v);
+        return -2;
+      }
+
+      rec = wg_find_record_int(db, 0, WG_COND_EQUAL, v, NULL);
+      if(rec && (is_special_record(rec) ||\
+        wg_decode_int(db, wg_get_field(db, rec, 0)) != v)) {
+        if(printlevel)
+          printf("wg_find_record() returned an index entry\n");
+        return -2;
+      }
+    }
+  }
+
+  /* Dropping the T-tree index releases its entries. The entries of
+   * the hash index remain, one per data row.
+   */
+  if(wg_drop_index(db, tindex_id)) {
+    if(printlevel)
+      printf("dropping covering index failed\n");
+    return -2;
+  }
+  {
+    int rows = 0, entries = 0;
+    rec = wg_get_first_raw_record(db);
+    while(rec) {
+      if(is_special_record(rec))
+        entries++;
+      else
+        rows++;
+      rec = wg_get_next_raw_record(db, rec);
+    }
+    if(rows != entries) {
+      if(printlevel)
+        printf("%d index entries left for %d rows\n", entries, rows);
+      return -2;
+    }
+  }
+
+  if (printlevel>1)
+    printf("********* covering index test successful ********** \n");
+  return 0;
+}
+
+/** Check a row against a query argument
+ *  returns 1 if the row matches, 0 otherwise.
+ */
+static int query_arg_matches(void *db, void *rec, wg_query_arg *arg) {
+  gint enc, cr;
+
+  if(wg_get_record_len(db, rec) <= arg->column)
+    return 0;
+  enc = wg_get_field(db, rec, arg->column);
+  if(arg->cond == WG_COND_CONTAINS) {
+    return (wg_get_encoded_type(db, enc) == WG_STRTYPE &&\
+      strstr(wg_decode_str(db, enc), wg_decode_str(db, arg->value)) != NULL);
+  }
+  cr = WG_COMPARE(db, enc, arg->value);
+  return !((arg->cond == WG_COND_EQUAL && cr != WG_EQUAL) ||\
+    (arg->cond == WG_COND_NOT_EQUAL && cr == WG_EQUAL) ||\
+    (arg->cond == WG_COND_LESSTHAN && cr != WG_LESSTHAN) ||\
+    (arg->cond == WG_COND_GREATER && cr != WG_GREATER) ||\
+    (arg->cond == WG_COND_LTEQUAL && cr == WG_GREATER) ||\
+    (arg->cond == WG_COND_GTEQUAL && cr == WG_LESSTHAN));
+}
+
+/** Check a bitmap index query against the data rows.
+ *  The query must return the matching rows in ascending order
+ *  of offsets and no rows may be missing.
+ *  returns 0 on success, -1 on error.
+ */
+static int check_bitmap_query(void *db, wg_query_arg *arglist, gint argc,
+  int printlevel) {
+  wg_query *query;
+  void *rec;
+  gint prev = 0;
+  int i, found = 0, expected = 0;
+
+  query = wg_make_query(db, NULL, 0, arglist, argc);
+  if(!query) {
+    if(printlevel)
+      printf("bitmap query failed\n");
+    return -1;
+  }
+  if(query->qtype != WG_QTYPE_PREFETCH) {
+    if(printlevel)
+      printf("bitmap query was not prefetched\n");
+    wg_free_query(db, query);
+    return -1;
+  }
+
+  while((rec = wg_fetch(db, query))) {
+    if(ptrtooffset(db, rec) <= prev) {
+      if(printlevel)
+        printf("bitmap query rows out of order\n");
+      wg_free_query(db, query);
+      return -1;
+    }
+    prev = ptrtooffset(db, rec);
+    for(i=0; i<argc; i++) {
+      if(!query_arg_matches(db, rec, &arglist[i]))
+        break;
+    }
+    if(i < argc) {
+      if(printlevel)
+        printf("bitmap query returned a non-matching row\n");
+      wg_free_query(db, query);
+      return -1;
+    }
+    found++;
+  }
+  wg_free_query(db, query);
+
+  /* Count the matching rows by scanning */
+  rec = wg_get_first_record(db);
+  while(rec) {
+    for(i=0; i<argc; i++) {
+      if(!query_arg_matches(db, rec, &arglist[i]))
+        break;
+    }
+    if(i == argc)
+      expected++;
+    rec = wg_get_next_record(db, rec);
+  }
+
+  if(found != expected) {
+    if(printlevel)
+      printf("bitmap query returned %d rows, expected %d\n",
+        found, expected);
+    return -1;
+  }
+  return 0;
+}
+
+/** Test bitmap indexes
+ *  Runs queries with conditions on several bitmap indexed columns
+ *  and checks the results against a scan of the data rows, while
+ *  rows are updated and deleted. The data is skewed so that both
+ *  array and bitmap containers are used.
+ */
+static gint wg_test_index7(void *db, int printlevel) {
+  const int dbsize = 12000;
+  const char *colors[] = { "red", "green", "blue" };
+  int i, j;
+  void *rec, *next;
+  gint cols[2] = { 0, 1 };
+  wg_query_arg arglist[3];
+  gint index_id[2];
+  gint red, one, fifty;
+
+  if (printlevel>1)
+    printf("********* testing bitmap indexes ********** \n");
+
+#ifdef _WIN32
+  srand(73310091);
+#else
+  srandom(73310091); /* fixed seed for repeatable sequences */
+#endif
+
+  for(i=0; i<dbsize; i++) {
+    /* every 50th row is too short to be indexed on column 1 */
+    int len = (i % 50 ? 3 : 1);
+#ifdef _WIN32
+    int r = rand();
+#else
+    int r = random();
+#endif
+    rec = wg_create_record(db, len);
+    if(!rec) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+    /* most rows have 1 in column 0 */
+    if(wg_set_field(db, rec, 0, wg_encode_int(db, (r % 10 ? 1 : (r / 10) % 5)))) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+    if(len > 1) {
+      if(wg_set_field(db, rec, 1,
+          wg_encode_str(db, (char *) colors[(r / 100) % 3], NULL)) ||\
+        wg_set_field(db, rec, 2, wg_encode_int(db, (r / 1000) % 100))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
+        return -1;
+      }
+    }
+  }
+
+  if(wg_create_multi_index(db, cols, 2,
+    WG_INDEX_TYPE_BITMAP, NULL, 0) != -1) {
+    if(printlevel)
+      fprintf(stderr, "multi-column bitmap index was created.\n");
+    return -3;
+  }
+  for(i=0; i<2; i++) {
+    if(wg_create_index(db, cols[i], WG_INDEX_TYPE_BITMAP, NULL, 0)) {
+      if(printlevel)
+        fprintf(stderr, "bitmap index creation failed, aborting.\n");
+      return -3;
+    }
+    index_id[i] = wg_column_to_index_id(db, cols[i],
+      WG_INDEX_TYPE_BITMAP, NULL, 0);
+    if(index_id[i] == -1) {
+      if(printlevel)
+        fprintf(stderr, "bitmap index lookup failed, aborting.\n");
+      return -3;
+    }
+  }
+  if(wg_bitmap_value_count(db, index_id[1]) != 3) {
+    if(printlevel)
+      printf("bitmap index has wrong number of values\n");
+    return -2;
+  }
+
+  red = wg_encode_query_param_str(db, "red", NULL);
+  one = wg_encode_query_param_int(db, 1);
+  fifty = wg_encode_query_param_int(db, 50);
+
+  for(j=0; j<3; j++) {
+    /* Two bitmap conditions */
+    arglist[0].column = 0;
+    arglist[0].cond = WG_COND_EQUAL;
+    arglist[0].value = one;
+    arglist[1].column = 1;
+    arglist[1].cond = WG_COND_EQUAL;
+    arglist[1].value = red;
+    if(check_bitmap_query(db, arglist, 2, printlevel))
+      goto error;
+
+    /* Negation and a residual condition on a column with no index */
+    arglist[0].cond = WG_COND_NOT_EQUAL;
+    arglist[1].cond = WG_COND_NOT_EQUAL;
+    arglist[2].column = 2;
+    arglist[2].cond = WG_COND_LESSTHAN;
+    arglist[2].value = fifty;
+    if(check_bitmap_query(db, arglist, 3, printlevel))
+      goto error;
+
+    /* Single range condition */
+    arglist[0].cond = WG_COND_GTEQUAL;
+    if(check_bitmap_query(db, arglist, 1, printlevel))
+      goto error;
+
+    /* Update and delete rows. Deleting the rows holding the
+     * strings the index directory was created from forces the
+     * directory to switch to other rows. */
+    i = 0;
+    rec = wg_get_first_record(db);
+    while(rec) {
+      next = wg_get_next_record(db, rec);
+      if(!(i % (3 - j))) {
+        if(wg_delete_record(db, rec)) {
+          if(printlevel)
+            printf("delete error\n");
+          goto error;
+        }
+      } else if(!(i % 7)) {
+        if(wg_set_field(db, rec, 0, wg_encode_int(db, i % 4))) {
+          if(printlevel)
+            printf("update error\n");
+          goto error;
+        }
+      }
+      i++;
+      rec = next;
+    }
+  }
+
+  /* All rows are deleted by now */
+  if(check_bitmap_query(db, arglist, 1, printlevel))
+    goto error;
+
+  wg_free_query_param(db, red);
+  wg_free_query_param(db, one);
+  wg_free_query_param(db, fifty);
+
+  for(i=0; i<2; i++) {
+    if(wg_drop_index(db, index_id[i])) {
+      if(printlevel)
+        printf("dropping bitmap index failed\n");
+      return -2;
+    }
+  }
+
+  if (printlevel>1)
+    printf("********* bitmap index test successful ********** \n");
+  return 0;
+
+error:
+  wg_free_query_param(db, red);
+  wg_free_query_param(db, one);
+  wg_free_query_param(db, fifty);
+  return -2;
+}
+
+/** Test trigram indexes
+ *  Runs substring queries and checks the results against a scan
+ *  of the data rows, while rows are updated and deleted.
+ */
+static gint wg_test_index8(void *db, int printlevel) {
+  const int dbsize = 3000;
+  const char *parts[] = { "lo", "rem", "ip", "sum", "do", "lor", "sit",
+    "am", "et" };
+  const char *patterns[] = { "rem", "ipsum", "xyz", "lo", "sitam" };
+  int i, j, k;
+  char buf[40];
+  void *rec, *next;
+  gint col = 0, index_id;
+  wg_query_arg arglist[2];
+  gint pvalues[5], fifty;
+
+  if (printlevel>1)
+    printf("********* testing trigram indexes ********** \n");
+
+#ifdef _WIN32
+  srand(1100913);
+#else
+  srandom(1100913); /* fixed seed for repeatable sequences */
+#endif
+
+  for(i=0; i<dbsize; i++) {
+#ifdef _WIN32
+    int r = rand();
+#else
+    int r = random();
+#endif
+    rec = wg_create_record(db, 2);
+    if(!rec) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+    if(!(i % 40)) {
+      /* some values are not indexed */
+      if(wg_set_field(db, rec, 0, (i % 80 ? wg_encode_int(db, r) :
+        wg_encode_str(db, "am", NULL)))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
+        return -1;
+      }
+    } else {
+      buf[0] = '\0';
+      for(j=0; j<2 + (r % 3); j++) {
+        strcat(buf, parts[(r / (10 << j)) % 9]);
+      }
+      if(wg_set_field(db, rec, 0, wg_encode_str(db, buf, NULL))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
+        return -1;
+      }
+    }
+    if(wg_set_field(db, rec, 1, wg_encode_int(db, (r / 7) % 100))) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+  }
+
+  if(wg_create_index(db, col, WG_INDEX_TYPE_TRIGRAM, NULL, 0)) {
+    if(printlevel)
+      fprintf(stderr, "trigram index creation failed, aborting.\n");
+    return -3;
+  }
+  index_id = wg_column_to_index_id(db, col, WG_INDEX_TYPE_TRIGRAM, NULL, 0);
+  if(index_id == -1) {
+    if(printlevel)
+      fprintf(stderr, "trigram index lookup failed, aborting.\n");
+    return -3;
+  }
+
+  for(i=0; i<5; i++)
+    pvalues[i] = wg_encode_query_param_str(db, (char *) patterns[i], NULL);
+  fifty = wg_encode_query_param_int(db, 50);
+
+  for(j=0; j<3; j++) {
+    for(i=0; i<5; i++) {
+      arglist[0].column = 0;
+      arglist[0].cond = WG_COND_CONTAINS;
+      arglist[0].value = pvalues[i];
+      if(check_bitmap_query(db, arglist, 1, printlevel))
+        goto error;
+
+      /* With a residual condition */
+      arglist[1].column = 1;
+      arglist[1].cond = WG_COND_LESSTHAN;
+      arglist[1].value = fifty;
+      if(check_bitmap_query(db, arglist, 2, printlevel))
+        goto error;
+    }
+
+    /* Update and delete rows */
+    i = 0;
+    rec = wg_get_first_record(db);
+    while(rec) {
+      next = wg_get_next_record(db, rec);
+      if(!(i % (3 - j))) {
+        if(wg_delete_record(db, rec)) {
+          if(printlevel)
+            printf("delete error\n");
+          goto error;
+        }
+      } else if(!(i % 7)) {
+        k = i % 9;
+        snprintf(buf, 39, "%s%s%s", parts[k], parts[(k + 3) % 9],
+          parts[(k + 5) % 9]);
+        if(wg_set_field(db, rec, 0, wg_encode_str(db, buf, NULL))) {
+          if(printlevel)
+            printf("update error\n");
+          goto error;
+        }
+      }
+      i++;
+      rec = next;
+    }
+  }
+
+  /* All rows are deleted by now, so should be the trigrams */
+  if(wg_bitmap_value_count(db, index_id) != 0) {
+    if(printlevel)
+      printf("trigram index not empty after deleting all rows\n");
+    goto error;
+  }
+
+  for(i=0; i<5; i++)
+    wg_free_query_param(db, pvalues[i]);
+  wg_free_query_param(db, fifty);
+
+  if(wg_drop_index(db, index_id)) {
+    if(printlevel)
+      printf("dropping trigram index failed\n");
+    return -2;
+  }
+
+  if (printlevel>1)
+    printf("********* trigram index test successful ********** \n");
+  return 0;
+
+error:
+  for(i=0; i<5; i++)
+    wg_free_query_param(db, pvalues[i]);
+  wg_free_query_param(db, fifty);
+  return -2;
+}
+
+static int compare_offsets(const void *a, const void *b) {
+  gint x = *((gint *) a), y = *((gint *) b);
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/** Check a query against the data rows.
+ *  The rows may be returned in any order, but each matching row
+ *  must be returned exactly once.
+ *  returns 0 on success, -1 on error.
+ */
+static int check_unordered_query(void *db, wg_query_arg *arglist, gint argc,
+  int printlevel) {
+  wg_query *query;
+  void *rec;
+  gint *offsets;
+  int i, found = 0, expected = 0;
+
+  /* Count the matching rows by scanning */
+  rec = wg_get_first_record(db);
+  while(rec) {
+    for(i=0; i<argc; i++) {
+      if(!query_arg_matches(db, rec, &arglist[i]))
+        break;
+    }
+    if(i == argc)
+      expected++;
+    rec = wg_get_next_record(db, rec);
+  }
+
+  offsets = (gint *) malloc((expected + 1) * sizeof(gint));
+  if(!offsets) {
+    if(printlevel)
+      printf("failed to allocate memory\n");
+    return -1;
+  }
+  query = wg_make_query(db, NULL, 0, arglist, argc);
+  if(!query) {
+    if(printlevel)
+      printf("query failed\n");
+    free(offsets);
+    return -1;
+  }
+
+  while((rec = wg_fetch(db, query))) {
+    for(i=0; i<argc; i++) {
+      if(!query_arg_matches(db, rec, &arglist[i]))
+        break;
+    }
+    if(i < argc || found == expected) {
+      if(printlevel)
+        printf("query returned a non-matching row\n");
+      wg_free_query(db, query);
+      free(offsets);
+      return -1;
+    }
+    offsets[found++] = ptrtooffset(db, rec);
+  }
+  wg_free_query(db, query);
+
+  qsort(offsets, found, sizeof(gint), compare_offsets);
+  for(i=1; i<found; i++) {
+    if(offsets[i] == offsets[i-1]) {
+      if(printlevel)
+        printf("query returned a row twice\n");
+      free(offsets);
+      return -1;
+    }
+  }
+  free(offsets);
+
+  if(found != expected) {
+    if(printlevel)
+      printf("query returned %d rows, expected %d\n",
+        found, expected);
+    return -1;
+  }
+  return 0;
+}
+
+/** Check the rows found by an R-tree box search
+ *  All the rows with numeric values inside the box (of any numeric
+ *  type) must be found.
+ *  returns 0 on success, -1 on error.
+ */
+static int check_rtree_search(void *db, gint index_id, double *box,
+  int printlevel) {
+  gint *offsets, count, expected = 0;
+  void *rec;
+  int i;
+
+  rec = wg_get_first_record(db);
+  while(rec) {
+    if(wg_get_record_len(db, rec) > 1) {
+      for(i=0; i<2; i++) {
+        gint enc = wg_get_field(db, rec, i);
+        double c;
+        if(wg_get_encoded_type(db, enc) == WG_INTTYPE)
+          c = wg_decode_int(db, enc);
+        else if(wg_get_encoded_type(db, enc) == WG_DOUBLETYPE)
+          c = wg_decode_double(db, enc);
+        else
+          break;
+        if(c < box[i] || c > box[2+i])
+          break;
+      }
+      if(i == 2)
+        expected++;
+    }
+    rec = wg_get_next_record(db, rec);
+  }
+
+  count = wg_search_rtree(db, index_id, box, &offsets);
+  if(count < 0) {
+    if(printlevel)
+      printf("R-tree search failed\n");
+    return -1;
+  }
+  if(count)
+    free(offsets);
+  if(count != expected) {
+    if(printlevel)
+      printf("R-tree search found %d rows, expected %d\n",
+        (int) count, (int) expected);
+    return -1;
+  }
+  return 0;
+}
+
+/** Test R-tree indexes
+ *  Runs box queries on two numeric columns and checks the results
+ *  against a scan of the data rows. Half of the rows are bulk loaded
+ *  when the index is created, the rest are inserted later. Then the
+ *  rows are updated and deleted. Some rows have non-numeric values
+ *  or values of another numeric type in the indexed columns.
+ */
+static gint wg_test_index9(void *db, int printlevel) {
+  const int dbsize = 4000;
+  int i, j;
+  void *rec, *next;
+  gint cols[2] = { 1, 0 };
+  gint index_id = -1;
+  wg_query_arg arglist[5];
+  gint lo0, hi0, lo1, hi1, ten;
+  double box[4] = { 100, 20.0, 600, 60.0 };
+  double all[4] = { -1e9, -1e9, 1e9, 1e9 };
+
+  if (printlevel>1)
+    printf("********* testing R-tree indexes ********** \n");
+
+#ifdef _WIN32
+  srand(2209111);
+#else
+  srandom(2209111); /* fixed seed for repeatable sequences */
+#endif
+
+  for(i=0; i<dbsize; i++) {
+    /* every 50th row is too short to be indexed */
+    int len = (i % 50 ? 3 : 1);
+#ifdef _WIN32
+    int r = rand();
+#else
+    int r = random();
+#endif
+    if(i == dbsize/2) {
+      if(wg_create_multi_index(db, cols, 2, WG_INDEX_TYPE_RTREE, NULL, 0)) {
+        if(printlevel)
+          fprintf(stderr, "R-tree index creation failed, aborting.\n");
+        return -3;
+      }
+      index_id = wg_multi_column_to_index_id(db, cols, 2,
+        WG_INDEX_TYPE_RTREE, NULL, 0);
+      if(index_id == -1) {
+        if(printlevel)
+          fprintf(stderr, "R-tree index lookup failed, aborting.\n");
+        return -3;
+      }
+    }
+
+    rec = wg_create_record(db, len);
+    if(!rec) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+    /* some values are not numeric and are not indexed */
+    if(wg_set_field(db, rec, 0, (i % 40 ? wg_encode_int(db, r % 1000) :
+      wg_encode_str(db, "x", NULL)))) {
+      if(printlevel)
+        fprintf(stderr, "insert error, aborting.\n");
+      return -1;
+    }
+    if(len > 1) {
+      /* some values are integers in a column of doubles */
+      if(wg_set_field(db, rec, 1, (i % 30 ?
+          wg_encode_double(db, ((r / 1000) % 1000) / 10.0) :
+          wg_encode_int(db, (r / 1000) % 100))) ||\
+        wg_set_field(db, rec, 2, wg_encode_int(db, (r / 7) % 20))) {
+        if(printlevel)
+          fprintf(stderr, "insert error, aborting.\n");
+        return -1;
+      }
+    }
+  }
+
+  lo0 = wg_encode_query_param_int(db, 100);
+  hi0 = wg_encode_query_param_int(db, 600);
+  lo1 = wg_encode_query_param_double(db, 20.0);
+  hi1 = wg_encode_query_param_double(db, 60.0);
+  ten = wg_encode_query_param_int(db, 10);
+
+  for(j=0; j<3; j++) {
+    if(check_rtree_search(db, index_id, box, printlevel))
+      goto error;
+
+    /* Box */
+    arglist[0].column = 0;
+    arglist[0].cond = WG_COND_GTEQUAL;
+    arglist[0].value = lo0;
+    arglist[1].column = 0;
+    arglist[1].cond = WG_COND_LTEQUAL;
+    arglist[1].value = hi0;
+    arglist[2].column = 1;
+    arglist[2].cond = WG_COND_GREATER;
+    arglist[2].value = lo1;
+    arglist[3].column = 1;
+    arglist[3].cond = WG_COND_LTEQUAL;
+    arglist[3].value = hi1;
+    if(check_unordered_query(db, arglist, 4, printlevel))
+      goto error;
+
+    /* Box and a condition on a column with no index */
+    arglist[4].column = 2;
+    arglist[4].cond = WG_COND_LESSTHAN;
+    arglist[4].value = ten;
+    if(check_unordered_query(db, arglist, 5, printlevel))
+      goto error;
+
+    /* Equality in one dimension */
+    arglist[1].cond = WG_COND_EQUAL;
+    arglist[1].value = lo0;
+    if(check_unordered_query(db, arglist, 4, printlevel))
+      goto error;
+
+    /* Empty box */
+    arglist[0].value = hi0;
+    arglist[1].cond = WG_COND_LESSTHAN;
+    if(check_unordered_query(db, arglist, 4, printlevel))
+      goto error;
+
+    /* Integer bounds on the column of doubles */
+    arglist[0].value = lo0;
+    arglist[1].value = hi0;
+    arglist[2].value = ten;
+    arglist[3].value = hi0;
+    if(check_unordered_query(db, arglist, 4, printlevel))
+      goto error;
+
+    /* Update and delete rows */
+    i = 0;
+    rec = wg_get_first_record(db);
+    while(rec) {
+      next = wg_get_next_record(db, rec);
+      if(!(i % (3 - j))) {
+        if(wg_delete_record(db, rec)) {
+          if(printlevel)
+            printf("delete error\n");
+          goto error;
+        }
+      } else if(!(i % 7) && wg_get_record_len(db, rec) > 1) {
+        if(wg_set_field(db, rec, 1, wg_encode_double(db, (i % 700) / 10.0))) {
+          if(printlevel)
+            printf("update error\n");
+          goto error;
+        }
+      } else if(!(i % 11)) {
+        if(wg_set_field(db, rec, 0, wg_encode_str(db, "y", NULL))) {
+          if(printlevel)
+            printf("update error\n");
+          goto error;
+        }
+      }
+      i++;
+      rec = next;
+    }
+  }
+
+  /* All rows are deleted by now */
+  if(check_rtree_search(db, index_id, all, printlevel))
+    goto error;
+
+  wg_free_query_param(db, lo0);
+  wg_free_query_param(db, hi0);
+  wg_free_query_param(db, lo1);
+  wg_free_query_param(db, hi1);
+  wg_free_query_param(db, ten);
+
+  if(wg_drop_index(db, index_id)) {
+    if(printlevel)
+      printf("dropping R-tree index failed\n");
+    return -2;
+  }
+
+  if (printlevel>1)
+    printf("********* R-tree index test successful ********** \n");
+  return 0;
+
+error:
+  wg_free_query_param(db, lo0);
+  wg_free_query_param(db, hi0);
+  wg_free_query_param(db, lo1);
+  wg_free_query_param(db, hi1);
+  wg_free_query_param(db, ten);
+  return -2;
+}
+
+/** Count the rows in a T-tree index
+ */
+static int count_ttree_rows(void *db, gint index_id) {
+  wg_index_header *hdr = (wg_index_header *) offsettoptr(db, index_id);
+  gint tnode_offset;
+  int count = 0;
+
+#ifdef TTREE_CHAINED_NODES
+  tnode_offset = TTREE_MIN_NODE(hdr);
+#else
+  tnode_offset = wg_ttree_find_lub_node(db, TTREE_ROOT_NODE(hdr));
+#endif
+  while(tnode_offset) {
+    struct wg_tnode *node = \
+      (struct wg_tnode *) offsettoptr(db, tnode_offset);
+    count += node->number_of_elements;
+    tnode_offset = TNODE_SUCCESSOR(db, node);
+  }
+  return count;
+}
+
+/** Test deferred index updates
+ *  Rows are created and updated several times with index updates
+ *  deferred. Queries in between must see the current data and the
+ *  indexes must be complete after the updates are flushed.
+ */
+static gint wg_test_index10(void *db, int printlevel) {
+  const int dbsize = 2000;
+  int i, j, count;
+  void *rec, *next;
+  gint cols[2] = { 1, 0 };
+  gint index0, index10;
+  wg_query_arg arglist[2];
+
+  if (printlevel>1)
+    printf("********* testing deferred index updates ********** \n");
+
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_multi_index(db, cols, 2, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_index(db, 2, WG_INDEX_TYPE_BITMAP, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+  index0 = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0);
+  index10 = wg_multi_column_to_index_id(db, cols, 2,
+    WG_INDEX_TYPE_TTREE, NULL, 0);
+
+  if(wg_defer_indexes(db, 1)) {
+    if(printlevel)
+      printf("failed to start deferring index updates\n");
+    return -1;
+  }
+
+  /* Each field gets a temporary value first. The rows are not in
+   * the indexes until the updates are flushed. */
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, -1)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, -1)) ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, (i*7) % 1000)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 13)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i % 4))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+  if(count_ttree_rows(db, index0) != 0) {
+    if(printlevel)
+      printf("rows were indexed before flushing\n");
+    return -2;
+  }
+
+  /* Delete every 10th row while its index updates are pending */
+  rec = wg_get_first_record(db);
+  for(i=0; rec; i++) {
+    next = wg_get_next_record(db, rec);
+    if(!(i % 10) && wg_delete_record(db, rec)) {
+      if(printlevel)
+        printf("delete error\n");
+      return -1;
+    }
+    rec = next;
+  }
+  count = dbsize - dbsize/10;
+
+  /* A query flushes the pending updates */
+  arglist[0].column = 1;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 5);
+  arglist[1].column = 0;
+  arglist[1].cond = WG_COND_LESSTHAN;
+  arglist[1].value = wg_encode_query_param_int(db, 500);
+  if(check_unordered_query(db, arglist, 2, printlevel))
+    return -2;
+  if(count_ttree_rows(db, index0) != count ||\
+    count_ttree_rows(db, index10) != count) {
+    if(printlevel)
+      printf("indexes are incomplete after flushing\n");
+    return -2;
+  }
+
+  /* Update the rows again, some several times */
+  for(j=0; j<3; j++) {
+    rec = wg_get_first_record(db);
+    for(i=0; rec; i++) {
+      if(!((i+j) % 3) &&\
+        (wg_set_field(db, rec, 0, wg_encode_int(db, (i*11+j) % 1000)) ||\
+        wg_set_field(db, rec, 2, wg_encode_int(db, (i+j) % 4)))) {
+        if(printlevel)
+          printf("update error\n");
+        return -1;
+      }
+      rec = wg_get_next_record(db, rec);
+    }
+  }
+
+  if(wg_defer_indexes(db, 0)) {
+    if(printlevel)
+      printf("failed to flush deferred index updates\n");
+    return -2;
+  }
+  if(validate_index(db, wg_get_first_record(db), count, 0, printlevel) ||\
+    count_ttree_rows(db, index0) != count ||\
+    count_ttree_rows(db, index10) != count) {
+    if(printlevel)
+      printf("index validation failed after flushing\n");
+    return -2;
+  }
+  if(check_unordered_query(db, arglist, 2, printlevel))
+    return -2;
+  wg_free_query_param(db, arglist[0].value);
+  wg_free_query_param(db, arglist[1].value);
+  arglist[0].column = 2;
+  arglist[0].value = wg_encode_query_param_int(db, 2);
+  if(check_unordered_query(db, arglist, 1, printlevel))
+    return -2;
+  wg_free_query_param(db, arglist[0].value);
+
+  if (printlevel>1)
+    printf("********* deferred index update test successful ********** \n");
+  return 0;
+}
+
+/** Test online index creation
+ *  Indexes are built in small chunks, while rows are inserted,
+ *  updated and deleted between the chunks. The completed indexes
+ *  must contain exactly the current rows.
+ */
+static gint wg_test_index11(void *db, int printlevel) {
+  const int dbsize = 2000;
+  int i, chunks, count;
+  void *rec, *next;
+  gint col0 = 0, col2 = 2;
+  gint index0, index2, res0 = 0, res2 = 0, progress = 0;
+  wg_query_arg arglist[2];
+
+  if (printlevel>1)
+    printf("********* testing online index creation ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, (i*7) % 1000)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 13)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i % 4))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+  count = dbsize;
+
+  index0 = wg_start_index_build(db, &col0, 1, NULL, 0,
+    WG_INDEX_TYPE_TTREE, NULL, 0);
+  index2 = wg_start_index_build(db, &col2, 1, NULL, 0,
+    WG_INDEX_TYPE_BITMAP, NULL, 0);
+  if(index0 <= 0 || index2 <= 0) {
+    if(printlevel)
+      printf("failed to start index build\n");
+    return -3;
+  }
+  if(wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0) != -1) {
+    if(printlevel)
+      printf("index was in use before the build was completed\n");
+    return -2;
+  }
+
+  for(chunks=0; !res0 || !res2; chunks++) {
+    gint p;
+    if(!res0)
+      res0 = wg_continue_index_build(db, index0, 150);
+    if(!res2)
+      res2 = wg_continue_index_build(db, index2, 250);
+    if(res0 < 0 || res2 < 0) {
+      if(printlevel)
+        printf("index build failed\n");
+      return -2;
+    }
+    p = wg_index_build_progress(db, index0);
+    if(p < progress || p > 100) {
+      if(printlevel)
+        printf("invalid build progress %d\n", (int) p);
+      return -2;
+    }
+    progress = p;
+
+    /* Modify rows on both sides of the scan position */
+    rec = wg_get_first_record(db);
+    for(i=0; rec; i++) {
+      next = wg_get_next_record(db, rec);
+      if(!((i+chunks) % 17)) {
+        if(wg_delete_record(db, rec)) {
+          if(printlevel)
+            printf("delete error\n");
+          return -1;
+        }
+        count--;
+      } else if(!((i+chunks) % 5)) {
+        if(wg_set_field(db, rec, 0, wg_encode_int(db, (i*11+chunks) % 1000)) ||\
+          wg_set_field(db, rec, 2, wg_encode_int(db, (i+chunks) % 4))) {
+          if(printlevel)
+            printf("update error\n");
+          return -1;
+        }
+      }
+      rec = next;
+    }
+    for(i=0; i<20; i++) {
+      rec = wg_create_record(db, 3);
+      if(!rec ||\
+        wg_set_field(db, rec, 0, wg_encode_int(db, (i*13+chunks) % 1000)) ||\
+        wg_set_field(db, rec, 1, wg_encode_int(db, i % 13)) ||\
+        wg_set_field(db, rec, 2, wg_encode_int(db, i % 4))) {
+        if(printlevel)
+          printf("insert error\n");
+        return -1;
+      }
+    }
+    count += 20;
+  }
+
+  if(wg_index_build_progress(db, index0) != 100 ||\
+    wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0) != index0 ||\
+    wg_column_to_index_id(db, 2, WG_INDEX_TYPE_BITMAP, NULL, 0) != index2) {
+    if(printlevel)
+      printf("index not in use after the build\n");
+    return -2;
+  }
+  if(validate_index(db, wg_get_first_record(db), count, 0, printlevel) ||\
+    count_ttree_rows(db, index0) != count) {
+    if(printlevel)
+      printf("index validation failed after online build\n");
+    return -2;
+  }
+
+  arglist[0].column = 2;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 1);
+  arglist[1].column = 0;
+  arglist[1].cond = WG_COND_LESSTHAN;
+  arglist[1].value = wg_encode_query_param_int(db, 500);
+  if(check_unordered_query(db, arglist, 2, printlevel))
+    return -2;
+  wg_free_query_param(db, arglist[0].value);
+  wg_free_query_param(db, arglist[1].value);
+
+  /* An index that is being built can be dropped */
+  index0 = wg_start_index_build(db, &col2, 1, NULL, 0,
+    WG_INDEX_TYPE_TTREE, NULL, 0);
+  if(index0 <= 0 || wg_continue_index_build(db, index0, 10) ||\
+    wg_drop_index(db, index0) ||\
+    wg_index_build_progress(db, index0) != -1) {
+    if(printlevel)
+      printf("failed to drop an index during the build\n");
+    return -2;
+  }
+
+  if (printlevel>1)
+    printf("********* online index creation test successful ********** \n");
+  return 0;
+}
+
+/** Check the histogram of index statistics
+ *  returns the total rows in the buckets, -1 if the histogram is invalid.
+ */
+static int check_histogram(wg_index_stats *stats, double min, double max) {
+  int i, total = 0;
+  if(stats->buckets < 1 || stats->buckets > WG_INDEX_HIST_BUCKETS ||\
+    stats->bound[0] != min || stats->bound[stats->buckets] != max)
+    return -1;
+  for(i=0; i<stats->buckets; i++) {
+    if(stats->bound[i] > stats->bound[i+1] || stats->bucket_rows[i] < 0)
+      return -1;
+    total += stats->bucket_rows[i];
+  }
+  return total;
+}
+
+/** Test index statistics
+ *  Checks the row counts, distinct value estimates, NULL counts
+ *  and histograms after creating the index, after updates and
+ *  after refreshing the statistics.
+ */
+static gint wg_test_index12(void *db, int printlevel) {
+  const int dbsize = 4000;
+  int i, deleted = 0;
+  void *rec, *next;
+  gint index0, index1, index2;
+  wg_index_stats stats;
+
+  if (printlevel>1)
+    printf("********* testing index statistics ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 2)) ||\
+      ((i % 4) && wg_set_field(db, rec, 2, wg_encode_double(db, i % 100)))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_index(db, 1, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_index(db, 2, WG_INDEX_TYPE_HASH, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+  index0 = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0);
+  index1 = wg_column_to_index_id(db, 1, WG_INDEX_TYPE_TTREE, NULL, 0);
+  index2 = wg_column_to_index_id(db, 2, WG_INDEX_TYPE_HASH, NULL, 0);
+
+  /* Unique column: the estimate should be within 10% */
+  if(wg_get_index_stats(db, index0, &stats) || stats.rows != dbsize ||\
+    stats.nulls != 0 ||\
+    stats.distinct < dbsize*9/10 || stats.distinct > dbsize ||\
+    check_histogram(&stats, 0, dbsize-1) != dbsize) {
+    if(printlevel)
+      printf("invalid statistics for a unique column: rows %d distinct %d\n",
+        (int) stats.rows, (int) stats.distinct);
+    return -2;
+  }
+  for(i=0; i<stats.buckets; i++) {
+    if(stats.bucket_rows[i] < dbsize/WG_INDEX_HIST_BUCKETS - 1 ||\
+      stats.bucket_rows[i] > dbsize/WG_INDEX_HIST_BUCKETS + 1) {
+      if(printlevel)
+        printf("histogram is not equi-depth\n");
+      return -2;
+    }
+  }
+
+  /* Two values, and 75 values and NULL */
+  if(wg_get_index_stats(db, index1, &stats) || stats.rows != dbsize ||\
+    stats.distinct != 2 || check_histogram(&stats, 0, 1) != dbsize) {
+    if(printlevel)
+      printf("invalid statistics for a boolean column: distinct %d\n",
+        (int) stats.distinct);
+    return -2;
+  }
+  if(wg_get_index_stats(db, index2, &stats) || stats.rows != dbsize ||\
+    stats.nulls != dbsize/4 ||\
+    stats.distinct < 70 || stats.distinct > 82 ||\
+    check_histogram(&stats, 1, 99) != dbsize - dbsize/4) {
+    if(printlevel)
+      printf("invalid statistics for a column with NULLs: "\
+        "nulls %d distinct %d\n", (int) stats.nulls, (int) stats.distinct);
+    return -2;
+  }
+
+  /* Counts are updated with the data */
+  rec = wg_get_first_record(db);
+  for(i=0; rec; i++) {
+    next = wg_get_next_record(db, rec);
+    if(!(i % 3)) {
+      if(wg_delete_record(db, rec)) {
+        if(printlevel)
+          printf("delete error\n");
+        return -1;
+      }
+      deleted++;
+    } else if(!(i % 5)) {
+      if(wg_set_field(db, rec, 0, wg_encode_int(db, dbsize + i))) {
+        if(printlevel)
+          printf("update error\n");
+        return -1;
+      }
+    }
+    rec = next;
+  }
+  /* The histogram range is only extended until refreshed */
+  if(wg_get_index_stats(db, index0, &stats) ||\
+    stats.rows != dbsize - deleted ||\
+    check_histogram(&stats, 0, 2*dbsize - 5) != dbsize - deleted) {
+    if(printlevel)
+      printf("statistics not updated\n");
+    return -2;
+  }
+
+  if(wg_refresh_index_stats(db, index0) ||\
+    wg_get_index_stats(db, index0, &stats) ||\
+    stats.rows != dbsize - deleted ||\
+    stats.distinct < (dbsize - deleted)*9/10 ||\
+    stats.distinct > dbsize - deleted ||\
+    check_histogram(&stats, 1, 2*dbsize - 5) != dbsize - deleted) {
+    if(printlevel)
+      printf("invalid statistics after refresh\n");
+    return -2;
+  }
+
+  if(wg_get_index_stats(db, -1, &stats) != -1) {
+    if(printlevel)
+      printf("statistics returned for an invalid index\n");
+    return -2;
+  }
+
+  if (printlevel>1)
+    printf("********* index statistics test successful ********** \n");
+  return 0;
+}
+
+/** Check the plan and the rows of a query
+ *  returns 0 if the query has the expected plan and rows, -1 otherwise.
+ */
+static int check_planned_query(void *db, wg_query_arg *arglist, gint argc,
+  gint plan_type, int rows, int printlevel) {
+  wg_query *query;
+  void *rec;
+  int count = 0;
+
+  query = wg_make_query(db, NULL, 0, arglist, argc);
+  if(!query) {
+    if(printlevel)
+      printf("query failed\n");
+    return -1;
+  }
+  if(query->plan.type != plan_type) {
+    if(printlevel)
+      printf("expected plan %d, got %d (cost %f rows %f)\n",
+        (int) plan_type, (int) query->plan.type,
+        query->plan.cost, query->plan.rows);
+    wg_free_query(db, query);
+    return -1;
+  }
+  while((rec = wg_fetch(db, query))) {
+    gint i;
+    for(i=0; i<argc; i++) {
+      gint enc = wg_get_field(db, rec, arglist[i].column);
+      if((arglist[i].cond == WG_COND_EQUAL &&\
+        WG_COMPARE(db, enc, arglist[i].value) != WG_EQUAL) ||\
+        (arglist[i].cond == WG_COND_GTEQUAL &&\
+        WG_COMPARE(db, enc, arglist[i].value) == WG_LESSTHAN)) {
+        if(printlevel)
+          printf("query returned a row that does not match\n");
+        wg_free_query(db, query);
+        return -1;
+      }
+    }
+    count++;
+  }
+  wg_free_query(db, query);
+  if(count != rows) {
+    if(printlevel)
+      printf("expected %d rows, got %d\n", rows, count);
+    return -1;
+  }
+  return 0;
+}
+
+/** Test the query planner
+ *  Checks that the plans follow the selectivity of the conditions
+ *  and that each kind of plan gives the correct rows.
+ */
+static gint wg_test_index13(void *db, int printlevel) {
+  const int dbsize = 4000;
+  int i;
+  void *rec;
+  gint index0;
+  wg_query_arg arglist[2];
+
+  if (printlevel>1)
+    printf("********* testing query planner ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 4);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 2)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i % 40)) ||\
+      wg_set_field(db, rec, 3, wg_encode_int(db, (i / 40) % 40))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+
+  /* No indexes */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 17);
+  if(check_planned_query(db, arglist, 1, WG_QPLAN_SCAN, 1, printlevel))
+    return -2;
+
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_index(db, 1, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_index(db, 2, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_index(db, 3, WG_INDEX_TYPE_HASH, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+  index0 = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0);
+
+  /* Unique column */
+  if(check_planned_query(db, arglist, 1, WG_QPLAN_TTREE, 1, printlevel))
+    return -2;
+
+  /* Range that covers the whole index is cheaper to scan */
+  arglist[0].column = 1;
+  arglist[0].cond = WG_COND_GTEQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 0);
+  if(check_planned_query(db, arglist, 1, WG_QPLAN_SCAN, dbsize,
+    printlevel))
+    return -2;
+
+  /* Hash index alone (3 blocks of 40 rows) */
+  arglist[0].column = 3;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 3);
+  if(check_planned_query(db, arglist, 1, WG_QPLAN_HASH, 120, printlevel))
+    return -2;
+
+  /* Neither column is selective, the combination is (3 rows) */
+  arglist[1].column = 2;
+  arglist[1].cond = WG_COND_EQUAL;
+  arglist[1].value = wg_encode_query_param_int(db, 7);
+  if(check_planned_query(db, arglist, 2, WG_QPLAN_INTERSECT, 3,
+    printlevel))
+    return -2;
+
+  /* The plan changes with the indexes */
+  if(wg_drop_index(db, index0)) {
+    if(printlevel)
+      printf("failed to drop an index\n");
+    return -3;
+  }
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 17);
+  if(check_planned_query(db, arglist, 1, WG_QPLAN_SCAN, 1, printlevel))
+    return -2;
+
+  if (printlevel>1)
+    printf("********* query planner test successful ********** \n");
+  return 0;
+}
+
+/** Count the rows of a query
+ *  If plan_type is not -1, the query is expected to have that plan.
+ *  If column is not -1, the rows are expected in ascending order
+ *  of the column.
+ *  returns the number of rows, -1 on error.
+ */
+static int count_query_rows(void *db, wg_query_arg *arglist, gint argc,
+  gint plan_type, gint column, int printlevel) {
+  wg_query *query;
+  void *rec;
+  int count = 0;
+  gint prev = WG_ILLEGAL;
+
+  query = wg_make_query(db, NULL, 0, arglist, argc);
+  if(!query) {
+    if(printlevel)
+      printf("query failed\n");
+    return -1;
+  }
+  if(plan_type != -1 && query->plan.type != plan_type) {
+    if(printlevel)
+      printf("expected plan %d, got %d\n", (int) plan_type,
+        (int) query->plan.type);
+    wg_free_query(db, query);
+    return -1;
+  }
+  while((rec = wg_fetch(db, query))) {
+    if(column != -1) {
+      gint enc = wg_get_field(db, rec, column);
+      if(prev != WG_ILLEGAL && WG_COMPARE(db, prev, enc) != WG_LESSTHAN) {
+        if(printlevel)
+          printf("rows are not in order\n");
+        wg_free_query(db, query);
+        return -1;
+      }
+      prev = enc;
+    }
+    count++;
+  }
+  wg_free_query(db, query);
+  return count;
+}
+
+/** Test lists of values and disjunctions in queries
+ *  Checks the rows and plans of WG_COND_IN queries using
+ *  T-tree and hash indexes and of disjunctions that are combined
+ *  into a list, or checked on the rows.
+ */
+static gint wg_test_index14(void *db, int printlevel) {
+  const int dbsize = 2000;
+  int i, expected, count;
+  void *rec;
+  gint values[5];
+  wg_query_arg arglist[4];
+
+  if (printlevel>1)
+    printf("********* testing lists and disjunctions in queries ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 100)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i % 7))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    wg_create_index(db, 1, WG_INDEX_TYPE_HASH, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+
+  /* Lookups of each value, in sorted order. Duplicates and
+   * missing values are ignored. */
+  values[0] = wg_encode_query_param_int(db, 1999);
+  values[1] = wg_encode_query_param_int(db, 5);
+  values[2] = wg_encode_query_param_int(db, 300);
+  values[3] = wg_encode_query_param_int(db, 5);
+  values[4] = wg_encode_query_param_int(db, 7000);
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_IN;
+  arglist[0].value = wg_encode_query_param_list(db, values, 5);
+  count = count_query_rows(db, arglist, 1, WG_QPLAN_PROBE, 0, printlevel);
+  wg_free_query_param(db, arglist[0].value);
+  if(count != 3) {
+    if(printlevel)
+      printf("T-tree list lookup failed\n");
+    return -2;
+  }
+
+  /* Hash index, with another condition */
+  values[0] = wg_encode_query_param_int(db, 50);
+  values[1] = wg_encode_query_param_int(db, 3);
+  arglist[0].column = 1;
+  arglist[0].value = wg_encode_query_param_list(db, values, 2);
+  arglist[1].column = 2;
+  arglist[1].cond = WG_COND_EQUAL;
+  arglist[1].value = wg_encode_query_param_int(db, 1);
+  for(i=0, expected=0; i<dbsize; i++) {
+    if((i % 100 == 50 || i % 100 == 3) && i % 7 == 1)
+      expected++;
+  }
+  count = count_query_rows(db, arglist, 2, WG_QPLAN_HASH, -1, printlevel);
+  wg_free_query_param(db, arglist[0].value);
+  if(count != expected) {
+    if(printlevel)
+      printf("hash list lookup failed\n");
+    return -2;
+  }
+
+  /* The same as a disjunction */
+  arglist[2] = arglist[1];
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = values[0];
+  arglist[1].column = 1;
+  arglist[1].cond = WG_COND_EQUAL|WG_COND_OR;
+  arglist[1].value = values[1];
+  if(count_query_rows(db, arglist, 3, WG_QPLAN_HASH, -1, printlevel) !=\
+    expected) {
+    if(printlevel)
+      printf("disjunction on a single column failed\n");
+    return -2;
+  }
+
+  /* Disjunction on different columns, with a range */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_GTEQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 100);
+  arglist[1].column = 0;
+  arglist[1].cond = WG_COND_LESSTHAN;
+  arglist[1].value = wg_encode_query_param_int(db, 200);
+  arglist[2].column = 1;
+  arglist[2].cond = WG_COND_EQUAL;
+  arglist[2].value = wg_encode_query_param_int(db, 5);
+  arglist[3].column = 2;
+  arglist[3].cond = WG_COND_EQUAL|WG_COND_OR;
+  arglist[3].value = wg_encode_query_param_int(db, 2);
+  for(i=100, expected=0; i<200; i++) {
+    if(i % 100 == 5 || i % 7 == 2)
+      expected++;
+  }
+  if(count_query_rows(db, arglist, 4, WG_QPLAN_TTREE, 0, printlevel) !=\
+    expected) {
+    if(printlevel)
+      printf("disjunction with a range failed\n");
+    return -2;
+  }
+
+  /* Only a disjunction */
+  arglist[0].cond = WG_COND_LESSTHAN;
+  arglist[0].value = wg_encode_query_param_int(db, 10);
+  arglist[1] = arglist[3];
+  for(i=0, expected=0; i<dbsize; i++) {
+    if(i < 10 || i % 7 == 2)
+      expected++;
+  }
+  if(count_query_rows(db, arglist, 2, WG_QPLAN_SCAN, -1, printlevel) !=\
+    expected) {
+    if(printlevel)
+      printf("disjunction on different columns failed\n");
+    return -2;
+  }
+
+  /* No index, empty list */
+  values[0] = wg_encode_query_param_int(db, 4);
+  values[1] = wg_encode_query_param_int(db, 1);
+  arglist[0].column = 2;
+  arglist[0].cond = WG_COND_IN;
+  arglist[0].value = wg_encode_query_param_list(db, values, 2);
+  for(i=0, expected=0; i<dbsize; i++) {
+    if(i % 7 == 4 || i % 7 == 1)
+      expected++;
+  }
+  count = count_query_rows(db, arglist, 1, WG_QPLAN_SCAN, -1, printlevel);
+  wg_free_query_param(db, arglist[0].value);
+  if(count != expected) {
+    if(printlevel)
+      printf("list without an index failed\n");
+    return -2;
+  }
+  arglist[0].column = 0;
+  arglist[0].value = wg_encode_query_param_list(db, NULL, 0);
+  count = count_query_rows(db, arglist, 1, -1, -1, printlevel);
+  wg_free_query_param(db, arglist[0].value);
+  if(count != 0) {
+    if(printlevel)
+      printf("empty list failed\n");
+    return -2;
+  }
+
+  if (printlevel>1)
+    printf("********* lists and disjunctions test successful ********** \n");
+  return 0;
+}
+
+/** Test aggregate queries
+ *  Compares the counts, sums, averages and extreme values to the
+ *  ones computed from the inserted data, with and without a T-tree
+ *  index range.
+ */
+static gint wg_test_index15(void *db, int printlevel) {
+  const int dbsize = 1000;
+  int i, nonnull;
+  void *rec;
+  wg_query_arg arglist[2];
+  wg_query_aggr specs[4];
+
+  if (printlevel>1)
+    printf("********* testing aggregate queries ********** \n");
+
+  for(i=0, nonnull=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_double(db, i % 10)) ||\
+      (i % 3 && wg_set_field(db, rec, 2, wg_encode_int(db, i)))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+    if(i % 3 && i >= 100 && i < 200)
+      nonnull++;
+  }
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+
+  /* Answered by the index */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_GTEQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 100);
+  arglist[1].column = 0;
+  arglist[1].cond = WG_COND_LESSTHAN;
+  arglist[1].value = wg_encode_query_param_int(db, 200);
+  specs[0].type = WG_AGGR_COUNT;
+  specs[0].column = -1;
+  specs[1].type = WG_AGGR_MIN;
+  specs[1].column = 0;
+  specs[2].type = WG_AGGR_MAX;
+  specs[2].column = 0;
+  if(wg_query_aggregate(db, NULL, 0, arglist, 2, specs, 3)) {
+    if(printlevel)
+      printf("aggregate query failed\n");
+    return -2;
+  }
+  if(specs[0].count != 100 ||\
+    wg_decode_int(db, specs[1].value) != 100 ||\
+    wg_decode_int(db, specs[2].value) != 199) {
+    if(printlevel)
+      printf("index range aggregates failed\n");
+    return -2;
+  }
+
+  /* Computed from the rows */
+  specs[0].type = WG_AGGR_SUM;
+  specs[0].column = 0;
+  specs[1].type = WG_AGGR_AVG;
+  specs[1].column = 1;
+  specs[2].type = WG_AGGR_COUNT;
+  specs[2].column = 2;
+  specs[3].type = WG_AGGR_MAX;
+  specs[3].column = 2;
+  if(wg_query_aggregate(db, NULL, 0, arglist, 2, specs, 4)) {
+    if(printlevel)
+      printf("aggregate query failed\n");
+    return -2;
+  }
+  if(specs[0].result != 14950 || specs[0].count != 100 ||\
+    specs[1].result != 4.5 || specs[2].count != nonnull ||\
+    wg_decode_int(db, specs[3].value) != 199) {
+    if(printlevel)
+      printf("row aggregates failed\n");
+    return -2;
+  }
+
+  /* All rows */
+  specs[0].type = WG_AGGR_COUNT;
+  specs[0].column = -1;
+  specs[1].type = WG_AGGR_MIN;
+  specs[1].column = 2;
+  specs[2].type = WG_AGGR_MAX;
+  specs[2].column = 1;
+  if(wg_query_aggregate(db, NULL, 0, NULL, 0, specs, 3)) {
+    if(printlevel)
+      printf("aggregate query failed\n");
+    return -2;
+  }
+  if(specs[0].count != dbsize ||\
+    wg_decode_int(db, specs[1].value) != 1 ||\
+    wg_decode_double(db, specs[2].value) != 9) {
+    if(printlevel)
+      printf("aggregates of all rows failed\n");
+    return -2;
+  }
+
+  /* No rows */
+  arglist[0].value = wg_encode_query_param_int(db, 5000);
+  arglist[1].value = wg_encode_query_param_int(db, 6000);
+  if(wg_query_aggregate(db, NULL, 0, arglist, 2, specs, 3)) {
+    if(printlevel)
+      printf("aggregate query failed\n");
+    return -2;
+  }
+  if(specs[0].count != 0 || specs[1].value != WG_ILLEGAL ||\
+    specs[2].count != 0) {
+    if(printlevel)
+      printf("aggregates of an empty range failed\n");
+    return -2;
+  }
+
+  if (printlevel>1)
+    printf("********* aggregate test successful ********** \n");
+  return 0;
+}
+
+/** Group the slices of a query and merge them
+ *  Every slice is expected to have rows.
+ *  returns the merged groups, NULL on error.
+ */
+static wg_query_groups *group_query_parts(void *db, wg_query *query,
+  int parts, gint *columns, wg_query_aggr *specs, gint count) {
+  wg_query_groups *groups = NULL, *part;
+  int i;
+
+  for(i=0; i<parts; i++) {
+    part = wg_query_group_part(db, query, i, parts, columns, 1,
+      specs, count);
+    if(part && !part->groups) {
+      wg_free_query_groups(db, part);
+      part = NULL;
+    }
+    if(part && groups) {
+      gint err = wg_merge_query_groups(db, groups, part);
+      wg_free_query_groups(db, part);
+      if(err)
+        part = NULL;
+    } else if(part)
+      groups = part;
+    if(!part) {
+      if(groups)
+        wg_free_query_groups(db, groups);
+      return NULL;
+    }
+  }
+  return groups;
+}
+
+/** Test grouped aggregate queries
+ *  Groups by integer and string columns, with NULL keys, merges
+ *  the groups of two halves of the rows and the groups of the
+ *  slices of T-tree, full scan and prefetched queries.
+ */
+static gint wg_test_index16(void *db, int printlevel) {
+  const int dbsize = 3000;
+  int i, j, n, counts[7][6], maxs[7];
+  gint qtypes[] = { WG_QTYPE_TTREE, WG_QTYPE_SCAN, WG_QTYPE_PREFETCH };
+  double sums[7];
+  char buf[10];
+  void *rec;
+  gint columns[2];
+  wg_query *query;
+  wg_query_arg arglist[1];
+  wg_query_aggr specs[4];
+  wg_query_groups *groups, *part;
+  wg_prepared_query *pq;
+
+  if (printlevel>1)
+    printf("********* testing grouped aggregates ********** \n");
+
+  memset(counts, 0, sizeof(counts));
+  memset(sums, 0, sizeof(sums));
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    sprintf(buf, "key%d", i % 5);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 7)) ||\
+      (i % 11 && wg_set_field(db, rec, 2, wg_encode_str(db, buf, NULL)))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+    counts[i % 7][i % 11 ? i % 5 : 5]++;
+    sums[i % 7] += i;
+    maxs[i % 7] = i;
+  }
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+
+  /* Single column */
+  columns[0] = 1;
+  specs[0].type = WG_AGGR_COUNT;
+  specs[0].column = -1;
+  specs[1].type = WG_AGGR_SUM;
+  specs[1].column = 0;
+  specs[2].type = WG_AGGR_MAX;
+  specs[2].column = 0;
+  specs[3].type = WG_AGGR_AVG;
+  specs[3].column = 0;
+  query = wg_make_query(db, NULL, 0, NULL, 0);
+  groups = (query ? wg_query_group(db, query, columns, 1, specs, 4) : NULL);
+  if(query)
+    wg_free_query(db, query);
+  if(!groups) {
+    if(printlevel)
+      printf("group query failed\n");
+    return -2;
+  }
+  if(groups->groups != 7) {
+    if(printlevel)
+      printf("expected 7 groups, got %d\n", (int) groups->groups);
+    wg_free_query_groups(db, groups);
+    return -2;
+  }
+  for(i=0; i<groups->groups; i++) {
+    int k = wg_decode_int(db, groups->keys[i]), cnt = 0;
+    wg_query_aggr *aggr = &groups->aggr[i * 4];
+    for(j=0; j<6; j++)
+      cnt += counts[k][j];
+    if(aggr[0].count != cnt || aggr[1].result != sums[k] ||\
+      wg_decode_int(db, aggr[2].value) != maxs[k] ||\
+      aggr[3].result != sums[k] / cnt) {
+      if(printlevel)
+        printf("aggregates of group %d do not match\n", k);
+      wg_free_query_groups(db, groups);
+      return -2;
+    }
+  }
+
+  /* Two halves, merged */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_LESSTHAN;
+  arglist[0].value = wg_encode_query_param_int(db, dbsize/2);
+  query = wg_make_query(db, NULL, 0, arglist, 1);
+  part = (query ? wg_query_group(db, query, columns, 1, specs, 4) : NULL);
+  if(query)
+    wg_free_query(db, query);
+  arglist[0].cond = WG_COND_GTEQUAL;
+  query = wg_make_query(db, NULL, 0, arglist, 1);
+  if(!part || !query) {
+    if(printlevel)
+      printf("group query failed\n");
+    return -2;
+  }
+  wg_free_query_groups(db, groups);
+  groups = wg_query_group(db, query, columns, 1, specs, 4);
+  wg_free_query(db, query);
+  if(!groups || wg_merge_query_groups(db, groups, part)) {
+    if(printlevel)
+      printf("merging groups failed\n");
+    return -2;
+  }
+  wg_free_query_groups(db, part);
+  for(i=0; i<groups->groups; i++) {
+    int k = wg_decode_int(db, groups->keys[i]), cnt = 0;
+    wg_query_aggr *aggr = &groups->aggr[i * 4];
+    for(j=0; j<6; j++)
+      cnt += counts[k][j];
+    if(aggr[0].count != cnt || aggr[1].result != sums[k] ||\
+      wg_decode_int(db, aggr[2].value) != maxs[k] ||\
+      aggr[3].result != sums[k] / cnt) {
+      if(printlevel)
+        printf("merged aggregates of group %d do not match\n", k);
+      wg_free_query_groups(db, groups);
+      return -2;
+    }
+  }
+  wg_free_query_groups(db, groups);
+
+  /* Slices of a T-tree range, a full scan and a prefetched query,
+   * compared to grouping the same rows at once */
+  arglist[0].cond = WG_COND_LESSTHAN;
+  arglist[0].value = wg_encode_query_param_int(db, 300);
+  for(n=0; n<3; n++) {
+    wg_query_arg *args = (n == 1 ? NULL : arglist);
+    gint argc = (n == 1 ? 0 : 1);
+    pq = NULL;
+    if(n == 2)
+      query = wg_make_query(db, NULL, 0, args, argc);
+    else {
+      pq = wg_prepare_query(db, NULL, 0, args, argc);
+      query = (pq ? wg_exec_query(db, pq) : NULL);
+    }
+    if(!query || query->qtype != qtypes[n]) {
+      if(printlevel)
+        printf("query %d: wrong query type\n", n);
+      if(n == 2 && query)
+        wg_free_query(db, query);
+      if(pq)
+        wg_free_prepared_query(db, pq);
+      return -2;
+    }
+    groups = group_query_parts(db, query, 3 + n, columns, specs, 4);
+    if(pq)
+      wg_free_prepared_query(db, pq);
+    else
+      wg_free_query(db, query);
+    query = wg_make_query(db, NULL, 0, args, argc);
+    part = (query ? wg_query_group(db, query, columns, 1, specs, 4) : NULL);
+    if(query)
+      wg_free_query(db, query);
+    if(!groups || !part || groups->groups != part->groups) {
+      if(printlevel)
+        printf("query %d: grouping slices failed\n", n);
+      if(groups)
+        wg_free_query_groups(db, groups);
+      if(part)
+        wg_free_query_groups(db, part);
+      return -2;
+    }
+    for(i=0; i<groups->groups; i++) {
+      wg_query_aggr *aggr = &groups->aggr[i * 4], *ref = NULL;
+      double diff;
+      for(j=0; j<part->groups; j++) {
+        if(part->keys[j] == groups->keys[i])
+          ref = &part->aggr[j * 4];
+      }
+      diff = (ref ? aggr[3].result - ref[3].result : 1);
+      if(!ref || aggr[0].count != ref[0].count ||\
+        aggr[1].result != ref[1].result || aggr[2].value != ref[2].value ||\
+        diff > 1e-9 || diff < -1e-9) {
+        if(printlevel)
+          printf("query %d: aggregates of group %d do not match\n", n,
+            (int) wg_decode_int(db, groups->keys[i]));
+        wg_free_query_groups(db, groups);
+        wg_free_query_groups(db, part);
+        return -2;
+      }
+    }
+    wg_free_query_groups(db, groups);
+    wg_free_query_groups(db, part);
+  }
+
+  /* Two columns, a string and a NULL key */
+  columns[1] = 2;
+  query = wg_make_query(db, NULL, 0, NULL, 0);
+  groups = (query ? wg_query_group(db, query, columns, 2, specs, 1) : NULL);
+  if(query)
+    wg_free_query(db, query);
+  if(!groups || groups->groups != 7*6) {
+    if(printlevel)
+      printf("grouping by two columns failed\n");
+    return -2;
+  }
+  for(i=0; i<groups->groups; i++) {
+    int k = wg_decode_int(db, groups->keys[i * 2]);
+    gint enc = groups->keys[i * 2 + 1];
+    j = (enc ? wg_decode_str(db, enc)[3] - '0' : 5);
+    if(groups->aggr[i].count != counts[k][j]) {
+      if(printlevel)
+        printf("group %d, %d does not match\n", k, j);
+      wg_free_query_groups(db, groups);
+      return -2;
+    }
+  }
+  wg_free_query_groups(db, groups);
+
+  /* Many groups */
+  columns[0] = 0;
+  query = wg_make_query(db, NULL, 0, NULL, 0);
+  groups = (query ? wg_query_group(db, query, columns, 1, specs, 1) : NULL);
+  if(query)
+    wg_free_query(db, query);
+  if(!groups || groups->groups != dbsize) {
+    if(printlevel)
+      printf("grouping by a unique column failed\n");
+    return -2;
+  }
+  for(i=0; i<groups->groups; i++) {
+    if(groups->aggr[i].count != 1) {
+      if(printlevel)
+        printf("unique group has %d rows\n", (int) groups->aggr[i].count);
+      wg_free_query_groups(db, groups);
+      return -2;
+    }
+  }
+  wg_free_query_groups(db, groups);
+
+  if (printlevel>1)
+    printf("********* grouped aggregates test successful ********** \n");
+  return 0;
+}
+
+/** Compare the rows of an ordered query to the expected values
+ *  returns 0 if the column has the expected values, -1 otherwise.
+ */
+static int check_ordered_rows(void *db, wg_query *query, gint column,
+  int *expected, int count, int printlevel) {
+  void *rec;
+  int i = 0;
+
+  while((rec = wg_fetch(db, query))) {
+    int val = wg_decode_int(db, wg_get_field(db, rec, column));
+    if(i >= count || val != expected[i]) {
+      if(printlevel)
+        printf("row %d: expected %d, got %d\n", i,
+          (i < count ? expected[i] : -1), val);
+      return -1;
+    }
+    i++;
+  }
+  if(i != count) {
+    if(printlevel)
+      printf("expected %d rows, got %d\n", count, i);
+    return -1;
+  }
+  return 0;
+}
+
+/** Sort integers for the expected results of ordered queries
+ */
+static void sort_expected(int *values, int count, int desc) {
+  int i, j;
+  for(i=1; i<count; i++) {
+    int tmp = values[i];
+    for(j=i; j>0 && (desc ? values[j-1] < tmp : values[j-1] > tmp); j--)
+      values[j] = values[j-1];
+    values[j] = tmp;
+  }
+}
+
+/** Test ordered queries with a row limit
+ *  Checks the order and the rows returned when the order is given
+ *  by a T-tree index, in both directions, and when the rows are
+ *  sorted by the query.
+ */
+static gint wg_test_index17(void *db, int printlevel) {
+  const int dbsize = 2000;
+  int i, count, expected[2000];
+  void *rec;
+  wg_query *query;
+  wg_query_arg arglist[2];
+
+  if (printlevel>1)
+    printf("********* testing ordered queries ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    /* every 50th row has only the first column */
+    rec = wg_create_record(db, (i % 50 ? 3 : 1));
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, (i * 7919) % dbsize)) ||\
+      (i % 50 && (wg_set_field(db, rec, 1, wg_encode_int(db, i % 10)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i))))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+
+  /* Index, backwards */
+  query = wg_make_ordered_query(db, NULL, 0, NULL, 0, 0, WG_ORDER_DESC, 5);
+  for(i=0; i<5; i++)
+    expected[i] = dbsize - 1 - i;
+  if(!query || query->plan.type != WG_QPLAN_TTREE ||\
+    check_ordered_rows(db, query, 0, expected, 5, printlevel)) {
+    if(printlevel)
+      printf("descending index order failed\n");
+    if(query)
+      wg_free_query(db, query);
+    return -2;
+  }
+  wg_free_query(db, query);
+
+  /* Index range, backwards */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_GTEQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 1990);
+  arglist[1].column = 0;
+  arglist[1].cond = WG_COND_LESSTHAN;
+  arglist[1].value = wg_encode_query_param_int(db, 1995);
+  query = wg_make_ordered_query(db, NULL, 0, arglist, 2, 0,
+    WG_ORDER_DESC, 0);
+  for(i=0; i<5; i++)
+    expected[i] = 1994 - i;
+  if(!query || check_ordered_rows(db, query, 0, expected, 5, printlevel)) {
+    if(printlevel)
+      printf("descending index range failed\n");
+    if(query)
+      wg_free_query(db, query);
+    return -2;
+  }
+  wg_free_query(db, query);
+
+  /* Index order with a condition on another column */
+  arglist[0].column = 1;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 3);
+  for(i=0, count=0; i<dbsize; i++) {
+    if(i % 50 && i % 10 == 3)
+      expected[count++] = (i * 7919) % dbsize;
+  }
+  sort_expected(expected, count, 0);
+  query = wg_make_ordered_query(db, NULL, 0, arglist, 1, 0,
+    WG_ORDER_ASC, 10);
+  if(!query || check_ordered_rows(db, query, 0, expected, 10, printlevel)) {
+    if(printlevel)
+      printf("ascending order with a condition failed\n");
+    if(query)
+      wg_free_query(db, query);
+    return -2;
+  }
+  wg_free_query(db, query);
+
+  /* Sorted by the query */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_LESSTHAN;
+  arglist[0].value = wg_encode_query_param_int(db, 1000);
+  for(i=0, count=0; i<dbsize; i++) {
+    if(i % 50 && (i * 7919) % dbsize < 1000)
+      expected[count++] = i;
+  }
+  sort_expected(expected, count, 1);
+  query = wg_make_ordered_query(db, NULL, 0, arglist, 1, 2,
+    WG_ORDER_DESC, 7);
+  if(!query || check_ordered_rows(db, query, 2, expected, 7, printlevel)) {
+    if(printlevel)
+      printf("descending order of a column without index failed\n");
+    if(query)
+      wg_free_query(db, query);
+    return -2;
+  }
+  wg_free_query(db, query);
+
+  /* All rows, sorted */
+  for(i=0, count=0; i<dbsize; i++) {
+    if(i % 50)
+      expected[count++] = i % 10;
+  }
+  sort_expected(expected, count, 0);
+  query = wg_make_ordered_query(db, NULL, 0, NULL, 0, 1, WG_ORDER_ASC, 0);
+  if(!query ||\
+    check_ordered_rows(db, query, 1, expected, count, printlevel)) {
+    if(printlevel)
+      printf("ascending order of all rows failed\n");
+    if(query)
+      wg_free_query(db, query);
+    return -2;
+  }
+  wg_free_query(db, query);
+
+  if (printlevel>1)
+    printf("********* ordered queries test successful ********** \n");
+  return 0;
+}
+
+/** Run a join and check the pairs
+ *  The left rows are the orders, joined to the customers of
+ *  region 1, either by the customer id or by reference.
+ *  returns the number of pairs, -1 on error.
+ */
+static int check_join(void *db, gint right_column, gint join_type,
+  int printlevel) {
+  wg_query *left;
+  wg_join *join;
+  wg_query_arg arglist[2];
+  void *rec, *right;
+  int count = 0;
+
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 2);
+  left = wg_make_query(db, NULL, 0, arglist, 1);
+  if(!left)
+    return -1;
+  arglist[0].value = wg_encode_query_param_int(db, 1);
+  arglist[1].column = 2;
+  arglist[1].cond = WG_COND_EQUAL;
+  arglist[1].value = wg_encode_query_param_int(db, 1);
+  join = wg_make_join(db, left, (right_column < 0 ? 3 : 2),
+    arglist, 2, right_column);
+  if(!join || join->type != join_type) {
+    if(printlevel)
+      printf("expected join type %d, got %d\n", (int) join_type,
+        (int) (join ? join->type : -1));
+    if(join)
+      wg_free_join(db, join);
+    wg_free_query(db, left);
+    return -1;
+  }
+  while((rec = wg_fetch_join(db, join, &right))) {
+    if(wg_decode_int(db, wg_get_field(db, right, 0)) != 1 ||\
+      wg_decode_int(db, wg_get_field(db, right, 2)) != 1 ||\
+      wg_decode_int(db, wg_get_field(db, right, 1)) !=\
+      wg_decode_int(db, wg_get_field(db, rec, 2))) {
+      if(printlevel)
+        printf("rows of a pair do not match\n");
+      count = -1;
+      break;
+    }
+    if(join_type == WG_JOIN_INDEX && join->inner->qtype == WG_QTYPE_SCAN) {
+      if(printlevel)
+        printf("index lookup was run as a full scan\n");
+      count = -1;
+      break;
+    }
+    count++;
+  }
+  wg_free_join(db, join);
+  wg_free_query(db, left);
+  return count;
+}
+
+/** Test joins
+ *  Joins orders to customers with the hash join, with index lookups
+ *  using T-tree and hash indexes and by following references.
+ */
+static gint wg_test_index18(void *db, int printlevel) {
+  int i, expected = 0;
+  void *rec, *customers[100];
+  gint index_id;
+
+  if (printlevel>1)
+    printf("********* testing joins ********** \n");
+
+  /* customers: 1, id, region */
+  for(i=0; i<100; i++) {
+    rec = customers[i] = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, 1)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i % 4))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+  /* orders: 2, order number, customer id, customer record.
+   * Ids above 99 have no customer. */
+  for(i=0; i<1000; i++) {
+    rec = wg_create_record(db, 4);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, 2)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i % 150)) ||\
+      (i % 150 < 100 && wg_set_field(db, rec, 3,
+        wg_encode_record(db, customers[i % 150])))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+    if(i % 150 < 100 && (i % 150) % 4 == 1)
+      expected++;
+  }
+
+  if(check_join(db, 1, WG_JOIN_HASH, printlevel) != expected) {
+    if(printlevel)
+      printf("hash join failed\n");
+    return -2;
+  }
+  if(check_join(db, -1, WG_JOIN_REFERENCE, printlevel) != expected) {
+    if(printlevel)
+      printf("reference join failed\n");
+    return -2;
+  }
+
+  if(wg_create_index(db, 1, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+  if(check_join(db, 1, WG_JOIN_INDEX, printlevel) != expected) {
+    if(printlevel)
+      printf("join using a T-tree index failed\n");
+    return -2;
+  }
+  index_id = wg_column_to_index_id(db, 1, WG_INDEX_TYPE_TTREE, NULL, 0);
+  if(index_id < 1 || wg_drop_index(db, index_id) ||\
+    wg_create_index(db, 1, WG_INDEX_TYPE_HASH, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+  if(check_join(db, 1, WG_JOIN_INDEX, printlevel) != expected) {
+    if(printlevel)
+      printf("join using a hash index failed\n");
+    return -2;
+  }
+
+  if (printlevel>1)
+    printf("********* joins test successful ********** \n");
+  return 0;
+}
+
+/** Count the rows of an execution of a prepared query
+ *  returns the number of rows, -1 on error.
+ */
+static int count_prepared_rows(void *db, wg_prepared_query *pq,
+  gint plan_type, int printlevel) {
+  wg_query *query = wg_exec_query(db, pq);
+  int count = 0;
+
+  if(!query)
+    return -1;
+  if(query->plan.type != plan_type) {
+    if(printlevel)
+      printf("expected plan type %d, got %d\n", (int) plan_type,
+        (int) query->plan.type);
+    return -1;
+  }
+  while(wg_fetch(db, query))
+    count++;
+  return count;
+}
+
+/** Test prepared queries
+ *  Runs the same queries with different bound values, before and
+ *  after creating an index.
+ */
+static gint wg_test_index19(void *db, int printlevel) {
+  int i, j, k, expected, dbsize = 500;
+  void *rec;
+  wg_prepared_query *pq;
+  wg_query_arg arglist[2];
+  gint matchrec[3], values[5], list;
+
+  if (printlevel>1)
+    printf("********* testing prepared queries ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i % 20)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 7)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+
+  /* col0 = ? and col1 >= ? */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 0);
+  arglist[1].column = 1;
+  arglist[1].cond = WG_COND_GTEQUAL;
+  arglist[1].value = wg_encode_query_param_int(db, 0);
+  pq = wg_prepare_query(db, NULL, 0, arglist, 2);
+  if(!pq) {
+    if(printlevel)
+      printf("failed to prepare a query\n");
+    return -2;
+  }
+  for(k=0; k<2; k++) {
+    for(i=0; i<20; i+=3) {
+      for(j=0; j<7; j+=2) {
+        int l;
+        for(l=0, expected=0; l<dbsize; l++) {
+          if(l % 20 == i && l % 7 >= j)
+            expected++;
+        }
+        if(wg_bind_query(db, pq, 0, wg_encode_query_param_int(db, i)) ||\
+          wg_bind_query(db, pq, 1, wg_encode_query_param_int(db, j)) ||\
+          count_prepared_rows(db, pq,
+            (k ? WG_QPLAN_TTREE : WG_QPLAN_SCAN), printlevel) != expected) {
+          if(printlevel)
+            printf("prepared query with values %d, %d failed%s\n",
+              i, j, (k ? " (indexed)" : ""));
+          wg_free_prepared_query(db, pq);
+          return -2;
+        }
+      }
+    }
+    /* The plan should be made again on the next execution */
+    if(!k && wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+      if(printlevel)
+        printf("index creation failed\n");
+      wg_free_prepared_query(db, pq);
+      return -3;
+    }
+  }
+  if(!wg_bind_query(db, pq, 2, wg_encode_query_param_int(db, 0))) {
+    if(printlevel)
+      printf("binding an invalid argument number succeeded\n");
+    wg_free_prepared_query(db, pq);
+    return -2;
+  }
+  wg_free_prepared_query(db, pq);
+
+  /* Match record: col1 = ? and col2 = ? */
+  matchrec[0] = wg_encode_query_param_var(db, 0);
+  matchrec[1] = wg_encode_query_param_int(db, 0);
+  matchrec[2] = wg_encode_query_param_int(db, 0);
+  pq = wg_prepare_query(db, matchrec, 3, NULL, 0);
+  if(!pq) {
+    if(printlevel)
+      printf("failed to prepare a query\n");
+    return -2;
+  }
+  for(i=0; i<dbsize; i+=37) {
+    if(wg_bind_query(db, pq, 0, wg_encode_query_param_int(db, i % 7)) ||\
+      wg_bind_query(db, pq, 1, wg_encode_query_param_int(db, i)) ||\
+      count_prepared_rows(db, pq, WG_QPLAN_SCAN, printlevel) != 1 ||\
+      wg_bind_query(db, pq, 0, wg_encode_query_param_int(db, i % 7 + 1)) ||\
+      count_prepared_rows(db, pq, WG_QPLAN_SCAN, printlevel) != 0) {
+      if(printlevel)
+        printf("prepared match record query failed\n");
+      wg_free_prepared_query(db, pq);
+      return -2;
+    }
+  }
+  wg_free_prepared_query(db, pq);
+
+  /* List of values or 1, rebound with longer lists */
+  for(i=0; i<5; i++)
+    values[i] = wg_encode_query_param_int(db, i * 4);
+  list = wg_encode_query_param_list(db, values, 1);
+  arglist[0].cond = WG_COND_IN;
+  arglist[0].value = list;
+  arglist[1].column = 0;
+  arglist[1].cond = WG_COND_EQUAL|WG_COND_OR;
+  arglist[1].value = wg_encode_query_param_int(db, 1);
+  pq = wg_prepare_query(db, NULL, 0, arglist, 2);
+  wg_free_query_param(db, list);
+  if(!pq) {
+    if(printlevel)
+      printf("failed to prepare a query\n");
+    return -2;
+  }
+  for(i=1; i<=5; i++) {
+    list = wg_encode_query_param_list(db, values, i);
+    if(wg_bind_query(db, pq, 0, list) ||\
+      count_prepared_rows(db, pq, WG_QPLAN_TTREE, printlevel) !=\
+      (i + 1) * dbsize / 20) {
+      if(printlevel)
+        printf("prepared query with a list of %d values failed\n", i);
+      wg_free_query_param(db, list);
+      wg_free_prepared_query(db, pq);
+      return -2;
+    }
+    wg_free_query_param(db, list);
+  }
+  wg_free_prepared_query(db, pq);
+
+  if (printlevel>1)
+    printf("********* prepared queries test successful ********** \n");
+  return 0;
+}
+
+/** Compare the rows of wg_fetch_many() to the rows of wg_fetch()
+ *  The query is run twice, either as a prepared query (read lazily)
+ *  or a prefetched query.
+ *  returns the number of rows, -1 on error.
+ */
+static int check_fetch_many(void *db, wg_query_arg *arglist, gint argc,
+  int prepared, gint batch, int printlevel) {
+  wg_prepared_query *pq = NULL;
+  wg_query *query;
+  void **expected, **rows;
+  int count = 0, i, j, res = -1;
+  gint n;
+
+  expected = (void **) malloc(2000 * sizeof(void *));
+  rows = (void **) malloc(2000 * sizeof(void *));
+  if(!expected || !rows)
+    goto done;
+  if(prepared) {
+    pq = wg_prepare_query(db, NULL, 0, arglist, argc);
+    if(!pq)
+      goto done;
+  }
+
+  for(i=0; i<2; i++) {
+    query = (prepared ? wg_exec_query(db, pq) :
+      wg_make_query(db, NULL, 0, arglist, argc));
+    if(!query)
+      goto done;
+    if(!i) {
+      while(count < 2000 && (expected[count] = wg_fetch(db, query)))
+        count++;
+    } else {
+      for(j=0; j<2000; j+=n) {
+        n = wg_fetch_many(db, query, rows + j,
+          (j + batch <= 2000 ? batch : 2000 - j));
+        if(n <= 0)
+          break;
+      }
+      if(n < 0 || j != count || memcmp(rows, expected, j * sizeof(void *))) {
+        if(printlevel)
+          printf("wg_fetch_many() returned %d rows, expected %d\n",
+            j, count);
+        if(!prepared)
+          wg_free_query(db, query);
+        goto done;
+      }
+    }
+    if(!prepared)
+      wg_free_query(db, query);
+  }
+  res = count;
+
+done:
+  if(pq)
+    wg_free_prepared_query(db, pq);
+  if(expected)
+    free(expected);
+  if(rows)
+    free(rows);
+  return res;
+}
+
+/** Test batched fetching
+ *  Compares wg_fetch_many() to wg_fetch() on full scans, T-tree
+ *  ranges with and without extra conditions, covering indexes and
+ *  prefetched queries, using different batch sizes.
+ */
+static gint wg_test_index20(void *db, int printlevel) {
+  int i, k, dbsize = 1500;
+  void *rec;
+  wg_query_arg arglist[2];
+  gint columns[1], include[1], batches[4] = { 1, 3, 64, 2000 };
+
+  if (printlevel>1)
+    printf("********* testing batched fetch ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i % 30)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 7)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_LESSTHAN;
+  arglist[0].value = wg_encode_query_param_int(db, 4);
+  arglist[1].column = 1;
+  arglist[1].cond = WG_COND_NOT_EQUAL;
+  arglist[1].value = wg_encode_query_param_int(db, 3);
+
+  for(k=0; k<3; k++) {
+    for(i=0; i<4; i++) {
+      /* T-tree range (or scan before the index is created) */
+      if(check_fetch_many(db, arglist, 1, 1, batches[i], printlevel) !=\
+        4 * dbsize / 30) {
+        if(printlevel)
+          printf("range query failed, batch %d\n", (int) batches[i]);
+        return -2;
+      }
+      /* Range with extra conditions */
+      if(check_fetch_many(db, arglist, 2, 1, batches[i], printlevel) < 0 ||\
+        check_fetch_many(db, arglist, 2, 0, batches[i], printlevel) < 0) {
+        if(printlevel)
+          printf("query with extra conditions failed, batch %d\n",
+            (int) batches[i]);
+        return -2;
+      }
+      /* All rows */
+      if(check_fetch_many(db, NULL, 0, 1, batches[i], printlevel) !=\
+        dbsize) {
+        if(printlevel)
+          printf("query of all rows failed, batch %d\n", (int) batches[i]);
+        return -2;
+      }
+    }
+
+    /* Repeat with a T-tree index and with a covering index */
+    columns[0] = 0;
+    include[0] = 1;
+    if(!k && wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+      if(printlevel)
+        printf("index creation failed\n");
+      return -3;
+    }
+    if(k == 1 && (wg_drop_index(db, wg_column_to_index_id(db, 0,
+        WG_INDEX_TYPE_TTREE, NULL, 0)) ||\
+      wg_create_covering_index(db, columns, 1, include, 1,
+        WG_INDEX_TYPE_TTREE, NULL, 0))) {
+      if(printlevel)
+        printf("covering index creation failed\n");
+      return -3;
+    }
+  }
+
+  if (printlevel>1)
+    printf("********* batched fetch test successful ********** \n");
+  return 0;
+}
+
+/** Count the rows of a query with a row limit
+ *  returns the number of rows, -1 on error.
+ */
+static int count_limited_rows(void *db, void *matchrec, gint reclen,
+  wg_query_arg *arglist, gint argc, wg_uint rowlimit, int printlevel) {
+  wg_query *query;
+  int count = 0;
+
+  query = wg_make_query_rc(db, matchrec, reclen, arglist, argc, rowlimit);
+  if(!query) {
+    if(printlevel)
+      printf("query failed\n");
+    return -1;
+  }
+  while(wg_fetch(db, query))
+    count++;
+  wg_free_query(db, query);
+  return count;
+}
+
+/** Check the query cache statistics
+ *  returns 0 if they match, -1 otherwise.
+ */
+static int check_cache_stats(void *db, gint entries, gint hits,
+  gint misses, int printlevel) {
+  wg_query_cache_stats stats;
+
+  if(wg_get_query_cache_stats(db, &stats)) {
+    if(printlevel)
+      printf("failed to get query cache stats\n");
+    return -1;
+  }
+  if(stats.entries != entries || stats.hits != hits ||\
+    stats.misses != misses) {
+    if(printlevel)
+      printf("expected %d entries, %d hits, %d misses, "\
+        "got %d, %d, %d\n", (int) entries, (int) hits, (int) misses,
+        (int) stats.entries, (int) stats.hits, (int) stats.misses);
+    return -1;
+  }
+  return 0;
+}
+
+/** Test the query result cache
+ *
+ */
+static gint wg_test_index21(void *db, int printlevel) {
+  int i, dbsize = 300;
+  void *rec, *first = NULL;
+  wg_query *query, *query2;
+  wg_query_arg arglist[2], revlist[2];
+  wg_query_cache_stats stats;
+  gint matchrec[1];
+
+  if (printlevel>1)
+    printf("********* testing query cache ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 2);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i % 10)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+    if(i == 3)
+      first = rec;
+  }
+
+  if(wg_get_query_cache_stats(db, &stats) != -1) {
+    if(printlevel)
+      printf("query cache should not be enabled\n");
+    return -2;
+  }
+  if(wg_enable_query_cache(db, 4)) {
+    if(printlevel)
+      printf("failed to enable query cache\n");
+    return -2;
+  }
+
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 3);
+  arglist[1].column = 1;
+  arglist[1].cond = WG_COND_LESSTHAN;
+  arglist[1].value = wg_encode_query_param_int(db, 200);
+  revlist[0] = arglist[1];
+  revlist[1] = arglist[0];
+  matchrec[0] = arglist[0].value;
+
+  /* The same query given in different ways */
+  if(count_query_rows(db, arglist, 2, -1, -1, printlevel) != 20 ||\
+    count_query_rows(db, arglist, 2, -1, -1, printlevel) != 20 ||\
+    count_query_rows(db, revlist, 2, -1, -1, printlevel) != 20 ||\
+    count_limited_rows(db, matchrec, 1, &arglist[1], 1, 0,
+      printlevel) != 20) {
+    if(printlevel)
+      printf("wrong number of rows from cached query\n");
+    return -3;
+  }
+  if(check_cache_stats(db, 1, 3, 1, printlevel))
+    return -3;
+
+  /* A different row limit is a different query */
+  if(count_limited_rows(db, NULL, 0, arglist, 2, 5, printlevel) != 5 ||\
+    count_limited_rows(db, NULL, 0, arglist, 2, 5, printlevel) != 5) {
+    if(printlevel)
+      printf("wrong number of rows from limited query\n");
+    return -4;
+  }
+  if(check_cache_stats(db, 2, 4, 2, printlevel))
+    return -4;
+
+  /* Changing a row drops the results. The query made before
+   * the change keeps its rows. */
+  query = wg_make_query(db, NULL, 0, arglist, 2);
+  if(!query || wg_set_field(db, first, 0, wg_encode_int(db, 4))) {
+    if(printlevel)
+      printf("query or update failed\n");
+    return -5;
+  }
+  if(count_query_rows(db, arglist, 2, -1, -1, printlevel) != 19) {
+    if(printlevel)
+      printf("stale result after update\n");
+    return -5;
+  }
+  for(i=0; wg_fetch(db, query); i++);
+  wg_free_query(db, query);
+  if(i != 20) {
+    if(printlevel)
+      printf("query made before the update lost rows\n");
+    return -5;
+  }
+  if(check_cache_stats(db, 1, 5, 3, printlevel))
+    return -5;
+
+  /* So does creating a new row or an index */
+  if(!wg_create_record(db, 2) ||\
+    count_query_rows(db, arglist, 2, -1, -1, printlevel) != 19 ||\
+    wg_create_index(db, 1, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+    count_query_rows(db, arglist, 2, -1, -1, printlevel) != 19) {
+    if(printlevel)
+      printf("query failed after insert or index creation\n");
+    return -6;
+  }
+  if(check_cache_stats(db, 1, 5, 5, printlevel))
+    return -6;
+
+  /* The least recently used results are dropped */
+  for(i=0; i<6; i++) {
+    arglist[0].value = wg_encode_query_param_int(db, i);
+    if(count_query_rows(db, arglist, 1, -1, -1, printlevel) < 0)
+      return -7;
+    wg_free_query_param(db, arglist[0].value);
+  }
+  if(check_cache_stats(db, 4, 5, 11, printlevel))
+    return -7;
+  arglist[0].value = wg_encode_query_param_int(db, 5);
+  if(count_query_rows(db, arglist, 1, -1, -1, printlevel) != 30 ||\
+    check_cache_stats(db, 4, 6, 11, printlevel)) {
+    if(printlevel)
+      printf("most recent result was not cached\n");
+    return -7;
+  }
+
+  /* Queries may outlive the cache */
+  query = wg_make_query(db, NULL, 0, arglist, 1);
+  query2 = wg_make_query(db, NULL, 0, arglist, 1);
+  if(!query || !query2 || wg_enable_query_cache(db, 0)) {
+    if(printlevel)
+      printf("failed to disable query cache\n");
+    return -8;
+  }
+  for(i=0; wg_fetch(db, query); i++);
+  wg_free_query(db, query);
+  while(wg_fetch(db, query2));
+  wg_free_query(db, query2);
+  if(i != 30 || wg_get_query_cache_stats(db, &stats) != -1) {
+    if(printlevel)
+      printf("query failed after disabling the cache\n");
+    return -8;
+  }
+
+  wg_free_query_param(db, arglist[0].value);
+  wg_free_query_param(db, arglist[1].value);
+  if (printlevel>1)
+    printf("********* query cache test successful ********** \n");
+  return 0;
+}
+
+/** Test explaining queries and the execution counters
+ *
+ */
+static gint wg_test_index22(void *db, int printlevel) {
+  int i, dbsize = 1000, count;
+  void *rec;
+  wg_query *query;
+  wg_query_arg arglist[3];
+  wg_query_explain explain;
+  wg_prepared_query *pq;
+  gint cols[1];
+
+  if (printlevel>1)
+    printf("********* testing query explain ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 3);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 4)) ||\
+      wg_set_field(db, rec, 2, wg_encode_int(db, i % 50))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_GTEQUAL;
+  arglist[0].value = wg_encode_query_param_int(db, 100);
+  arglist[1].column = 0;
+  arglist[1].cond = WG_COND_LESSTHAN;
+  arglist[1].value = wg_encode_query_param_int(db, 300);
+  arglist[2].column = 1;
+  arglist[2].cond = WG_COND_EQUAL;
+  arglist[2].value = wg_encode_query_param_int(db, 1);
+
+  /* No indexes */
+  if(wg_explain_query(db, NULL, 0, arglist, 3, &explain) ||\
+    explain.plan.type != WG_QPLAN_SCAN || explain.plan.count != 0 ||\
+    explain.column != -1 || explain.start_bound != WG_ILLEGAL ||\
+    explain.end_bound != WG_ILLEGAL) {
+    if(printlevel)
+      printf("wrong explanation of a full scan\n");
+    return -2;
+  }
+  query = wg_make_query(db, NULL, 0, arglist, 3);
+  if(!query) {
+    if(printlevel)
+      printf("query failed\n");
+    return -2;
+  }
+  for(count=0; wg_fetch(db, query); count++);
+  if(count != 50 || query->stats.examined != dbsize ||\
+    query->stats.matched != 50 || query->stats.returned != 50 ||\
+    query->stats.tnodes != 0 || query->stats.time < 0) {
+    if(printlevel)
+      printf("wrong counters of a full scan: %d %d %d %d\n",
+        (int) query->stats.examined, (int) query->stats.matched,
+        (int) query->stats.returned, (int) query->stats.tnodes);
+    wg_free_query(db, query);
+    return -2;
+  }
+  wg_free_query(db, query);
+
+  /* T-tree range */
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -3;
+  }
+  if(wg_explain_query(db, NULL, 0, arglist, 3, &explain) ||\
+    explain.plan.type != WG_QPLAN_TTREE || explain.plan.count != 1 ||\
+    explain.index_type[0] != WG_INDEX_TYPE_TTREE || explain.column != 0 ||\
+    explain.start_bound != arglist[0].value || !explain.start_inclusive ||\
+    explain.end_bound != arglist[1].value || explain.end_inclusive) {
+    if(printlevel)
+      printf("wrong explanation of a T-tree range\n");
+    return -3;
+  }
+  query = wg_make_query(db, NULL, 0, arglist, 3);
+  if(!query) {
+    if(printlevel)
+      printf("query failed\n");
+    return -3;
+  }
+  for(count=0; wg_fetch(db, query); count++);
+  if(count != 50 || query->stats.examined != 200 ||\
+    query->stats.matched != 50 || query->stats.returned != 50 ||\
+    query->stats.tnodes < 1) {
+    if(printlevel)
+      printf("wrong counters of a T-tree range: %d %d %d %d\n",
+        (int) query->stats.examined, (int) query->stats.matched,
+        (int) query->stats.returned, (int) query->stats.tnodes);
+    wg_free_query(db, query);
+    return -3;
+  }
+  wg_free_query(db, query);
+
+  /* Rows are examined while fetching from a prepared query */
+  pq = wg_prepare_query(db, NULL, 0, arglist, 3);
+  if(!pq || !(query = wg_exec_query(db, pq))) {
+    if(printlevel)
+      printf("prepared query failed\n");
+    if(pq)
+      wg_free_prepared_query(db, pq);
+    return -4;
+  }
+  if(query->stats.examined != 0 || query->stats.tnodes != 1) {
+    if(printlevel)
+      printf("prepared query examined rows before fetching\n");
+    wg_free_prepared_query(db, pq);
+    return -4;
+  }
+  for(count=0; wg_fetch(db, query); count++);
+  if(count != 50 || query->stats.examined != 200 ||\
+    query->stats.returned != 50) {
+    if(printlevel)
+      printf("wrong counters of a prepared query\n");
+    wg_free_prepared_query(db, pq);
+    return -4;
+  }
+  wg_free_prepared_query(db, pq);
+
+  /* Hash index lookup */
+  cols[0] = 2;
+  if(wg_create_multi_index(db, cols, 1, WG_INDEX_TYPE_HASH, NULL, 0) < 0) {
+    if(printlevel)
+      printf("hash index creation failed\n");
+    return -5;
+  }
+  arglist[0].column = 2;
+  arglist[0].cond = WG_COND_EQUAL;
+  if(wg_explain_query(db, NULL, 0, arglist, 1, &explain) ||\
+    explain.plan.type != WG_QPLAN_HASH ||\
+    explain.index_type[0] != WG_INDEX_TYPE_HASH || explain.column != -1) {
+    if(printlevel)
+      printf("wrong explanation of a hash lookup\n");
+    return -5;
+  }
+
+  for(i=0; i<3; i++)
+    wg_free_query_param(db, arglist[i].value);
+  if (printlevel>1)
+    printf("********* query explain test successful ********** \n");
+  return 0;
+}
+
+/** Count the rows that match a list of conditions
+ *  Each row is compared with wg_compare(), without the query code.
+ */
+static int count_compared_rows(void *db, wg_query_arg *arglist, gint argc) {
+  void *rec = wg_get_first_record(db);
+  int count = 0, i;
+
+  for(; rec; rec = wg_get_next_record(db, rec)) {
+    for(i=0; i<argc; i++) {
+      gint cr;
+      if(wg_get_record_len(db, rec) <= arglist[i].column)
+        break;
+      cr = WG_COMPARE(db, wg_get_field(db, rec, arglist[i].column),
+        arglist[i].value);
+      if((arglist[i].cond == WG_COND_EQUAL && cr != WG_EQUAL) ||\
+        (arglist[i].cond == WG_COND_NOT_EQUAL && cr == WG_EQUAL) ||\
+        (arglist[i].cond == WG_COND_LESSTHAN && cr != WG_LESSTHAN) ||\
+        (arglist[i].cond == WG_COND_GREATER && cr != WG_GREATER) ||\
+        (arglist[i].cond == WG_COND_LTEQUAL && cr == WG_GREATER) ||\
+        (arglist[i].cond == WG_COND_GTEQUAL && cr == WG_LESSTHAN))
+        break;
+    }
+    if(i == argc)
+      count++;
+  }
+  return count;
+}
+
+/** Test checking rows that have values of mixed types
+ *
+ */
+static gint wg_test_index23(void *db, int printlevel) {
+  int i, j, k, dbsize = 700, count, expected;
+  void *rec;
+  char buf[100];
+  gint values[9], conds[6] = { WG_COND_EQUAL, WG_COND_NOT_EQUAL,
+    WG_COND_LESSTHAN, WG_COND_GREATER, WG_COND_LTEQUAL, WG_COND_GTEQUAL };
+  wg_query_arg arglist[3];
+  wg_query_explain explain;
+  wg_prepared_query *pq;
+  wg_query *query;
+
+  if (printlevel>1)
+    printf("********* testing checking rows of mixed types ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    gint enc;
+    rec = wg_create_record(db, (i % 7 ? 4 : 2));
+    if(!rec) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+    if(i % 3 == 0)
+      enc = wg_encode_int(db, (i * 37) % 200 - 100);
+    else if(i % 3 == 1)
+      enc = wg_encode_double(db, (i % 40) / 4.0);
+    else
+      enc = wg_encode_fixpoint(db, (i % 50) / 10.0);
+    if(wg_set_field(db, rec, 0, enc))
+      return -1;
+    if(i % 4 == 0)
+      enc = wg_encode_date(db, 730000 + i % 30);
+    else if(i % 4 == 1)
+      enc = wg_encode_time(db, (i * 99991) % 8640000);
+    else if(i % 4 == 2)
+      enc = wg_encode_int(db, i % 30);
+    else
+      enc = 0;
+    if(wg_set_field(db, rec, 1, enc))
+      return -1;
+    if(i % 7) {
+      if(i % 3)
+        snprintf(buf, 100, "s%d", i % 20);
+      else
+        snprintf(buf, 100, "a rather long string that is stored once %d",
+          i % 5);
+      if(wg_set_field(db, rec, 2,
+          wg_encode_str(db, buf, (i % 2 ? "en" : NULL))) ||\
+        wg_set_field(db, rec, 3, wg_encode_int(db, i % 10)))
+        return -1;
+    }
+  }
+
+  values[0] = wg_encode_query_param_int(db, 5);
+  values[1] = wg_encode_query_param_fixpoint(db, 2.5);
+  values[2] = wg_encode_query_param_double(db, 3.0);
+  values[3] = wg_encode_query_param_date(db, 730010);
+  values[4] = wg_encode_query_param_time(db, 8000000);
+  values[5] = wg_encode_query_param_time(db, 100000);
+  values[6] = wg_encode_query_param_str(db, "s7", NULL);
+  values[7] = wg_encode_query_param_str(db,
+    "a rather long string that is stored once 3", NULL);
+  values[8] = wg_encode_query_param_int(db, 1000000000);
+
+  /* Single conditions on each column */
+  for(i=0; i<9; i++) {
+    for(j=0; j<6; j++) {
+      for(k=0; k<3; k++) {
+        arglist[0].column = k;
+        arglist[0].cond = conds[j];
+        arglist[0].value = values[i];
+        expected = count_compared_rows(db, arglist, 1);
+        count = count_limited_rows(db, NULL, 0, arglist, 1, 0, printlevel);
+        if(count != expected) {
+          if(printlevel)
+            printf("value %d cond %d column %d: expected %d rows, got %d\n",
+              i, (int) conds[j], k, expected, count);
+          return -2;
+        }
+      }
+    }
+  }
+
+  /* Combined conditions, the same result in any order */
+  for(i=0; i<9; i++) {
+    for(j=0; j<6; j++) {
+      arglist[0].column = 2;
+      arglist[0].cond = conds[j];
+      arglist[0].value = values[(i + 6) % 9];
+      arglist[1].column = 0;
+      arglist[1].cond = conds[(j + 2) % 6];
+      arglist[1].value = values[i];
+      arglist[2].column = 1;
+      arglist[2].cond = conds[(j + 3) % 6];
+      arglist[2].value = values[(i + 3) % 9];
+      expected = count_compared_rows(db, arglist, 3);
+      count = count_limited_rows(db, NULL, 0, arglist, 3, 0, printlevel);
+      if(count != expected) {
+        if(printlevel)
+          printf("combined query %d %d: expected %d rows, got %d\n",
+            i, j, expected, count);
+        return -3;
+      }
+
+      /* Prepared query checks the rows while fetching */
+      pq = wg_prepare_query(db, NULL, 0, arglist, 3);
+      if(!pq || !(query = wg_exec_query(db, pq))) {
+        if(printlevel)
+          printf("prepared query failed\n");
+        if(pq)
+          wg_free_prepared_query(db, pq);
+        return -3;
+      }
+      for(count=0; wg_fetch(db, query); count++);
+      wg_free_prepared_query(db, pq);
+      if(count != expected) {
+        if(printlevel)
+          printf("prepared query %d %d: expected %d rows, got %d\n",
+            i, j, expected, count);
+        return -3;
+      }
+    }
+  }
+
+  /* Candidate rows of a bitmap index are checked in batches */
+  if(wg_create_index(db, 3, WG_INDEX_TYPE_BITMAP, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -4;
+  }
+  arglist[0].column = 3;
+  arglist[0].cond = WG_COND_EQUAL;
+  arglist[0].value = values[0];
+  for(j=0; j<6; j++) {
+    arglist[1].column = 0;
+    arglist[1].cond = conds[j];
+    arglist[1].value = values[1];
+    arglist[2].column = 2;
+    arglist[2].cond = WG_COND_NOT_EQUAL;
+    arglist[2].value = values[6];
+    if(wg_explain_query(db, NULL, 0, arglist, 3, &explain) ||\
+      explain.plan.type != WG_QPLAN_BITMAP) {
+      if(printlevel)
+        printf("bitmap index was not used\n");
+      return -4;
+    }
+    expected = count_compared_rows(db, arglist, 3);
+    count = count_limited_rows(db, NULL, 0, arglist, 3, 0, printlevel);
+    if(count != expected) {
+      if(printlevel)
+        printf("bitmap query %d: expected %d rows, got %d\n",
+          j, expected, count);
+      return -4;
+    }
+    if(expected > 3 &&\
+      count_limited_rows(db, NULL, 0, arglist, 3, 3, printlevel) != 3) {
+      if(printlevel)
+        printf("bitmap query %d: wrong number of limited rows\n", j);
+      return -4;
+    }
+  }
+
+  /* Disjunction is kept whole */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_LESSTHAN;
+  arglist[0].value = values[0];
+  arglist[1].column = 3;
+  arglist[1].cond = WG_COND_GREATER|WG_COND_OR;
+  arglist[1].value = values[0];
+  arglist[2].column = 2;
+  arglist[2].cond = WG_COND_EQUAL;
+  arglist[2].value = values[6];
+  expected = 0;
+  for(rec = wg_get_first_record(db); rec; rec = wg_get_next_record(db, rec)) {
+    if(wg_get_record_len(db, rec) < 4 ||\
+      WG_COMPARE(db, wg_get_field(db, rec, 2), values[6]) != WG_EQUAL)
+      continue;
+    if(WG_COMPARE(db, wg_get_field(db, rec, 0), values[0]) == WG_LESSTHAN ||\
+      WG_COMPARE(db, wg_get_field(db, rec, 3), values[0]) == WG_GREATER)
+      expected++;
+  }
+  count = count_limited_rows(db, NULL, 0, arglist, 3, 0, printlevel);
+  if(count != expected || !expected) {
+    if(printlevel)
+      printf("disjunction: expected %d rows, got %d\n", expected, count);
+    return -5;
+  }
+
+  for(i=0; i<9; i++)
+    wg_free_query_param(db, values[i]);
+  if (printlevel>1)
+    printf("********* mixed type checking test successful ********** \n");
+  return 0;
+}
+
+/** Test counting rows and checking if any rows match
+ *
+ */
+static gint wg_test_index24(void *db, int printlevel) {
+  int i, j, dbsize = 1000;
+  void *rec;
+  gint count, exists;
+  wg_query_arg arglist[3];
+  struct {
+    int bounds;       /* use the range arguments */
+    gint lo, hi;      /* range of column 0 */
+    gint rest;        /* value of column 1, -1 if none */
+    int expected;
+  } cases[] = {
+    { 0, 0, 0, 1, 250 },
+    { 0, 0, 0, 7, 0 },
+    { 1, 100, 300, -1, 200 },
+    { 1, 100, 300, 1, 50 },
+    { 1, 500, 100, -1, 0 },
+    { 1, 995, 2000, -1, 5 },
+    { 1, 995, 2000, 2, 1 },
+    { 1, -10, 0, -1, 0 }
+  };
+
+  if (printlevel>1)
+    printf("********* testing counting rows ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 2);
+    if(!rec ||\
+      wg_set_field(db, rec, 0, wg_encode_int(db, i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, i % 4))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+
+  /* The same results without and with the T-tree index and with
+   * a hash index that is planned like in a prefetch query */
+  for(j=0; j<3; j++) {
+    if(j == 2 && wg_create_index(db, 1, WG_INDEX_TYPE_HASH, NULL, 0)) {
+      if(printlevel)
+        printf("index creation failed\n");
+      return -2;
+    }
+    if(j == 1 && wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+      if(printlevel)
+        printf("index creation failed\n");
+      return -2;
+    }
+    for(i=0; i<(int) (sizeof(cases) / sizeof(cases[0])); i++) {
+      gint argc = 0;
+      if(cases[i].bounds) {
+        arglist[argc].column = 0;
+        arglist[argc].cond = WG_COND_GTEQUAL;
+        arglist[argc++].value = wg_encode_query_param_int(db, cases[i].lo);
+        arglist[argc].column = 0;
+        arglist[argc].cond = WG_COND_LESSTHAN;
+        arglist[argc++].value = wg_encode_query_param_int(db, cases[i].hi);
+      }
+      if(cases[i].rest >= 0) {
+        arglist[argc].column = 1;
+        arglist[argc].cond = WG_COND_EQUAL;
+        arglist[argc++].value = wg_encode_query_param_int(db, cases[i].rest);
+      }
+
+      count = wg_query_count(db, NULL, 0, arglist, argc);
+      exists = wg_query_exists(db, NULL, 0, arglist, argc);
+      if(count != cases[i].expected ||\
+        count != count_limited_rows(db, NULL, 0, arglist, argc, 0,
+          printlevel) ||\
+        exists != (cases[i].expected > 0)) {
+        if(printlevel)
+          printf("case %d (index %d): expected %d rows, counted %d, "\
+            "exists %d\n", i, j, cases[i].expected, (int) count,
+            (int) exists);
+        return -3;
+      }
+      while(argc--)
+        wg_free_query_param(db, arglist[argc].value);
+    }
+  }
+
+  /* Match record */
+  arglist[0].column = 0;
+  arglist[0].cond = WG_COND_LESSTHAN;
+  arglist[0].value = wg_encode_query_param_int(db, 10);
+  rec = wg_get_first_record(db);
+  count = wg_query_count(db, rec, 0, arglist, 1);
+  if(count != 1 || wg_query_exists(db, rec, 0, arglist, 1) != 1) {
+    if(printlevel)
+      printf("wrong count with a match record: %d\n", (int) count);
+    return -4;
+  }
+  wg_free_query_param(db, arglist[0].value);
+
+  if (printlevel>1)
+    printf("********* counting rows test successful ********** \n");
+  return 0;
+}
+
+/** Test skipping rows of T-tree ranges
+ *  The rows after the skipped ones are compared to the rows of
+ *  the same query that discards the rows by fetching them. The
+ *  prefetched queries are skipped in the buffer, the executed
+ *  prepared query by the positions in the T-tree.
+ */
+static gint wg_test_index25(void *db, int printlevel) {
+  int i, j, k, n, dbsize = 2000;
+  void *rec, *rec2;
+  gint index_id, rootoffset, nodeoffset, slot, count;
+  wg_query *query, *query2;
+  wg_prepared_query *pq = NULL;
+  wg_query_arg arglist[2];
+  int skips[] = { 0, 1, 9, 10, 11, 77, 300, 1000 };
+  struct {
+    gint lo, hi;      /* range of column 0 */
+  } ranges[] = {
+    { 0, 500 },
+    { 100, 300 },
+    { 250, 251 },
+    { 490, 600 },
+    { 600, 700 }
+  };
+
+  if (printlevel>1)
+    printf("********* testing skipping rows ********** \n");
+
+  /* The index is created first, so that the element counts are
+   * maintained by inserts, deletes and rotations. */
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -1;
+  }
+  for(i=0; i<dbsize; i++) {
+    rec = wg_create_record(db, 1);
+    if(!rec || wg_set_field(db, rec, 0,
+      wg_encode_int(db, ((i * 7919) % dbsize) % 500))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+  rec = wg_get_first_record(db);
+  for(i=0; rec; i++) {
+    rec2 = wg_get_next_record(db, rec);
+    if(!(i % 3) && wg_delete_record(db, rec)) {
+      if(printlevel)
+        printf("delete error\n");
+      return -1;
+    }
+    rec = rec2;
+  }
+  if(validate_index(db, wg_get_first_record(db), dbsize, 0, printlevel)) {
+    if(printlevel)
+      printf("index validation failed\n");
+    return -2;
+  }
+
+  /* Positions of all the elements */
+  index_id = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0);
+  rootoffset = TTREE_ROOT_NODE(((wg_index_header *) offsettoptr(db,
+    index_id)));
+  count = ((struct wg_tnode *) offsettoptr(db, rootoffset))->subtree_count;
+  if(count != dbsize - (dbsize + 2) / 3) {
+    if(printlevel)
+      printf("wrong element count in root: %d\n", (int) count);
+    return -3;
+  }
+  for(i=0; i<count; i++) {
+    nodeoffset = wg_ttree_select(db, rootoffset, i, &slot);
+    if(!nodeoffset || wg_ttree_rank(db, nodeoffset, slot) != i) {
+      if(printlevel)
+        printf("element %d not found by position\n", i);
+      return -3;
+    }
+  }
+  if(wg_ttree_select(db, rootoffset, count, &slot)) {
+    if(printlevel)
+      printf("position out of range was found\n");
+    return -3;
+  }
+
+  for(i=0; i<(int) (sizeof(ranges) / sizeof(ranges[0])); i++) {
+    arglist[0].column = 0;
+    arglist[0].cond = WG_COND_GTEQUAL;
+    arglist[0].value = wg_encode_query_param_int(db, ranges[i].lo);
+    arglist[1].column = 0;
+    arglist[1].cond = WG_COND_LESSTHAN;
+    arglist[1].value = wg_encode_query_param_int(db, ranges[i].hi);
+
+    count = wg_query_count(db, NULL, 0, arglist, 2);
+    if(count != count_limited_rows(db, NULL, 0, arglist, 2, 0,
+      printlevel)) {
+      if(printlevel)
+        printf("range %d: wrong count %d\n", i, (int) count);
+      return -4;
+    }
+
+    for(j=0; j<(int) (sizeof(skips) / sizeof(skips[0])); j++) {
+      for(k=0; k<3; k++) {
+        if(k == 2) {
+          pq = wg_prepare_query(db, NULL, 0, arglist, 2);
+          query = (pq ? wg_exec_query(db, pq) : NULL);
+          query2 = wg_make_query(db, NULL, 0, arglist, 2);
+          /* the first range covers the table and is scanned */
+          if(query && i &&\
+            (query->qtype != WG_QTYPE_TTREE || query->arglist)) {
+            if(printlevel)
+              printf("range %d: prepared query is not a T-tree range\n", i);
+            return -5;
+          }
+        } else if(k) {
+          query = wg_make_ordered_query(db, NULL, 0, arglist, 2, 0,
+            WG_ORDER_DESC, 0);
+          query2 = wg_make_ordered_query(db, NULL, 0, arglist, 2, 0,
+            WG_ORDER_DESC, 0);
+        } else {
+          query = wg_make_query(db, NULL, 0, arglist, 2);
+          query2 = wg_make_query(db, NULL, 0, arglist, 2);
+        }
+        if(!query || !query2) {
+          if(printlevel)
+            printf("range %d: failed to make query\n", i);
+          return -5;
+        }
+        for(n=0; n<skips[j] && wg_fetch(db, query2); n++);
+        if(wg_query_skip(db, query, skips[j]) != n) {
+          if(printlevel)
+            printf("range %d, order %d: wrong number of rows skipped "\
+              "(expected %d)\n", i, k, n);
+          return -5;
+        }
+        do {
+          rec = wg_fetch(db, query);
+          rec2 = wg_fetch(db, query2);
+          if(rec != rec2) {
+            if(printlevel)
+              printf("range %d, order %d: wrong row after skipping %d\n",
+                i, k, skips[j]);
+            return -6;
+          }
+        } while(rec);
+        if(k == 2)
+          wg_free_prepared_query(db, pq);
+        else
+          wg_free_query(db, query);
+        wg_free_query(db, query2);
+      }
+    }
+    wg_free_query_param(db, arglist[0].value);
+    wg_free_query_param(db, arglist[1].value);
+  }
+
+  /* The element counts changed the T-node layout in 0.8.1, the
+   * images of earlier versions are not compatible */
+  {
+    db_memsegment_header *dbh = dbmemsegh(db);
+    gint32 version = dbh->version;
+    int err;
+
+    dbh->version = (gint32) ((0<<16)|(8<<8)|0); /* 0.8.0 */
+    err = wg_check_header_compat(dbh);
+    dbh->version = version;
+    if(err != -3 || wg_check_header_compat(dbh)) {
+      if(printlevel)
+        printf("image of an earlier version was accepted\n");
+      return -7;
+    }
+  }
+
+  if (printlevel>1)
+    printf("********* skipping rows test successful ********** \n");
+  return 0;
+}
+
+/** Check if a field begins with a prefix
+ *  Strings and URIs are decoded and compared with strncmp(), without
+ *  the query code. A missing namespace is the same as an empty one.
+ *  returns 1 if the field matches, 0 otherwise.
+ */
+static int match_prefix(void *db, void *rec, gint column, gint type,
+  const char *prefix, const char *ns) {
+  gint enc = wg_get_field(db, rec, column);
+  char *str;
+
+  if(wg_get_encoded_type(db, enc) != type)
+    return 0;
+  if(type == WG_URITYPE) {
+    char *uns = wg_decode_uri_prefix(db, enc);
+    if(strcmp((uns ? uns : ""), (ns ? ns : "")))
+      return 0;
+    str = wg_decode_uri(db, enc);
+  } else
+    str = wg_decode_str(db, enc);
+  return !strncmp(str, prefix, strlen(prefix));
+}
+
+/** Test string and URI prefix conditions
+ *  The rows found with and without T-tree indexes are compared
+ *  to the rows that begin with the prefix. The strings include
+ *  0xFF bytes that have no next value and the namespaces include
+ *  one that follows another one directly.
+ */
+static gint wg_test_index26(void *db, int printlevel) {
+  int i, j, k, idx, dbsize = 1500, count, expected;
+  void *rec;
+  const char *words[] = { "", "a", "ab", "abc", "abd", "ab\xff",
+    "ab\xff\xff", "ab\xff" "a", "ac", "b", "\xff", "\xff\xff", "\xff" "a",
+    "abc\xff" };
+  const char *ns[] = { NULL, "", "http://a/", "http://a/b",
+    "http://a/\x01", "http://b/" };
+  int nwords = sizeof(words) / sizeof(words[0]);
+  int nns = sizeof(ns) / sizeof(ns[0]);
+  wg_query_arg arglist[2];
+  wg_query_explain explain;
+  wg_prepared_query *pq;
+
+  if (printlevel>1)
+    printf("********* testing prefix conditions ********** \n");
+
+  for(i=0; i<dbsize; i++) {
+    gint enc;
+    rec = wg_create_record(db, 2);
+    if(!rec) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+    if(!(i % 17))
+      enc = wg_encode_int(db, i);
+    else if(!(i % 19))
+      enc = wg_encode_null(db, NULL);
+    else
+      enc = wg_encode_str(db, (char *) words[i % nwords],
+        (i % 2 ? "en" : NULL));
+    if(wg_set_field(db, rec, 0, enc) ||\
+      wg_set_field(db, rec, 1, wg_encode_uri(db,
+        (char *) words[(i / 3) % nwords], (char *) ns[i % nns]))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+
+  for(idx=0; idx<2; idx++) {
+    if(idx && (wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0) ||\
+      wg_create_index(db, 1, WG_INDEX_TYPE_TTREE, NULL, 0))) {
+      if(printlevel)
+        printf("index creation failed\n");
+      return -1;
+    }
+
+    /* Strings, the language is ignored */
+    for(j=0; j<nwords; j++) {
+      arglist[0].column = 0;
+      arglist[0].cond = WG_COND_PREFIX;
+      arglist[0].value = wg_encode_query_param_str(db, (char *) words[j],
+        (j % 2 ? "fr" : NULL));
+      expected = 0;
+      for(rec = wg_get_first_record(db); rec;
+        rec = wg_get_next_record(db, rec))
+        expected += match_prefix(db, rec, 0, WG_STRTYPE, words[j], NULL);
+      if(wg_query_count(db, NULL, 0, arglist, 1) != expected ||\
+        count_limited_rows(db, NULL, 0, arglist, 1, 0,
+        printlevel) != expected) {
+        if(printlevel)
+          printf("index %d, string %d: wrong number of rows "\
+            "(expected %d)\n", idx, j, expected);
+        return -2;
+      }
+      if(idx && (wg_explain_query(db, NULL, 0, arglist, 1, &explain) ||\
+        explain.plan.type != WG_QPLAN_TTREE || explain.column != 0 ||\
+        explain.start_bound != arglist[0].value ||\
+        !explain.start_inclusive || explain.end_bound != WG_ILLEGAL)) {
+        if(printlevel)
+          printf("string %d: wrong query plan\n", j);
+        return -2;
+      }
+      wg_free_query_param(db, arglist[0].value);
+    }
+
+    /* URIs of a namespace */
+    for(j=0; j<nwords; j++) {
+      for(k=0; k<nns; k++) {
+        arglist[0].column = 1;
+        arglist[0].cond = WG_COND_PREFIX;
+        arglist[0].value = wg_encode_query_param_uri(db, (char *) words[j],
+          (char *) ns[k]);
+        expected = 0;
+        for(rec = wg_get_first_record(db); rec;
+          rec = wg_get_next_record(db, rec))
+          expected += match_prefix(db, rec, 1, WG_URITYPE, words[j], ns[k]);
+        if(wg_query_count(db, NULL, 0, arglist, 1) != expected ||\
+          count_limited_rows(db, NULL, 0, arglist, 1, 0,
+          printlevel) != expected) {
+          if(printlevel)
+            printf("index %d, URI %d, namespace %d: wrong number of rows "\
+              "(expected %d)\n", idx, j, k, expected);
+          return -3;
+        }
+        wg_free_query_param(db, arglist[0].value);
+      }
+    }
+
+    /* Disjunction of prefixes and prefixes on two columns */
+    arglist[0].column = 0;
+    arglist[0].cond = WG_COND_PREFIX;
+    arglist[0].value = wg_encode_query_param_str(db, "ab", NULL);
+    for(i=0; i<2; i++) {
+      arglist[1].column = i;
+      arglist[1].cond = WG_COND_PREFIX|(i ? 0 : WG_COND_OR);
+      arglist[1].value = (i ? wg_encode_query_param_uri(db, "", "http://a/") :
+        wg_encode_query_param_str(db, "b", NULL));
+      expected = 0;
+      for(rec = wg_get_first_record(db); rec;
+        rec = wg_get_next_record(db, rec)) {
+        int m0 = match_prefix(db, rec, 0, WG_STRTYPE, "ab", NULL);
+        if(i)
+          expected += (m0 &&\
+            match_prefix(db, rec, 1, WG_URITYPE, "", "http://a/"));
+        else
+          expected += (m0 || match_prefix(db, rec, 0, WG_STRTYPE, "b", NULL));
+      }
+      count = count_limited_rows(db, NULL, 0, arglist, 2, 0, printlevel);
+      if(count != expected) {
+        if(printlevel)
+          printf("index %d, combination %d: wrong number of rows %d "\
+            "(expected %d)\n", idx, i, count, expected);
+        return -4;
+      }
+      wg_free_query_param(db, arglist[1].value);
+    }
+
+    /* Prepared query with the prefix bound again */
+    pq = wg_prepare_query(db, NULL, 0, arglist, 1);
+    if(!pq) {
+      if(printlevel)
+        printf("failed to prepare query\n");
+      return -5;
+    }
+    wg_free_query_param(db, arglist[0].value);
+    for(j=0; j<nwords; j++) {
+      gint value = wg_encode_query_param_str(db, (char *) words[j], NULL);
+      expected = 0;
+      for(rec = wg_get_first_record(db); rec;
+        rec = wg_get_next_record(db, rec))
+        expected += match_prefix(db, rec, 0, WG_STRTYPE, words[j], NULL);
+      if(wg_bind_query(db, pq, 0, value) ||\
+        count_prepared_rows(db, pq, (idx ? WG_QPLAN_TTREE : WG_QPLAN_SCAN),
+        printlevel) != expected) {
+        if(printlevel)
+          printf("index %d, string %d: wrong number of rows in prepared "\
+            "query (expected %d)\n", idx, j, expected);
+        wg_free_prepared_query(db, pq);
+        return -5;
+      }
+      wg_free_query_param(db, value);
+    }
+    if(!wg_bind_query(db, pq, 0, wg_encode_query_param_int(db, 1))) {
+      if(printlevel)
+        printf("prefix of an integer was accepted\n");
+      wg_free_prepared_query(db, pq);
+      return -5;
+    }
+    wg_free_prepared_query(db, pq);
+  }
+
+  /* Cached results of different prefixes */
+  if(wg_enable_query_cache(db, 4)) {
+    if(printlevel)
+      printf("failed to enable the query cache\n");
+    return -6;
+  }
+  for(i=0; i<4; i++) {
+    arglist[0].column = 0;
+    arglist[0].cond = WG_COND_PREFIX;
+    arglist[0].value = wg_encode_query_param_str(db, (i % 2 ? "ab" : "a"),
+      NULL);
+    expected = 0;
+    for(rec = wg_get_first_record(db); rec;
+      rec = wg_get_next_record(db, rec))
+      expected += match_prefix(db, rec, 0, WG_STRTYPE, (i % 2 ? "ab" : "a"),
+        NULL);
+    count = count_limited_rows(db, NULL, 0, arglist, 1, 0, printlevel);
+    wg_free_query_param(db, arglist[0].value);
+    if(count != expected) {
+      if(printlevel)
+        printf("cached query %d: wrong number of rows %d (expected %d)\n",
+          i, count, expected);
+      return -6;
+    }
+  }
+  if(wg_enable_query_cache(db, 0))
+    return -6;
+
+  /* Simple query function */
+  expected = 0;
+  for(rec = wg_get_first_record(db); rec; rec = wg_get_next_record(db, rec))
+    expected += match_prefix(db, rec, 0, WG_STRTYPE, "ab", NULL);
+  count = 0;
+  rec = NULL;
+  while((rec = wg_find_record_str(db, 0, WG_COND_PREFIX, "ab", rec)))
+    count++;
+  if(count != expected) {
+    if(printlevel)
+      printf("wg_find_record_str(): wrong number of rows %d "\
+        "(expected %d)\n", count, expected);
+    return -7;
+  }
+
+  if (printlevel>1)
+    printf("********* prefix conditions test successful ********** \n");
+  return 0;
+}
+
+/** Count the documents of a JSON query
+ *  The plan and the number of documents examined are returned
+ *  in plan and examined, if not NULL.
+ *  returns the number of documents, -1 on error.
+ */
+static int count_json_rows(void *db, char *json, wg_query_plan *plan,
+  gint *examined, int printlevel) {
+  wg_json_query_arg arglist[4];
+  wg_query *query;
+  void *param;
+  gint i, argc;
+  int count = 0;
+
+  if(wg_parse_json_param(db, json, &param)) {
+    if(printlevel)
+      printf("failed to parse query %s\n", json);
+    return -1;
+  }
+  argc = wg_get_record_len(db, param);
+  for(i=0; i<argc && i<4; i++) {
+    void *kv = wg_decode_record(db, wg_get_field(db, param, i));
+    arglist[i].key = wg_get_field(db, kv, WG_SCHEMA_KEY_OFFSET);
+    arglist[i].value = wg_get_field(db, kv, WG_SCHEMA_VALUE_OFFSET);
+  }
+  query = wg_make_json_query(db, arglist, i);
+  if(!query) {
+    if(printlevel)
+      printf("query %s failed\n", json);
+    wg_delete_document(db, param);
+    return -1;
+  }
+  while(wg_fetch(db, query))
+    count++;
+  if(plan)
+    *plan = query->plan;
+  if(examined)
+    *examined = query->stats.examined;
+  wg_free_query(db, query);
+  wg_delete_document(db, param);
+  return count;
+}
+
+/** Find the key-value pair of a key in a JSON object
+ *  returns the pair record, NULL if not found.
+ */
+static void *find_json_kv(void *db, void *obj, char *key) {
+  gint i, reclen = wg_get_record_len(db, obj);
+  for(i=0; i<reclen; i++) {
+    void *kv = wg_decode_record(db, wg_get_field(db, obj, i));
+    if(!strcmp(wg_decode_str(db, wg_get_field(db, kv, WG_SCHEMA_KEY_OFFSET)),
+      key))
+      return kv;
+  }
+  return NULL;
+}
+
+/** Test the JSON path index
+ *  Document queries are compared against a database without indexes.
+ *  returns 0 on success
+ *  returns -1..-8 on failure
+ */
+static gint wg_test_index27(void *db, int printlevel) {
+#ifdef USE_BACKLINKING
+  int i, j, ndocs = 300, count, expected;
+  gint index_id, examined, nids, *ids;
+  void *refdb, *docs[300], *refdocs[300];
+  char buf[200];
+  wg_query_plan plan;
+  char *queries[] = {
+    "{\"type\":\"t3\"}",
+    "{\"tags\":\"y\"}",
+    "{\"owner\":\"u2\"}",
+    "{\"hot\":1}",
+    "{\"hot\":5}",
+    "{\"type\":\"none\"}",
+    "{\"type\":\"t1\",\"tags\":\"x5\"}",
+    "{\"type\":\"t1\",\"hot\":1}",
+    "{\"id\":17,\"tags\":\"y\",\"type\":\"t2\"}",
+    "{\"meta\":{\"owner\":\"u4\",\"flags\":{\"hot\":1}}}",
+    "{\"flags\":{\"hot\":0},\"type\":\"t2\"}",
+    "{\"tags\":[\"y\",\"x3\"],\"type\":\"t3\"}",
+    "{\"meta\":{\"flags\":{\"hot\":1}}}",
+    "{\"type\":\"t9\"}",
+    "{\"tags\":\"z\"}",
+    "{\"tags\":\"x2\",\"type\":\"t2\"}"
+  };
+  int nqueries = sizeof(queries) / sizeof(queries[0]);
+
+  if (printlevel>1)
+    printf("********* testing JSON path index ********** \n");
+
+  refdb = wg_attach_local_database(4000000);
+  if(!refdb) {
+    if(printlevel)
+      printf("failed to create the reference database\n");
+    return -1;
+  }
+
+  /* Every tenth document is a top-level array. Some of the documents
+   * are inserted after the index is created. */
+  for(i=0; i<ndocs; i++) {
+    snprintf(buf, sizeof(buf), "%s{\"id\":%d,\"type\":\"t%d\","\
+      "\"tags\":[\"x%d\",\"y\"],\"meta\":{\"owner\":\"u%d\","\
+      "\"flags\":{\"hot\":%d}}}%s", (i % 10 == 9 ? "[" : ""), i, i % 5,
+      i % 7, i % 6, !(i % 3), (i % 10 == 9 ? "]" : ""));
+    if(i == ndocs/2 &&\
+      wg_create_index(db, 0, WG_INDEX_TYPE_HASH_PATH, NULL, 0)) {
+      if(printlevel)
+        printf("index creation failed\n");
+      wg_delete_local_database(refdb);
+      return -1;
+    }
+    if(wg_parse_json_document(db, buf, &docs[i]) ||\
+      wg_parse_json_document(refdb, buf, &refdocs[i])) {
+      if(printlevel)
+        printf("insert error\n");
+      wg_delete_local_database(refdb);
+      return -1;
+    }
+  }
+
+  index_id = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_HASH_PATH, NULL, 0);
+  ids = (gint *) wg_get_all_indexes(db, &nids);
+  if(index_id < 1 || nids != 1 || ids[0] != index_id ||\
+    !wg_create_index(db, 0, WG_INDEX_TYPE_HASH_PATH, NULL, 0) ||\
+    !wg_create_index(db, 1, WG_INDEX_TYPE_HASH_PATH, NULL, 0)) {
+    if(printlevel)
+      printf("index lookup failed\n");
+    free(ids);
+    wg_delete_local_database(refdb);
+    return -2;
+  }
+  free(ids);
+
+  for(j=0; j<3; j++) {
+    if(j == 1) {
+      /* Update nested values: meta.flags.hot of every fourth document */
+      for(i=0; i<ndocs; i+=4) {
+        void *d[2];
+        int k;
+        d[0] = docs[i];
+        d[1] = refdocs[i];
+        for(k=0; k<2; k++) {
+          void *dbk = (k ? refdb : db), *obj = d[k], *kv;
+          if(is_schema_array(obj))
+            obj = wg_decode_record(dbk, wg_get_field(dbk, obj, 0));
+          kv = find_json_kv(dbk, obj, "meta");
+          kv = find_json_kv(dbk,
+            wg_decode_record(dbk, wg_get_field(dbk, kv,
+            WG_SCHEMA_VALUE_OFFSET)), "flags");
+          kv = find_json_kv(dbk,
+            wg_decode_record(dbk, wg_get_field(dbk, kv,
+            WG_SCHEMA_VALUE_OFFSET)), "hot");
+          if(wg_set_field(dbk, kv, WG_SCHEMA_VALUE_OFFSET,
+            wg_encode_int(dbk, 5))) {
+            if(printlevel)
+              printf("update error\n");
+            wg_delete_local_database(refdb);
+            return -3;
+          }
+        }
+      }
+      /* Update a top-level key and an array element of every fifth
+       * document */
+      for(i=2; i<ndocs; i+=5) {
+        void *d[2];
+        int k;
+        d[0] = docs[i];
+        d[1] = refdocs[i];
+        for(k=0; k<2; k++) {
+          void *dbk = (k ? refdb : db), *obj = d[k], *kv;
+          if(is_schema_array(obj))
+            obj = wg_decode_record(dbk, wg_get_field(dbk, obj, 0));
+          kv = find_json_kv(dbk, obj, "tags");
+          if(wg_set_field(dbk, find_json_kv(dbk, obj, "type"),
+            WG_SCHEMA_VALUE_OFFSET, wg_encode_str(dbk, "t9", NULL)) ||\
+            wg_set_field(dbk, wg_decode_record(dbk, wg_get_field(dbk, kv,
+            WG_SCHEMA_VALUE_OFFSET)), 0, wg_encode_str(dbk, "z", NULL))) {
+            if(printlevel)
+              printf("update error\n");
+            wg_delete_local_database(refdb);
+            return -3;
+          }
+        }
+      }
+    } else if(j == 2) {
+      /* Delete every third document */
+      for(i=0; i<ndocs; i+=3) {
+        if(wg_delete_document(db, docs[i]) ||\
+          wg_delete_document(refdb, refdocs[i])) {
+          if(printlevel)
+            printf("delete error\n");
+          wg_delete_local_database(refdb);
+          return -3;
+        }
+      }
+    }
+
+    for(i=0; i<nqueries; i++) {
+      count = count_json_rows(db, queries[i], &plan, NULL, printlevel);
+      expected = count_json_rows(refdb, queries[i], NULL, NULL, printlevel);
+      if(count < 0 || count != expected || plan.index_id[0] != index_id) {
+        if(printlevel)
+          printf("pass %d, query %s: wrong number of documents %d "\
+            "(expected %d)\n", j, queries[i], count, expected);
+        wg_delete_local_database(refdb);
+        return -4;
+      }
+    }
+
+    /* An array directly under the key is not looked up in the index */
+    count = count_json_rows(db, "{\"tags\":[\"x3\",\"y\"]}", &plan, NULL,
+      printlevel);
+    if(count < 0 || plan.count != 0 || count != count_json_rows(refdb,
+      "{\"tags\":[\"x3\",\"y\"]}", NULL, NULL, printlevel)) {
+      if(printlevel)
+        printf("pass %d: wrong number of documents with an array\n", j);
+      wg_delete_local_database(refdb);
+      return -4;
+    }
+  }
+
+  /* Known counts after the changes */
+  expected = 0;
+  for(i=0; i<ndocs; i++)
+    expected += (i % 3 && i % 5 == 1);
+  if(count_json_rows(db, "{\"type\":\"t1\"}", NULL, NULL,
+    printlevel) != expected ||\
+    count_json_rows(db, "{\"hot\":5}", NULL, NULL, printlevel) !=\
+    ndocs/4 - ndocs/12) {
+    if(printlevel)
+      printf("wrong number of documents after updates\n");
+    wg_delete_local_database(refdb);
+    return -5;
+  }
+
+  /* Plans: a missing value, checking the documents of a single
+   * id and intersecting two large sets */
+  if(count_json_rows(db, "{\"type\":\"none\",\"tags\":\"y\"}", &plan,
+    &examined, printlevel) != 0 || plan.type != WG_QPLAN_HASH ||\
+    examined != 0) {
+    if(printlevel)
+      printf("empty query: wrong plan\n");
+    wg_delete_local_database(refdb);
+    return -6;
+  }
+  if(count_json_rows(db, "{\"tags\":\"y\",\"id\":16,\"type\":\"t1\"}",
+    &plan, &examined, printlevel) != 1 || plan.type != WG_QPLAN_HASH ||\
+    plan.rows != 1.0 || examined != 2) {
+    if(printlevel)
+      printf("single document query: wrong plan\n");
+    wg_delete_local_database(refdb);
+    return -7;
+  }
+  if(count_json_rows(db, "{\"type\":\"t1\",\"tags\":\"y\"}",
+    &plan, &examined, printlevel) != expected ||\
+    plan.type != WG_QPLAN_INTERSECT || examined != 0) {
+    if(printlevel)
+      printf("intersection query: wrong plan\n");
+    wg_delete_local_database(refdb);
+    return -8;
+  }
+
+  /* Dropping is refused and leaves the index in use */
+  if(wg_drop_index(db, index_id) != -1 ||\
+    wg_column_to_index_id(db, 0, WG_INDEX_TYPE_HASH_PATH, NULL, 0) !=\
+    index_id || count_json_rows(db, "{\"hot\":5}", &plan, NULL,
+    printlevel) != ndocs/4 - ndocs/12 || plan.index_id[0] != index_id) {
+    if(printlevel)
+      printf("index was dropped\n");
+    wg_delete_local_database(refdb);
+    return -9;
+  }
+
+  wg_delete_local_database(refdb);
+  if (printlevel>1)
+    printf("********* JSON path index test successful ********** \n");
+#endif
+  return 0;
+}
+
+#ifdef HAVE_PTHREAD
+
+#define LOOKUP_TEST_KEYS 500      /* rows that the readers look up */
+#define LOOKUP_TEST_ROWS 400      /* rows that the writer changes */
+#define LOOKUP_TEST_WRITES 20000
+#define LOOKUP_TEST_MIN_READS 2000
+#define LOOKUP_TEST_READERS 2
+
+typedef struct {
+  void *db;
+  gint index_id;
+  volatile int done;                     /* set when the writer is done */
+  int reads[LOOKUP_TEST_READERS];
+  int errors[LOOKUP_TEST_READERS + 1];   /* writer is the last */
+} lookup_test_data;
+
+typedef struct {
+  lookup_test_data *data;
+  int id;
+} lookup_test_thread;
+
+/** Writer of the lookup test
+ *  Inserts and deletes rows with odd keys between the even keys of
+ *  the rows that are looked up, so that the nodes with those keys are
+ *  split, merged and rotated.
+ */
+static void *lookup_test_writer(void *arg) {
+  lookup_test_data *data = ((lookup_test_thread *) arg)->data;
+  void *db = data->db, *recs[LOOKUP_TEST_ROWS];
+  int i, slot;
+  gint lock_id;
+
+  memset(recs, 0, sizeof(recs));
+  for(i=0; i<LOOKUP_TEST_WRITES; i++) {
+    slot = (i * 7919) % LOOKUP_TEST_ROWS;
+    if(!(lock_id = wg_start_write(db))) {
+      data->errors[LOOKUP_TEST_READERS]++;
+      break;
+    }
+    if(recs[slot]) {
+      if(wg_delete_record(db, recs[slot]))
+        data->errors[LOOKUP_TEST_READERS]++;
+      recs[slot] = NULL;
+    } else {
+      recs[slot] = wg_create_record(db, 2);
+      if(!recs[slot] || wg_set_field(db, recs[slot], 0,
+        wg_encode_int(db, 2 * ((i * 31) % LOOKUP_TEST_KEYS) + 1)))
+        data->errors[LOOKUP_TEST_READERS]++;
+    }
+    if(!wg_end_write(db, lock_id)) {
+      data->errors[LOOKUP_TEST_READERS]++;
+      break;
+    }
+  }
+  data->done = 1;
+  return NULL;
+}
+
+/** Reader of the lookup test
+ *  Looks up the rows with even keys, which are never changed, and
+ *  a key that is never present, without taking the database lock.
+ */
+static void *lookup_test_reader(void *arg) {
+  lookup_test_data *data = ((lookup_test_thread *) arg)->data;
+  int id = ((lookup_test_thread *) arg)->id;
+  void *db = data->db, *rec;
+  int i, key;
+  gint rowoffset;
+
+  for(i=id; !data->done || data->reads[id] < LOOKUP_TEST_MIN_READS; i+=7) {
+    key = 2 * (i % LOOKUP_TEST_KEYS);
+    rowoffset = wg_search_ttree_index(db, data->index_id,
+      wg_encode_int(db, key));
+    if(rowoffset <= 0 || wg_decode_int(db, wg_get_field(db,
+      offsettoptr(db, rowoffset), 1)) != key)
+      data->errors[id]++;
+    rec = wg_find_record_int(db, 0, WG_COND_EQUAL, key, NULL);
+    if(!rec || wg_decode_int(db, wg_get_field(db, rec, 1)) != key)
+      data->errors[id]++;
+    if(wg_search_ttree_index(db, data->index_id, wg_encode_int(db, -2)))
+      data->errors[id]++;
+    data->reads[id]++;
+  }
+  return NULL;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/** Test T-tree lookups without the database lock
+ *  The rows of a full segment, up to its end, are looked up first. Then
+ *  readers look up rows while a writer holding the write lock
+ *  changes the same index. The lookups are repeated when the index
+ *  changes under them, so every row must be found.
+ */
+static gint wg_test_index28(void *db, int printlevel) {
+  void *smalldb, *rec;
+  gint index_id, rowoffset;
+  int i, rows;
+#ifdef HAVE_PTHREAD
+  lookup_test_data data;
+  lookup_test_thread threads[LOOKUP_TEST_READERS + 1];
+  pthread_t pth[LOOKUP_TEST_READERS + 1];
+  int started = 0, errors = 0;
+  gint version;
+#endif
+
+  if (printlevel>1)
+    printf("********* testing lookups without lock ********** \n");
+
+  /* Fill a small segment. With this size, the last row ends less
+   * than a hundred bytes before the end of the segment. */
+  smalldb = wg_attach_local_database(400000);
+  if(!smalldb || wg_create_index(smalldb, 0, WG_INDEX_TYPE_TTREE,
+    NULL, 0)) {
+    if(printlevel)
+      printf("small database or index creation failed\n");
+    if(smalldb)
+      wg_delete_local_database(smalldb);
+    return -1;
+  }
+  index_id = wg_column_to_index_id(smalldb, 0, WG_INDEX_TYPE_TTREE,
+    NULL, 0);
+  for(rows=0; ; rows++) {
+    rec = wg_create_record(smalldb, 1);
+    if(!rec || wg_set_field(smalldb, rec, 0, wg_encode_int(smalldb, rows)))
+      break;
+  }
+  for(i=0; i<rows; i++) {
+    rec = wg_find_record_int(smalldb, 0, WG_COND_EQUAL, i, NULL);
+    rowoffset = wg_search_ttree_index(smalldb, index_id,
+      wg_encode_int(smalldb, i));
+    if(!rec || rowoffset != ptrtooffset(smalldb, rec) ||\
+      wg_decode_int(smalldb, wg_get_field(smalldb, rec, 0)) != i) {
+      if(printlevel)
+        printf("row %d of the full segment not found\n", i);
+      wg_delete_local_database(smalldb);
+      return -5;
+    }
+  }
+  wg_delete_local_database(smalldb);
+
+#ifdef HAVE_PTHREAD
+
+  memset(&data, 0, sizeof(lookup_test_data));
+  data.db = db;
+  if(wg_create_index(db, 0, WG_INDEX_TYPE_TTREE, NULL, 0)) {
+    if(printlevel)
+      printf("index creation failed\n");
+    return -1;
+  }
+  data.index_id = wg_column_to_index_id(db, 0, WG_INDEX_TYPE_TTREE,
+    NULL, 0);
+  for(i=0; i<LOOKUP_TEST_KEYS; i++) {
+    rec = wg_create_record(db, 2);
+    if(!rec || wg_set_field(db, rec, 0, wg_encode_int(db, 2*i)) ||\
+      wg_set_field(db, rec, 1, wg_encode_int(db, 2*i))) {
+      if(printlevel)
+        printf("insert error\n");
+      return -1;
+    }
+  }
+  version = wg_index_read_begin(db, data.index_id);
+
+  for(i=0; i<=LOOKUP_TEST_READERS; i++) {
+    threads[i].data = &data;
+    threads[i].id = i;
+    if(pthread_create(&pth[i], NULL, (i < LOOKUP_TEST_READERS ?
+      lookup_test_reader : lookup_test_writer), &threads[i])) {
+      if(printlevel)
+        printf("failed to start thread %d\n", i);
+      data.done = 1;
+      errors++;
+      break;
+    }
+    started++;
+  }
+  for(i=0; i<started; i++)
+    pthread_join(pth[i], NULL);
+  if(errors)
+    return -2;
+
+  for(i=0; i<=LOOKUP_TEST_READERS; i++) {
+    if(data.errors[i]) {
+      if(printlevel)
+        printf("thread %d: %d errors\n", i, data.errors[i]);
+      return -3;
+    }
+  }
+  if(!wg_index_read_retry(db, data.index_id, version) ||\
+    wg_index_read_begin(db, data.index_id) & 1) {
+    if(printlevel)
+      printf("index version not updated\n");
+    return -4;
+  }
+
+  if (printlevel>1)
+    printf("********* lookups without lock test successful ********** \n");
+#else
+  if (printlevel>1)
+    printf("********* no thread support: skipping lookups without lock "\
+      "test ********** \n");
+#endif
+  return 0;
+}
+
+/** Validate a T-tree index
+ *  1. validates a set of rows starting from *rec.
+ *  2. checks tree balance
+ *  3. checks tree min/max values
+ *  4. checks the element counts of the subtrees
+ *  returns 0 if no errors found
+ *  returns -1 if value was not indexed
+ *  returns -2 if there was another error
+ */
+static int validate_index(void *db, void *rec, int rows, int column,
+  int printlevel) {
+  gint index_id = wg_column_to_index_id(db, column,
+    WG_INDEX_TYPE_TTREE, NULL, 0);
+  gint tnode_offset, count;
+  wg_index_header *hdr;
+
+  if(index_id == -1)
+    return -2;
+
+  /* Check if all values are indexed */
+  while(rec && rows) {
+    if(wg_get_record_len(db, rec) > column) {
+      gint val = wg_get_field(db, rec, column);
+      if(wg_search_ttree_index(db, index_id, val) < 1) {
+        if(printlevel) {
+          printf("missing: %d\n", (int) val);
+        }
+        return -1;
+      }
+    }
+    rec = wg_get_next_record(db, rec);
+    rows--;
+  }
+
+  hdr = (wg_index_header *) offsettoptr(db, index_id);
+
+  if(((struct wg_tnode *)(offsettoptr(db,
+    TTREE_ROOT_NODE(hdr))))->parent_offset != 0) {
+    if(printlevel)
+      printf("root node parent offset is not 0\n");
+    return -2;
+  }
+#ifdef TTREE_CHAINED_NODES
+  if(TTREE_MIN_NODE(hdr) == 0) {
+    if(printlevel)
+      printf("min node offset is 0\n");
+    return -2;
+  }
+  if(TTREE_MAX_NODE(hdr) == 0) {
+    if(printlevel)
+      printf("max node offset is 0\n");
+    return -2;
+  }
+#endif
+
+#ifdef TTREE_CHAINED_NODES
+  tnode_offset = TTREE_MIN_NODE(hdr);
+#else
+  tnode_offset = wg_ttree_find_lub_node(db, TTREE_ROOT_NODE(hdr));
+#endif
+  while(tnode_offset) {
+    int diff;
+    gint minval, maxval;
+    struct wg_tnode *node = (struct wg_tnode *) offsettoptr(db, tnode_offset);
+
+    /* Check index tree balance */
+    diff = node->left_subtree_height - node->right_subtree_height;
+    if(diff < -1 || diff > 1)
+      return -2;
+
+    /* Check element counts */
+    count = node->number_of_elements;
+    if(node->left_child_offset)
+      count += ((struct wg_tnode *) offsettoptr(db,
+        node->left_child_offset))->subtree_count;
+    if(node->right_child_offset)
+      count += ((struct wg_tnode *) offsettoptr(db,
+        node->right_child_offset))->subtree_count;
+    if(count != node->subtree_count) {
+      if(printlevel) {
+        printf("subtree_count invalid: %d is: %d should be: %d\n",
+          (int) tnode_offset, (int) node->subtree_count, (int) count);
+      }
+      return -2;
+    }
 
     /* Check min/max values */
     minval = wg_get_field(db,
@@ -27,4 +27,4 @@ ${CC} -O2 -Wall -o Main/wgdb Main/wgdb.c Db/dbmem.c \
 #$CC  -O2 -Wall -o Main/selftest Main/selftest.c Db/dbmem.c \
 #  Db/dballoc.c Db/dbdata.c Db/dblock.c Db/dbindex.c Test/dbtest.c Db/dbdump.c \
 #  Db/dblog.c Db/dbhash.c Db/dbcompare.c Db/dbquery.c Db/dbutil.c Db/dbmpool.c \
-#  Db/dbjson.c Db/dbschema.c json/yajl_all.c -lm
+#  Db/dbjson.c Db/dbschema.c json/yajl_all.c -lm -lpthread
@@ -94,4 +94,4 @@
 #define VERSION_MINOR 8
 
 /* Package revision number */
-#define VERSION_REV 0
+#define VERSION_REV 1
@@ -278,6 +278,8 @@ gint map_cond(jint cond) {
             return WG_COND_LTEQUAL;
         case whitedb_driver_WhiteDB_COND_GTEQUAL:
             return WG_COND_GTEQUAL;
+        case whitedb_driver_WhiteDB_COND_CONTAINS:
+            return WG_COND_CONTAINS;
         default:
             break;
     }
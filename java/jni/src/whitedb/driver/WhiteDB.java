@@ -49,6 +49,7 @@ public class WhiteDB {
     public static final int COND_GREATER = 8;
     public static final int COND_LTEQUAL = 16;
     public static final int COND_GTEQUAL  = 32;
+    public static final int COND_CONTAINS = 64;
 
     /************************** Native methods **************************/
 